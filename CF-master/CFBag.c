@@ -213,6 +213,8 @@ static CFBasicHashRef __CFBagCreateGeneric(CFAllocatorRef allocator, const CFHas
     callbacks.equateValues = useValueCB ? (valueCallBacks ? (Boolean (*)(uintptr_t, uintptr_t))valueCallBacks->equal : NULL) : (callbacks.equateKeys);
     callbacks.copyValueDescription = useValueCB ? (valueCallBacks ? (CFStringRef (*)(uintptr_t))valueCallBacks->copyDescription : NULL) : (callbacks.copyKeyDescription);
 
+    if (callbacks.equateKeys && CFBasicHashGroupProbingRequested()) flags |= kCFBasicHashGroupProbing;
+
     CFBasicHashRef ht = CFBasicHashCreate(allocator, flags, &callbacks);
     return ht;
 }
@@ -240,6 +242,7 @@ CF_PRIVATE CFHashRef __CFBagCreateTransfer(CFAllocatorRef allocator, const_any_p
     callbacks.releaseValue = CFDictionary ? (void (*)(CFAllocatorRef, uintptr_t))kCFTypeBagValueCallBacks.release : callbacks.releaseKey;
     callbacks.equateValues = CFDictionary ? (Boolean (*)(uintptr_t, uintptr_t))kCFTypeBagValueCallBacks.equal : callbacks.equateKeys;
     callbacks.copyValueDescription = CFDictionary ? (CFStringRef (*)(uintptr_t))kCFTypeBagValueCallBacks.copyDescription : callbacks.copyKeyDescription;
+    if (CFBasicHashGroupProbingRequested()) flags |= kCFBasicHashGroupProbing;
 
     CFBasicHashRef ht = CFBasicHashCreate(allocator, flags, &callbacks);
     CFBasicHashSuppressRC(ht);
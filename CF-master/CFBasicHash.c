@@ -31,6 +31,11 @@
 #import <CoreFoundation/CFSet.h>
 #import <Block.h>
 #import <math.h>
+#if defined(__SSE2__)
+#import <emmintrin.h>
+#elif defined(__ARM_NEON)
+#import <arm_neon.h>
+#endif
 #if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED
 #import <dispatch/dispatch.h>
 #endif
@@ -328,7 +333,7 @@ struct __CFBasicHash {
         uint64_t __vret:10;
         uint64_t __krel:10;
         uint64_t __vrel:10;
-        uint64_t __:1;
+        uint64_t group_probing:1;
         uint64_t null_rc:1;
         uint64_t fast_grow:1;
         uint64_t finalized:1;
@@ -693,6 +698,106 @@ CF_INLINE void __CFBasicHashSetHashes(CFBasicHashRef ht, uintptr_t *ptr) {
     __AssignWithWriteBarrier(&ht->pointers[ht->bits.hashes_offset], ptr);
 }
 
+// A group probing table keeps a control byte per bucket in its tags array:
+// __CFBasicHashTagEmpty, __CFBasicHashTagDeleted, or 7 bits of the hash of
+// the key in the bucket. The first __CFBasicHashGroupWidth - 1 tags are
+// repeated after the last, so the tags of the group of buckets starting at
+// any index can be loaded at once and compared with a key's tag in one
+// instruction; keys are only tested for equality in buckets whose tags match.
+// The tags array is always in the last of the pointers.
+#define __CFBasicHashGroupWidth 16
+#define __CFBasicHashTagEmpty 0x80
+#define __CFBasicHashTagDeleted 0xFE
+
+CF_INLINE CFIndex __CFBasicHashGetTagsOffset(CFConstBasicHashRef ht) {
+    return 1 + (ht->bits.keys_offset ? 1 : 0) + (ht->bits.counts_offset ? 1 : 0) + (ht->bits.hashes_offset ? 1 : 0);
+}
+
+CF_INLINE uint8_t *__CFBasicHashGetTags(CFConstBasicHashRef ht) {
+    return (uint8_t *)ht->pointers[__CFBasicHashGetTagsOffset(ht)];
+}
+
+CF_INLINE void __CFBasicHashSetTags(CFBasicHashRef ht, uint8_t *ptr) {
+    __AssignWithWriteBarrier(&ht->pointers[__CFBasicHashGetTagsOffset(ht)], ptr);
+}
+
+CF_INLINE CFIndex __CFBasicHashGetTagsSize(CFIndex num_buckets) {
+    return num_buckets + __CFBasicHashGroupWidth - 1;
+}
+
+// The bucket index is taken from the low bits of the hash code, by the
+// modulus, so the tag is taken from the high bits of a multiplicative
+// scramble of it; pointer keys hash to themselves and vary only in the
+// middle bits.
+CF_INLINE uint8_t __CFBasicHashTagForHash(CFHashCode hash_code) {
+#if __LP64__
+    return (uint8_t)((hash_code * 0x9E3779B97F4A7C15ULL) >> 57);
+#else
+    return (uint8_t)((hash_code * 0x9E3779B9UL) >> 25);
+#endif
+}
+
+CF_INLINE void __CFBasicHashSetTag(CFBasicHashRef ht, CFIndex idx, uint8_t tag) {
+    uint8_t *tags = __CFBasicHashGetTags(ht);
+    CFIndex num_buckets = __CFBasicHashTableSizes[ht->bits.num_buckets_idx];
+    tags[idx] = tag;
+    // the repeated tags; a table of fewer buckets than a group repeats each more than once
+    for (CFIndex copy = idx; copy < __CFBasicHashGroupWidth - 1; copy += num_buckets) {
+        tags[num_buckets + copy] = tag;
+    }
+}
+
+// Compares the tags of the group at 'group' with 'tag', setting in *match,
+// *empty and *deleted a bit for each bucket with that tag, an empty one, or a
+// deleted one. Bucket i of the group is bit (i << __CFBasicHashGroupLaneShift).
+#if defined(__SSE2__)
+#define __CFBasicHashGroupLaneShift 0
+
+CF_INLINE void __CFBasicHashMatchGroup(const uint8_t *group, uint8_t tag, uint64_t *match, uint64_t *empty, uint64_t *deleted) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    uint64_t special = (uint32_t)_mm_movemask_epi8(ctrl); // empty and deleted both have the high bit set
+    *match = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag)));
+    *empty = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)__CFBasicHashTagEmpty)));
+    *deleted = special & ~*empty;
+}
+#elif defined(__ARM_NEON)
+#define __CFBasicHashGroupLaneShift 2
+
+// NEON has no movemask; narrowing each 16-bit lane by 4 leaves a nibble
+// per byte, of which the high bit is kept.
+CF_INLINE uint64_t __CFBasicHashNarrowMask(uint8x16_t cmp) {
+    uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0) & 0x8888888888888888ULL;
+}
+
+CF_INLINE void __CFBasicHashMatchGroup(const uint8_t *group, uint8_t tag, uint64_t *match, uint64_t *empty, uint64_t *deleted) {
+    uint8x16_t ctrl = vld1q_u8(group);
+    *match = __CFBasicHashNarrowMask(vceqq_u8(ctrl, vdupq_n_u8(tag)));
+    *empty = __CFBasicHashNarrowMask(vceqq_u8(ctrl, vdupq_n_u8(__CFBasicHashTagEmpty)));
+    *deleted = __CFBasicHashNarrowMask(vceqq_u8(ctrl, vdupq_n_u8(__CFBasicHashTagDeleted)));
+}
+#else
+#define __CFBasicHashGroupLaneShift 0
+
+CF_INLINE void __CFBasicHashMatchGroup(const uint8_t *group, uint8_t tag, uint64_t *match, uint64_t *empty, uint64_t *deleted) {
+    uint64_t m = 0, e = 0, d = 0;
+    for (CFIndex idx = 0; idx < __CFBasicHashGroupWidth; idx++) {
+        uint8_t ctrl = group[idx];
+        if (ctrl == tag) m |= (1ULL << idx);
+        if (ctrl == __CFBasicHashTagEmpty) e |= (1ULL << idx);
+        if (ctrl == __CFBasicHashTagDeleted) d |= (1ULL << idx);
+    }
+    *match = m;
+    *empty = e;
+    *deleted = d;
+}
+#endif
+
+// Index in its group of the bucket for the lowest bit set in a mask
+CF_INLINE uintptr_t __CFBasicHashGroupLane(uint64_t mask) {
+    return (uintptr_t)__builtin_ctzll(mask) >> __CFBasicHashGroupLaneShift;
+}
+
 
 // to expose the load factor, expose this function to customization
 CF_INLINE CFIndex __CFBasicHashGetCapacityForNumBuckets(CFConstBasicHashRef ht, CFIndex num_buckets_idx) {
@@ -857,11 +962,141 @@ static uintptr_t __CFBasicHashFold(uintptr_t dividend, uint8_t idx) {
 #include "CFBasicHashFindBucket.m"
 
 
+// Group probing visits the buckets in the same order as linear probing, but
+// a group at a time: the buckets before the first empty one in a group whose
+// tag matches the key's are tested, then if the group has an empty bucket
+// the key is not in the table. In the last group only the buckets not yet
+// visited count.
+CF_INLINE uint64_t __CFBasicHashGroupLimit(uintptr_t num_buckets, uintptr_t probed) {
+    uintptr_t remaining = num_buckets - probed;
+    if (__CFBasicHashGroupWidth <= remaining) return ~0ULL;
+    return (1ULL << (remaining << __CFBasicHashGroupLaneShift)) - 1;
+}
+
+static CFBasicHashBucket ___CFBasicHashFindBucket_Group(CFConstBasicHashRef ht, uintptr_t stack_key) {
+    uint8_t num_buckets_idx = ht->bits.num_buckets_idx;
+    uintptr_t num_buckets = __CFBasicHashTableSizes[num_buckets_idx];
+    CFHashCode hash_code = __CFBasicHashHashKey(ht, stack_key);
+#if defined(__arm__)
+    uintptr_t probe = __CFBasicHashFold(hash_code, num_buckets_idx);
+#else
+    uintptr_t probe = hash_code % num_buckets;
+#endif
+    uint8_t tag = __CFBasicHashTagForHash(hash_code);
+
+    COCOA_HASHTABLE_PROBING_START(ht, num_buckets);
+    CFBasicHashValue *keys = (ht->bits.keys_offset) ? __CFBasicHashGetKeys(ht) : __CFBasicHashGetValues(ht);
+    // The key itself in its first bucket is the usual hit, and needs no tags
+    if (keys[probe].neutral == stack_key && 0UL != stack_key && ~0UL != stack_key && !ht->bits.indirect_keys) {
+        COCOA_HASHTABLE_PROBE_VALID(ht, probe);
+        COCOA_HASHTABLE_PROBING_END(ht, 1);
+        CFBasicHashBucket result;
+        result.idx = probe;
+        result.weak_value = __CFBasicHashGetValue(ht, probe);
+        result.weak_key = stack_key;
+        result.count = (ht->bits.counts_offset) ? __CFBasicHashGetSlotCount(ht, probe) : 1;
+        return result;
+    }
+    const uint8_t *tags = __CFBasicHashGetTags(ht);
+    uintptr_t *hashes = (__CFBasicHashHasHashCache(ht)) ? __CFBasicHashGetHashes(ht) : NULL;
+    CFIndex deleted_idx = kCFNotFound;
+    for (uintptr_t probed = 0; probed < num_buckets; probed += __CFBasicHashGroupWidth) {
+        uint64_t match, empty, deleted;
+        __CFBasicHashMatchGroup(tags + probe, tag, &match, &empty, &deleted);
+        uint64_t limit = __CFBasicHashGroupLimit(num_buckets, probed);
+        match &= limit;
+        empty &= limit;
+        deleted &= limit;
+        uint64_t before_empty = (empty & (0 - empty)) - 1; // all buckets if none is empty
+        match &= before_empty;
+        deleted &= before_empty;
+        while (match) {
+            uintptr_t idx = probe + __CFBasicHashGroupLane(match);
+            if (num_buckets <= idx) idx -= num_buckets;
+            match &= match - 1;
+            COCOA_HASHTABLE_PROBE_VALID(ht, idx);
+            uintptr_t curr_key = keys[idx].neutral;
+            if (__CFBasicHashSubABZero == curr_key) curr_key = 0UL;
+            if (__CFBasicHashSubABOne == curr_key) curr_key = ~0UL;
+            if (ht->bits.indirect_keys) {
+                // curr_key holds the value coming in here
+                curr_key = __CFBasicHashGetIndirectKey(ht, curr_key);
+            }
+            if (curr_key == stack_key || ((!hashes || hashes[idx] == hash_code) && __CFBasicHashTestEqualKey(ht, curr_key, stack_key))) {
+                COCOA_HASHTABLE_PROBING_END(ht, probed + 1);
+                CFBasicHashBucket result;
+                result.idx = idx;
+                result.weak_value = __CFBasicHashGetValue(ht, idx);
+                result.weak_key = curr_key;
+                result.count = (ht->bits.counts_offset) ? __CFBasicHashGetSlotCount(ht, idx) : 1;
+                return result;
+            }
+        }
+        if (deleted && kCFNotFound == deleted_idx) {
+            deleted_idx = probe + __CFBasicHashGroupLane(deleted);
+            if (num_buckets <= deleted_idx) deleted_idx -= num_buckets;
+        }
+        if (empty) {
+            uintptr_t empty_idx = probe + __CFBasicHashGroupLane(empty);
+            if (num_buckets <= empty_idx) empty_idx -= num_buckets;
+            COCOA_HASHTABLE_PROBE_EMPTY(ht, empty_idx);
+            CFBasicHashBucket result;
+            result.idx = (kCFNotFound == deleted_idx) ? empty_idx : deleted_idx;
+            result.count = 0;
+            COCOA_HASHTABLE_PROBING_END(ht, probed + 1);
+            return result;
+        }
+        probe += __CFBasicHashGroupWidth;
+        while (num_buckets <= probe) probe -= num_buckets;
+    }
+    COCOA_HASHTABLE_PROBING_END(ht, num_buckets);
+    CFBasicHashBucket result;
+    result.idx = deleted_idx;
+    result.count = 0;
+    return result; // all buckets full or deleted, return first deleted element which was found
+}
+
+// During rehashing there are no deleted buckets and the keys are unique, so
+// the first empty bucket is the one.
+static CFIndex ___CFBasicHashFindBucket_Group_NoCollision(CFConstBasicHashRef ht, uintptr_t stack_key, uintptr_t key_hash) {
+    uint8_t num_buckets_idx = ht->bits.num_buckets_idx;
+    uintptr_t num_buckets = __CFBasicHashTableSizes[num_buckets_idx];
+    CFHashCode hash_code = key_hash ? key_hash : __CFBasicHashHashKey(ht, stack_key);
+#if defined(__arm__)
+    uintptr_t probe = __CFBasicHashFold(hash_code, num_buckets_idx);
+#else
+    uintptr_t probe = hash_code % num_buckets;
+#endif
+
+    COCOA_HASHTABLE_PROBING_START(ht, num_buckets);
+    const uint8_t *tags = __CFBasicHashGetTags(ht);
+    for (uintptr_t probed = 0; probed < num_buckets; probed += __CFBasicHashGroupWidth) {
+        uint64_t match, empty, deleted;
+        __CFBasicHashMatchGroup(tags + probe, __CFBasicHashTagEmpty, &match, &empty, &deleted);
+        uint64_t available = (empty | deleted) & __CFBasicHashGroupLimit(num_buckets, probed);
+        if (available) {
+            uintptr_t idx = probe + __CFBasicHashGroupLane(available);
+            if (num_buckets <= idx) idx -= num_buckets;
+            COCOA_HASHTABLE_PROBE_EMPTY(ht, idx);
+            COCOA_HASHTABLE_PROBING_END(ht, probed + 1);
+            return idx;
+        }
+        probe += __CFBasicHashGroupWidth;
+        while (num_buckets <= probe) probe -= num_buckets;
+    }
+    COCOA_HASHTABLE_PROBING_END(ht, num_buckets);
+    return kCFNotFound;
+}
+
+
 CF_INLINE CFBasicHashBucket __CFBasicHashFindBucket(CFConstBasicHashRef ht, uintptr_t stack_key) {
     if (0 == ht->bits.num_buckets_idx) {
         CFBasicHashBucket result = {kCFNotFound, 0UL, 0UL, 0};
         return result;
     }
+    if (ht->bits.group_probing) {
+        return ___CFBasicHashFindBucket_Group(ht, stack_key);
+    }
     if (ht->bits.indirect_keys) {
         switch (ht->bits.hash_style) {
         case __kCFBasicHashLinearHashingValue: return ___CFBasicHashFindBucket_Linear_Indirect(ht, stack_key);
@@ -884,6 +1119,9 @@ CF_INLINE CFIndex __CFBasicHashFindBucket_NoCollision(CFConstBasicHashRef ht, ui
     if (0 == ht->bits.num_buckets_idx) {
         return kCFNotFound;
     }
+    if (ht->bits.group_probing) {
+        return ___CFBasicHashFindBucket_Group_NoCollision(ht, stack_key, key_hash);
+    }
     if (ht->bits.indirect_keys) {
         switch (ht->bits.hash_style) {
         case __kCFBasicHashLinearHashingValue: return ___CFBasicHashFindBucket_Linear_Indirect_NoCollision(ht, stack_key, key_hash);
@@ -925,6 +1163,7 @@ CF_PRIVATE CFOptionFlags CFBasicHashGetFlags(CFConstBasicHashRef ht) {
     if (ht->bits.keys_offset) flags |= kCFBasicHashHasKeys;
     if (ht->bits.counts_offset) flags |= kCFBasicHashHasCounts;
     if (__CFBasicHashHasHashCache(ht)) flags |= kCFBasicHashHasHashCache;
+    if (ht->bits.group_probing) flags |= kCFBasicHashGroupProbing;
     return flags;
 }
 
@@ -1072,6 +1311,7 @@ static void __CFBasicHashDrain(CFBasicHashRef ht, Boolean forFinalization) {
     CFBasicHashValue *old_values = NULL, *old_keys = NULL;
     void *old_counts = NULL;
     uintptr_t *old_hashes = NULL;
+    uint8_t *old_tags = NULL;
 
     old_values = __CFBasicHashGetValues(ht);
     if (nullify) __CFBasicHashSetValues(ht, NULL);
@@ -1087,6 +1327,10 @@ static void __CFBasicHashDrain(CFBasicHashRef ht, Boolean forFinalization) {
         old_hashes = __CFBasicHashGetHashes(ht);
         if (nullify) __CFBasicHashSetHashes(ht, NULL);
     }
+    if (ht->bits.group_probing) {
+        old_tags = __CFBasicHashGetTags(ht);
+        if (nullify) __CFBasicHashSetTags(ht, NULL);
+    }
 
     if (nullify) {
         ht->bits.mutations++;
@@ -1116,6 +1360,7 @@ static void __CFBasicHashDrain(CFBasicHashRef ht, Boolean forFinalization) {
         CFAllocatorDeallocate(allocator, old_keys);
         CFAllocatorDeallocate(allocator, old_counts);
         CFAllocatorDeallocate(allocator, old_hashes);
+        CFAllocatorDeallocate(allocator, old_tags);
     }
 
 #if ENABLE_MEMORY_COUNTERS
@@ -1148,6 +1393,7 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
     CFBasicHashValue *new_values = NULL, *new_keys = NULL;
     void *new_counts = NULL;
     uintptr_t *new_hashes = NULL;
+    uint8_t *new_tags = NULL;
 
     if (0 < new_num_buckets) {
         new_values = (CFBasicHashValue *)__CFBasicHashAllocateMemory(ht, new_num_buckets, sizeof(CFBasicHashValue), CFBasicHashHasStrongValues(ht), 0);
@@ -1172,6 +1418,12 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
             __SetLastAllocationEventName(new_hashes, "CFBasicHash (hash-store)");
             memset(new_hashes, 0, new_num_buckets * sizeof(uintptr_t));
         }
+        if (ht->bits.group_probing) {
+            new_tags = (uint8_t *)__CFBasicHashAllocateMemory(ht, __CFBasicHashGetTagsSize(new_num_buckets), 1, false, false);
+            if (!new_tags) HALT;
+            __SetLastAllocationEventName(new_tags, "CFBasicHash (tag-store)");
+            memset(new_tags, __CFBasicHashTagEmpty, __CFBasicHashGetTagsSize(new_num_buckets));
+        }
     }
 
     ht->bits.num_buckets_idx = new_num_buckets_idx;
@@ -1180,6 +1432,7 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
     CFBasicHashValue *old_values = NULL, *old_keys = NULL;
     void *old_counts = NULL;
     uintptr_t *old_hashes = NULL;
+    uint8_t *old_tags = NULL;
 
     old_values = __CFBasicHashGetValues(ht);
     __CFBasicHashSetValues(ht, new_values);
@@ -1195,6 +1448,10 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
         old_hashes = __CFBasicHashGetHashes(ht);
         __CFBasicHashSetHashes(ht, new_hashes);
     }
+    if (ht->bits.group_probing) {
+        old_tags = __CFBasicHashGetTags(ht);
+        __CFBasicHashSetTags(ht, new_tags);
+    }
 
     if (0 < old_num_buckets) {
         for (CFIndex idx = 0; idx < old_num_buckets; idx++) {
@@ -1227,6 +1484,9 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
                 if (old_hashes) {
                     new_hashes[bkt_idx] = old_hashes[idx];
                 }
+                if (old_tags) {
+                    __CFBasicHashSetTag(ht, bkt_idx, old_tags[idx]);
+                }
             }
         }
     }
@@ -1237,6 +1497,7 @@ static void __CFBasicHashRehash(CFBasicHashRef ht, CFIndex newItemCount) {
         CFAllocatorDeallocate(allocator, old_keys);
         CFAllocatorDeallocate(allocator, old_counts);
         CFAllocatorDeallocate(allocator, old_hashes);
+        CFAllocatorDeallocate(allocator, old_tags);
     }
 
     if (COCOA_HASHTABLE_REHASH_END_ENABLED()) COCOA_HASHTABLE_REHASH_END(ht, CFBasicHashGetNumBuckets(ht), CFBasicHashGetSize(ht, true));
@@ -1265,7 +1526,7 @@ static void __CFBasicHashAddValue(CFBasicHashRef ht, CFIndex bkt_idx, uintptr_t
         ht->bits.deleted--;
     }
     uintptr_t key_hash = 0;
-    if (__CFBasicHashHasHashCache(ht)) {
+    if (__CFBasicHashHasHashCache(ht) || ht->bits.group_probing) {
         key_hash = __CFBasicHashHashKey(ht, stack_key);
     }
     stack_value = __CFBasicHashImportValue(ht, stack_value);
@@ -1282,6 +1543,9 @@ static void __CFBasicHashAddValue(CFBasicHashRef ht, CFIndex bkt_idx, uintptr_t
     if (__CFBasicHashHasHashCache(ht)) {
         __CFBasicHashGetHashes(ht)[bkt_idx] = key_hash;
     }
+    if (ht->bits.group_probing) {
+        __CFBasicHashSetTag(ht, bkt_idx, __CFBasicHashTagForHash(key_hash));
+    }
     ht->bits.used_buckets++;
 }
 
@@ -1309,6 +1573,9 @@ static void __CFBasicHashRemoveValue(CFBasicHashRef ht, CFIndex bkt_idx) {
     if (__CFBasicHashHasHashCache(ht)) {
         __CFBasicHashGetHashes(ht)[bkt_idx] = 0;
     }
+    if (ht->bits.group_probing) {
+        __CFBasicHashSetTag(ht, bkt_idx, __CFBasicHashTagDeleted);
+    }
     ht->bits.used_buckets--;
     ht->bits.deleted++;
     Boolean do_shrink = false;
@@ -1469,6 +1736,7 @@ CF_PRIVATE size_t CFBasicHashGetSize(CFConstBasicHashRef ht, Boolean total) {
     if (ht->bits.keys_offset) size += sizeof(CFBasicHashValue *);
     if (ht->bits.counts_offset) size += sizeof(void *);
     if (__CFBasicHashHasHashCache(ht)) size += sizeof(uintptr_t *);
+    if (ht->bits.group_probing) size += sizeof(uint8_t *);
     if (total) {
         CFIndex num_buckets = __CFBasicHashTableSizes[ht->bits.num_buckets_idx];
         if (0 < num_buckets) {
@@ -1476,6 +1744,7 @@ CF_PRIVATE size_t CFBasicHashGetSize(CFConstBasicHashRef ht, Boolean total) {
             if (ht->bits.keys_offset) size += malloc_size(__CFBasicHashGetKeys(ht));
             if (ht->bits.counts_offset) size += malloc_size(__CFBasicHashGetCounts(ht));
             if (__CFBasicHashHasHashCache(ht)) size += malloc_size(__CFBasicHashGetHashes(ht));
+            if (ht->bits.group_probing) size += malloc_size(__CFBasicHashGetTags(ht));
         }
     }
     return size;
@@ -1486,7 +1755,7 @@ CF_PRIVATE CFStringRef CFBasicHashCopyDescription(CFConstBasicHashRef ht, Boolea
     CFStringAppendFormat(result, NULL, CFSTR("%@{type = %s %s%s, count = %ld,\n"), prefix, (CFBasicHashIsMutable(ht) ? "mutable" : "immutable"), ((ht->bits.counts_offset) ? "multi" : ""), ((ht->bits.keys_offset) ? "dict" : "set"), CFBasicHashGetCount(ht));
     if (detailed) {
         const char *cb_type = "custom";
-        CFStringAppendFormat(result, NULL, CFSTR("%@hash cache = %s, strong values = %s, strong keys = %s, cb = %s,\n"), prefix, (__CFBasicHashHasHashCache(ht) ? "yes" : "no"), (CFBasicHashHasStrongValues(ht) ? "yes" : "no"), (CFBasicHashHasStrongKeys(ht) ? "yes" : "no"), cb_type);
+        CFStringAppendFormat(result, NULL, CFSTR("%@hash cache = %s, group probing = %s, strong values = %s, strong keys = %s, cb = %s,\n"), prefix, (__CFBasicHashHasHashCache(ht) ? "yes" : "no"), (ht->bits.group_probing ? "yes" : "no"), (CFBasicHashHasStrongValues(ht) ? "yes" : "no"), (CFBasicHashHasStrongKeys(ht) ? "yes" : "no"), cb_type);
         CFStringAppendFormat(result, NULL, CFSTR("%@num bucket index = %d, num buckets = %ld, capacity = %ld, num buckets used = %u,\n"), prefix, ht->bits.num_buckets_idx, CFBasicHashGetNumBuckets(ht), (long)CFBasicHashGetCapacity(ht), ht->bits.used_buckets);
         CFStringAppendFormat(result, NULL, CFSTR("%@counts width = %d, finalized = %s,\n"), prefix,((ht->bits.counts_offset) ? (1 << ht->bits.counts_width) : 0), (ht->bits.finalized ? "yes" : "no"));
         CFStringAppendFormat(result, NULL, CFSTR("%@num mutations = %ld, num deleted = %ld, size = %ld, total size = %ld,\n"), prefix, (long)ht->bits.mutations, (long)ht->bits.deleted, CFBasicHashGetSize(ht, false), CFBasicHashGetSize(ht, true));
@@ -1580,17 +1849,29 @@ CF_PRIVATE CFTypeID CFBasicHashGetTypeID(void) {
     return __kCFBasicHashTypeID;
 }
 
+// Setting CFBasicHashGroupProbing in the environment makes the collections use
+// group probing for tables whose keys have an equality callback, which are the
+// tables where it saves work
+CF_PRIVATE Boolean CFBasicHashGroupProbingRequested(void) {
+    static dispatch_once_t onceToken;
+    static Boolean requested = false;
+    dispatch_once(&onceToken, ^{ requested = (NULL != __CFgetenv("CFBasicHashGroupProbing")); });
+    return requested;
+}
+
 CF_PRIVATE CFBasicHashRef CFBasicHashCreate(CFAllocatorRef allocator, CFOptionFlags flags, const CFBasicHashCallbacks *cb) {
     size_t size = sizeof(struct __CFBasicHash) - sizeof(CFRuntimeBase);
     if (flags & kCFBasicHashHasKeys) size += sizeof(CFBasicHashValue *); // keys
     if (flags & kCFBasicHashHasCounts) size += sizeof(void *); // counts
     if (flags & kCFBasicHashHasHashCache) size += sizeof(uintptr_t *); // hashes
+    if (flags & kCFBasicHashGroupProbing) size += sizeof(uint8_t *); // tags
     CFBasicHashRef ht = (CFBasicHashRef)_CFRuntimeCreateInstance(allocator, CFBasicHashGetTypeID(), size, NULL);
     if (NULL == ht) return NULL;
 
     ht->bits.finalized = 0;
     ht->bits.hash_style = (flags >> 13) & 0x3;
     ht->bits.fast_grow = (flags & kCFBasicHashAggressiveGrowth) ? 1 : 0;
+    ht->bits.group_probing = (flags & kCFBasicHashGroupProbing) ? 1 : 0;
     ht->bits.counts_width = 0;
     ht->bits.strong_values = (flags & kCFBasicHashStrongValues) ? 1 : 0;
     ht->bits.strong_keys = (flags & kCFBasicHashStrongKeys) ? 1 : 0;
@@ -1618,6 +1899,7 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreate(CFAllocatorRef allocator, CFOptionFl
     ht->bits.keys_offset = (flags & kCFBasicHashHasKeys) ? offset++ : 0;
     ht->bits.counts_offset = (flags & kCFBasicHashHasCounts) ? offset++ : 0;
     ht->bits.hashes_offset = (flags & kCFBasicHashHasHashCache) ? offset++ : 0;
+    if (ht->bits.group_probing) offset++; // tags, see __CFBasicHashGetTagsOffset()
 
 #if DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_EMBEDDED_MINI
     ht->bits.hashes_offset = 0;
@@ -1659,6 +1941,7 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreateCopy(CFAllocatorRef allocator, CFCons
     CFBasicHashValue *new_values = NULL, *new_keys = NULL;
     void *new_counts = NULL;
     uintptr_t *new_hashes = NULL;
+    uint8_t *new_tags = NULL;
 
     if (0 < new_num_buckets) {
         Boolean strongValues = CFBasicHashHasStrongValues(src_ht) && !(kCFUseCollectableAllocator && !CF_IS_COLLECTABLE_ALLOCATOR(allocator));
@@ -1681,6 +1964,11 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreateCopy(CFAllocatorRef allocator, CFCons
             if (!new_hashes) return NULL; // in this unusual circumstance, leak previously allocated blocks for now
             __SetLastAllocationEventName(new_hashes, "CFBasicHash (hash-store)");
         }
+        if (src_ht->bits.group_probing) {
+            new_tags = (uint8_t *)__CFBasicHashAllocateMemory2(allocator, __CFBasicHashGetTagsSize(new_num_buckets), 1, false, false);
+            if (!new_tags) return NULL; // in this unusual circumstance, leak previously allocated blocks for now
+            __SetLastAllocationEventName(new_tags, "CFBasicHash (tag-store)");
+        }
     }
 
     CFBasicHashRef ht = (CFBasicHashRef)_CFRuntimeCreateInstance(allocator, CFBasicHashGetTypeID(), size, NULL);
@@ -1710,6 +1998,7 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreateCopy(CFAllocatorRef allocator, CFCons
     CFBasicHashValue *old_values = NULL, *old_keys = NULL;
     void *old_counts = NULL;
     uintptr_t *old_hashes = NULL;
+    uint8_t *old_tags = NULL;
 
     old_values = __CFBasicHashGetValues(src_ht);
     if (src_ht->bits.keys_offset) {
@@ -1721,6 +2010,9 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreateCopy(CFAllocatorRef allocator, CFCons
     if (__CFBasicHashHasHashCache(src_ht)) {
         old_hashes = __CFBasicHashGetHashes(src_ht);
     }
+    if (src_ht->bits.group_probing) {
+        old_tags = __CFBasicHashGetTags(src_ht);
+    }
 
     __CFBasicHashSetValues(ht, new_values);
     if (new_keys) {
@@ -1732,6 +2024,9 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreateCopy(CFAllocatorRef allocator, CFCons
     if (new_hashes) {
         __CFBasicHashSetHashes(ht, new_hashes);
     }
+    if (new_tags) {
+        __CFBasicHashSetTags(ht, new_tags);
+    }
 
     for (CFIndex idx = 0; idx < new_num_buckets; idx++) {
         uintptr_t stack_value = old_values[idx].neutral;
@@ -1755,6 +2050,7 @@ CF_PRIVATE CFBasicHashRef CFBasicHashCreateCopy(CFAllocatorRef allocator, CFCons
     }
     if (new_counts) memmove(new_counts, old_counts, new_num_buckets * (1 << ht->bits.counts_width));
     if (new_hashes) memmove(new_hashes, old_hashes, new_num_buckets * sizeof(uintptr_t));
+    if (new_tags) memmove(new_tags, old_tags, __CFBasicHashGetTagsSize(new_num_buckets));
 
 #if ENABLE_MEMORY_COUNTERS
     int64_t size_now = OSAtomicAdd64Barrier((int64_t) CFBasicHashGetSize(ht, true), & __CFBasicHashTotalSize);
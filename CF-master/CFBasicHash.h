@@ -65,6 +65,8 @@ enum {
     kCFBasicHashExponentialHashing = (__kCFBasicHashExponentialHashingValue << 13),
 
     kCFBasicHashAggressiveGrowth = (1UL << 15),
+
+    kCFBasicHashGroupProbing = (1UL << 16), // buckets in linear order, 16 at a time by hash tag
 };
 
 // Note that for a hash table without keys, the value is treated as the key,
@@ -140,6 +142,7 @@ void CFBasicHashUnsuppressRC(CFBasicHashRef ht);
 CFStringRef CFBasicHashCopyDescription(CFConstBasicHashRef ht, Boolean detailed, CFStringRef linePrefix, CFStringRef entryLinePrefix, Boolean describeElements);
 
 CFTypeID CFBasicHashGetTypeID(void);
+Boolean CFBasicHashGroupProbingRequested(void);
 
 extern Boolean __CFBasicHashEqual(CFTypeRef cf1, CFTypeRef cf2);
 extern CFHashCode __CFBasicHashHash(CFTypeRef cf);
@@ -453,8 +453,110 @@ static void _appendNumber(__CFBinaryPlistWriteBuffer *buf, CFNumberRef num) {
     }
 }
 
-static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, CFDictionaryRef objtable, uint32_t objRefSize) {
-    uint64_t refnum;
+/*
+The objects to write, in the order they are written, so that an object's
+refnum is its index in objlist. An open addressed table with linear probing,
+kept at most half full, holds the refnum + 1 of each object by pointer,
+checked against objlist. Strings, numbers, dates and data are uniqued by
+pointer only, as the uniquing set always did: uniquing by CFEqual would merge
+objects that are written differently, such as the integer 1 and the real 1.0,
+or 0.0 and -0.0. Nothing is retained, the plist being written holds on to
+every object.
+*/
+typedef struct {
+    CFTypeRef *objlist;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *identity;
+    uint32_t identityMask;
+    uint32_t identityCount;
+} __CFBinaryPlistObjects;
+
+CF_INLINE uint32_t _identityHash(CFTypeRef obj) {
+    return (uint32_t)(((uint64_t)(uintptr_t)obj * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static void _objectsInit(__CFBinaryPlistObjects *objects, uint64_t estimate) {
+    uint32_t capacity = (estimate && estimate < (1UL << 30)) ? (uint32_t)estimate : 650;
+    uint32_t tableSize = 16;
+    while (tableSize < 2 * capacity) tableSize *= 2;
+    objects->objlist = (CFTypeRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, capacity * sizeof(CFTypeRef), 0);
+    objects->count = 0;
+    objects->capacity = capacity;
+    objects->identity = (uint32_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, tableSize * sizeof(uint32_t), 0);
+    memset(objects->identity, 0, tableSize * sizeof(uint32_t));
+    objects->identityMask = tableSize - 1;
+    objects->identityCount = 0;
+}
+
+static void _objectsDestroy(__CFBinaryPlistObjects *objects) {
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, objects->objlist);
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, objects->identity);
+}
+
+static void _objectsGrowIdentity(__CFBinaryPlistObjects *objects) {
+    uint32_t oldSize = objects->identityMask + 1, newMask = 2 * oldSize - 1;
+    uint32_t *old = objects->identity;
+    uint32_t *identity = (uint32_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, 2 * oldSize * sizeof(uint32_t), 0);
+    memset(identity, 0, 2 * oldSize * sizeof(uint32_t));
+    for (uint32_t idx = 0; idx < oldSize; idx++) {
+        if (!old[idx]) continue;
+        uint32_t bucket = _identityHash(objects->objlist[old[idx] - 1]) & newMask;
+        while (identity[bucket]) bucket = (bucket + 1) & newMask;
+        identity[bucket] = old[idx];
+    }
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, old);
+    objects->identity = identity;
+    objects->identityMask = newMask;
+}
+
+// Adds obj to the end of objlist, and to identity unless it is there already
+static uint32_t _objectsAppend(__CFBinaryPlistObjects *objects, CFTypeRef obj) {
+    if (objects->count == objects->capacity) {
+        objects->capacity *= 2;
+        objects->objlist = (CFTypeRef *)CFAllocatorReallocate(kCFAllocatorSystemDefault, objects->objlist, objects->capacity * sizeof(CFTypeRef), 0);
+    }
+    uint32_t refnum = objects->count++;
+    objects->objlist[refnum] = obj;
+    if (objects->identityMask < 2 * (objects->identityCount + 1)) _objectsGrowIdentity(objects);
+    uint32_t bucket = _identityHash(obj) & objects->identityMask;
+    for (; objects->identity[bucket]; bucket = (bucket + 1) & objects->identityMask) {
+        if (objects->objlist[objects->identity[bucket] - 1] == obj) return refnum;	// refs go to the first
+    }
+    objects->identity[bucket] = refnum + 1;
+    objects->identityCount++;
+    return refnum;
+}
+
+CF_INLINE Boolean _objectIsUniqued(CFTypeID type) {
+    // Do not unique dictionaries or arrays, because: they
+    // are slow to compare, and have poor hash codes.
+    // Uniquing bools is unnecessary.
+    return (stringtype == type || numbertype == type || datetype == type || datatype == type);
+}
+
+// Returns the refnum + 1 of obj, or 0
+static uint32_t _objectsFind(const __CFBinaryPlistObjects *objects, CFTypeRef obj) {
+    for (uint32_t bucket = _identityHash(obj) & objects->identityMask; objects->identity[bucket]; bucket = (bucket + 1) & objects->identityMask) {
+        uint32_t refnum = objects->identity[bucket] - 1;
+        if (objects->objlist[refnum] == obj) return refnum + 1;
+    }
+    return 0;
+}
+
+// Safe to call from several threads at once once flattening is done
+static uint32_t _objectsGetRefnum(const __CFBinaryPlistObjects *objects, CFTypeRef obj) {
+    uint32_t found = _objectsFind(objects, obj);
+    return found ? found - 1 : 0;
+}
+
+static void _appendRef(__CFBinaryPlistWriteBuffer *buf, const __CFBinaryPlistObjects *objects, CFTypeRef obj, uint32_t objRefSize) {
+    uint32_t swapped = CFSwapInt32HostToBig(_objectsGetRefnum(objects, obj));
+    uint8_t *source = (uint8_t *)&swapped;
+    bufferWrite(buf, source + sizeof(swapped) - objRefSize, objRefSize);
+}
+
+static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, const __CFBinaryPlistObjects *objects, uint32_t objRefSize) {
     CFIndex idx2;
     CFTypeID type = CFGetTypeID(obj);
 	if (stringtype == type) {
@@ -490,14 +592,10 @@ static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, CFD
             CFDictionaryGetKeysAndValues((CFDictionaryRef)obj, list, list + count);
             for (idx2 = 0; idx2 < 2 * count; idx2++) {
 		CFPropertyListRef value = list[idx2];
-		if (objtable) {
-		    uint32_t swapped = 0;
-		    uint8_t *source = (uint8_t *)&swapped;
-		    refnum = (uint32_t)(uintptr_t)CFDictionaryGetValue(objtable, value);
-		    swapped = CFSwapInt32HostToBig((uint32_t)refnum);
-		    bufferWrite(buf, source + sizeof(swapped) - objRefSize, objRefSize);
+		if (objects) {
+		    _appendRef(buf, objects, value, objRefSize);
 		} else {
-		    Boolean ret = _appendObject(buf, value, objtable, objRefSize);
+		    Boolean ret = _appendObject(buf, value, objects, objRefSize);
 		    if (!ret) {
 			if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
 			return false;
@@ -517,14 +615,10 @@ static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, CFD
 	    CFArrayGetValues((CFArrayRef)obj, CFRangeMake(0, count), list);
 	    for (idx2 = 0; idx2 < count; idx2++) {
 		CFPropertyListRef value = list[idx2];
-		if (objtable) {
-		    uint32_t swapped = 0;
-		    uint8_t *source = (uint8_t *)&swapped;
-		    refnum = (uint32_t)(uintptr_t)CFDictionaryGetValue(objtable, value);
-		    swapped = CFSwapInt32HostToBig((uint32_t)refnum);
-		    bufferWrite(buf, source + sizeof(swapped) - objRefSize, objRefSize);
+		if (objects) {
+		    _appendRef(buf, objects, value, objRefSize);
 		} else {
-		    Boolean ret = _appendObject(buf, value, objtable, objRefSize);
+		    Boolean ret = _appendObject(buf, value, objects, objRefSize);
 		    if (!ret) {
 			if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
 			return false;
@@ -540,36 +634,18 @@ static Boolean _appendObject(__CFBinaryPlistWriteBuffer *buf, CFTypeRef obj, CFD
     return true;
 }
 
-static void _flattenPlist(CFPropertyListRef plist, CFMutableArrayRef objlist, CFMutableDictionaryRef objtable, CFMutableSetRef uniquingset) {
-    uint32_t refnum;
+static void _flattenPlist(CFPropertyListRef plist, __CFBinaryPlistObjects *objects) {
     CFTypeID type = CFGetTypeID(plist);
 
-    // Do not unique dictionaries or arrays, because: they
-    // are slow to compare, and have poor hash codes.
-    // Uniquing bools is unnecessary.
-    if (stringtype == type || numbertype == type || datetype == type || datatype == type) {
-	CFIndex before = CFSetGetCount(uniquingset);
-	CFSetAddValue(uniquingset, plist);
-	CFIndex after = CFSetGetCount(uniquingset);
-	if (after == before) {	// already in set
-	    CFPropertyListRef unique = CFSetGetValue(uniquingset, plist);
-	    if (unique != plist) {
-		refnum = (uint32_t)(uintptr_t)CFDictionaryGetValue(objtable, unique);
-		CFDictionaryAddValue(objtable, plist, (const void *)(uintptr_t)refnum);
-	    }
-	    return;
-	}
-    }
-    refnum = CFArrayGetCount(objlist);
-    CFArrayAppendValue(objlist, plist);
-    CFDictionaryAddValue(objtable, plist, (const void *)(uintptr_t)refnum);
+    if (_objectIsUniqued(type) && _objectsFind(objects, plist)) return;	// already seen
+    _objectsAppend(objects, plist);
     if (dicttype == type) {
         CFIndex count = CFDictionaryGetCount((CFDictionaryRef)plist);
         STACK_BUFFER_DECL(CFPropertyListRef, buffer, count <= 128 ? count * 2 : 1);
         CFPropertyListRef *list = (count <= 128) ? buffer : (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, 2 * count * sizeof(CFTypeRef), __kCFAllocatorGCScannedMemory);
         CFDictionaryGetKeysAndValues((CFDictionaryRef)plist, list, list + count);
         for (CFIndex idx = 0; idx < 2 * count; idx++) {
-            _flattenPlist(list[idx], objlist, objtable, uniquingset);
+            _flattenPlist(list[idx], objects);
         }
         if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
     } else if (arraytype == type) {
@@ -578,7 +654,7 @@ static void _flattenPlist(CFPropertyListRef plist, CFMutableArrayRef objlist, CF
         CFPropertyListRef *list = (count <= 256) ? buffer : (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, count * sizeof(CFTypeRef), __kCFAllocatorGCScannedMemory);
         CFArrayGetValues((CFArrayRef)plist, CFRangeMake(0, count), list);
         for (CFIndex idx = 0; idx < count; idx++) {
-            _flattenPlist(list[idx], objlist, objtable, uniquingset);
+            _flattenPlist(list[idx], objects);
         }
         if (list != buffer) CFAllocatorDeallocate(kCFAllocatorSystemDefault, list);
     }
@@ -605,12 +681,107 @@ CF_INLINE uint8_t _byteCount(uint64_t count) {
     return size;
 }
 
+#define __CFBinaryPlistParallelAppendMinimum 16384
+
+typedef struct {
+    __CFBinaryPlistWriteBuffer *buf;
+    const __CFBinaryPlistObjects *objects;
+    uint64_t *offsets;
+    uint32_t objRefSize;
+    CFIndex start;
+    CFIndex end;
+    Boolean success;
+} __CFBinaryPlistChunk;
+
+// Encodes objects start up to end into the chunk's buffer, with offsets from the start of the chunk for now
+static void _appendChunk(__CFBinaryPlistChunk *chunk) {
+    __CFBinaryPlistWriteBuffer *chunkbuf = chunk->buf;
+    Boolean success = true;
+    for (CFIndex idx = chunk->start; idx < chunk->end && success; idx++) {
+        chunk->offsets[idx] = chunkbuf->written + chunkbuf->used;
+        success = _appendObject(chunkbuf, chunk->objects->objlist[idx], chunk->objects, chunk->objRefSize);
+    }
+    bufferFlush(chunkbuf);
+    chunk->success = success;
+}
+
+#if !(DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_WINDOWS)
+static void *_appendChunkThreadMain(void *arg) {
+    _appendChunk((__CFBinaryPlistChunk *)arg);
+    return NULL;
+}
+#endif
+
+/* Appends objlist to buf in nchunks runs of objects, each encoded into memory on its own thread. Once flattening is done nothing an object's encoding depends on changes, so the runs are written to buf in order once they are all done, with the same bytes as appending one object at a time. Without dispatch a thread is started for each run but the first, which the calling thread encodes, as it does any run whose thread could not be started. */
+static Boolean _appendObjectsInChunks(__CFBinaryPlistWriteBuffer *buf, const __CFBinaryPlistObjects *objects, uint64_t *offsets, uint32_t objRefSize, CFIndex nchunks) {
+    CFIndex cnt = objects->count;
+    CFIndex chunkSize = (cnt + nchunks - 1) / nchunks;
+    __CFBinaryPlistChunk *chunks = (__CFBinaryPlistChunk *)CFAllocatorAllocate(kCFAllocatorSystemDefault, nchunks * sizeof(__CFBinaryPlistChunk), 0);
+    for (CFIndex chunk = 0; chunk < nchunks; chunk++) {
+        __CFBinaryPlistWriteBuffer *chunkbuf = (__CFBinaryPlistWriteBuffer *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(__CFBinaryPlistWriteBuffer), 0);
+        chunkbuf->stream = CFDataCreateMutable(kCFAllocatorSystemDefault, 0);
+        chunkbuf->databytes = NULL;
+        chunkbuf->datalen = 0;
+        chunkbuf->error = NULL;
+        chunkbuf->streamIsData = true;
+        chunkbuf->written = 0;
+        chunkbuf->used = 0;
+        chunks[chunk].buf = chunkbuf;
+        chunks[chunk].objects = objects;
+        chunks[chunk].offsets = offsets;
+        chunks[chunk].objRefSize = objRefSize;
+        chunks[chunk].start = __CFMin(cnt, chunk * chunkSize);
+        chunks[chunk].end = __CFMin(cnt, (chunk + 1) * chunkSize);
+        chunks[chunk].success = false;
+    }
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_WINDOWS
+    dispatch_apply(nchunks, __CFDispatchQueueGetGenericMatchingCurrent(), ^(size_t chunk) {
+        _appendChunk(&chunks[chunk]);
+    });
+#else
+    pthread_t threads[16];
+    Boolean started[16];
+    for (CFIndex chunk = 1; chunk < nchunks; chunk++) {
+        started[chunk] = (0 == pthread_create(&threads[chunk], NULL, _appendChunkThreadMain, &chunks[chunk]));
+    }
+    _appendChunk(&chunks[0]);
+    for (CFIndex chunk = 1; chunk < nchunks; chunk++) {
+        if (started[chunk]) {
+            pthread_join(threads[chunk], NULL);
+        } else {
+            _appendChunk(&chunks[chunk]);
+        }
+    }
+#endif
+    Boolean success = true;
+    for (CFIndex chunk = 0; chunk < nchunks; chunk++) {
+        __CFBinaryPlistWriteBuffer *chunkbuf = chunks[chunk].buf;
+        if (success && chunks[chunk].success) {
+            uint64_t base = buf->written + buf->used;
+            for (CFIndex idx = chunks[chunk].start; idx < chunks[chunk].end; idx++) {
+                offsets[idx] += base;
+            }
+            bufferWrite(buf, CFDataGetBytePtr((CFDataRef)chunkbuf->stream), CFDataGetLength((CFDataRef)chunkbuf->stream));
+        } else {
+            success = false;
+        }
+        // the first chunk to fail says why, as appending one object at a time would
+        if (chunkbuf->error && !buf->error) {
+            buf->error = chunkbuf->error;
+        } else if (chunkbuf->error) {
+            CFRelease(chunkbuf->error);
+        }
+        CFRelease(chunkbuf->stream);
+        CFAllocatorDeallocate(kCFAllocatorSystemDefault, chunkbuf);
+    }
+    CFAllocatorDeallocate(kCFAllocatorSystemDefault, chunks);
+    return success;
+}
+
 // stream can be a CFWriteStreamRef (on supported platforms) or a CFMutableDataRef
 /* Write a property list to a stream, in binary format. plist is the property list to write (one of the basic property list types), stream is the destination of the property list, and estimate is a best-guess at the total number of objects in the property list. The estimate parameter is for efficiency in pre-allocating memory for the uniquing step. Pass in a 0 if no estimate is available. The options flag specifies sort options. If the error parameter is non-NULL and an error occurs, it will be used to return a CFError explaining the problem. It is the callers responsibility to release the error. */
 CFIndex __CFBinaryPlistWrite(CFPropertyListRef plist, CFTypeRef stream, uint64_t estimate, CFOptionFlags options, CFErrorRef *error) {
-    CFMutableDictionaryRef objtable = NULL;
-    CFMutableArrayRef objlist = NULL;
-    CFMutableSetRef uniquingset = NULL;
+    __CFBinaryPlistObjects objects;
     CFBinaryPlistTrailer trailer;
     uint64_t *offsets, length_so_far;
     int64_t idx, cnt;
@@ -618,27 +789,10 @@ CFIndex __CFBinaryPlistWrite(CFPropertyListRef plist, CFTypeRef stream, uint64_t
     
     initStatics();
 
-    const CFDictionaryKeyCallBacks dictKeyCallbacks = {0, __CFTypeCollectionRetain, __CFTypeCollectionRelease, 0, 0, 0};
-    objtable = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, &dictKeyCallbacks, NULL);
+    _objectsInit(&objects, estimate);
+    _flattenPlist(plist, &objects);
     
-    const CFArrayCallBacks arrayCallbacks = {0, __CFTypeCollectionRetain, __CFTypeCollectionRelease, 0, 0};
-    objlist = CFArrayCreateMutable(kCFAllocatorSystemDefault, 0, &arrayCallbacks);
-    
-    
-    const CFSetCallBacks setCallbacks = {0, __CFTypeCollectionRetain, __CFTypeCollectionRelease, 0, 0, 0};
-    uniquingset = CFSetCreateMutable(kCFAllocatorSystemDefault, 0, &setCallbacks);
-
-#if DEPLOYMENT_TARGET_MACOSX
-    _CFDictionarySetCapacity(objtable, estimate ? estimate : 650);
-    _CFArraySetCapacity(objlist, estimate ? estimate : 650);
-    _CFSetSetCapacity(uniquingset, estimate ? estimate : 1000);
-#endif
-
-    _flattenPlist(plist, objlist, objtable, uniquingset);
-
-    CFRelease(uniquingset);
-    
-    cnt = CFArrayGetCount(objlist);
+    cnt = objects.count;
     offsets = (uint64_t *)CFAllocatorAllocate(kCFAllocatorSystemDefault, (CFIndex)(cnt * sizeof(*offsets)), 0);
 
     buf = (__CFBinaryPlistWriteBuffer *)CFAllocatorAllocate(kCFAllocatorSystemDefault, sizeof(__CFBinaryPlistWriteBuffer), 0);
@@ -655,27 +809,29 @@ CFIndex __CFBinaryPlistWrite(CFPropertyListRef plist, CFTypeRef stream, uint64_t
     trailer._numObjects = CFSwapInt64HostToBig(cnt);
     trailer._topObject = 0;	// true for this implementation
     trailer._objectRefSize = _byteCount(cnt);    
-    for (idx = 0; idx < cnt; idx++) {
-	offsets[idx] = buf->written + buf->used;
-	CFPropertyListRef obj = CFArrayGetValueAtIndex(objlist, (CFIndex)idx);
-	Boolean success = _appendObject(buf, obj, objtable, trailer._objectRefSize);
-	if (!success) {
-	    CFRelease(objtable);
-	    CFRelease(objlist);
-	    if (error && buf->error) {
-		// caller will release error
-		*error = buf->error;
-	    } else if (buf->error) {
-		// caller is not interested in error, release it here
-		CFRelease(buf->error);
-	    }
-	    CFAllocatorDeallocate(kCFAllocatorSystemDefault, buf);
-            CFAllocatorDeallocate(kCFAllocatorSystemDefault, offsets);
-	    return 0;
-	}
+    Boolean success = true, appended = false;
+    CFIndex ncores = __CFActiveProcessorCount();
+    if (__CFBinaryPlistParallelAppendMinimum <= cnt && 1 < ncores) {
+        success = _appendObjectsInChunks(buf, &objects, offsets, trailer._objectRefSize, __CFMin(ncores, 16));
+        appended = true;
+    }
+    for (idx = 0; idx < cnt && success && !appended; idx++) {
+        offsets[idx] = buf->written + buf->used;
+        success = _appendObject(buf, objects.objlist[idx], &objects, trailer._objectRefSize);
+    }
+    _objectsDestroy(&objects);
+    if (!success) {
+        if (error && buf->error) {
+            // caller will release error
+            *error = buf->error;
+        } else if (buf->error) {
+            // caller is not interested in error, release it here
+            CFRelease(buf->error);
+        }
+        CFAllocatorDeallocate(kCFAllocatorSystemDefault, buf);
+        CFAllocatorDeallocate(kCFAllocatorSystemDefault, offsets);
+        return 0;
     }
-    CFRelease(objtable);
-    CFRelease(objlist);
     
     length_so_far = buf->written + buf->used;
     trailer._offsetTableOffset = CFSwapInt64HostToBig(length_so_far);
@@ -1607,3 +1763,342 @@ if (!CFEqual(pl, pl2)) CFLog(3, CFSTR("*** error: plists before and after are no
     FAIL_FALSE;
 }
 
+
+#pragma mark -
+#pragma mark Lazy Reading
+
+// A lazy container stands in for an array, set or dictionary of a binary
+// property list. Creating one reads only its marker and count; each element
+// is created the first time it is asked for and kept until the container is
+// freed. Elements that are containers are lazy containers themselves, and
+// ASCII strings share the data's bytes instead of copying them.
+//
+// A dictionary's key refs come before its value refs, and _elements follows
+// the refs, so key idx is slot idx and its value is slot _count + idx.
+struct __CFBinaryPlistLazyContainer {
+    CFRuntimeBase _base;
+    CFDataRef _data;
+    CFAllocatorRef _contentsDeallocator;	// retains _data for strings sharing its bytes
+    CFBinaryPlistTrailer _trailer;
+    uint64_t _offset;				// of the container's marker
+    const uint8_t *_refs;
+    CFIndex _count;				// elements, or key-value pairs
+    uint8_t _marker;				// kCFBinaryPlistMarkerArray, Set or Dict
+    CFPropertyListRef *_elements;		// NULL until first access, then NULL per slot until created
+    struct __CFBinaryPlistLazyIndexEntry *_index;	// dictionaries over the linear search limit, on first lookup
+};
+
+struct __CFBinaryPlistLazyIndexEntry {
+    CFIndex _key;				// 1 + key index, 0 if the entry is empty
+    CFHashCode _hash;
+};
+
+// Dictionaries with no more pairs than this are searched without an index
+#define __CFBinaryPlistLazyLinearSearchLimit 8
+
+// The index is open addressed with linear probing, at most half full. Its size follows from the count, so a reader that sees the index never needs a second field to go with it.
+CF_INLINE CFIndex __CFBinaryPlistLazyIndexSize(CFIndex count) {
+    CFIndex size = 16;
+    while (size < 2 * count) size *= 2;
+    return size;
+}
+
+// Pointers published with OSAtomicCompareAndSwapPtrBarrier() are read with acquire semantics, so that what they point to is seen fully written
+CF_INLINE void *__CFBinaryPlistLazyLoad(void * volatile *ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+CF_INLINE CFIndex __CFBinaryPlistLazyContainerGetSlotCount(_CFBinaryPlistLazyContainerRef container) {
+    return (kCFBinaryPlistMarkerDict == container->_marker) ? 2 * container->_count : container->_count;
+}
+
+static void __CFBinaryPlistLazyContainerDeallocate(CFTypeRef cf) {
+    struct __CFBinaryPlistLazyContainer *container = (struct __CFBinaryPlistLazyContainer *)cf;
+    if (container->_elements) {
+        CFIndex slots = __CFBinaryPlistLazyContainerGetSlotCount(container);
+        for (CFIndex idx = 0; idx < slots; idx++) {
+            if (container->_elements[idx]) CFRelease(container->_elements[idx]);
+        }
+        CFAllocatorDeallocate(kCFAllocatorSystemDefault, container->_elements);
+    }
+    if (container->_index) CFAllocatorDeallocate(kCFAllocatorSystemDefault, container->_index);
+    CFRelease(container->_contentsDeallocator);
+    CFRelease(container->_data);
+}
+
+static CFStringRef __CFBinaryPlistLazyContainerCopyDescription(CFTypeRef cf) {
+    _CFBinaryPlistLazyContainerRef container = (_CFBinaryPlistLazyContainerRef)cf;
+    const char *type = (kCFBinaryPlistMarkerDict == container->_marker) ? "dictionary" : (kCFBinaryPlistMarkerSet == container->_marker) ? "set" : "array";
+    return CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("<CFBinaryPlistLazyContainer %p [%p]>{type = %s, count = %ld, offset = %llu}"), cf, CFGetAllocator(cf), type, (long)container->_count, (unsigned long long)container->_offset);
+}
+
+static CFTypeID __kCFBinaryPlistLazyContainerTypeID = _kCFRuntimeNotATypeID;
+
+static const CFRuntimeClass __CFBinaryPlistLazyContainerClass = {
+    0,
+    "CFBinaryPlistLazyContainer",
+    NULL,	// init
+    NULL,	// copy
+    __CFBinaryPlistLazyContainerDeallocate,
+    NULL,	// equal -- pointer equality only
+    NULL,	// hash -- pointer hashing only
+    NULL,	// copyFormattingDesc
+    __CFBinaryPlistLazyContainerCopyDescription
+};
+
+CFTypeID _CFBinaryPlistLazyContainerGetTypeID(void) {
+    static dispatch_once_t initOnce;
+    dispatch_once(&initOnce, ^{ __kCFBinaryPlistLazyContainerTypeID = _CFRuntimeRegisterClass(&__CFBinaryPlistLazyContainerClass); });
+    return __kCFBinaryPlistLazyContainerTypeID;
+}
+
+static _CFBinaryPlistLazyContainerRef __CFBinaryPlistLazyContainerCreate(CFAllocatorRef allocator, CFDataRef data, CFAllocatorRef contentsDeallocator, const CFBinaryPlistTrailer *trailer, uint64_t startOffset) {
+    const uint8_t *databytes = CFDataGetBytePtr(data);
+    uint64_t objectsRangeStart = 8, objectsRangeEnd = trailer->_offsetTableOffset - 1;
+    if (startOffset < objectsRangeStart || objectsRangeEnd < startOffset) return NULL;
+    const uint8_t *ptr = databytes + startOffset;
+    uint8_t marker = *ptr;
+    if ((marker & 0xf0) != kCFBinaryPlistMarkerArray && (marker & 0xf0) != kCFBinaryPlistMarkerSet && (marker & 0xf0) != kCFBinaryPlistMarkerDict) return NULL;
+    int32_t err = CF_NO_ERROR;
+    ptr = check_ptr_add(ptr, 1, &err);
+    if (CF_NO_ERROR != err) return NULL;
+    CFIndex cnt = marker & 0x0f;
+    if (0xf == cnt) {
+        uint64_t bigint = 0;
+        if (!_readInt(ptr, databytes + objectsRangeEnd, &bigint, &ptr)) return NULL;
+        if (LONG_MAX < bigint) return NULL;
+        cnt = (CFIndex)bigint;
+    }
+    size_t refCount = ((marker & 0xf0) == kCFBinaryPlistMarkerDict) ? check_size_t_mul(cnt, 2, &err) : (size_t)cnt;
+    size_t byte_cnt = check_size_t_mul(refCount, trailer->_objectRefSize, &err);
+    if (CF_NO_ERROR != err) return NULL;
+    const uint8_t *extent = check_ptr_add(ptr, byte_cnt, &err) - 1;
+    if (CF_NO_ERROR != err) return NULL;
+    if (databytes + objectsRangeEnd < extent) return NULL;
+    check_size_t_mul(refCount, sizeof(CFPropertyListRef), &err);
+    if (CF_NO_ERROR != err) return NULL;
+
+    struct __CFBinaryPlistLazyContainer *container = (struct __CFBinaryPlistLazyContainer *)_CFRuntimeCreateInstance(allocator, _CFBinaryPlistLazyContainerGetTypeID(), sizeof(struct __CFBinaryPlistLazyContainer) - sizeof(CFRuntimeBase), NULL);
+    if (NULL == container) return NULL;
+    container->_data = (CFDataRef)CFRetain(data);
+    container->_contentsDeallocator = (CFAllocatorRef)CFRetain(contentsDeallocator);
+    container->_trailer = *trailer;
+    container->_offset = startOffset;
+    container->_refs = ptr;
+    container->_count = cnt;
+    container->_marker = marker & 0xf0;
+    return container;
+}
+
+// Finds the bytes of the ASCII string at startOffset; they are all ASCII if isASCII is set
+static bool __CFBinaryPlistLazyGetASCIIString(const uint8_t *databytes, const CFBinaryPlistTrailer *trailer, uint64_t startOffset, const uint8_t **bytes, CFIndex *length, Boolean *isASCII) {
+    uint64_t objectsRangeStart = 8, objectsRangeEnd = trailer->_offsetTableOffset - 1;
+    if (startOffset < objectsRangeStart || objectsRangeEnd < startOffset) FAIL_FALSE;
+    const uint8_t *ptr = databytes + startOffset;
+    uint8_t marker = *ptr;
+    if ((marker & 0xf0) != kCFBinaryPlistMarkerASCIIString) FAIL_FALSE;
+    int32_t err = CF_NO_ERROR;
+    ptr = check_ptr_add(ptr, 1, &err);
+    if (CF_NO_ERROR != err) FAIL_FALSE;
+    CFIndex cnt = marker & 0x0f;
+    if (0xf == cnt) {
+        uint64_t bigint = 0;
+        if (!_readInt(ptr, databytes + objectsRangeEnd, &bigint, &ptr)) FAIL_FALSE;
+        if (LONG_MAX < bigint) FAIL_FALSE;
+        cnt = (CFIndex)bigint;
+    }
+    const uint8_t *extent = check_ptr_add(ptr, cnt, &err) - 1;
+    if (CF_NO_ERROR != err) FAIL_FALSE;
+    if (databytes + objectsRangeEnd < extent) FAIL_FALSE;
+    *bytes = ptr;
+    *length = cnt;
+    *isASCII = true;
+    for (CFIndex idx = 0; idx < cnt; idx++) {
+        if (ptr[idx] & 0x80) {
+            *isASCII = false;
+            break;
+        }
+    }
+    return true;
+}
+
+static CFPropertyListRef __CFBinaryPlistLazyCreateElement(_CFBinaryPlistLazyContainerRef container, uint64_t startOffset) {
+    const uint8_t *databytes = CFDataGetBytePtr(container->_data);
+    uint64_t datalen = CFDataGetLength(container->_data);
+    CFAllocatorRef allocator = CFGetAllocator(container);
+    uint64_t objectsRangeStart = 8, objectsRangeEnd = container->_trailer._offsetTableOffset - 1;
+    if (startOffset < objectsRangeStart || objectsRangeEnd < startOffset) return NULL;
+    switch (databytes[startOffset] & 0xf0) {
+    case kCFBinaryPlistMarkerArray:
+    case kCFBinaryPlistMarkerSet:
+    case kCFBinaryPlistMarkerDict:
+        return __CFBinaryPlistLazyContainerCreate(allocator, container->_data, container->_contentsDeallocator, &container->_trailer, startOffset);
+    case kCFBinaryPlistMarkerASCIIString: {
+        const uint8_t *bytes;
+        CFIndex length;
+        Boolean isASCII;
+        if (!__CFBinaryPlistLazyGetASCIIString(databytes, &container->_trailer, startOffset, &bytes, &length, &isASCII)) return NULL;
+        // strings with other bytes need converting, so are copied anyway
+        if (isASCII) return CFStringCreateWithBytesNoCopy(allocator, bytes, length, kCFStringEncodingASCII, false, container->_contentsDeallocator);
+        break;
+    }
+    }
+    CFPropertyListRef pl = NULL;
+    if (!__CFBinaryPlistCreateObjectFiltered(databytes, datalen, startOffset, &container->_trailer, allocator, kCFPropertyListImmutable, NULL, NULL, 0, NULL, &pl)) return NULL;
+    return pl;
+}
+
+static CFPropertyListRef __CFBinaryPlistLazyGetElement(_CFBinaryPlistLazyContainerRef container, CFIndex slot) {
+    struct __CFBinaryPlistLazyContainer *mutableContainer = (struct __CFBinaryPlistLazyContainer *)container;
+    CFPropertyListRef *elements = (CFPropertyListRef *)__CFBinaryPlistLazyLoad((void * volatile *)&container->_elements);
+    if (!elements) {
+        size_t size = __CFBinaryPlistLazyContainerGetSlotCount(container) * sizeof(CFPropertyListRef);
+        elements = (CFPropertyListRef *)CFAllocatorAllocate(kCFAllocatorSystemDefault, size, __kCFAllocatorGCScannedMemory);
+        if (!elements) return NULL;
+        memset(elements, 0, size);
+        if (!OSAtomicCompareAndSwapPtrBarrier(NULL, elements, (void * volatile *)&mutableContainer->_elements)) {
+            CFAllocatorDeallocate(kCFAllocatorSystemDefault, elements);
+            elements = (CFPropertyListRef *)__CFBinaryPlistLazyLoad((void * volatile *)&container->_elements);
+        }
+    }
+    CFPropertyListRef pl = (CFPropertyListRef)__CFBinaryPlistLazyLoad((void * volatile *)&elements[slot]);
+    if (pl) return pl;
+    uint64_t off = _getOffsetOfRefAt(CFDataGetBytePtr(container->_data), container->_refs + slot * container->_trailer._objectRefSize, &container->_trailer);
+    if (UINT64_MAX == off) return NULL;
+    pl = __CFBinaryPlistLazyCreateElement(container, off);
+    if (!pl) return NULL;
+    if (!OSAtomicCompareAndSwapPtrBarrier(NULL, (void *)pl, (void * volatile *)&elements[slot])) {
+        CFRelease(pl);
+        pl = (CFPropertyListRef)__CFBinaryPlistLazyLoad((void * volatile *)&elements[slot]);
+    }
+    return pl;
+}
+
+// Hashes key idx as CFHash() would, without creating it if it is an ASCII string
+static bool __CFBinaryPlistLazyGetKeyHash(_CFBinaryPlistLazyContainerRef container, CFIndex idx, CFHashCode *hash) {
+    const uint8_t *databytes = CFDataGetBytePtr(container->_data);
+    uint64_t off = _getOffsetOfRefAt(databytes, container->_refs + idx * container->_trailer._objectRefSize, &container->_trailer);
+    if (UINT64_MAX == off) FAIL_FALSE;
+    const uint8_t *bytes;
+    CFIndex length;
+    Boolean isASCII;
+    if (__CFBinaryPlistLazyGetASCIIString(databytes, &container->_trailer, off, &bytes, &length, &isASCII) && isASCII) {
+        *hash = CFStringHashCString(bytes, length);
+        return true;
+    }
+    CFPropertyListRef key = __CFBinaryPlistLazyGetElement(container, idx);
+    if (!key || CFGetTypeID(key) == _CFBinaryPlistLazyContainerGetTypeID()) FAIL_FALSE;
+    *hash = CFHash(key);
+    return true;
+}
+
+// The index is built whole on the first lookup that needs it.
+static struct __CFBinaryPlistLazyIndexEntry *__CFBinaryPlistLazyGetIndex(_CFBinaryPlistLazyContainerRef container) {
+    struct __CFBinaryPlistLazyContainer *mutableContainer = (struct __CFBinaryPlistLazyContainer *)container;
+    struct __CFBinaryPlistLazyIndexEntry *index = (struct __CFBinaryPlistLazyIndexEntry *)__CFBinaryPlistLazyLoad((void * volatile *)&container->_index);
+    if (index) return index;
+    CFIndex size = __CFBinaryPlistLazyIndexSize(container->_count);
+    index = (struct __CFBinaryPlistLazyIndexEntry *)CFAllocatorAllocate(kCFAllocatorSystemDefault, size * sizeof(struct __CFBinaryPlistLazyIndexEntry), 0);
+    if (!index) return NULL;
+    memset(index, 0, size * sizeof(struct __CFBinaryPlistLazyIndexEntry));
+    for (CFIndex idx = 0; idx < container->_count; idx++) {
+        CFHashCode hash;
+        if (!__CFBinaryPlistLazyGetKeyHash(container, idx, &hash)) continue;	// such a key can't be looked up
+        CFIndex bucket = hash & (size - 1);
+        while (index[bucket]._key) bucket = (bucket + 1) & (size - 1);
+        index[bucket]._key = idx + 1;
+        index[bucket]._hash = hash;
+    }
+    if (!OSAtomicCompareAndSwapPtrBarrier(NULL, index, (void * volatile *)&mutableContainer->_index)) {
+        CFAllocatorDeallocate(kCFAllocatorSystemDefault, index);
+        index = (struct __CFBinaryPlistLazyIndexEntry *)__CFBinaryPlistLazyLoad((void * volatile *)&container->_index);
+    }
+    return index;
+}
+
+static void __CFBinaryPlistLazyDeallocate(void *ptr, void *info) {
+    // the bytes belong to the data, which is released with the allocator
+}
+
+CFPropertyListRef _CFBinaryPlistCreateLazy(CFAllocatorRef allocator, CFDataRef data, CFErrorRef *error) {
+    uint8_t marker;
+    CFBinaryPlistTrailer trailer;
+    uint64_t offset;
+    const uint8_t *databytes = CFDataGetBytePtr(data);
+    uint64_t datalen = CFDataGetLength(data);
+    CFPropertyListRef pl = NULL;
+
+    if (8 <= datalen && __CFBinaryPlistGetTopLevelInfo(databytes, datalen, &marker, &offset, &trailer)) {
+        switch (marker & 0xf0) {
+        case kCFBinaryPlistMarkerArray:
+        case kCFBinaryPlistMarkerSet:
+        case kCFBinaryPlistMarkerDict: {
+            // Strings sharing the data's bytes keep it alive through their contents deallocator, which retains the data and frees nothing
+            CFAllocatorContext context = {0, (void *)data, CFRetain, CFRelease, NULL, NULL, NULL, __CFBinaryPlistLazyDeallocate, NULL};
+            CFAllocatorRef contentsDeallocator = CFAllocatorCreate(kCFAllocatorSystemDefault, &context);
+            if (contentsDeallocator) {
+                pl = __CFBinaryPlistLazyContainerCreate(allocator, data, contentsDeallocator, &trailer, offset);
+                CFRelease(contentsDeallocator);
+            }
+            break;
+        }
+        default:
+            if (!__CFBinaryPlistCreateObjectFiltered(databytes, datalen, offset, &trailer, allocator, kCFPropertyListImmutable, NULL, NULL, 0, NULL, &pl)) pl = NULL;
+            break;
+        }
+    }
+    if (!pl && error) *error = __CFPropertyListCreateError(kCFPropertyListReadCorruptError, CFSTR("Binary property list is corrupt"));
+    return pl;
+}
+
+CFTypeID _CFBinaryPlistLazyContainerGetContainerTypeID(_CFBinaryPlistLazyContainerRef container) {
+    switch (container->_marker) {
+    case kCFBinaryPlistMarkerDict: return CFDictionaryGetTypeID();
+    case kCFBinaryPlistMarkerSet: return CFSetGetTypeID();
+    default: return CFArrayGetTypeID();
+    }
+}
+
+CFIndex _CFBinaryPlistLazyContainerGetCount(_CFBinaryPlistLazyContainerRef container) {
+    return container->_count;
+}
+
+CFPropertyListRef _CFBinaryPlistLazyContainerGetValueAtIndex(_CFBinaryPlistLazyContainerRef container, CFIndex idx) {
+    if (idx < 0 || container->_count <= idx) return NULL;
+    return __CFBinaryPlistLazyGetElement(container, (kCFBinaryPlistMarkerDict == container->_marker) ? container->_count + idx : idx);
+}
+
+CFPropertyListRef _CFBinaryPlistLazyContainerGetKeyAtIndex(_CFBinaryPlistLazyContainerRef container, CFIndex idx) {
+    if (kCFBinaryPlistMarkerDict != container->_marker || idx < 0 || container->_count <= idx) return NULL;
+    return __CFBinaryPlistLazyGetElement(container, idx);
+}
+
+CFPropertyListRef _CFBinaryPlistLazyContainerGetValue(_CFBinaryPlistLazyContainerRef container, CFPropertyListRef key) {
+    if (kCFBinaryPlistMarkerDict != container->_marker || !key) return NULL;
+    if (container->_count <= __CFBinaryPlistLazyLinearSearchLimit) {
+        for (CFIndex idx = 0; idx < container->_count; idx++) {
+            CFPropertyListRef candidate = __CFBinaryPlistLazyGetElement(container, idx);
+            if (candidate && CFEqual(candidate, key)) return __CFBinaryPlistLazyGetElement(container, container->_count + idx);
+        }
+        return NULL;
+    }
+    struct __CFBinaryPlistLazyIndexEntry *index = __CFBinaryPlistLazyGetIndex(container);
+    if (!index) return NULL;
+    CFIndex mask = __CFBinaryPlistLazyIndexSize(container->_count) - 1;
+    CFHashCode hash = CFHash(key);
+    for (CFIndex bucket = hash & mask; index[bucket]._key; bucket = (bucket + 1) & mask) {
+        if (index[bucket]._hash != hash) continue;
+        CFIndex idx = index[bucket]._key - 1;
+        CFPropertyListRef candidate = __CFBinaryPlistLazyGetElement(container, idx);
+        if (candidate && CFEqual(candidate, key)) return __CFBinaryPlistLazyGetElement(container, container->_count + idx);
+    }
+    return NULL;
+}
+
+CFPropertyListRef _CFBinaryPlistLazyContainerCopyPropertyList(_CFBinaryPlistLazyContainerRef container, CFOptionFlags option) {
+    CFMutableDictionaryRef objects = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+    CFPropertyListRef pl = NULL;
+    if (!__CFBinaryPlistCreateObjectFiltered(CFDataGetBytePtr(container->_data), CFDataGetLength(container->_data), container->_offset, &container->_trailer, CFGetAllocator(container), option, objects, NULL, 0, NULL, &pl)) pl = NULL;
+    CFRelease(objects);
+    return pl;
+}
@@ -953,12 +953,14 @@ static CFIndex __CFToUTF8(uint32_t flags, const UniChar *characters, CFIndex num
     bool isStrict = (flags & kCFStringEncodingUseHFSPlusCanonical ? false : true);
 
     while ((characters < endCharacter) && (!maxByteLen || (bytes < endBytes))) {
-        ch = *(characters++);
-
-        if (ch < 0x80) { // ASCII
-            if (maxByteLen) *bytes = ch;
-            ++bytes;
+        if (*characters < 0x80) { // ASCII, copied a run at a time
+            CFIndex run = ((maxByteLen && (endBytes - bytes < endCharacter - characters)) ? endBytes - bytes : endCharacter - characters);
+            run = __CFStringEncodingNarrowASCIIPrefix(characters, run, (maxByteLen ? bytes : NULL));
+            characters += run;
+            bytes += run;
         } else {
+            ch = *(characters++);
+
             if (ch >= kSurrogateHighStart) {
                 if (ch <= kSurrogateHighEnd) {
                     if ((characters < endCharacter) && ((*characters >= kSurrogateLowStart) && (*characters <= kSurrogateLowEnd))) {
@@ -1023,6 +1025,16 @@ static CFIndex __CFFromUTF8(uint32_t flags, const uint8_t *bytes, CFIndex numByt
     bool isStrict = !isHFSPlus;
 
     while (numBytes && (!maxCharLen || (theUsedCharLen < maxCharLen))) {
+        if (*source < 0x80) { // ASCII, copied a run at a time; never decomposed
+            CFIndex run = ((maxCharLen && (maxCharLen - theUsedCharLen < numBytes)) ? maxCharLen - theUsedCharLen : numBytes);
+            run = (maxCharLen ? __CFStringEncodingWidenASCIIPrefix(source, run, characters) : __CFStringEncodingASCIIPrefixLength(source, run));
+            source += run;
+            numBytes -= run;
+            theUsedCharLen += run;
+            if (maxCharLen) characters += run;
+            continue;
+        }
+
         extraBytesToRead = trailingBytesForUTF8[*source];
 
         if (extraBytesToRead > --numBytes) break;
@@ -1110,6 +1122,13 @@ static CFIndex __CFToUTF8Len(uint32_t flags, const UniChar *characters, CFIndex
     uint32_t ch;
 
     while (numChars) {
+        if (*characters < 0x80) {
+            CFIndex run = __CFStringEncodingNarrowASCIIPrefix(characters, numChars, NULL);
+            characters += run;
+            numChars -= run;
+            bytesToWrite += run;
+            continue;
+        }
         ch = *characters++;
         numChars--;
         if ((ch >= kSurrogateHighStart && ch <= kSurrogateHighEnd) && numChars && (*characters >= kSurrogateLowStart && *characters <= kSurrogateLowEnd)) {
@@ -1134,6 +1153,14 @@ static CFIndex __CFFromUTF8Len(uint32_t flags, const uint8_t *source, CFIndex nu
     bool isStrict = !isHFSPlus;
 
     while (numBytes) {
+        if (*source < 0x80) {
+            CFIndex run = __CFStringEncodingASCIIPrefixLength(source, numBytes);
+            source += run;
+            numBytes -= run;
+            theUsedCharLen += run;
+            continue;
+        }
+
         extraBytesToRead = trailingBytesForUTF8[*source];
 
         if (extraBytesToRead > --numBytes) break;
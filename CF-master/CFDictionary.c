@@ -213,6 +213,8 @@ static CFBasicHashRef __CFDictionaryCreateGeneric(CFAllocatorRef allocator, cons
     callbacks.equateValues = useValueCB ? (valueCallBacks ? (Boolean (*)(uintptr_t, uintptr_t))valueCallBacks->equal : NULL) : (callbacks.equateKeys);
     callbacks.copyValueDescription = useValueCB ? (valueCallBacks ? (CFStringRef (*)(uintptr_t))valueCallBacks->copyDescription : NULL) : (callbacks.copyKeyDescription);
 
+    if (callbacks.equateKeys && CFBasicHashGroupProbingRequested()) flags |= kCFBasicHashGroupProbing;
+
     CFBasicHashRef ht = CFBasicHashCreate(allocator, flags, &callbacks);
     return ht;
 }
@@ -240,6 +242,7 @@ CF_PRIVATE CFHashRef __CFDictionaryCreateTransfer(CFAllocatorRef allocator, cons
     callbacks.releaseValue = CFDictionary ? (void (*)(CFAllocatorRef, uintptr_t))kCFTypeDictionaryValueCallBacks.release : callbacks.releaseKey;
     callbacks.equateValues = CFDictionary ? (Boolean (*)(uintptr_t, uintptr_t))kCFTypeDictionaryValueCallBacks.equal : callbacks.equateKeys;
     callbacks.copyValueDescription = CFDictionary ? (CFStringRef (*)(uintptr_t))kCFTypeDictionaryValueCallBacks.copyDescription : callbacks.copyKeyDescription;
+    if (CFBasicHashGroupProbingRequested()) flags |= kCFBasicHashGroupProbing;
 
     CFBasicHashRef ht = CFBasicHashCreate(allocator, flags, &callbacks);
     CFBasicHashSuppressRC(ht);
@@ -253,6 +253,9 @@ CF_EXPORT const CFStringRef _kCFSystemVersionBuildStringKey;		// Localized strin
 CF_EXPORT void CFMergeSortArray(void *list, CFIndex count, CFIndex elementSize, CFComparatorFunction comparator, void *context);
 CF_EXPORT void CFQSortArray(void *list, CFIndex count, CFIndex elementSize, CFComparatorFunction comparator, void *context);
 
+/* Fills indexBuffer with 0 through count-1 ordered by keys[index], equal keys keeping index order. Signed or floating point keys must be mapped so that their order is the unsigned order. Uses no comparator, so is much faster than a comparator sort when keys can be computed up front. */
+CF_EXPORT void _CFSortIndexesUsingKeys(CFIndex *indexBuffer, const uint64_t *keys, CFIndex count);
+
 /* _CFExecutableLinkedOnOrAfter(releaseVersionName) will return YES if the current executable seems to be linked on or after the specified release. Example: If you specify CFSystemVersionPuma (10.1), you will get back true for executables linked on Puma or Jaguar(10.2), but false for those linked on Cheetah (10.0) or any of its software updates (10.0.x). You will also get back false for any app whose version info could not be figured out.
     This function caches its results, so no need to cache at call sites.
 
@@ -608,6 +611,19 @@ CF_EXPORT bool _CFPropertyListCreateSingleValue(CFAllocatorRef allocator, CFData
 // Returns a subset of the property list, only including the keyPaths in the CFSet. If the top level object is not a dictionary, you will get back an empty dictionary as the result.
 CF_EXPORT bool _CFPropertyListCreateFiltered(CFAllocatorRef allocator, CFDataRef data, CFOptionFlags option, CFSetRef keyPaths, CFPropertyListRef *value, CFErrorRef *error) CF_AVAILABLE(10_8, 6_0);
 
+// Returns the top level object of a binary property list, creating as little as it can. An array, set or dictionary is returned as a _CFBinaryPlistLazyContainerRef, whose elements are created when first asked for; nested containers are lazy containers too, and ASCII strings use the data's bytes instead of a copy. The data is retained and must not change, and may be memory mapped. Lazy containers are not CFArrays, CFSets or CFDictionaries; _CFBinaryPlistLazyContainerCopyPropertyList() makes one of those. Elements that are corrupt are returned as NULL.
+typedef const struct __CFBinaryPlistLazyContainer * _CFBinaryPlistLazyContainerRef;
+
+CF_EXPORT CFTypeID _CFBinaryPlistLazyContainerGetTypeID(void);
+CF_EXPORT CFPropertyListRef _CFBinaryPlistCreateLazy(CFAllocatorRef allocator, CFDataRef data, CFErrorRef *error);
+CF_EXPORT CFTypeID _CFBinaryPlistLazyContainerGetContainerTypeID(_CFBinaryPlistLazyContainerRef container);
+CF_EXPORT CFIndex _CFBinaryPlistLazyContainerGetCount(_CFBinaryPlistLazyContainerRef container);
+CF_EXPORT CFPropertyListRef _CFBinaryPlistLazyContainerGetValueAtIndex(_CFBinaryPlistLazyContainerRef container, CFIndex idx);
+// Dictionaries only. Looking up a key in a dictionary of more than a few pairs hashes all its keys once, creating only those that are not ASCII strings.
+CF_EXPORT CFPropertyListRef _CFBinaryPlistLazyContainerGetKeyAtIndex(_CFBinaryPlistLazyContainerRef container, CFIndex idx);
+CF_EXPORT CFPropertyListRef _CFBinaryPlistLazyContainerGetValue(_CFBinaryPlistLazyContainerRef container, CFPropertyListRef key);
+CF_EXPORT CFPropertyListRef _CFBinaryPlistLazyContainerCopyPropertyList(_CFBinaryPlistLazyContainerRef container, CFOptionFlags option);
+
 #if (TARGET_OS_MAC && !(TARGET_OS_EMBEDDED || TARGET_OS_IPHONE)) || (TARGET_OS_EMBEDDED || TARGET_OS_IPHONE) || TARGET_OS_WIN32
 
 // Returns a subset of a bundle's Info.plist. The keyPaths follow the same rules as above CFPropertyList function. This function takes platform and product keys into account.
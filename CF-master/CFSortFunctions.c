@@ -45,96 +45,292 @@ typedef CFIndex INDEX_TYPE;
 typedef CFComparisonResult CMP_RESULT_TYPE;
 typedef CMP_RESULT_TYPE (^COMPARATOR_BLOCK)(VALUE_TYPE, VALUE_TYPE);
 
-/*
-Number of elements in a list and expected number of compares,
-when the initial short-circuiting compare is not done.
-1	0
-2	1
-3	2.667
-4	4.667
-5	7.167
-6	9.833
-7	12.733
-8	15.733
-9	19.167
-10	22.667
-11	26.2857
-12	29.9524
+/* Adaptive merge sort, after Tim Peters' listsort.
+    The list is scanned for runs which are already in order (strictly descending runs
+    are reversed in place, which keeps the sort stable), short runs are extended to
+    a minimum length with a binary insertion sort, and runs are merged as they are
+    found while keeping the pending run lengths growing faster than the Fibonacci
+    numbers, so merges stay balanced. Before each merge, the parts of the two runs
+    which are already in place are found by binary search and skipped; ordered or
+    reverse ordered input costs about one compare per element. Galloping within a
+    merge is not done.
 */
 
-static void __CFSimpleMerge(VALUE_TYPE listp[], INDEX_TYPE cnt1, INDEX_TYPE cnt2, VALUE_TYPE tmp[], COMPARATOR_BLOCK cmp) {
-    if (cnt1 <= 0 || cnt2 <= 0) return;
-    // if the last element of listp1 <= the first of listp2, lists are already ordered
-    if (16 < cnt1 + cnt2 && cmp(listp[cnt1 - 1], listp[cnt1]) <= 0) return;
+#define __CF_SORT_MIN_MERGE 64
+#define __CF_SORT_MAX_PENDING 85
 
-    INDEX_TYPE idx = 0, idx1 = 0, idx2 = cnt1;
-    for (;;) {
-        if (cnt1 <= idx1) {
-            while (idx--) {
-                listp[idx] = tmp[idx];
-            }
-            return;
+static INDEX_TYPE __CFRunMergeSortMinRun(INDEX_TYPE cnt) {
+    // a length between 32 and 64 such that cnt / minrun is, or is just below, a power of 2
+    INDEX_TYPE r = 0;
+    while (__CF_SORT_MIN_MERGE <= cnt) {
+        r |= (cnt & 1);
+        cnt >>= 1;
+    }
+    return cnt + r;
+}
+
+// returns the length of the run at the start of listp, which is left in ascending order
+static INDEX_TYPE __CFRunMergeSortCountRun(VALUE_TYPE listp[], INDEX_TYPE cnt, COMPARATOR_BLOCK cmp) {
+    if (cnt < 2) return cnt;
+    INDEX_TYPE run = 2;
+    if (0 < cmp(listp[0], listp[1])) {
+        while (run < cnt && 0 < cmp(listp[run - 1], listp[run])) run++;
+        for (INDEX_TYPE lo = 0, hi = run - 1; lo < hi; lo++, hi--) {
+            VALUE_TYPE vt = listp[lo];
+            listp[lo] = listp[hi];
+            listp[hi] = vt;
         }
-        if (cnt1 + cnt2 <= idx2) {
-            for (INDEX_TYPE t = cnt1 + cnt2 - 1; idx <= t; t--) {
-                listp[t] = listp[t - cnt2];
-            }
-            while (idx--) {
-                listp[idx] = tmp[idx];
+    } else {
+        while (run < cnt && cmp(listp[run - 1], listp[run]) <= 0) run++;
+    }
+    return run;
+}
+
+// listp[0 .. sorted-1] is in order; inserts the rest after any equal values
+static void __CFBinaryInsertionSort(VALUE_TYPE listp[], INDEX_TYPE cnt, INDEX_TYPE sorted, COMPARATOR_BLOCK cmp) {
+    for (INDEX_TYPE idx = sorted; idx < cnt; idx++) {
+        VALUE_TYPE v = listp[idx];
+        INDEX_TYPE lo = 0, hi = idx;
+        while (lo < hi) {
+            INDEX_TYPE mid = lo + (hi - lo) / 2;
+            if (0 < cmp(listp[mid], v)) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
             }
-            return;
         }
-        VALUE_TYPE v1 = listp[idx1], v2 = listp[idx2];
-        if (cmp(v1, v2) <= 0) {
-            tmp[idx] = v1;
-            idx1++;
-        } else {
-            tmp[idx] = v2;
-            idx2++;
-        }
-        idx++;
+        memmove(listp + lo + 1, listp + lo, (idx - lo) * sizeof(VALUE_TYPE));
+        listp[lo] = v;
     }
 }
 
-static void __CFSimpleMergeSort(VALUE_TYPE listp[], INDEX_TYPE cnt, VALUE_TYPE tmp[], COMPARATOR_BLOCK cmp) {
-    if (cnt < 2) {
-        /* do nothing */
-    } else if (2 == cnt) {
-        VALUE_TYPE v0 = listp[0], v1 = listp[1];
-        if (0 < cmp(v0, v1)) {
-            listp[0] = v1;
-            listp[1] = v0;
+// merges the adjacent runs listp[0 .. cnt1-1] and listp[cnt1 .. cnt1+cnt2-1]; tmp must hold (cnt1 + cnt2) / 2 values
+static void __CFRunMerge(VALUE_TYPE listp[], INDEX_TYPE cnt1, INDEX_TYPE cnt2, VALUE_TYPE tmp[], COMPARATOR_BLOCK cmp) {
+    if (cnt1 <= 0 || cnt2 <= 0) return;
+    VALUE_TYPE *listp2 = listp + cnt1;
+
+    // values of the first run not greater than the first of the second are in place
+    VALUE_TYPE first2 = listp2[0];
+    INDEX_TYPE lo = 0, hi = cnt1;
+    while (lo < hi) {
+        INDEX_TYPE mid = lo + (hi - lo) / 2;
+        if (0 < cmp(listp[mid], first2)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
         }
-    } else if (3 == cnt) {
-        VALUE_TYPE v0 = listp[0], v1 = listp[1], v2 = listp[2], vt;
-        if (0 < cmp(v0, v1)) {
-            vt = v0;
-            v0 = v1;
-            v1 = vt;
+    }
+    listp += lo;
+    cnt1 -= lo;
+    if (cnt1 == 0) return;
+
+    // values of the second run not less than the last of the first are in place
+    VALUE_TYPE last1 = listp[cnt1 - 1];
+    lo = 0;
+    hi = cnt2;
+    while (lo < hi) {
+        INDEX_TYPE mid = lo + (hi - lo) / 2;
+        if (0 < cmp(last1, listp2[mid])) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
-        if (0 < cmp(v1, v2)) {
-            vt = v1;
-            v1 = v2;
-            v2 = vt;
-            if (0 < cmp(v0, v1)) {
-                vt = v0;
-                v0 = v1;
-                v1 = vt;
+    }
+    cnt2 = lo;
+    if (cnt2 == 0) return;
+
+    if (cnt1 <= cnt2) {
+        // copy the first run out and merge from the front
+        memmove(tmp, listp, cnt1 * sizeof(VALUE_TYPE));
+        VALUE_TYPE *dst = listp, *src1 = tmp, *src1_end = tmp + cnt1, *src2 = listp2, *src2_end = listp2 + cnt2;
+        while (src1 < src1_end && src2 < src2_end) {
+            if (0 < cmp(*src1, *src2)) {
+                *dst++ = *src2++;
+            } else {
+                *dst++ = *src1++;
             }
         }
-        listp[0] = v0;
-        listp[1] = v1;
-        listp[2] = v2;
+        memmove(dst, src1, (src1_end - src1) * sizeof(VALUE_TYPE));
     } else {
-        INDEX_TYPE half_cnt = cnt / 2;
-        __CFSimpleMergeSort(listp, half_cnt, tmp, cmp);
-        __CFSimpleMergeSort(listp + half_cnt, cnt - half_cnt, tmp, cmp);
-        __CFSimpleMerge(listp, half_cnt, cnt - half_cnt, tmp, cmp);
+        // copy the second run out and merge from the back
+        memmove(tmp, listp2, cnt2 * sizeof(VALUE_TYPE));
+        VALUE_TYPE *dst = listp2 + cnt2, *src1 = listp2, *src2 = tmp + cnt2;
+        while (listp < src1 && tmp < src2) {
+            if (0 < cmp(src1[-1], src2[-1])) {
+                *--dst = *--src1;
+            } else {
+                *--dst = *--src2;
+            }
+        }
+        memmove(dst - (src2 - tmp), tmp, (src2 - tmp) * sizeof(VALUE_TYPE));
+    }
+}
+
+// tmp must hold cnt / 2 values
+static void __CFRunMergeSort(VALUE_TYPE listp[], INDEX_TYPE cnt, VALUE_TYPE tmp[], COMPARATOR_BLOCK cmp) {
+    if (cnt < 2) return;
+    INDEX_TYPE min_run = __CFRunMergeSortMinRun(cnt);
+    INDEX_TYPE run_base[__CF_SORT_MAX_PENDING], run_len[__CF_SORT_MAX_PENDING];
+    INDEX_TYPE pending = 0;
+    for (INDEX_TYPE base = 0; base < cnt; ) {
+        INDEX_TYPE len = __CFRunMergeSortCountRun(listp + base, cnt - base, cmp);
+        if (len < min_run) {
+            INDEX_TYPE forced = __CFMin(min_run, cnt - base);
+            __CFBinaryInsertionSort(listp + base, forced, len, cmp);
+            len = forced;
+        }
+        run_base[pending] = base;
+        run_len[pending] = len;
+        pending++;
+        base += len;
+
+        // restore run_len[k-2] > run_len[k-1] + run_len[k] and run_len[k-1] > run_len[k] for the pending runs
+        while (1 < pending) {
+            INDEX_TYPE k = pending - 2;
+            if ((0 < k && run_len[k - 1] <= run_len[k] + run_len[k + 1]) || (1 < k && run_len[k - 2] <= run_len[k - 1] + run_len[k])) {
+                if (run_len[k - 1] < run_len[k + 1]) k--;
+            } else if (run_len[k + 1] < run_len[k]) {
+                break;
+            }
+            __CFRunMerge(listp + run_base[k], run_len[k], run_len[k + 1], tmp, cmp);
+            run_len[k] += run_len[k + 1];
+            for (INDEX_TYPE idx = k + 1; idx < pending - 1; idx++) {
+                run_base[idx] = run_base[idx + 1];
+                run_len[idx] = run_len[idx + 1];
+            }
+            pending--;
+        }
+    }
+    while (1 < pending) {
+        INDEX_TYPE k = pending - 2;
+        if (0 < k && run_len[k - 1] < run_len[k + 1]) k--;
+        __CFRunMerge(listp + run_base[k], run_len[k], run_len[k + 1], tmp, cmp);
+        run_len[k] += run_len[k + 1];
+        for (INDEX_TYPE idx = k + 1; idx < pending - 1; idx++) {
+            run_base[idx] = run_base[idx + 1];
+            run_len[idx] = run_len[idx + 1];
+        }
+        pending--;
     }
 }
 
 #if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_WINDOWS
-// Excluded from linux for dispatch dependency
+#define __CF_SORT_CONCURRENT_MIN 160
+#else
+// threads are started for each sort rather than kept in a pool, so fewer sorts are worth splitting
+#define __CF_SORT_CONCURRENT_MIN 16384
+#endif
+
+/* Threads for the concurrent sort.
+    Where dispatch is available each phase is a dispatch_apply on the generic queue.
+    Elsewhere up to ncores - 1 pthreads are started for the duration of one sort;
+    __CFSortWorkersApply() hands them the iterations of one phase, the calling thread
+    taking iterations too, and returns once all of them are done. If no thread can be
+    started, the calling thread does all the work.
+*/
+typedef struct {
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_WINDOWS
+    dispatch_queue_t _queue;
+#else
+    pthread_mutex_t _lock;
+    pthread_cond_t _wake;           // signalled when a phase starts or the workers should exit
+    pthread_cond_t _done;           // signalled when the last iteration of a phase finishes
+    void (^_work)(size_t);
+    size_t _next;                   // next iteration to hand out
+    size_t _limit;                  // iterations in the current phase
+    size_t _finished;
+    uint64_t _phase;
+    Boolean _exiting;
+    int32_t _numThreads;
+    pthread_t _threads[15];
+#endif
+} __CFSortWorkers;
+
+#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_WINDOWS
+
+static void __CFSortWorkersInit(__CFSortWorkers *workers, int32_t ncores) {
+    workers->_queue = __CFDispatchQueueGetGenericMatchingCurrent();
+}
+
+static void __CFSortWorkersApply(__CFSortWorkers *workers, size_t iterations, void (^work)(size_t)) {
+    dispatch_apply(iterations, workers->_queue, work);
+}
+
+static void __CFSortWorkersDestroy(__CFSortWorkers *workers) {
+}
+
+#else
+
+// called and returns with the lock held
+static void __CFSortWorkersRunPhase(__CFSortWorkers *workers) {
+    while (workers->_next < workers->_limit) {
+        size_t iteration = workers->_next++;
+        void (^work)(size_t) = workers->_work;
+        pthread_mutex_unlock(&workers->_lock);
+        work(iteration);
+        pthread_mutex_lock(&workers->_lock);
+        if (++workers->_finished == workers->_limit) pthread_cond_signal(&workers->_done);
+    }
+}
+
+static void *__CFSortWorkerMain(void *arg) {
+    __CFSortWorkers *workers = (__CFSortWorkers *)arg;
+    uint64_t phase = 0;
+    pthread_mutex_lock(&workers->_lock);
+    for (;;) {
+        while (phase == workers->_phase && !workers->_exiting) pthread_cond_wait(&workers->_wake, &workers->_lock);
+        if (workers->_exiting) break;
+        phase = workers->_phase;
+        __CFSortWorkersRunPhase(workers);
+    }
+    pthread_mutex_unlock(&workers->_lock);
+    return NULL;
+}
+
+static void __CFSortWorkersInit(__CFSortWorkers *workers, int32_t ncores) {
+    pthread_mutex_init(&workers->_lock, NULL);
+    pthread_cond_init(&workers->_wake, NULL);
+    pthread_cond_init(&workers->_done, NULL);
+    workers->_work = NULL;
+    workers->_next = workers->_limit = workers->_finished = 0;
+    workers->_phase = 0;
+    workers->_exiting = false;
+    workers->_numThreads = 0;
+    int32_t wanted = __CFMin(ncores - 1, (int32_t)(sizeof(workers->_threads) / sizeof(workers->_threads[0])));
+    while (workers->_numThreads < wanted && 0 == pthread_create(&workers->_threads[workers->_numThreads], NULL, __CFSortWorkerMain, workers)) {
+        workers->_numThreads++;
+    }
+}
+
+static void __CFSortWorkersApply(__CFSortWorkers *workers, size_t iterations, void (^work)(size_t)) {
+    if (iterations == 0) return;
+    pthread_mutex_lock(&workers->_lock);
+    workers->_work = work;
+    workers->_next = 0;
+    workers->_limit = iterations;
+    workers->_finished = 0;
+    workers->_phase++;
+    pthread_cond_broadcast(&workers->_wake);
+    __CFSortWorkersRunPhase(workers);
+    while (workers->_finished < workers->_limit) pthread_cond_wait(&workers->_done, &workers->_lock);
+    workers->_work = NULL;
+    pthread_mutex_unlock(&workers->_lock);
+}
+
+static void __CFSortWorkersDestroy(__CFSortWorkers *workers) {
+    pthread_mutex_lock(&workers->_lock);
+    workers->_exiting = true;
+    pthread_cond_broadcast(&workers->_wake);
+    pthread_mutex_unlock(&workers->_lock);
+    for (int32_t idx = 0; idx < workers->_numThreads; idx++) {
+        pthread_join(workers->_threads[idx], NULL);
+    }
+    pthread_cond_destroy(&workers->_done);
+    pthread_cond_destroy(&workers->_wake);
+    pthread_mutex_destroy(&workers->_lock);
+}
+
+#endif
 
 // if !right, put the cnt1 smallest values in tmp, else put the cnt2 largest values in tmp
 static void __CFSortIndexesNMerge(VALUE_TYPE listp1[], INDEX_TYPE cnt1, VALUE_TYPE listp2[], INDEX_TYPE cnt2, VALUE_TYPE tmp[], size_t right, COMPARATOR_BLOCK cmp) {
@@ -213,16 +409,17 @@ static void __CFSortIndexesN(VALUE_TYPE listp[], INDEX_TYPE count, int32_t ncore
     }
     VALUE_TYPE **tmps = stack_tmps;
 
-    dispatch_queue_t q = __CFDispatchQueueGetGenericMatchingCurrent();
-    dispatch_apply(num_sect, q, ^(size_t sect) {
+    __CFSortWorkers workers;
+    __CFSortWorkersInit(&workers, ncores);
+    __CFSortWorkersApply(&workers, num_sect, ^(size_t sect) {
             INDEX_TYPE sect_len = (sect < num_sect - 1) ? sz : last_sect_len;
-            __CFSimpleMergeSort(listp + sect * sz, sect_len, tmps[sect], cmp); // naturally stable
+            __CFRunMergeSort(listp + sect * sz, sect_len, tmps[sect], cmp); // naturally stable
         });
 
     INDEX_TYPE even_phase_cnt = ((num_sect / 2) * 2);
     INDEX_TYPE odd_phase_cnt = (((num_sect - 1) / 2) * 2);
     for (INDEX_TYPE idx = 0; idx < (num_sect + 1) / 2; idx++) {
-        dispatch_apply(even_phase_cnt, q, ^(size_t sect) { // merge even
+        __CFSortWorkersApply(&workers, even_phase_cnt, ^(size_t sect) { // merge even
                 size_t right = sect & (size_t)0x1;
                 VALUE_TYPE *left_base = listp + sect * sz - (right ? sz : 0);
                 VALUE_TYPE *right_base = listp + sect * sz + (right ? 0 : sz);
@@ -232,7 +429,7 @@ static void __CFSortIndexesN(VALUE_TYPE listp[], INDEX_TYPE count, int32_t ncore
         if (num_sect & 0x1) {
             memmove(tmps[num_sect - 1], listp + (num_sect - 1) * sz, last_sect_len * sizeof(VALUE_TYPE));
         }
-        dispatch_apply(odd_phase_cnt, q, ^(size_t sect) { // merge odd
+        __CFSortWorkersApply(&workers, odd_phase_cnt, ^(size_t sect) { // merge odd
                 size_t right = sect & (size_t)0x1;
                 VALUE_TYPE *left_base = tmps[sect + (right ? 0 : 1)];
                 VALUE_TYPE *right_base = tmps[sect + (right ? 1 : 2)];
@@ -244,12 +441,12 @@ static void __CFSortIndexesN(VALUE_TYPE listp[], INDEX_TYPE count, int32_t ncore
             memmove(listp + (num_sect - 1) * sz, tmps[num_sect - 1], last_sect_len * sizeof(VALUE_TYPE));
         }
     }
+    __CFSortWorkersDestroy(&workers);
 
     for (INDEX_TYPE idx = 0; idx < num_sect; idx++) {
         free(stack_tmps[idx]);
     }
 }
-#endif
 
 // fills an array of indexes (of length count) giving the indexes 0 - count-1, as sorted by the comparator block
 void CFSortIndexes(CFIndex *indexBuffer, CFIndex count, CFOptionFlags opts, CFComparisonResult (^cmp)(CFIndex, CFIndex)) {
@@ -258,7 +455,7 @@ void CFSortIndexes(CFIndex *indexBuffer, CFIndex count, CFOptionFlags opts, CFCo
     int32_t ncores = 0;
     if (opts & kCFSortConcurrent) {
         ncores = __CFActiveProcessorCount();
-        if (count < 160 || ncores < 2) {
+        if (count < __CF_SORT_CONCURRENT_MIN || ncores < 2) {
             opts = (opts & ~kCFSortConcurrent);
         } else if (count < 640 && 2 < ncores) {
             ncores = 2;
@@ -285,47 +482,80 @@ void CFSortIndexes(CFIndex *indexBuffer, CFIndex count, CFOptionFlags opts, CFCo
 #else
     for (CFIndex idx = 0; idx < count; idx++) indexBuffer[idx] = idx;
 #endif
-#if DEPLOYMENT_TARGET_MACOSX || DEPLOYMENT_TARGET_EMBEDDED || DEPLOYMENT_TARGET_WINDOWS
     if (opts & kCFSortConcurrent) {
         __CFSortIndexesN(indexBuffer, count, ncores, cmp); // naturally stable
         return;
     }
-#endif
-    STACK_BUFFER_DECL(VALUE_TYPE, local, count <= 4096 ? count : 1);
-    VALUE_TYPE *tmp = (count <= 4096) ? local : (VALUE_TYPE *)malloc(count * sizeof(VALUE_TYPE));
-    __CFSimpleMergeSort(indexBuffer, count, tmp, cmp); // naturally stable
+    CFIndex tmp_cnt = count / 2 + 1;
+    STACK_BUFFER_DECL(VALUE_TYPE, local, tmp_cnt <= 4096 ? tmp_cnt : 1);
+    VALUE_TYPE *tmp = (tmp_cnt <= 4096) ? local : (VALUE_TYPE *)malloc(tmp_cnt * sizeof(VALUE_TYPE));
+    __CFRunMergeSort(indexBuffer, count, tmp, cmp); // naturally stable
     if (local != tmp) free(tmp);
 }
 
-/* Comparator is passed the address of the values. */
-void CFQSortArray(void *list, CFIndex count, CFIndex elementSize, CFComparatorFunction comparator, void *context) {
-    if (count < 2 || elementSize < 1) return;
-    STACK_BUFFER_DECL(CFIndex, locali, count <= 4096 ? count : 1);
-    CFIndex *indexes = (count <= 4096) ? locali : (CFIndex *)malloc(count * sizeof(CFIndex));
-    CFSortIndexes(indexes, count, 0, ^(CFIndex a, CFIndex b) { return comparator((char *)list + a * elementSize, (char *)list + b * elementSize, context); });
-    STACK_BUFFER_DECL(uint8_t, locals, count <= (16 * 1024 / elementSize) ? count * elementSize : 1);
-    void *store = (count <= (16 * 1024 / elementSize)) ? locals : malloc(count * elementSize);
+typedef struct {
+    uint64_t _key;
+    CFIndex _index;
+} __CFSortKeyEntry;
+
+/* Least significant digit first radix sort, one byte per pass. The histograms for
+    all eight passes are counted at once, and a pass is skipped when every key has
+    the same byte there, so keys which fit in 32 bits take at most four passes.
+*/
+// fills an array of indexes (of length count) giving the indexes 0 - count-1, as sorted by keys[index]; equal keys keep index order
+void _CFSortIndexesUsingKeys(CFIndex *indexBuffer, const uint64_t *keys, CFIndex count) {
+    if (count < 1) return;
+    if (INTPTR_MAX / (2 * sizeof(__CFSortKeyEntry)) < count) HALT;
+    if (count < 64) {
+        for (CFIndex idx = 0; idx < count; idx++) {
+            CFIndex pos = idx;
+            while (0 < pos && keys[idx] < keys[indexBuffer[pos - 1]]) {
+                indexBuffer[pos] = indexBuffer[pos - 1];
+                pos--;
+            }
+            indexBuffer[pos] = idx;
+        }
+        return;
+    }
+    __CFSortKeyEntry *entries = (__CFSortKeyEntry *)malloc(2 * count * sizeof(__CFSortKeyEntry));
+    if (!entries) HALT;
+    __CFSortKeyEntry *src = entries, *dst = entries + count;
+    CFIndex counts[8][256];
+    memset(counts, 0, sizeof(counts));
     for (CFIndex idx = 0; idx < count; idx++) {
-        if (sizeof(uintptr_t) == elementSize) {
-            uintptr_t *a = (uintptr_t *)list + indexes[idx];
-            uintptr_t *b = (uintptr_t *)store + idx;
-            *b = *a;
-        } else {
-            memmove((char *)store + idx * elementSize, (char *)list + indexes[idx] * elementSize, elementSize);
+        uint64_t key = keys[idx];
+        src[idx]._key = key;
+        src[idx]._index = idx;
+        for (int32_t digit = 0; digit < 8; digit++) {
+            counts[digit][(key >> (8 * digit)) & 0xFF]++;
         }
     }
-    // no swapping or modification of the original list has occurred until this point
-    objc_memmove_collectable(list, store, count * elementSize);
-    if (locals != store) free(store);
-    if (locali != indexes) free(indexes);
+    for (int32_t digit = 0; digit < 8; digit++) {
+        int32_t shift = 8 * digit;
+        if (counts[digit][(src[0]._key >> shift) & 0xFF] == count) continue;
+        CFIndex offset = 0;
+        for (int32_t byte = 0; byte < 256; byte++) {
+            CFIndex cnt = counts[digit][byte];
+            counts[digit][byte] = offset;
+            offset += cnt;
+        }
+        for (CFIndex idx = 0; idx < count; idx++) {
+            dst[counts[digit][(src[idx]._key >> shift) & 0xFF]++] = src[idx];
+        }
+        __CFSortKeyEntry *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    for (CFIndex idx = 0; idx < count; idx++) indexBuffer[idx] = src[idx]._index;
+    free(entries);
 }
 
-/* Comparator is passed the address of the values. */
-void CFMergeSortArray(void *list, CFIndex count, CFIndex elementSize, CFComparatorFunction comparator, void *context) {
+// sorts by way of an index array, so the list is not modified until the order is known
+static void __CFSortArray(void *list, CFIndex count, CFIndex elementSize, CFOptionFlags opts, CFComparatorFunction comparator, void *context) {
     if (count < 2 || elementSize < 1) return;
     STACK_BUFFER_DECL(CFIndex, locali, count <= 4096 ? count : 1);
     CFIndex *indexes = (count <= 4096) ? locali : (CFIndex *)malloc(count * sizeof(CFIndex));
-    CFSortIndexes(indexes, count, kCFSortStable, ^(CFIndex a, CFIndex b) { return comparator((char *)list + a * elementSize, (char *)list + b * elementSize, context); });
+    CFSortIndexes(indexes, count, opts, ^(CFIndex a, CFIndex b) { return comparator((char *)list + a * elementSize, (char *)list + b * elementSize, context); });
     STACK_BUFFER_DECL(uint8_t, locals, count <= (16 * 1024 / elementSize) ? count * elementSize : 1);
     void *store = (count <= (16 * 1024 / elementSize)) ? locals : malloc(count * elementSize);
     for (CFIndex idx = 0; idx < count; idx++) {
@@ -343,4 +573,17 @@ void CFMergeSortArray(void *list, CFIndex count, CFIndex elementSize, CFComparat
     if (locali != indexes) free(indexes);
 }
 
+/* Comparator is passed the address of the values.
+    These two always sort serially, whatever the count. Callers such as
+    CFArraySortValues() pass comparators and contexts that have only ever been called
+    from one thread at a time, and nothing says they are safe otherwise; a caller whose
+    comparator is can sort concurrently with CFSortIndexes() and kCFSortConcurrent.
+*/
+void CFQSortArray(void *list, CFIndex count, CFIndex elementSize, CFComparatorFunction comparator, void *context) {
+    __CFSortArray(list, count, elementSize, 0, comparator, context);
+}
 
+/* Comparator is passed the address of the values. */
+void CFMergeSortArray(void *list, CFIndex count, CFIndex elementSize, CFComparatorFunction comparator, void *context) {
+    __CFSortArray(list, count, elementSize, kCFSortStable, comparator, context);
+}
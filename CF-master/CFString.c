@@ -32,6 +32,7 @@
 #include <CoreFoundation/CFString.h>
 #include <CoreFoundation/CFDictionary.h>
 #include <CoreFoundation/CFStringEncodingConverterExt.h>
+#include "CFStringEncodingConverterPriv.h"
 #include <CoreFoundation/CFUniChar.h>
 #include <CoreFoundation/CFUnicodeDecomposition.h>
 #include <CoreFoundation/CFUnicodePrecomposition.h>
@@ -539,54 +540,18 @@ CFStringEncoding __CFStringComputeEightBitStringEncoding(void) {
 /* Returns whether the provided bytes can be stored in ASCII
 */
 CF_INLINE Boolean __CFBytesInASCII(const uint8_t *bytes, CFIndex len) {
-#if __LP64__
-    /* A bit of unrolling; go by 32s, 16s, and 8s first */
-    while (len >= 32) {
-        uint64_t val = *(const uint64_t *)bytes;
-        uint64_t hiBits = (val & 0x8080808080808080ULL);    // More efficient to collect this rather than do a conditional at every step
-        bytes += 8;
-        val = *(const uint64_t *)bytes;
-        hiBits |= (val & 0x8080808080808080ULL);
-        bytes += 8;
-        val = *(const uint64_t *)bytes;
-        hiBits |= (val & 0x8080808080808080ULL);
-        bytes += 8;
-        val = *(const uint64_t *)bytes;
-        if (hiBits | (val & 0x8080808080808080ULL)) return false;
-        bytes += 8;
-        len -= 32;
-    }
-
-    while (len >= 16) {
-        uint64_t val = *(const uint64_t *)bytes;
-        uint64_t hiBits = (val & 0x8080808080808080ULL);
-        bytes += 8;
-        val = *(const uint64_t *)bytes;
-        if (hiBits | (val & 0x8080808080808080ULL)) return false;
-        bytes += 8;
-        len -= 16;
-    }
-
-    while (len >= 8) {
-        uint64_t val = *(const uint64_t *)bytes;
-        if (val & 0x8080808080808080ULL) return false;
-        bytes += 8;
-        len -= 8;
-    }
-#endif
-    /* Go by 4s */
-    while (len >= 4) {
-        uint32_t val = *(const uint32_t *)bytes;
-        if (val & 0x80808080U) return false;
-        bytes += 4;
-        len -= 4;
-    }
-    /* Handle the rest one byte at a time */
-    while (len--) {
-        if (*bytes++ & 0x80) return false;
+    /* Most strings checked here are short; checking those a word at a time here is quicker than calling out to the vector code */
+    if (len < 32) {
+        uint64_t hiBits = 0;
+        for (; len >= 8; len -= 8, bytes += 8) {
+            uint64_t val;
+            memcpy(&val, bytes, sizeof(val));
+            hiBits |= val;
+        }
+        while (len--) hiBits |= *bytes++;
+        return (hiBits & 0x8080808080808080ULL) ? false : true;
     }
-
-    return true;
+    return __CFStringEncodingASCIIPrefixLength(bytes, len) == len;
 }
 
 /* Returns whether the provided 8-bit string in the specified encoding can be stored in an 8-bit CFString. 
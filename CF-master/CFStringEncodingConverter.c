@@ -62,6 +62,223 @@ typedef struct {
 
 static const uint8_t __CFMaximumConvertedLength = 20;
 
+/* ASCII runs
+
+Most text is mostly ASCII, so the UTF-8 converter and the byte stream decoder
+hand runs of ASCII to these instead of going a character at a time. Each
+returns the length of the run at the start of its input. The SSE2 and NEON
+versions are always available where they are built; on x86_64 an AVX2
+version is chosen, once, the first time one is called, if the processor has
+it. Setting CFStringDisableASCIIRuns in the environment makes them all go a
+byte at a time, to compare against.
+*/
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <emmintrin.h>
+#if defined(__x86_64__) && (defined(__clang__) || (__GNUC__ >= 5))
+#include <immintrin.h>
+#define __CF_ASCII_RUNS_AVX2 1
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static CFIndex __CFASCIIPrefixLengthScalar(const uint8_t *bytes, CFIndex numBytes, CFIndex idx) {
+    while (idx < numBytes && !(bytes[idx] & 0x80)) idx++;
+    return idx;
+}
+
+static CFIndex __CFWidenASCIIPrefixScalar(const uint8_t *bytes, CFIndex numBytes, UniChar *characters, CFIndex idx) {
+    while (idx < numBytes && !(bytes[idx] & 0x80)) {
+        characters[idx] = bytes[idx];
+        idx++;
+    }
+    return idx;
+}
+
+static CFIndex __CFNarrowASCIIPrefixScalar(const UniChar *characters, CFIndex numChars, uint8_t *bytes, CFIndex idx) {
+    while (idx < numChars && characters[idx] < 0x80) {
+        if (bytes) bytes[idx] = (uint8_t)characters[idx];
+        idx++;
+    }
+    return idx;
+}
+
+static CFIndex __CFASCIIPrefixLengthBytewise(const uint8_t *bytes, CFIndex numBytes) {
+    return __CFASCIIPrefixLengthScalar(bytes, numBytes, 0);
+}
+
+static CFIndex __CFASCIIPrefixLengthGeneric(const uint8_t *bytes, CFIndex numBytes) {
+    CFIndex idx = 0;
+    for (; idx + 8 <= numBytes; idx += 8) {
+        uint64_t val;
+        memcpy(&val, bytes + idx, sizeof(val));
+        if (val & 0x8080808080808080ULL) break;
+    }
+    return __CFASCIIPrefixLengthScalar(bytes, numBytes, idx);
+}
+
+static CFIndex __CFWidenASCIIPrefixGeneric(const uint8_t *bytes, CFIndex numBytes, UniChar *characters) {
+    return __CFWidenASCIIPrefixScalar(bytes, numBytes, characters, 0);
+}
+
+static CFIndex __CFNarrowASCIIPrefixGeneric(const UniChar *characters, CFIndex numChars, uint8_t *bytes) {
+    return __CFNarrowASCIIPrefixScalar(characters, numChars, bytes, 0);
+}
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+
+static CFIndex __CFASCIIPrefixLengthSSE2(const uint8_t *bytes, CFIndex numBytes) {
+    CFIndex idx = 0;
+    for (; idx + 16 <= numBytes; idx += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(bytes + idx)));
+        if (mask) return idx + __builtin_ctz(mask);
+    }
+    return __CFASCIIPrefixLengthScalar(bytes, numBytes, idx);
+}
+
+static CFIndex __CFWidenASCIIPrefixSSE2(const uint8_t *bytes, CFIndex numBytes, UniChar *characters) {
+    const __m128i zero = _mm_setzero_si128();
+    CFIndex idx = 0;
+    for (; idx + 16 <= numBytes; idx += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(bytes + idx));
+        if (_mm_movemask_epi8(v)) break;
+        _mm_storeu_si128((__m128i *)(characters + idx), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i *)(characters + idx + 8), _mm_unpackhi_epi8(v, zero));
+    }
+    return __CFWidenASCIIPrefixScalar(bytes, numBytes, characters, idx);
+}
+
+static CFIndex __CFNarrowASCIIPrefixSSE2(const UniChar *characters, CFIndex numChars, uint8_t *bytes) {
+    const __m128i high = _mm_set1_epi16((short)0xFF80);
+    const __m128i zero = _mm_setzero_si128();
+    CFIndex idx = 0;
+    for (; idx + 16 <= numChars; idx += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(characters + idx));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(characters + idx + 8));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(lo, hi), high), zero)) != 0xFFFF) break;
+        if (bytes) _mm_storeu_si128((__m128i *)(bytes + idx), _mm_packus_epi16(lo, hi));
+    }
+    return __CFNarrowASCIIPrefixScalar(characters, numChars, bytes, idx);
+}
+
+#if __CF_ASCII_RUNS_AVX2
+
+__attribute__((target("avx2"))) static CFIndex __CFASCIIPrefixLengthAVX2(const uint8_t *bytes, CFIndex numBytes) {
+    CFIndex idx = 0;
+    for (; idx + 32 <= numBytes; idx += 32) {
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(bytes + idx)));
+        if (mask) return idx + __builtin_ctz(mask);
+    }
+    return __CFASCIIPrefixLengthScalar(bytes, numBytes, idx);
+}
+
+__attribute__((target("avx2"))) static CFIndex __CFWidenASCIIPrefixAVX2(const uint8_t *bytes, CFIndex numBytes, UniChar *characters) {
+    CFIndex idx = 0;
+    for (; idx + 32 <= numBytes; idx += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(bytes + idx));
+        if (_mm256_movemask_epi8(v)) break;
+        _mm256_storeu_si256((__m256i *)(characters + idx), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+        _mm256_storeu_si256((__m256i *)(characters + idx + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+    }
+    return __CFWidenASCIIPrefixScalar(bytes, numBytes, characters, idx);
+}
+
+__attribute__((target("avx2"))) static CFIndex __CFNarrowASCIIPrefixAVX2(const UniChar *characters, CFIndex numChars, uint8_t *bytes) {
+    const __m256i high = _mm256_set1_epi16((short)0xFF80);
+    CFIndex idx = 0;
+    for (; idx + 32 <= numChars; idx += 32) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(characters + idx));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(characters + idx + 16));
+        if (!_mm256_testz_si256(_mm256_or_si256(lo, hi), high)) break;
+        // packus works within 128 bit lanes, so the quarters come out as lo0 hi0 lo1 hi1
+        if (bytes) _mm256_storeu_si256((__m256i *)(bytes + idx), _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8));
+    }
+    return __CFNarrowASCIIPrefixScalar(characters, numChars, bytes, idx);
+}
+
+#endif
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+static CFIndex __CFASCIIPrefixLengthNEON(const uint8_t *bytes, CFIndex numBytes) {
+    CFIndex idx = 0;
+    for (; idx + 16 <= numBytes; idx += 16) {
+        if (vmaxvq_u8(vld1q_u8(bytes + idx)) & 0x80) break;
+    }
+    return __CFASCIIPrefixLengthScalar(bytes, numBytes, idx);
+}
+
+static CFIndex __CFWidenASCIIPrefixNEON(const uint8_t *bytes, CFIndex numBytes, UniChar *characters) {
+    CFIndex idx = 0;
+    for (; idx + 16 <= numBytes; idx += 16) {
+        uint8x16_t v = vld1q_u8(bytes + idx);
+        if (vmaxvq_u8(v) & 0x80) break;
+        vst1q_u16(characters + idx, vmovl_u8(vget_low_u8(v)));
+        vst1q_u16(characters + idx + 8, vmovl_high_u8(v));
+    }
+    return __CFWidenASCIIPrefixScalar(bytes, numBytes, characters, idx);
+}
+
+static CFIndex __CFNarrowASCIIPrefixNEON(const UniChar *characters, CFIndex numChars, uint8_t *bytes) {
+    CFIndex idx = 0;
+    for (; idx + 16 <= numChars; idx += 16) {
+        uint16x8_t lo = vld1q_u16(characters + idx);
+        uint16x8_t hi = vld1q_u16(characters + idx + 8);
+        if (vmaxvq_u16(vorrq_u16(lo, hi)) >= 0x80) break;
+        if (bytes) vst1q_u8(bytes + idx, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+    }
+    return __CFNarrowASCIIPrefixScalar(characters, numChars, bytes, idx);
+}
+
+#endif
+
+// Chosen once, by __CFASCIIRunsResolve(), before any of them is called
+static CFIndex (*__CFASCIIPrefixLength)(const uint8_t *bytes, CFIndex numBytes) = __CFASCIIPrefixLengthGeneric;
+static CFIndex (*__CFWidenASCIIPrefix)(const uint8_t *bytes, CFIndex numBytes, UniChar *characters) = __CFWidenASCIIPrefixGeneric;
+static CFIndex (*__CFNarrowASCIIPrefix)(const UniChar *characters, CFIndex numChars, uint8_t *bytes) = __CFNarrowASCIIPrefixGeneric;
+
+static void __CFASCIIRunsResolve(void) {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        if (__CFgetenv("CFStringDisableASCIIRuns")) {
+            // the widen and narrow Generic versions already go a byte at a time
+            __CFASCIIPrefixLength = __CFASCIIPrefixLengthBytewise;
+            return;
+        }
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+        __CFASCIIPrefixLength = __CFASCIIPrefixLengthSSE2;
+        __CFWidenASCIIPrefix = __CFWidenASCIIPrefixSSE2;
+        __CFNarrowASCIIPrefix = __CFNarrowASCIIPrefixSSE2;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        __CFASCIIPrefixLength = __CFASCIIPrefixLengthNEON;
+        __CFWidenASCIIPrefix = __CFWidenASCIIPrefixNEON;
+        __CFNarrowASCIIPrefix = __CFNarrowASCIIPrefixNEON;
+#endif
+#if __CF_ASCII_RUNS_AVX2
+        if (__builtin_cpu_supports("avx2")) {
+            __CFASCIIPrefixLength = __CFASCIIPrefixLengthAVX2;
+            __CFWidenASCIIPrefix = __CFWidenASCIIPrefixAVX2;
+            __CFNarrowASCIIPrefix = __CFNarrowASCIIPrefixAVX2;
+        }
+#endif
+    });
+}
+
+CF_PRIVATE CFIndex __CFStringEncodingASCIIPrefixLength(const uint8_t *bytes, CFIndex numBytes) {
+    __CFASCIIRunsResolve();
+    return __CFASCIIPrefixLength(bytes, numBytes);
+}
+
+CF_PRIVATE CFIndex __CFStringEncodingWidenASCIIPrefix(const uint8_t *bytes, CFIndex numBytes, UniChar *characters) {
+    __CFASCIIRunsResolve();
+    return __CFWidenASCIIPrefix(bytes, numBytes, characters);
+}
+
+CF_PRIVATE CFIndex __CFStringEncodingNarrowASCIIPrefix(const UniChar *characters, CFIndex numChars, uint8_t *bytes) {
+    __CFASCIIRunsResolve();
+    return __CFNarrowASCIIPrefix(characters, numChars, bytes);
+}
+
 /* Mapping 128..255 to lossy ASCII
 */
 static const struct {
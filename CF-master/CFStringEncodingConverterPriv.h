@@ -45,5 +45,11 @@ extern  CFIndex __CFStringEncodingPlatformBytesToUnicode(uint32_t encoding, uint
 extern  CFIndex __CFStringEncodingPlatformCharLengthForBytes(uint32_t encoding, uint32_t flags, const uint8_t *bytes, CFIndex numBytes);
 extern  CFIndex __CFStringEncodingPlatformByteLengthForCharacters(uint32_t encoding, uint32_t flags, const UniChar *characters, CFIndex numChars);
 
+/* Return the length of the run of ASCII at the start of their input. Widen copies the run to characters; Narrow copies it to bytes unless bytes is NULL.
+*/
+CF_PRIVATE CFIndex __CFStringEncodingASCIIPrefixLength(const uint8_t *bytes, CFIndex numBytes);
+CF_PRIVATE CFIndex __CFStringEncodingWidenASCIIPrefix(const uint8_t *bytes, CFIndex numBytes, UniChar *characters);
+CF_PRIVATE CFIndex __CFStringEncodingNarrowASCIIPrefix(const UniChar *characters, CFIndex numChars, uint8_t *bytes);
+
 #endif /* ! __COREFOUNDATION_CFSTRINGENCODINGCONVERTERPRIV__ */
 
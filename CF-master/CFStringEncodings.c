@@ -32,6 +32,7 @@
 #include <CoreFoundation/CFPriv.h>
 #include <string.h>
 #include <CoreFoundation/CFStringEncodingConverterExt.h>
+#include "CFStringEncodingConverterPriv.h"
 #include <CoreFoundation/CFUniChar.h>
 #include <CoreFoundation/CFUnicodeDecomposition.h>
 #if (TARGET_OS_MAC && !(TARGET_OS_EMBEDDED || TARGET_OS_IPHONE)) || (TARGET_OS_EMBEDDED || TARGET_OS_IPHONE)
@@ -171,14 +172,17 @@ Boolean __CFStringDecodeByteStream3(const uint8_t *bytes, CFIndex len, CFStringE
             buffer->isASCII = false;
         } else {
             if (buffer->isASCII) {	// Let's see if we can reduce the Unicode down to ASCII...
-                const UTF16Char *characters = src;
-                UTF16Char mask = (swap ? 0x80FF : 0xFF80);
+                if (swap) {
+                    const UTF16Char *characters = src;
     
-                while (characters < limit) {
-                    if (*(characters++) & mask) {
-                        buffer->isASCII = false;
-                        break;
+                    while (characters < limit) {
+                        if (*(characters++) & 0x80FF) {
+                            buffer->isASCII = false;
+                            break;
+                        }
                     }
+                } else if (__CFStringEncodingNarrowASCIIPrefix(src, limit - src, NULL) < limit - src) {
+                    buffer->isASCII = false;
                 }
             }
     
@@ -198,7 +202,7 @@ Boolean __CFStringDecodeByteStream3(const uint8_t *bytes, CFIndex len, CFStringE
                 if (swap) {
                     while (src < limit) *(dst++) = (*(src++) >> 8);
                 } else {
-                    while (src < limit) *(dst++) = (uint8_t)*(src++);
+                    __CFStringEncodingNarrowASCIIPrefix(src, limit - src, dst);
                 }
             } else {
                 UTF16Char *dst;
@@ -301,14 +305,7 @@ Boolean __CFStringDecodeByteStream3(const uint8_t *bytes, CFIndex len, CFStringE
             len -= 3;
             if (0 == len) return true;
         }
-        if (buffer->isASCII) {
-            for (idx = 0; idx < len; idx++) {
-                if (128 <= chars[idx]) {
-                    buffer->isASCII = false;
-                    break;
-                }
-            }
-        }
+        if (buffer->isASCII && (__CFStringEncodingASCIIPrefixLength(chars, len) < len)) buffer->isASCII = false;
         if (buffer->isASCII) {
             buffer->numChars = len;
             buffer->shouldFreeChars = !buffer->chars.ascii && (len <= MAX_LOCAL_CHARS) ? false : true;
@@ -420,14 +417,7 @@ Boolean __CFStringDecodeByteStream3(const uint8_t *bytes, CFIndex len, CFStringE
         
         if (!isASCIISuperset) buffer->isASCII = false;
         
-        if (buffer->isASCII) {
-            for (idx = 0; idx < len; idx++) {
-                if (128 <= chars[idx]) {
-                    buffer->isASCII = false;
-                    break;
-                }
-            }
-        }
+        if (buffer->isASCII && (__CFStringEncodingASCIIPrefixLength(chars, len) < len)) buffer->isASCII = false;
         
         if (converter->encodingClass == kCFStringEncodingConverterCheapEightBit) {
             if (buffer->isASCII) {
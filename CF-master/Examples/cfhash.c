@@ -0,0 +1,260 @@
+// Mac OS X: clang -F<path-to-CFLite-framework> -framework CoreFoundation Examples/cfhash.c -o cfhash
+//  note: When running this sample, be sure to set the environment variable DYLD_FRAMEWORK_PATH to point to the directory containing your new version of CoreFoundation.
+//   e.g.
+//  DYLD_FRAMEWORK_PATH=/tmp/CF-Root ./cfhash
+//
+// Linux: clang -I/usr/local/include -L/usr/local/lib -lCoreFoundation cfhash.c -o cfhash
+
+/*
+ This example runs CFDictionary, CFSet and CFBag over both of CFBasicHash's bucket layouts. It takes no arguments.
+ It runs once with linear probing, then runs itself again with CFBasicHashGroupProbing set in the environment, which makes the collections use group probing for keys with an equality callback.
+ Each run adds, removes and looks up random keys in each kind of collection, with keys compared by a custom callback and by the CFType callbacks, and checks every key against a reference after each round, in copies, and after removing everything.
+ It then fills a dictionary, a set and a bag with custom callbacks, looks up keys that are not there, and prints how many times the equality callback ran per lookup; with group probing that must be well under one. It also prints the time of lookups that hit and that miss in a dictionary of strings.
+ It exits with status 1 if anything is wrong in either run.
+*/
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#define KEY_SPACE 20000
+#define ROUNDS 4
+#define OPS_PER_ROUND 50000
+#define LOOKUP_COUNT 100000
+
+extern char **environ;
+
+static const char *layoutName;
+static Boolean failed = false;
+
+static void check(Boolean ok, const char *what, const char *kind, CFIndex key) {
+    if (ok) return;
+    printf("%s: %s is wrong in a %s, key %ld\n", layoutName, what, kind, (long)key);
+    failed = true;
+}
+
+// Custom callbacks, which count calls of the equality callback
+static CFIndex equalCalls = 0;
+
+static const void *retainKey(CFAllocatorRef allocator, const void *value) { return CFRetain(value); }
+static void releaseKey(CFAllocatorRef allocator, const void *value) { CFRelease(value); }
+static Boolean countingEqual(const void *value1, const void *value2) {
+    equalCalls++;
+    return CFEqual(value1, value2);
+}
+
+static const CFDictionaryKeyCallBacks countingDictionaryKeyCallBacks = {0, retainKey, releaseKey, CFCopyDescription, countingEqual, CFHash};
+static const CFSetCallBacks countingSetCallBacks = {0, retainKey, releaseKey, CFCopyDescription, countingEqual, CFHash};
+static const CFBagCallBacks countingBagCallBacks = {0, retainKey, releaseKey, CFCopyDescription, countingEqual, CFHash};
+
+// The three kinds of collection behind one interface; for a set or bag the value is the key
+typedef struct {
+    const char *name;
+    Boolean counted;    // a bag, which counts each key
+    CFTypeRef (*create)(Boolean counting);
+    void (*add)(CFTypeRef collection, const void *key, const void *value);
+    void (*remove)(CFTypeRef collection, const void *key);
+    void (*removeAll)(CFTypeRef collection);
+    CFIndex (*getCount)(CFTypeRef collection);
+    CFIndex (*getCountOfKey)(CFTypeRef collection, const void *key);
+    const void *(*getValue)(CFTypeRef collection, const void *key);
+    CFTypeRef (*createCopy)(CFTypeRef collection);
+    CFTypeRef (*createMutableCopy)(CFTypeRef collection);
+} Kind;
+
+static CFTypeRef dictionaryCreate(Boolean counting) { return CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, counting ? &countingDictionaryKeyCallBacks : &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks); }
+static void dictionaryAdd(CFTypeRef c, const void *key, const void *value) { CFDictionaryAddValue((CFMutableDictionaryRef)c, key, value); }
+static void dictionaryRemove(CFTypeRef c, const void *key) { CFDictionaryRemoveValue((CFMutableDictionaryRef)c, key); }
+static void dictionaryRemoveAll(CFTypeRef c) { CFDictionaryRemoveAllValues((CFMutableDictionaryRef)c); }
+static CFIndex dictionaryGetCount(CFTypeRef c) { return CFDictionaryGetCount((CFDictionaryRef)c); }
+static CFIndex dictionaryGetCountOfKey(CFTypeRef c, const void *key) { return CFDictionaryGetCountOfKey((CFDictionaryRef)c, key); }
+static const void *dictionaryGetValue(CFTypeRef c, const void *key) { return CFDictionaryGetValue((CFDictionaryRef)c, key); }
+static CFTypeRef dictionaryCreateCopy(CFTypeRef c) { return CFDictionaryCreateCopy(kCFAllocatorSystemDefault, (CFDictionaryRef)c); }
+static CFTypeRef dictionaryCreateMutableCopy(CFTypeRef c) { return CFDictionaryCreateMutableCopy(kCFAllocatorSystemDefault, 0, (CFDictionaryRef)c); }
+
+static CFTypeRef setCreate(Boolean counting) { return CFSetCreateMutable(kCFAllocatorSystemDefault, 0, counting ? &countingSetCallBacks : &kCFTypeSetCallBacks); }
+static void setAdd(CFTypeRef c, const void *key, const void *value) { CFSetAddValue((CFMutableSetRef)c, key); }
+static void setRemove(CFTypeRef c, const void *key) { CFSetRemoveValue((CFMutableSetRef)c, key); }
+static void setRemoveAll(CFTypeRef c) { CFSetRemoveAllValues((CFMutableSetRef)c); }
+static CFIndex setGetCount(CFTypeRef c) { return CFSetGetCount((CFSetRef)c); }
+static CFIndex setGetCountOfKey(CFTypeRef c, const void *key) { return CFSetGetCountOfValue((CFSetRef)c, key); }
+static const void *setGetValue(CFTypeRef c, const void *key) { return CFSetGetValue((CFSetRef)c, key); }
+static CFTypeRef setCreateCopy(CFTypeRef c) { return CFSetCreateCopy(kCFAllocatorSystemDefault, (CFSetRef)c); }
+static CFTypeRef setCreateMutableCopy(CFTypeRef c) { return CFSetCreateMutableCopy(kCFAllocatorSystemDefault, 0, (CFSetRef)c); }
+
+static CFTypeRef bagCreate(Boolean counting) { return CFBagCreateMutable(kCFAllocatorSystemDefault, 0, counting ? &countingBagCallBacks : &kCFTypeBagCallBacks); }
+static void bagAdd(CFTypeRef c, const void *key, const void *value) { CFBagAddValue((CFMutableBagRef)c, key); }
+static void bagRemove(CFTypeRef c, const void *key) { CFBagRemoveValue((CFMutableBagRef)c, key); }
+static void bagRemoveAll(CFTypeRef c) { CFBagRemoveAllValues((CFMutableBagRef)c); }
+static CFIndex bagGetCount(CFTypeRef c) { return CFBagGetCount((CFBagRef)c); }
+static CFIndex bagGetCountOfKey(CFTypeRef c, const void *key) { return CFBagGetCountOfValue((CFBagRef)c, key); }
+static const void *bagGetValue(CFTypeRef c, const void *key) { return CFBagGetValue((CFBagRef)c, key); }
+static CFTypeRef bagCreateCopy(CFTypeRef c) { return CFBagCreateCopy(kCFAllocatorSystemDefault, (CFBagRef)c); }
+static CFTypeRef bagCreateMutableCopy(CFTypeRef c) { return CFBagCreateMutableCopy(kCFAllocatorSystemDefault, 0, (CFBagRef)c); }
+
+static const Kind kinds[] = {
+    {"CFDictionary", false, dictionaryCreate, dictionaryAdd, dictionaryRemove, dictionaryRemoveAll, dictionaryGetCount, dictionaryGetCountOfKey, dictionaryGetValue, dictionaryCreateCopy, dictionaryCreateMutableCopy},
+    {"CFSet", false, setCreate, setAdd, setRemove, setRemoveAll, setGetCount, setGetCountOfKey, setGetValue, setCreateCopy, setCreateMutableCopy},
+    {"CFBag", true, bagCreate, bagAdd, bagRemove, bagRemoveAll, bagGetCount, bagGetCountOfKey, bagGetValue, bagCreateCopy, bagCreateMutableCopy},
+};
+#define KIND_COUNT (sizeof(kinds) / sizeof(kinds[0]))
+
+// A dictionary's value for keys[idx] is keys[idx + 1]; a set or bag gives back keys[idx] itself
+static const void *expectedValue(const Kind *kind, CFTypeRef *keys, CFIndex idx) {
+    return (kind->getValue == dictionaryGetValue) ? keys[(idx + 1) % KEY_SPACE] : keys[idx];
+}
+
+static void checkAll(const Kind *kind, CFTypeRef collection, CFTypeRef *keys, const CFIndex *reference, const char *what) {
+    CFIndex total = 0;
+    for (CFIndex idx = 0; idx < KEY_SPACE; idx++) {
+        CFIndex count = kind->getCountOfKey(collection, keys[idx]);
+        check(count == reference[idx], what, kind->name, idx);
+        const void *value = kind->getValue(collection, keys[idx]);
+        check(value == (reference[idx] ? expectedValue(kind, keys, idx) : NULL), what, kind->name, idx);
+        total += kind->counted ? reference[idx] : (reference[idx] ? 1 : 0);
+    }
+    check(kind->getCount(collection) == total, what, kind->name, -1);
+}
+
+static void exercise(const Kind *kind, CFTypeRef *keys, Boolean counting) {
+    CFTypeRef collection = kind->create(counting);
+    CFIndex *reference = (CFIndex *)calloc(KEY_SPACE, sizeof(CFIndex));
+    srandom(17);
+    for (int round = 0; round < ROUNDS; round++) {
+        // adds outnumber removes in the early rounds and removes the late ones, to grow and shrink the table
+        int removePercent = (round < ROUNDS / 2) ? 25 : 60;
+        for (int op = 0; op < OPS_PER_ROUND; op++) {
+            CFIndex idx = random() % KEY_SPACE;
+            if (random() % 100 < removePercent) {
+                kind->remove(collection, keys[idx]);
+                if (reference[idx]) reference[idx]--;
+            } else {
+                kind->add(collection, keys[idx], expectedValue(kind, keys, idx));
+                if (kind->counted || !reference[idx]) reference[idx]++;
+            }
+        }
+        checkAll(kind, collection, keys, reference, "lookup after adds and removes");
+    }
+
+    CFTypeRef copy = kind->createCopy(collection);
+    checkAll(kind, copy, keys, reference, "lookup in a copy");
+    check(CFEqual(copy, collection), "equality of a copy", kind->name, -1);
+    CFRelease(copy);
+    copy = kind->createMutableCopy(collection);
+    checkAll(kind, copy, keys, reference, "lookup in a mutable copy");
+    CFRelease(copy);
+
+    kind->removeAll(collection);
+    memset(reference, 0, KEY_SPACE * sizeof(CFIndex));
+    checkAll(kind, collection, keys, reference, "lookup after removing everything");
+    for (CFIndex idx = 0; idx < KEY_SPACE; idx += 2) {
+        kind->add(collection, keys[idx], expectedValue(kind, keys, idx));
+        reference[idx] = 1;
+    }
+    checkAll(kind, collection, keys, reference, "lookup after adding again");
+
+    free(reference);
+    CFRelease(collection);
+}
+
+// Returns the number of equality callbacks per lookup of a key that is not there
+static double equalCallsPerMiss(const Kind *kind) {
+    CFTypeRef collection = kind->create(true);
+    for (int idx = 0; idx < LOOKUP_COUNT; idx++) {
+        int value = idx * 2;
+        CFNumberRef key = CFNumberCreate(kCFAllocatorSystemDefault, kCFNumberIntType, &value);
+        kind->add(collection, key, key);
+        CFRelease(key);
+    }
+    CFIndex missing = 0;
+    equalCalls = 0;
+    for (int idx = 0; idx < LOOKUP_COUNT; idx++) {
+        int value = idx * 2 + 1;
+        CFNumberRef key = CFNumberCreate(kCFAllocatorSystemDefault, kCFNumberIntType, &value);
+        if (!kind->getCountOfKey(collection, key)) missing++;
+        CFRelease(key);
+    }
+    double result = (double)equalCalls / LOOKUP_COUNT;
+    check(missing == LOOKUP_COUNT, "lookup of a missing key", kind->name, -1);
+    CFRelease(collection);
+    return result;
+}
+
+static void timeLookups(void) {
+    CFStringRef *present = (CFStringRef *)malloc(LOOKUP_COUNT * sizeof(CFStringRef));
+    CFStringRef *absent = (CFStringRef *)malloc(LOOKUP_COUNT * sizeof(CFStringRef));
+    CFMutableDictionaryRef dict = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    for (CFIndex idx = 0; idx < LOOKUP_COUNT; idx++) {
+        present[idx] = CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("present key %ld"), (long)idx);
+        absent[idx] = CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("absent key %ld"), (long)idx);
+        CFDictionaryAddValue(dict, present[idx], present[idx]);
+    }
+    // look up copies, so that the keys are not found by identity
+    CFStringRef *lookups = (CFStringRef *)malloc(LOOKUP_COUNT * sizeof(CFStringRef));
+    for (CFIndex idx = 0; idx < LOOKUP_COUNT; idx++) lookups[idx] = CFStringCreateCopy(kCFAllocatorSystemDefault, present[(idx * 7919) % LOOKUP_COUNT]);
+
+    CFIndex found = 0;
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (CFIndex idx = 0; idx < LOOKUP_COUNT; idx++) if (CFDictionaryGetValue(dict, lookups[idx])) found++;
+    CFAbsoluteTime hits = CFAbsoluteTimeGetCurrent() - start;
+    start = CFAbsoluteTimeGetCurrent();
+    for (CFIndex idx = 0; idx < LOOKUP_COUNT; idx++) if (CFDictionaryGetValue(dict, absent[idx])) found++;
+    CFAbsoluteTime misses = CFAbsoluteTimeGetCurrent() - start;
+    check(found == LOOKUP_COUNT, "lookup of strings", "CFDictionary", -1);
+    printf("%s: %d strings, %.1f ns per hit, %.1f ns per miss\n", layoutName, LOOKUP_COUNT, hits * 1.0e9 / LOOKUP_COUNT, misses * 1.0e9 / LOOKUP_COUNT);
+
+    for (CFIndex idx = 0; idx < LOOKUP_COUNT; idx++) {
+        CFRelease(present[idx]);
+        CFRelease(absent[idx]);
+        CFRelease(lookups[idx]);
+    }
+    free(present);
+    free(absent);
+    free(lookups);
+    CFRelease(dict);
+}
+
+int main(int argc, char **argv) {
+    Boolean groupProbing = (getenv("CFBasicHashGroupProbing") != NULL);
+    layoutName = groupProbing ? "group probing" : "linear probing";
+
+    CFTypeRef numberKeys[KEY_SPACE], stringKeys[KEY_SPACE];
+    for (int idx = 0; idx < KEY_SPACE; idx++) {
+        int value = idx * 3;
+        numberKeys[idx] = CFNumberCreate(kCFAllocatorSystemDefault, kCFNumberIntType, &value);
+        stringKeys[idx] = CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("key %d"), idx);
+    }
+    for (int k = 0; k < (int)KIND_COUNT; k++) {
+        exercise(&kinds[k], numberKeys, true);
+        exercise(&kinds[k], stringKeys, false);
+        double calls = equalCallsPerMiss(&kinds[k]);
+        printf("%s: %s of %d numbers, %.2f equality callbacks per missing key\n", layoutName, kinds[k].name, LOOKUP_COUNT, calls);
+        // a tag matches by chance 1 time in 128
+        if (groupProbing && 0.25 < calls) {
+            printf("%s: %s does not seem to use group probing\n", layoutName, kinds[k].name);
+            failed = true;
+        }
+    }
+    timeLookups();
+    for (int idx = 0; idx < KEY_SPACE; idx++) {
+        CFRelease(numberKeys[idx]);
+        CFRelease(stringKeys[idx]);
+    }
+
+    if (!groupProbing) {
+        // run again with group probing
+        setenv("CFBasicHashGroupProbing", "YES", 1);
+        pid_t pid;
+        int status = 0;
+        if (posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) != 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("the run with group probing failed\n");
+            failed = true;
+        }
+    }
+    return failed ? 1 : 0;
+}
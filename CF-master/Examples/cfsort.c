@@ -0,0 +1,121 @@
+// Mac OS X: clang -F<path-to-CFLite-framework> -framework CoreFoundation Examples/cfsort.c -o cfsort
+//  note: When running this sample, be sure to set the environment variable DYLD_FRAMEWORK_PATH to point to the directory containing your new version of CoreFoundation.
+//   e.g.
+//  DYLD_FRAMEWORK_PATH=/tmp/CF-Root ./cfsort [<count>]
+//
+// Linux: clang -fblocks -I/usr/local/include -L/usr/local/lib -lCoreFoundation -lBlocksRuntime cfsort.c -o cfsort
+
+/*
+ This example times the sorts in CFSortFunctions.c. It takes one optional argument:
+    1. The largest number of values to sort, 1000000 if not given.
+ Values in six orders (random, sorted, reversed, sorted with 1% swapped, sawtooth and 8 distinct values) are sorted by CFSortIndexes(), serially and with kCFSortConcurrent, and by _CFSortIndexesUsingKeys(), at 1000 values and at every tenfold size up to the largest. Every result is checked to be in order with equal values keeping index order. The best time of three in milliseconds is printed for each. It exits with status 1 if any result is wrong.
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreFoundation/CFPriv.h>
+
+// from CFSortFunctions.c
+enum {
+    kCFSortConcurrent = (1 << 0),
+    kCFSortStable = (1 << 4),
+};
+CF_EXPORT void CFSortIndexes(CFIndex *indexBuffer, CFIndex count, CFOptionFlags opts, CFComparisonResult (^cmp)(CFIndex, CFIndex));
+
+#define ROUNDS 3
+
+static const char *orderNames[] = {"random", "sorted", "reversed", "1% swapped", "sawtooth", "8 distinct"};
+#define ORDER_COUNT (sizeof(orderNames) / sizeof(orderNames[0]))
+
+static int compareValues(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+static void fillValues(uint64_t *values, CFIndex count, int order) {
+    srandom(count + order);
+    for (CFIndex idx = 0; idx < count; idx++) values[idx] = ((uint64_t)random() << 31) ^ random();
+    switch (order) {
+    case 1:
+        qsort(values, count, sizeof(uint64_t), compareValues);
+        break;
+    case 2:
+        qsort(values, count, sizeof(uint64_t), compareValues);
+        for (CFIndex idx = 0; idx < count / 2; idx++) {
+            uint64_t swap = values[idx];
+            values[idx] = values[count - 1 - idx];
+            values[count - 1 - idx] = swap;
+        }
+        break;
+    case 3:
+        qsort(values, count, sizeof(uint64_t), compareValues);
+        for (CFIndex idx = 0; idx < count / 100; idx++) {
+            CFIndex a = random() % count, b = random() % count;
+            uint64_t swap = values[a];
+            values[a] = values[b];
+            values[b] = swap;
+        }
+        break;
+    case 4:
+        for (CFIndex idx = 0; idx < count; idx++) values[idx] = (idx % 1000) * 7 + random() % 3;
+        break;
+    case 5:
+        for (CFIndex idx = 0; idx < count; idx++) values[idx] = random() % 8;
+        break;
+    }
+}
+
+static Boolean isStablySorted(const CFIndex *indexes, const uint64_t *values, CFIndex count) {
+    for (CFIndex idx = 1; idx < count; idx++) {
+        CFIndex a = indexes[idx - 1], b = indexes[idx];
+        if (values[b] < values[a] || (values[a] == values[b] && b < a)) return false;
+    }
+    return true;
+}
+
+// 0 for CFSortIndexes(), kCFSortConcurrent for CFSortIndexes() with it, -1 for _CFSortIndexesUsingKeys()
+static double timeSort(CFIndex *indexes, const uint64_t *values, CFIndex count, int kind, Boolean *ok) {
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        memset(indexes, 0, count * sizeof(CFIndex));
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        if (kind < 0) {
+            _CFSortIndexesUsingKeys(indexes, values, count);
+        } else {
+            CFSortIndexes(indexes, count, kind, ^(CFIndex a, CFIndex b) { return (CFComparisonResult)((values[a] < values[b]) ? kCFCompareLessThan : (values[a] > values[b]) ? kCFCompareGreaterThan : kCFCompareEqualTo); });
+        }
+        double elapsed = (CFAbsoluteTimeGetCurrent() - start) * 1000.0;
+        if (round == 0 || elapsed < best) best = elapsed;
+        if (!isStablySorted(indexes, values, count)) *ok = false;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    CFIndex largest = (argc > 1) ? atol(argv[1]) : 1000000;
+    if (largest < 1000) {
+        printf("Usage: cfsort [<count>], where count is at least 1000\n");
+        return 1;
+    }
+    uint64_t *values = (uint64_t *)malloc(largest * sizeof(uint64_t));
+    CFIndex *indexes = (CFIndex *)malloc(largest * sizeof(CFIndex));
+    Boolean allOK = true;
+    printf("%-12s %10s %12s %12s %12s\n", "order", "count", "serial ms", "concurrent", "keys ms");
+    for (CFIndex count = 1000; count <= largest; count *= 10) {
+        for (int order = 0; order < (int)ORDER_COUNT; order++) {
+            Boolean ok = true;
+            fillValues(values, count, order);
+            double serial = timeSort(indexes, values, count, 0, &ok);
+            double concurrent = timeSort(indexes, values, count, kCFSortConcurrent, &ok);
+            double keys = timeSort(indexes, values, count, -1, &ok);
+            printf("%-12s %10ld %12.3f %12.3f %12.3f%s\n", orderNames[order], (long)count, serial, concurrent, keys, ok ? "" : "  WRONG ORDER");
+            if (!ok) allOK = false;
+        }
+    }
+    free(indexes);
+    free(values);
+    return allOK ? 0 : 1;
+}
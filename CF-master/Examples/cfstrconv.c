@@ -0,0 +1,176 @@
+// Mac OS X: clang -F<path-to-CFLite-framework> -framework CoreFoundation Examples/cfstrconv.c -o cfstrconv
+//  note: When running this sample, be sure to set the environment variable DYLD_FRAMEWORK_PATH to point to the directory containing your new version of CoreFoundation.
+//   e.g.
+//  DYLD_FRAMEWORK_PATH=/tmp/CF-Root ./cfstrconv [<kilobytes>]
+//
+// Linux: clang -I/usr/local/include -L/usr/local/lib -lCoreFoundation cfstrconv.c -o cfstrconv
+
+/*
+ This example times conversions between CFStrings and UTF-8 and UTF-16 bytes. It takes one optional argument:
+    1. The size of each text in kilobytes of UTF-8, 4096 if not given.
+ The texts are Latin (English, French and German, mostly ASCII), CJK (Chinese and Japanese), emoji, and a mix of all three. Each is made into a CFString from UTF-8 and from UTF-16, and written back to UTF-8 and UTF-16 with CFStringGetBytes(), and the bytes written must be the bytes read. The best throughput of five rounds in MB/s is printed for each.
+ It runs once with the ASCII run kernels, then runs itself again with CFStringDisableASCIIRuns set in the environment, which makes the kernels go a byte at a time, as the converters did before them, and prints the ratio of the two. It exits with status 1 if any conversion is wrong in either run.
+ Only runs of ASCII are converted in bulk; validating and transcoding the other characters goes a character at a time either way, so the CJK and emoji texts are expected to gain little.
+*/
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#define ROUNDS 5
+
+extern char **environ;
+
+static const char *textNames[] = {"Latin", "CJK", "emoji", "mixed"};
+#define TEXT_COUNT (sizeof(textNames) / sizeof(textNames[0]))
+
+static const char *latinPhrases[] = {
+    "The quick brown fox jumps over the lazy dog, again and again, until the dog gives up and goes to sleep. ",
+    "Le cœur a ses raisons que la raison ne connaît point; on le sait à la fin de l'été. ",
+    "Zwölf Boxkämpfer jagen Viktor quer über den großen Sylter Deich, bis es dunkel wird. ",
+    "Meanwhile, in the café on the corner, a naïve résumé was being read aloud to nobody in particular. ",
+};
+static const char *cjkPhrases[] = {
+    "春眠不觉晓，处处闻啼鸟。夜来风雨声，花落知多少。",
+    "吾輩は猫である。名前はまだ無い。どこで生れたかとんと見当がつかぬ。",
+    "天地玄黄，宇宙洪荒。日月盈昃，辰宿列张。",
+    "いろはにほへと ちりぬるを わかよたれそ つねならむ",
+};
+static const char *emojiPhrases[] = {
+    "😀😃😄😁😆😅🤣😂🙂🙃😉😊😇",
+    "🐶🐱🐭🐹🐰🦊🐻🐼🐨🐯🦁🐮",
+    "🍏🍎🍐🍊🍋🍌🍉🍇🍓🫐🍈🍒",
+    "👍🏽👋🏻🧑‍💻👩‍👩‍👧‍👦🏳️‍🌈",
+};
+
+// Repeats phrases from the text's lists, picked at random, until there are size bytes of UTF-8
+static char *createText(int text, size_t size, size_t *length) {
+    const char **lists[3] = {latinPhrases, cjkPhrases, emojiPhrases};
+    char *bytes = (char *)malloc(size + 256);
+    size_t used = 0;
+    srandom(text + 1);
+    while (used < size) {
+        // the mix is mostly Latin, as mixed text usually is
+        int list = (text < 3) ? text : ((random() % 4 < 2) ? 0 : 1 + random() % 2);
+        const char *phrase = lists[list][random() % 4];
+        size_t phraseLength = strlen(phrase);
+        if (size + 256 < used + phraseLength) break;
+        memcpy(bytes + used, phrase, phraseLength);
+        used += phraseLength;
+    }
+    *length = used;
+    return bytes;
+}
+
+static CFStringEncoding encodings[] = {kCFStringEncodingUTF8, kCFStringEncodingUTF16};
+static const char *operationNames[] = {"UTF-8 in", "UTF-8 out", "UTF-16 in", "UTF-16 out"};
+#define OPERATION_COUNT 4
+
+// Returns the best MB/s of each operation on the text
+static Boolean timeText(const char *utf8, size_t utf8Length, double rates[OPERATION_COUNT]) {
+    Boolean ok = true;
+    CFStringRef string = CFStringCreateWithBytes(kCFAllocatorSystemDefault, (const UInt8 *)utf8, utf8Length, kCFStringEncodingUTF8, false);
+    if (!string) return false;
+    CFIndex length = CFStringGetLength(string);
+    const UInt8 *input[2] = {(const UInt8 *)utf8, NULL};
+    CFIndex inputLength[2] = {(CFIndex)utf8Length, 0};
+    UInt8 *utf16 = (UInt8 *)malloc(length * sizeof(UniChar));
+    CFStringGetBytes(string, CFRangeMake(0, length), kCFStringEncodingUTF16, 0, false, utf16, length * sizeof(UniChar), &inputLength[1]);
+    input[1] = utf16;
+    UInt8 *output = (UInt8 *)malloc(utf8Length + length * sizeof(UniChar));
+
+    for (int encoding = 0; encoding < 2; encoding++) {
+        double bestIn = 0, bestOut = 0;
+        for (int round = 0; round < ROUNDS; round++) {
+            CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+            CFStringRef made = CFStringCreateWithBytes(kCFAllocatorSystemDefault, input[encoding], inputLength[encoding], encodings[encoding], false);
+            CFAbsoluteTime madeTime = CFAbsoluteTimeGetCurrent() - start;
+            if (!made || !CFEqual(made, string)) ok = false;
+            if (!made) break;
+            CFIndex used = 0;
+            start = CFAbsoluteTimeGetCurrent();
+            CFIndex converted = CFStringGetBytes(made, CFRangeMake(0, length), encodings[encoding], 0, false, output, utf8Length + length * sizeof(UniChar), &used);
+            CFAbsoluteTime writtenTime = CFAbsoluteTimeGetCurrent() - start;
+            if (converted != length || used != inputLength[encoding] || memcmp(output, input[encoding], used) != 0) ok = false;
+            CFRelease(made);
+            double in = inputLength[encoding] / madeTime / 1.0e6, out = inputLength[encoding] / writtenTime / 1.0e6;
+            if (bestIn < in) bestIn = in;
+            if (bestOut < out) bestOut = out;
+        }
+        rates[2 * encoding] = bestIn;
+        rates[2 * encoding + 1] = bestOut;
+    }
+    free(output);
+    free(utf16);
+    CFRelease(string);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    long kilobytes = (argc > 1) ? atol(argv[1]) : 4096;
+    if (kilobytes <= 0) {
+        printf("Usage: cfstrconv [<kilobytes>]\n");
+        return 1;
+    }
+    Boolean bytewise = (getenv("CFStringDisableASCIIRuns") != NULL);
+    double rates[TEXT_COUNT][OPERATION_COUNT];
+    Boolean ok = true;
+    for (int text = 0; text < (int)TEXT_COUNT; text++) {
+        size_t length;
+        char *utf8 = createText(text, kilobytes * 1024, &length);
+        if (!timeText(utf8, length, rates[text])) {
+            fprintf(stderr, "%s: %s text did not convert back to the same bytes\n", bytewise ? "byte at a time" : "ASCII runs", textNames[text]);
+            ok = false;
+        }
+        free(utf8);
+    }
+    if (bytewise) {
+        // standard output is a pipe to the run that started this one, which compares the rates
+        fwrite(rates, sizeof(rates), 1, stdout);
+        return ok ? 0 : 1;
+    }
+
+    // run again a byte at a time
+    double oldRates[TEXT_COUNT][OPERATION_COUNT];
+    int fds[2];
+    pid_t pid;
+    int status = 0;
+    Boolean compared = false;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (pipe(fds) == 0) {
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, fds[0]);
+        setenv("CFStringDisableASCIIRuns", "YES", 1);
+        if (posix_spawn(&pid, argv[0], &actions, NULL, argv, environ) == 0) {
+            close(fds[1]);
+            FILE *fromChild = fdopen(fds[0], "r");
+            compared = (fread(oldRates, sizeof(oldRates), 1, fromChild) == 1);
+            fclose(fromChild);
+            if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = false;
+        } else {
+            close(fds[0]);
+            close(fds[1]);
+        }
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    if (!compared) printf("could not run again a byte at a time\n");
+
+    printf("%-8s %-11s %14s %14s %8s\n", "text", "conversion", "bytewise MB/s", "runs MB/s", "ratio");
+    for (int text = 0; text < (int)TEXT_COUNT; text++) {
+        for (int op = 0; op < OPERATION_COUNT; op++) {
+            if (compared) {
+                printf("%-8s %-11s %14.0f %14.0f %7.2fx\n", textNames[text], operationNames[op], oldRates[text][op], rates[text][op], rates[text][op] / oldRates[text][op]);
+            } else {
+                printf("%-8s %-11s %14s %14.0f\n", textNames[text], operationNames[op], "-", rates[text][op]);
+            }
+        }
+    }
+    return (ok && compared) ? 0 : 1;
+}
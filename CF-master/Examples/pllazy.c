@@ -0,0 +1,257 @@
+// Mac OS X: clang -F<path-to-CFLite-framework> -framework CoreFoundation Examples/pllazy.c -o pllazy
+//  note: When running this sample, be sure to set the environment variable DYLD_FRAMEWORK_PATH to point to the directory containing your new version of CoreFoundation.
+//   e.g.
+//  DYLD_FRAMEWORK_PATH=/tmp/CF-Root ./pllazy [<input>]
+//
+// Linux: clang -I/usr/local/include -L/usr/local/lib -lCoreFoundation -lpthread pllazy.c -o pllazy
+
+/*
+ This example compares _CFBinaryPlistCreateLazy() with CFPropertyListCreateWithData(). It takes one optional argument:
+    1. A property list file to read, in either binary or XML property list format. Without it, a property list with a large dictionary is made up.
+ The property list is written as a binary property list and read back both ways. Every element of the lazy containers is checked against the eager property list, every dictionary key is looked up through the lazy index, and several threads then look up the keys of one fresh lazy dictionary at once. The time to read the data and look up one key is printed for both ways. It exits with status 1 if anything differs.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreFoundation/CFPriv.h>
+
+#define THREAD_COUNT 8
+
+static CFMutableDataRef createDataFromFile(const char *fname) {
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) return NULL;
+    CFMutableDataRef res = CFDataCreateMutable(kCFAllocatorSystemDefault, 0);
+    char buf[4096];
+
+    ssize_t amountRead;
+    while ((amountRead = read(fd, buf, 4096)) > 0) {
+        CFDataAppendBytes(res, (const UInt8 *)buf, amountRead);
+    }
+
+    close(fd);
+    return res;
+}
+
+// A dictionary of 20000 pairs, big enough to be looked up through an index, whose values are numbers, strings, arrays and small dictionaries
+static CFPropertyListRef createSample(void) {
+    CFMutableDictionaryRef top = CFDictionaryCreateMutable(kCFAllocatorSystemDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    for (int i = 0; i < 20000; i++) {
+        CFStringRef key = CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("key-%d"), i);
+        CFPropertyListRef value;
+        switch (i % 4) {
+        case 0:
+            value = CFNumberCreate(kCFAllocatorSystemDefault, kCFNumberIntType, &i);
+            break;
+        case 1: {
+            // half ASCII, which lazy reading shares with the data, and half not
+            char str[32];
+            snprintf(str, sizeof(str), (i % 8 == 1) ? "value %d" : "valu\xc3\xa9 %d", i);
+            value = CFStringCreateWithCString(kCFAllocatorSystemDefault, str, kCFStringEncodingUTF8);
+            break;
+        }
+        case 2: {
+            CFStringRef strings[3] = {key, CFSTR("shared"), CFSTR("")};
+            value = CFArrayCreate(kCFAllocatorSystemDefault, (const void **)strings, 3, &kCFTypeArrayCallBacks);
+            break;
+        }
+        default: {
+            CFStringRef keys[2] = {CFSTR("name"), CFSTR("flag")};
+            CFTypeRef values[2] = {key, (i % 3) ? kCFBooleanTrue : kCFBooleanFalse};
+            value = CFDictionaryCreate(kCFAllocatorSystemDefault, (const void **)keys, (const void **)values, 2, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+            break;
+        }
+        }
+        CFDictionarySetValue(top, key, value);
+        CFRelease(value);
+        CFRelease(key);
+    }
+    return top;
+}
+
+static bool isLazy(CFPropertyListRef pl) {
+    return pl && CFGetTypeID(pl) == _CFBinaryPlistLazyContainerGetTypeID();
+}
+
+static bool compare(CFPropertyListRef lazy, CFPropertyListRef eager, int depth);
+
+static bool compareDictionary(_CFBinaryPlistLazyContainerRef lazy, CFDictionaryRef eager, int depth) {
+    CFIndex count = _CFBinaryPlistLazyContainerGetCount(lazy);
+    for (CFIndex idx = 0; idx < count; idx++) {
+        CFPropertyListRef key = _CFBinaryPlistLazyContainerGetKeyAtIndex(lazy, idx);
+        CFPropertyListRef value = _CFBinaryPlistLazyContainerGetValueAtIndex(lazy, idx);
+        if (!key || isLazy(key) || !CFDictionaryContainsKey(eager, key)) {
+            printf("depth %d: key %ld is not a key of the eager dictionary\n", depth, (long)idx);
+            return false;
+        }
+        if (_CFBinaryPlistLazyContainerGetValue(lazy, key) != value) {
+            printf("depth %d: looking up key %ld finds another value than its index\n", depth, (long)idx);
+            return false;
+        }
+        if (!compare(value, CFDictionaryGetValue(eager, key), depth + 1)) return false;
+    }
+    if (_CFBinaryPlistLazyContainerGetValue(lazy, CFSTR("no such key in this dictionary"))) {
+        printf("depth %d: a missing key was found\n", depth);
+        return false;
+    }
+    return true;
+}
+
+static bool compare(CFPropertyListRef lazy, CFPropertyListRef eager, int depth) {
+    if (!lazy || !eager) {
+        printf("depth %d: element is NULL\n", depth);
+        return false;
+    }
+    if (!isLazy(lazy)) {
+        if (!CFEqual(lazy, eager)) {
+            printf("depth %d: elements differ\n", depth);
+            return false;
+        }
+        return true;
+    }
+    _CFBinaryPlistLazyContainerRef container = (_CFBinaryPlistLazyContainerRef)lazy;
+    CFTypeID type = _CFBinaryPlistLazyContainerGetContainerTypeID(container);
+    if (type != CFGetTypeID(eager)) {
+        printf("depth %d: container types differ\n", depth);
+        return false;
+    }
+    CFIndex count = _CFBinaryPlistLazyContainerGetCount(container);
+    if (type == CFDictionaryGetTypeID()) {
+        if (count != CFDictionaryGetCount((CFDictionaryRef)eager)) {
+            printf("depth %d: dictionary counts differ\n", depth);
+            return false;
+        }
+        return compareDictionary(container, (CFDictionaryRef)eager, depth);
+    }
+    if (type == CFArrayGetTypeID()) {
+        if (count != CFArrayGetCount((CFArrayRef)eager)) {
+            printf("depth %d: array counts differ\n", depth);
+            return false;
+        }
+        for (CFIndex idx = 0; idx < count; idx++) {
+            if (!compare(_CFBinaryPlistLazyContainerGetValueAtIndex(container, idx), CFArrayGetValueAtIndex((CFArrayRef)eager, idx), depth + 1)) return false;
+        }
+        return true;
+    }
+    // sets have no order to compare elements in
+    CFPropertyListRef copy = _CFBinaryPlistLazyContainerCopyPropertyList(container, kCFPropertyListImmutable);
+    bool equal = copy && CFEqual(copy, eager);
+    if (copy) CFRelease(copy);
+    if (!equal) printf("depth %d: sets differ\n", depth);
+    return equal;
+}
+
+struct lookupJob {
+    _CFBinaryPlistLazyContainerRef lazy;
+    CFDictionaryRef eager;
+    CFIndex count;
+    CFStringRef *keys;
+    int start;
+    bool ok;
+};
+
+// Containers are only counted, comparing them whole from several threads would not add anything
+static bool matches(CFPropertyListRef value, CFPropertyListRef expected) {
+    if (!value) return false;
+    if (!isLazy(value)) return CFEqual(value, expected);
+    CFIndex count = _CFBinaryPlistLazyContainerGetCount((_CFBinaryPlistLazyContainerRef)value);
+    CFTypeID type = CFGetTypeID(expected);
+    if (type == CFArrayGetTypeID()) return count == CFArrayGetCount((CFArrayRef)expected);
+    if (type == CFDictionaryGetTypeID()) return count == CFDictionaryGetCount((CFDictionaryRef)expected);
+    return type == CFSetGetTypeID() && count == CFSetGetCount((CFSetRef)expected);
+}
+
+// Each thread starts at a different key, so that several build the index and create the same elements at once
+static void *lookupKeys(void *arg) {
+    struct lookupJob *job = (struct lookupJob *)arg;
+    job->ok = true;
+    for (CFIndex n = 0; n < job->count && job->ok; n++) {
+        CFStringRef key = job->keys[(job->start + n * 7919) % job->count];
+        if (!matches(_CFBinaryPlistLazyContainerGetValue(job->lazy, key), CFDictionaryGetValue(job->eager, key))) job->ok = false;
+    }
+    return NULL;
+}
+
+static bool lookupConcurrently(CFDataRef binary, CFDictionaryRef eager) {
+    CFPropertyListRef lazy = _CFBinaryPlistCreateLazy(kCFAllocatorSystemDefault, binary, NULL);
+    CFIndex count = CFDictionaryGetCount(eager);
+    CFStringRef *keys = (CFStringRef *)malloc(count * sizeof(CFStringRef));
+    CFDictionaryGetKeysAndValues(eager, (const void **)keys, NULL);
+    struct lookupJob jobs[THREAD_COUNT];
+    pthread_t threads[THREAD_COUNT];
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        jobs[t] = (struct lookupJob){(_CFBinaryPlistLazyContainerRef)lazy, eager, count, keys, t * 1000, false};
+        pthread_create(&threads[t], NULL, lookupKeys, &jobs[t]);
+    }
+    bool ok = true;
+    for (int t = 0; t < THREAD_COUNT; t++) {
+        pthread_join(threads[t], NULL);
+        if (!jobs[t].ok) {
+            printf("thread %d: a lookup found the wrong value\n", t);
+            ok = false;
+        }
+    }
+    free(keys);
+    CFRelease(lazy);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    CFPropertyListRef plist;
+    CFErrorRef err = NULL;
+    if (argc > 1) {
+        CFMutableDataRef plistData = createDataFromFile(argv[1]);
+        if (!plistData) {
+            printf("Unable to create data from file name: %s\n", argv[1]);
+            return 1;
+        }
+        plist = CFPropertyListCreateWithData(kCFAllocatorSystemDefault, plistData, 0, NULL, &err);
+        CFRelease(plistData);
+        if (!plist) {
+            printf("Unable to create property list from data\n");
+            return 1;
+        }
+    } else {
+        plist = createSample();
+    }
+
+    CFDataRef binary = CFPropertyListCreateData(kCFAllocatorSystemDefault, plist, kCFPropertyListBinaryFormat_v1_0, 0, &err);
+    CFRelease(plist);
+    if (!binary) {
+        printf("Unable to write property list to data\n");
+        return 1;
+    }
+
+    // read both ways and get one element, which is where lazy reading should win
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    CFPropertyListRef eager = CFPropertyListCreateWithData(kCFAllocatorSystemDefault, binary, 0, NULL, NULL);
+    if (eager && CFGetTypeID(eager) == CFDictionaryGetTypeID()) CFDictionaryGetValue((CFDictionaryRef)eager, CFSTR("key-1"));
+    CFAbsoluteTime eagerTime = CFAbsoluteTimeGetCurrent() - start;
+    start = CFAbsoluteTimeGetCurrent();
+    CFPropertyListRef lazy = _CFBinaryPlistCreateLazy(kCFAllocatorSystemDefault, binary, NULL);
+    if (isLazy(lazy) && _CFBinaryPlistLazyContainerGetContainerTypeID((_CFBinaryPlistLazyContainerRef)lazy) == CFDictionaryGetTypeID()) _CFBinaryPlistLazyContainerGetValue((_CFBinaryPlistLazyContainerRef)lazy, CFSTR("key-1"));
+    CFAbsoluteTime lazyTime = CFAbsoluteTimeGetCurrent() - start;
+    printf("%ld bytes: eager read and lookup %.3f ms, lazy %.3f ms\n", (long)CFDataGetLength(binary), eagerTime * 1000.0, lazyTime * 1000.0);
+
+    bool ok = compare(lazy, eager, 0);
+    if (ok && isLazy(lazy)) {
+        CFPropertyListRef copy = _CFBinaryPlistLazyContainerCopyPropertyList((_CFBinaryPlistLazyContainerRef)lazy, kCFPropertyListImmutable);
+        ok = copy && CFEqual(copy, eager);
+        if (!ok) printf("the lazy container's property list differs\n");
+        if (copy) CFRelease(copy);
+    }
+    if (ok && isLazy(lazy) && CFGetTypeID(eager) == CFDictionaryGetTypeID()) ok = lookupConcurrently(binary, (CFDictionaryRef)eager);
+    printf("%s\n", ok ? "lazy and eager property lists are the same" : "lazy and eager property lists differ");
+
+    if (lazy) CFRelease(lazy);
+    if (eager) CFRelease(eager);
+    CFRelease(binary);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+// Mac OS X: clang -F<path-to-CFLite-framework> -framework CoreFoundation Examples/plwrite.c -o plwrite
+//  note: When running this sample, be sure to set the environment variable DYLD_FRAMEWORK_PATH to point to the directory containing your new version of CoreFoundation.
+//   e.g.
+//  DYLD_FRAMEWORK_PATH=/tmp/CF-Root ./plwrite [<count>]
+//
+// Linux: clang -I/usr/local/include -L/usr/local/lib -lCoreFoundation plwrite.c -o plwrite
+
+/*
+ This example writes a large property list as a binary property list and reads it back. It takes one optional argument:
+    1. The number of dictionaries in the property list, 100000 if not given.
+ Each dictionary has its own number, a name shared with three others, one of four kinds, and a data shared with fifteen others, so that the writer has many objects to unique and, from 16384 objects on, encodes in parallel. The result must read back equal to what was written. The best time of three writes and reads and the process's peak resident size are printed, so run it once per count to compare counts, e.g.
+    for n in 1000 10000 100000 1000000; do ./plwrite $n; done
+ It also checks that the integer 1 and the real 1.0, and 0.0 and -0.0, read back with their own types and signs.
+ On Mac OS X it also writes to a stream too small for the result, which must fail with an error. It exits with status 1 if anything is wrong.
+*/
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+static CFPropertyListRef createSample(int count) {
+    CFStringRef kinds[4] = {CFSTR("alpha"), CFSTR("beta"), CFSTR("gamma"), CFSTR("delta")};
+    CFMutableArrayRef top = CFArrayCreateMutable(kCFAllocatorSystemDefault, count, &kCFTypeArrayCallBacks);
+    CFStringRef name = NULL;
+    CFDataRef payload = NULL;
+    for (int i = 0; i < count; i++) {
+        int shared = i / 16;
+        if (i % 4 == 0) {
+            if (name) CFRelease(name);
+            name = CFStringCreateWithFormat(kCFAllocatorSystemDefault, NULL, CFSTR("item-%d"), i / 4);
+        }
+        if (i % 16 == 0) {
+            if (payload) CFRelease(payload);
+            payload = CFDataCreate(kCFAllocatorSystemDefault, (const UInt8 *)&shared, sizeof(shared));
+        }
+        CFStringRef keys[4] = {CFSTR("index"), CFSTR("name"), CFSTR("kind"), CFSTR("payload")};
+        CFTypeRef values[4];
+        values[0] = CFNumberCreate(kCFAllocatorSystemDefault, kCFNumberIntType, &i);
+        values[1] = name;
+        values[2] = kinds[i % 4];
+        values[3] = payload;
+        CFDictionaryRef dict = CFDictionaryCreate(kCFAllocatorSystemDefault, (const void **)keys, values, 4, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        CFArrayAppendValue(top, dict);
+        CFRelease(dict);
+        CFRelease(values[0]);
+    }
+    if (name) CFRelease(name);
+    if (payload) CFRelease(payload);
+    return top;
+}
+
+// Numbers that CFEqual finds equal but that are written differently must each keep their type
+static bool numbersKeepTheirTypes(void) {
+    int one = 1;
+    double realOne = 1.0, zero = 0.0, negativeZero = -0.0;
+    CFTypeRef values[4];
+    values[0] = CFNumberCreate(kCFAllocatorSystemDefault, kCFNumberIntType, &one);
+    values[1] = CFNumberCreate(kCFAllocatorSystemDefault, kCFNumberDoubleType, &realOne);
+    values[2] = CFNumberCreate(kCFAllocatorSystemDefault, kCFNumberDoubleType, &zero);
+    values[3] = CFNumberCreate(kCFAllocatorSystemDefault, kCFNumberDoubleType, &negativeZero);
+    CFArrayRef array = CFArrayCreate(kCFAllocatorSystemDefault, values, 4, &kCFTypeArrayCallBacks);
+    CFDataRef data = CFPropertyListCreateData(kCFAllocatorSystemDefault, array, kCFPropertyListBinaryFormat_v1_0, 0, NULL);
+    CFArrayRef readBack = data ? (CFArrayRef)CFPropertyListCreateWithData(kCFAllocatorSystemDefault, data, 0, NULL, NULL) : NULL;
+    bool ok = readBack && CFGetTypeID(readBack) == CFArrayGetTypeID() && CFArrayGetCount(readBack) == 4;
+    if (ok) {
+        double value = 0;
+        ok = !CFNumberIsFloatType((CFNumberRef)CFArrayGetValueAtIndex(readBack, 0)) && CFNumberIsFloatType((CFNumberRef)CFArrayGetValueAtIndex(readBack, 1));
+        ok = ok && CFNumberGetValue((CFNumberRef)CFArrayGetValueAtIndex(readBack, 3), kCFNumberDoubleType, &value) && signbit(value);
+    }
+    if (!ok) printf("1 and 1.0, or 0.0 and -0.0, did not read back as written\n");
+    if (readBack) CFRelease(readBack);
+    if (data) CFRelease(data);
+    CFRelease(array);
+    for (int idx = 0; idx < 4; idx++) CFRelease(values[idx]);
+    return ok;
+}
+
+// The number of objects is in the trailer, big endian, 24 bytes from the end
+static uint64_t objectCount(CFDataRef data) {
+    const UInt8 *end = CFDataGetBytePtr(data) + CFDataGetLength(data);
+    uint64_t count = 0;
+    for (int idx = 0; idx < 8; idx++) count = (count << 8) | end[idx - 24];
+    return count;
+}
+
+static long peakResidentKilobytes(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if __APPLE__
+    return usage.ru_maxrss / 1024;	// bytes
+#else
+    return usage.ru_maxrss;		// kilobytes
+#endif
+}
+
+int main(int argc, char **argv) {
+    int count = (argc > 1) ? atoi(argv[1]) : 100000;
+    if (count <= 0) {
+        printf("Usage: plwrite [<count>]\n");
+        return 1;
+    }
+    CFPropertyListRef plist = createSample(count);
+    long sampleKilobytes = peakResidentKilobytes();
+
+    CFDataRef data = NULL;
+    CFPropertyListRef readBack = NULL;
+    CFAbsoluteTime writeTime = 0, readTime = 0;
+    bool ok = true;
+    for (int round = 0; round < 3 && ok; round++) {
+        if (data) CFRelease(data);
+        if (readBack) CFRelease(readBack);
+        CFErrorRef err = NULL;
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        data = CFPropertyListCreateData(kCFAllocatorSystemDefault, plist, kCFPropertyListBinaryFormat_v1_0, 0, &err);
+        CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+        if (round == 0 || elapsed < writeTime) writeTime = elapsed;
+        if (!data) {
+            printf("writing failed%s\n", err ? " with an error" : " without an error");
+            if (err) CFRelease(err);
+            return 1;
+        }
+        start = CFAbsoluteTimeGetCurrent();
+        readBack = CFPropertyListCreateWithData(kCFAllocatorSystemDefault, data, 0, NULL, NULL);
+        elapsed = CFAbsoluteTimeGetCurrent() - start;
+        if (round == 0 || elapsed < readTime) readTime = elapsed;
+        ok = readBack && CFEqual(readBack, plist);
+    }
+    printf("%d dictionaries, %llu objects, %ld bytes: write %.1f ms, read %.1f ms, peak resident %ld KB (%ld KB before writing)\n",
+           count, (unsigned long long)objectCount(data), (long)CFDataGetLength(data), writeTime * 1000.0, readTime * 1000.0, peakResidentKilobytes(), sampleKilobytes);
+    if (!ok) printf("the property list read back is not the one written\n");
+    if (!numbersKeepTheirTypes()) ok = false;
+
+#if DEPLOYMENT_TARGET_MACOSX || __APPLE__
+    if (ok) {
+        // a stream that fills up must make the write fail and say why
+        CFIndex size = CFDataGetLength(data) / 2;
+        UInt8 *bytes = (UInt8 *)malloc(size);
+        CFWriteStreamRef stream = CFWriteStreamCreateWithBuffer(kCFAllocatorSystemDefault, bytes, size);
+        CFWriteStreamOpen(stream);
+        CFErrorRef err = NULL;
+        CFIndex written = CFPropertyListWrite(plist, stream, kCFPropertyListBinaryFormat_v1_0, 0, &err);
+        if (written != 0 || !err) {
+            printf("writing to a full stream returned %ld%s\n", (long)written, err ? "" : " and no error");
+            ok = false;
+        }
+        if (err) CFRelease(err);
+        CFWriteStreamClose(stream);
+        CFRelease(stream);
+        free(bytes);
+    }
+#endif
+
+    if (readBack) CFRelease(readBack);
+    CFRelease(data);
+    CFRelease(plist);
+    return ok ? 0 : 1;
+}
@@ -48,6 +48,7 @@
 #include "MachOLayout.hpp"
 #include "MachORebaser.hpp"
 #include "MachOTrie.hpp"
+#include "MachOFixupRuns.hpp"
 
 #ifndef EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER
 	#define EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER 0x10
@@ -94,6 +95,14 @@ private:
 	typedef std::unordered_map<const char*, pint_t, CStringHash, CStringEquals> NameToAddrMap;
 	typedef std::unordered_set<const char*, CStringHash, CStringEquals> NameSet;
 	typedef std::unordered_map<const char*, std::set<Binder<A>*>, CStringHash, CStringEquals> ResolverClientsMap;
+	struct BindTarget {
+		const char*		symbolName;			// as last looked up, NULL if none yet
+		int				libraryOrdinal;
+		bool			weakImport;
+		bool			skip;				// lazy pointer to a resolver, left alone
+		bool			isAbsolute;
+		pint_t			address;
+	};
 
 	
 	static bool									isPublicLocation(const char* pth);
@@ -101,9 +110,12 @@ private:
 	int											ordinalOfDependentBinder(Binder<A>* dep);
 	void										doBindDyldInfo(std::vector<void*>& pointersInData);
 	void										doBindDyldLazyInfo(std::vector<void*>& pointersInData);
+	void										resolveBindTarget(int libraryOrdinal, const char* symbolName, bool lazyPointer, bool weakImport,
+																BindTarget& target);
 	void										bindDyldInfoAt(uint8_t segmentIndex, uint64_t segmentOffset, uint8_t type, 
-																int libraryOrdinal, int64_t addend, 
-																const char* symbolName, bool lazyPointer, bool weakImport,
+																const BindTarget& target, int64_t addend,
+																std::vector<void*>& pointersInData);
+	void										bindDyldInfoRun(const MachOBindRun& run, BindTarget& target,
 																std::vector<void*>& pointersInData);
 	bool										findExportedSymbolAddress(const char* name, pint_t* result, Binder<A>** foundIn, 
 																			bool* isResolverSymbol, bool* isAbsolute);
@@ -440,15 +452,15 @@ void Binder<A>::bind(std::vector<void*>& pointersInData)
 	// weak bind info is processed at launch time
 }
 
+// Sets target to where symbolName from libraryOrdinal is. Binds of one
+// symbol usually come together, so target is left as is if it was last
+// resolved for the same symbol.
 template <typename A>
-void Binder<A>::bindDyldInfoAt(uint8_t segmentIndex, uint64_t segmentOffset, uint8_t type, int libraryOrdinal, 
-							int64_t addend, const char* symbolName, bool lazyPointer, bool weakImport, std::vector<void*>& pointersInData)
+void Binder<A>::resolveBindTarget(int libraryOrdinal, const char* symbolName, bool lazyPointer, bool weakImport, BindTarget& target)
 {
-	//printf("%d 0x%08llX type=%d, lib=%d, addend=%lld, symbol=%s\n", segmentIndex, segmentOffset, type, libraryOrdinal, addend, symbolName);
-	const std::vector<MachOLayoutAbstraction::Segment>& segments = this->fLayout.getSegments();
-	if ( segmentIndex > segments.size() )
-		throw "bad segment index in rebase info";
-		
+	if ( (target.symbolName == symbolName) && (target.libraryOrdinal == libraryOrdinal) && (target.weakImport == weakImport) )
+		return;
+
 	if ( libraryOrdinal == BIND_SPECIAL_DYLIB_FLAT_LOOKUP ) 
 		throw "dynamic lookup linkage not allowed in dyld shared cache";
 	
@@ -479,6 +491,13 @@ void Binder<A>::bindDyldInfoAt(uint8_t segmentIndex, uint64_t segmentOffset, uin
 			throwf("could not bind symbol %s in %s expected in %s", symbolName, this->getDylibID(), binder->getDylibID());
 	}
 	
+	target.symbolName = symbolName;
+	target.libraryOrdinal = libraryOrdinal;
+	target.weakImport = weakImport;
+	target.address = targetSymbolAddress;
+	target.isAbsolute = isAbsolute;
+	target.skip = false;
+
 	// don't bind lazy pointers to resolver stubs in shared cache
 	if ( lazyPointer && isResolverSymbol ) {
         if ( foundIn != this ) {
@@ -486,8 +505,21 @@ void Binder<A>::bindDyldInfoAt(uint8_t segmentIndex, uint64_t segmentOffset, uin
             foundIn->addResolverClient(this, symbolName);
            // fprintf(stderr, "have lazy pointer to resolver %s in %s\n", symbolName, this->getDylibID());
         }
-		return;
+		target.skip = true;
     }
+}
+
+template <typename A>
+void Binder<A>::bindDyldInfoAt(uint8_t segmentIndex, uint64_t segmentOffset, uint8_t type, const BindTarget& target,
+							int64_t addend, std::vector<void*>& pointersInData)
+{
+	//printf("%d 0x%08llX type=%d, addend=%lld, symbol=%s\n", segmentIndex, segmentOffset, type, addend, target.symbolName);
+	const std::vector<MachOLayoutAbstraction::Segment>& segments = this->fLayout.getSegments();
+	if ( segmentIndex >= segments.size() )
+		throw "bad segment index in bind info";
+	if ( target.skip )
+		return;
+	pint_t targetSymbolAddress = target.address;
 
 	// do actual update
 	const MachOLayoutAbstraction::Segment& seg = segments[segmentIndex];
@@ -512,11 +544,38 @@ void Binder<A>::bindDyldInfoAt(uint8_t segmentIndex, uint64_t segmentOffset, uin
 		default:
 			throw "bad bind type";
 	}
-	if ( !isAbsolute )
+	if ( !target.isAbsolute )
 		pointersInData.push_back(mappedAddr);
 }
 
+// Binds count locations stride bytes apart to one symbol, which is looked up
+// and checked once for the whole run.
+template <typename A>
+void Binder<A>::bindDyldInfoRun(const MachOBindRun& run, BindTarget& target, std::vector<void*>& pointersInData)
+{
+	if ( run.count == 0 )
+		return;
+	resolveBindTarget(run.libraryOrdinal, run.symbolName, false, run.weakImport, target);
+	if ( (run.count == 1) || (run.type != BIND_TYPE_POINTER) ) {
+		for (uint64_t i=0; i < run.count; ++i)
+			bindDyldInfoAt(run.segIndex, run.segOffset + i*run.stride, run.type, target, run.addend, pointersInData);
+		return;
+	}
 
+	const std::vector<MachOLayoutAbstraction::Segment>& segments = this->fLayout.getSegments();
+	if ( run.segIndex >= segments.size() )
+		throw "bad segment index in bind info";
+	const MachOLayoutAbstraction::Segment& seg = segments[run.segIndex];
+	if ( (run.segOffset >= seg.size()) || ((run.count-1) > (seg.size() - run.segOffset - 1)/run.stride) )
+		throwf("bind run of %s at offset=0x%08llX in seg=%s extends beyond the segment", run.symbolName, run.segOffset, seg.name());
+	const pint_t value = target.address + run.addend;
+	uint8_t* mappedAddr = (uint8_t*)seg.mappedAddress() + run.segOffset;
+	for (uint64_t i=0; i < run.count; ++i, mappedAddr += run.stride) {
+		P::setP(*(pint_t*)mappedAddr, value);
+		if ( !target.isAbsolute )
+			pointersInData.push_back(mappedAddr);
+	}
+}
 
 template <typename A>
 void Binder<A>::doBindDyldLazyInfo(std::vector<void*>& pointersInData)
@@ -531,6 +590,8 @@ void Binder<A>::doBindDyldLazyInfo(std::vector<void*>& pointersInData)
 	int libraryOrdinal = 0;
 	int64_t addend = 0;
 	bool weakImport = false;
+	BindTarget target;
+	target.symbolName = NULL;
 	while ( p < end ) {
 		uint8_t immediate = *p & BIND_IMMEDIATE_MASK;
 		uint8_t opcode = *p & BIND_OPCODE_MASK;
@@ -569,7 +630,8 @@ void Binder<A>::doBindDyldLazyInfo(std::vector<void*>& pointersInData)
 				segmentOffset = read_uleb128(p, end);
 				break;
 			case BIND_OPCODE_DO_BIND:
-				bindDyldInfoAt(segmentIndex, segmentOffset, type, libraryOrdinal, addend, symbolName, true, weakImport, pointersInData);
+				resolveBindTarget(libraryOrdinal, symbolName, true, weakImport, target);
+				bindDyldInfoAt(segmentIndex, segmentOffset, type, target, addend, pointersInData);
 				segmentOffset += sizeof(pint_t);
 				break;
 			case BIND_OPCODE_SET_TYPE_IMM:
@@ -588,86 +650,19 @@ void Binder<A>::doBindDyldLazyInfo(std::vector<void*>& pointersInData)
 template <typename A>
 void Binder<A>::doBindDyldInfo(std::vector<void*>& pointersInData)
 {
+	struct RunHandler {
+		Binder<A>*				binder;
+		BindTarget				target;
+		std::vector<void*>*		pointersInData;
+		void operator()(const MachOBindRun& run) { binder->bindDyldInfoRun(run, target, *pointersInData); }
+	};
+	RunHandler handler;
+	handler.binder = this;
+	handler.target.symbolName = NULL;
+	handler.pointersInData = &pointersInData;
 	const uint8_t* p = &this->fLinkEditBase[fDyldInfo->bind_off()];
 	const uint8_t* end = &p[fDyldInfo->bind_size()];
-	
-	uint8_t type = 0;
-	uint64_t segmentOffset = 0;
-	uint8_t segmentIndex = 0;
-	const char* symbolName = NULL;
-	int libraryOrdinal = 0;
-	int64_t addend = 0;
-	uint32_t count;
-	uint32_t skip;
-	bool weakImport = false;
-	bool done = false;
-	while ( !done && (p < end) ) {
-		uint8_t immediate = *p & BIND_IMMEDIATE_MASK;
-		uint8_t opcode = *p & BIND_OPCODE_MASK;
-		++p;
-		switch (opcode) {
-			case BIND_OPCODE_DONE:
-				done = true;
-				break;
-			case BIND_OPCODE_SET_DYLIB_ORDINAL_IMM:
-				libraryOrdinal = immediate;
-				break;
-			case BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB:
-				libraryOrdinal = read_uleb128(p, end);
-				break;
-			case BIND_OPCODE_SET_DYLIB_SPECIAL_IMM:
-				// the special ordinals are negative numbers
-				if ( immediate == 0 )
-					libraryOrdinal = 0;
-				else {
-					int8_t signExtended = BIND_OPCODE_MASK | immediate;
-					libraryOrdinal = signExtended;
-				}
-				break;
-			case BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM:
-				weakImport = ( (immediate & BIND_SYMBOL_FLAGS_WEAK_IMPORT) != 0 );
-				symbolName = (char*)p;
-				while (*p != '\0')
-					++p;
-				++p;
-				break;
-			case BIND_OPCODE_SET_TYPE_IMM:
-				type = immediate;
-				break;
-			case BIND_OPCODE_SET_ADDEND_SLEB:
-				addend = read_sleb128(p, end);
-				break;
-			case BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
-				segmentIndex = immediate;
-				segmentOffset = read_uleb128(p, end);
-				break;
-			case BIND_OPCODE_ADD_ADDR_ULEB:
-				segmentOffset += read_uleb128(p, end);
-				break;
-			case BIND_OPCODE_DO_BIND:
-				bindDyldInfoAt(segmentIndex, segmentOffset, type, libraryOrdinal, addend, symbolName, false, weakImport, pointersInData);
-				segmentOffset += sizeof(pint_t);
-				break;
-			case BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB:
-				bindDyldInfoAt(segmentIndex, segmentOffset, type, libraryOrdinal, addend, symbolName, false, weakImport, pointersInData);
-				segmentOffset += read_uleb128(p, end) + sizeof(pint_t);
-				break;
-			case BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED:
-				bindDyldInfoAt(segmentIndex, segmentOffset, type, libraryOrdinal, addend, symbolName, false, weakImport, pointersInData);
-				segmentOffset += immediate*sizeof(pint_t) + sizeof(pint_t);
-				break;
-			case BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB:
-				count = read_uleb128(p, end);
-				skip = read_uleb128(p, end);
-				for (uint32_t i=0; i < count; ++i) {
-					bindDyldInfoAt(segmentIndex, segmentOffset, type, libraryOrdinal, addend, symbolName, false, weakImport, pointersInData);
-					segmentOffset += skip + sizeof(pint_t);
-				}
-				break;
-			default:
-				throwf("bad bind opcode %d", *p);
-		}
-	}
+	forEachBindRun<P>(p, end, handler);
 }
 
 template <typename A>
@@ -0,0 +1,222 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef __MACHO_FIXUP_RUNS__
+#define __MACHO_FIXUP_RUNS__
+
+#include <stdint.h>
+#include <mach-o/loader.h>
+
+#include "MachOFileAbstraction.hpp"
+
+void throwf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+//
+// forEachRebaseRun() and forEachBindRun() decode the REBASE_OPCODE_* and
+// non-lazy BIND_OPCODE_* streams of LC_DYLD_INFO into runs of equally spaced
+// locations, instead of one location at a time. ld emits runs for arrays of
+// pointers and, with BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB, for one
+// symbol bound at many places, so a handler can check a run's segment once
+// and look its symbol up once.
+//
+// Both are templates on P, the pointer type of the image's architecture, so
+// strides are compile time constants and the handler, called as
+// handler(run), is inlined into the opcode loop. Errors are thrown, as
+// everywhere in update_dyld_shared_cache.
+//
+
+struct MachORebaseRun
+{
+	uint64_t	segOffset;			// first location, from the start of segment segIndex
+	uint64_t	stride;				// bytes from one location to the next
+	uint64_t	count;
+	uint8_t		segIndex;
+	uint8_t		type;				// REBASE_TYPE_*
+};
+
+struct MachOBindRun
+{
+	uint64_t	segOffset;			// first location, from the start of segment segIndex
+	uint64_t	stride;				// bytes from one location to the next
+	uint64_t	count;
+	int64_t		addend;
+	const char*	symbolName;			// points into the opcodes, so the same symbol is the same pointer
+	int			libraryOrdinal;		// or BIND_SPECIAL_DYLIB_*
+	uint8_t		segIndex;
+	uint8_t		type;				// BIND_TYPE_*
+	bool		weakImport;
+};
+
+
+template <typename P, typename H>
+void forEachRebaseRun(const uint8_t* p, const uint8_t* end, H& handler)
+{
+	const uint64_t pointerSize = sizeof(typename P::uint_t);
+	MachORebaseRun run;
+	run.segIndex = 0;
+	run.segOffset = 0;
+	run.type = 0;
+	bool done = false;
+	while ( !done && (p < end) ) {
+		uint8_t immediate = *p & REBASE_IMMEDIATE_MASK;
+		uint8_t opcode = *p & REBASE_OPCODE_MASK;
+		++p;
+		switch (opcode) {
+			case REBASE_OPCODE_DONE:
+				done = true;
+				break;
+			case REBASE_OPCODE_SET_TYPE_IMM:
+				run.type = immediate;
+				break;
+			case REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+				run.segIndex = immediate;
+				run.segOffset = read_uleb128(p, end);
+				break;
+			case REBASE_OPCODE_ADD_ADDR_ULEB:
+				run.segOffset += read_uleb128(p, end);
+				break;
+			case REBASE_OPCODE_ADD_ADDR_IMM_SCALED:
+				run.segOffset += immediate*pointerSize;
+				break;
+			case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
+				run.count = immediate;
+				run.stride = pointerSize;
+				handler(run);
+				run.segOffset += run.count*pointerSize;
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES:
+				run.count = read_uleb128(p, end);
+				run.stride = pointerSize;
+				handler(run);
+				run.segOffset += run.count*pointerSize;
+				break;
+			case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
+				run.count = 1;
+				run.stride = pointerSize;
+				handler(run);
+				run.segOffset += read_uleb128(p, end) + pointerSize;
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB:
+				run.count = read_uleb128(p, end);
+				run.stride = read_uleb128(p, end) + pointerSize;
+				handler(run);
+				run.segOffset += run.count*run.stride;
+				break;
+			default:
+				throwf("bad rebase opcode %d", *(p-1));
+		}
+	}
+}
+
+
+template <typename P, typename H>
+void forEachBindRun(const uint8_t* p, const uint8_t* end, H& handler)
+{
+	const uint64_t pointerSize = sizeof(typename P::uint_t);
+	MachOBindRun run;
+	run.segIndex = 0;
+	run.segOffset = 0;
+	run.type = 0;
+	run.symbolName = NULL;
+	run.libraryOrdinal = 0;
+	run.addend = 0;
+	run.weakImport = false;
+	bool done = false;
+	while ( !done && (p < end) ) {
+		uint8_t immediate = *p & BIND_IMMEDIATE_MASK;
+		uint8_t opcode = *p & BIND_OPCODE_MASK;
+		++p;
+		switch (opcode) {
+			case BIND_OPCODE_DONE:
+				done = true;
+				break;
+			case BIND_OPCODE_SET_DYLIB_ORDINAL_IMM:
+				run.libraryOrdinal = immediate;
+				break;
+			case BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB:
+				run.libraryOrdinal = (int)read_uleb128(p, end);
+				break;
+			case BIND_OPCODE_SET_DYLIB_SPECIAL_IMM:
+				// the special ordinals are negative numbers
+				if ( immediate == 0 )
+					run.libraryOrdinal = 0;
+				else {
+					int8_t signExtended = BIND_OPCODE_MASK | immediate;
+					run.libraryOrdinal = signExtended;
+				}
+				break;
+			case BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM:
+				run.weakImport = ( (immediate & BIND_SYMBOL_FLAGS_WEAK_IMPORT) != 0 );
+				run.symbolName = (char*)p;
+				while ( (p < end) && (*p != '\0') )
+					++p;
+				if ( p == end )
+					throw "unterminated symbol name in bind info";
+				++p;
+				break;
+			case BIND_OPCODE_SET_TYPE_IMM:
+				run.type = immediate;
+				break;
+			case BIND_OPCODE_SET_ADDEND_SLEB:
+				run.addend = read_sleb128(p, end);
+				break;
+			case BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+				run.segIndex = immediate;
+				run.segOffset = read_uleb128(p, end);
+				break;
+			case BIND_OPCODE_ADD_ADDR_ULEB:
+				run.segOffset += read_uleb128(p, end);
+				break;
+			case BIND_OPCODE_DO_BIND:
+				run.count = 1;
+				run.stride = pointerSize;
+				handler(run);
+				run.segOffset += pointerSize;
+				break;
+			case BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB:
+				run.count = 1;
+				run.stride = pointerSize;
+				handler(run);
+				run.segOffset += read_uleb128(p, end) + pointerSize;
+				break;
+			case BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED:
+				run.count = 1;
+				run.stride = pointerSize;
+				handler(run);
+				run.segOffset += immediate*pointerSize + pointerSize;
+				break;
+			case BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB:
+				run.count = read_uleb128(p, end);
+				run.stride = read_uleb128(p, end) + pointerSize;
+				handler(run);
+				run.segOffset += run.count*run.stride;
+				break;
+			default:
+				throwf("bad bind opcode %d", *(p-1));
+		}
+	}
+}
+
+
+#endif // __MACHO_FIXUP_RUNS__
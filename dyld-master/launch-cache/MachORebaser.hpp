@@ -47,6 +47,7 @@
 #include "Architectures.hpp"
 #include "MachOLayout.hpp"
 #include "MachOTrie.hpp"
+#include "MachOFixupRuns.hpp"
 
 
 
@@ -91,6 +92,8 @@ private:
 																uint64_t imageStartAddress, uint64_t imageEndAddress, std::vector<void*>& pointersInData);
 	bool										adjustExportInfo();
 	void										doRebase(int segIndex, uint64_t segOffset, uint8_t type, std::vector<void*>& pointersInData);
+	void										applyRebaseRun(const MachORebaseRun& run, std::vector<void*>& pointersInData);
+	const MachOLayoutAbstraction::Segment*		segmentForVMAddress(pint_t vmaddress);
 	pint_t										getSlideForVMAddress(pint_t vmaddress);
 	pint_t										maskedVMAddress(pint_t vmaddress);
 	pint_t*										mappedAddressForVMAddress(pint_t vmaddress);
@@ -310,17 +313,26 @@ typename A::P::uint_t Rebaser<A>::maskedVMAddress(pint_t vmaddress)
 
 
 template <typename A>
-typename A::P::uint_t Rebaser<A>::getSlideForVMAddress(pint_t vmaddress)
+const MachOLayoutAbstraction::Segment* Rebaser<A>::segmentForVMAddress(pint_t vmaddress)
 {
 	pint_t vmaddr = this->maskedVMAddress(vmaddress);
 	const std::vector<MachOLayoutAbstraction::Segment>& segments = fLayout.getSegments();
 	for(std::vector<MachOLayoutAbstraction::Segment>::const_iterator it = segments.begin(); it != segments.end(); ++it) {
 		const MachOLayoutAbstraction::Segment& seg = *it;
 		if ( (seg.address() <= vmaddr) && (seg.size() != 0) && ((vmaddr < (seg.address()+seg.size())) || (seg.address() == vmaddr)) ) {
-			return seg.newAddress() - seg.address();
+			return &seg;
 		}
 	}
-	throwf("vm address 0x%08llX not found", (uint64_t)vmaddr);
+	return NULL;
+}
+
+template <typename A>
+typename A::P::uint_t Rebaser<A>::getSlideForVMAddress(pint_t vmaddress)
+{
+	const MachOLayoutAbstraction::Segment* seg = this->segmentForVMAddress(vmaddress);
+	if ( seg == NULL )
+		throwf("vm address 0x%08llX not found", (uint64_t)this->maskedVMAddress(vmaddress));
+	return seg->newAddress() - seg->address();
 }
 
 
@@ -645,7 +657,7 @@ template <typename A>
 void Rebaser<A>::doRebase(int segIndex, uint64_t segOffset, uint8_t type, std::vector<void*>& pointersInData)
 {
 	const std::vector<MachOLayoutAbstraction::Segment>& segments = fLayout.getSegments();
-	if ( segIndex > segments.size() )
+	if ( segIndex >= segments.size() )
 		throw "bad segment index in rebase info";
 	const MachOLayoutAbstraction::Segment& seg = segments[segIndex];
 	uint8_t*  mappedAddr = (uint8_t*)seg.mappedAddress() + segOffset;
@@ -688,68 +700,61 @@ void Rebaser<A>::doRebase(int segIndex, uint64_t segOffset, uint8_t type, std::v
 }
 
 
+// Slides count pointers stride bytes apart. Most pointers in a run point
+// into the same segment as the one before, so that segment's slide is
+// reused until a pointer falls outside it.
+template <typename A>
+void Rebaser<A>::applyRebaseRun(const MachORebaseRun& run, std::vector<void*>& pointersInData)
+{
+	if ( run.count == 0 )
+		return;
+	const std::vector<MachOLayoutAbstraction::Segment>& segments = fLayout.getSegments();
+	if ( run.segIndex >= segments.size() )
+		throw "bad segment index in rebase info";
+	const MachOLayoutAbstraction::Segment& seg = segments[run.segIndex];
+	if ( (run.segOffset >= seg.size()) || ((run.count-1) > (seg.size() - run.segOffset - 1)/run.stride) )
+		throwf("rebase run at offset=0x%08llX in seg=%s extends beyond the segment", run.segOffset, seg.name());
+	if ( run.type != REBASE_TYPE_POINTER ) {
+		for (uint64_t i=0; i < run.count; ++i)
+			doRebase(run.segIndex, run.segOffset + i*run.stride, run.type, pointersInData);
+		return;
+	}
+
+	uint64_t targetStart = 1;
+	uint64_t targetEnd = 0;
+	pint_t slide = 0;
+	uint8_t* mappedAddr = (uint8_t*)seg.mappedAddress() + run.segOffset;
+	for (uint64_t i=0; i < run.count; ++i, mappedAddr += run.stride) {
+		pint_t* mappedAddrP = (pint_t*)mappedAddr;
+		pint_t valueP = P::getP(*mappedAddrP);
+		uint64_t vmaddr = this->maskedVMAddress(valueP);
+		if ( (vmaddr < targetStart) || (vmaddr >= targetEnd) ) {
+			const MachOLayoutAbstraction::Segment* target = this->segmentForVMAddress(valueP);
+			if ( target == NULL ) {
+				throwf("at offset=0x%08llX in seg=%s, pointer cannot be rebased because it does not point to __TEXT or __DATA. vm address 0x%08llX not found\n", 
+						run.segOffset + i*run.stride, seg.name(), vmaddr);
+			}
+			targetStart = target->address();
+			targetEnd = target->address() + target->size();
+			slide = target->newAddress() - target->address();
+		}
+		P::setP(*mappedAddrP, valueP + slide);
+		pointersInData.push_back(mappedAddr);
+	}
+}
+
 template <typename A>
 void Rebaser<A>::applyRebaseInfo(std::vector<void*>& pointersInData)
 {
+	struct RunHandler {
+		Rebaser<A>*				rebaser;
+		std::vector<void*>*		pointersInData;
+		void operator()(const MachORebaseRun& run) { rebaser->applyRebaseRun(run, *pointersInData); }
+	};
+	RunHandler handler = { this, &pointersInData };
 	const uint8_t* p = &fLinkEditBase[fDyldInfo->rebase_off()];
 	const uint8_t* end = &p[fDyldInfo->rebase_size()];
-	
-	uint8_t type = 0;
-	int segIndex;
-	uint64_t segOffset = 0;
-	uint32_t count;
-	uint32_t skip;
-	bool done = false;
-	while ( !done && (p < end) ) {
-		uint8_t immediate = *p & REBASE_IMMEDIATE_MASK;
-		uint8_t opcode = *p & REBASE_OPCODE_MASK;
-		++p;
-		switch (opcode) {
-			case REBASE_OPCODE_DONE:
-				done = true;
-				break;
-			case REBASE_OPCODE_SET_TYPE_IMM:
-				type = immediate;
-				break;
-			case REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
-				segIndex = immediate;
-				segOffset = read_uleb128(p, end);
-				break;
-			case REBASE_OPCODE_ADD_ADDR_ULEB:
-				segOffset += read_uleb128(p, end);
-				break;
-			case REBASE_OPCODE_ADD_ADDR_IMM_SCALED:
-				segOffset += immediate*sizeof(pint_t);
-				break;
-			case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
-				for (int i=0; i < immediate; ++i) {
-					doRebase(segIndex, segOffset, type, pointersInData);
-					segOffset += sizeof(pint_t);
-				}
-				break;
-			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES:
-				count = read_uleb128(p, end);
-				for (uint32_t i=0; i < count; ++i) {
-					doRebase(segIndex, segOffset, type, pointersInData);
-					segOffset += sizeof(pint_t);
-				}
-				break;
-			case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
-				doRebase(segIndex, segOffset, type, pointersInData);
-				segOffset += read_uleb128(p, end) + sizeof(pint_t);
-				break;
-			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB:
-				count = read_uleb128(p, end);
-				skip = read_uleb128(p, end);
-				for (uint32_t i=0; i < count; ++i) {
-					doRebase(segIndex, segOffset, type, pointersInData);
-					segOffset += skip + sizeof(pint_t);
-				}
-				break;
-			default:
-				throwf("bad rebase opcode %d", *p);
-		}
-	}	
+	forEachRebaseRun<P>(p, end, handler);
 }
 
 template <>
@@ -36,6 +36,7 @@
 #include <mach-o/fat.h>
 #include <mach-o/arch.h>
 #include <mach-o/loader.h>
+#include <time.h>
 #include <Availability.h>
 
 #define NO_ULEB 
@@ -106,8 +107,42 @@ private:
 };
 
 
+// Builds the string pool of an extracted dylib. The symbols of a dylib in the
+// cache point into one string pool shared by all dylibs, and many of them,
+// like an N_INDR re-export and the symbol it names, use the same string, so
+// each string is copied only once.
+class StringPool {
+public:
+								StringPool() : _strings(1, '\0') { _offsets[""] = 0; } // first pool entry is always empty string
+	uint32_t					add(const char* str);
+	void						align(size_t alignment) { while ( (_strings.size() % alignment) != 0 ) _strings.push_back('\0'); }
+	uint32_t					size() const { return (uint32_t)_strings.size(); }
+	std::vector<char>::const_iterator begin() const { return _strings.begin(); }
+	std::vector<char>::const_iterator end() const { return _strings.end(); }
+private:
+	typedef std::unordered_map<const char*, uint32_t, CStringHash, CStringEquals> StringToOffset;
+	std::vector<char>			_strings;
+	StringToOffset				_offsets;
+};
+
+uint32_t StringPool::add(const char* str)
+{
+	StringToOffset::iterator pos = _offsets.find(str);
+	if ( pos != _offsets.end() )
+		return pos->second;
+	uint32_t offset = (uint32_t)_strings.size();
+	_strings.insert(_strings.end(), str, str+strlen(str)+1);
+	_offsets[str] = offset;
+	return offset;
+}
+
+
+// Updates the load commands at mh, a copy of those of a dylib in the cache, for
+// a stand-alone dylib, and builds its new LINKEDIT content in newLinkEdit, which
+// goes at file offset newLinkEditOffset.
 template <typename A>
-int optimize_linkedit(macho_header<typename A::P>* mh, uint64_t textOffsetInCache, const void* mapped_cache, uint64_t* newSize) 
+int optimize_linkedit(macho_header<typename A::P>* mh, uint64_t textOffsetInCache, const void* mapped_cache, 
+						std::vector<uint8_t>& newLinkEdit, uint64_t* newLinkEditOffset, uint64_t* newSize) 
 {
 	typedef typename A::P P;
 	typedef typename A::P::E E;
@@ -206,20 +241,15 @@ int optimize_linkedit(macho_header<typename A::P>* mh, uint64_t textOffsetInCach
 		return -1;
 	}
 
-	const uint64_t newFunctionStartsOffset = linkEditSegCmd->fileoff();
+	const uint64_t linkEditOffset = linkEditSegCmd->fileoff();
+	const uint64_t newFunctionStartsOffset = linkEditOffset;
 	uint32_t functionStartsSize = 0;
-	if ( functionStarts != NULL ) {
-		// copy function starts from original cache file to new mapped dylib file
+	if ( functionStarts != NULL )
 		functionStartsSize = functionStarts->datasize();
-		memcpy((char*)mh + newFunctionStartsOffset, (char*)mapped_cache + functionStarts->dataoff(), functionStartsSize);
-	}
 	const uint64_t newDataInCodeOffset = (newFunctionStartsOffset + functionStartsSize + sizeof(pint_t) - 1) & (-sizeof(pint_t)); // pointer align
 	uint32_t dataInCodeSize = 0;
-	if ( dataInCode != NULL ) {
-		// copy data-in-code info from original cache file to new mapped dylib file
+	if ( dataInCode != NULL )
 		dataInCodeSize = dataInCode->datasize();
-		memcpy((char*)mh + newDataInCodeOffset, (char*)mapped_cache + dataInCode->dataoff(), dataInCodeSize);
-	}
 
 	std::vector<mach_o::trie::Entry> exports;
 	if ( exportsTrieSize != 0 ) {
@@ -268,47 +298,49 @@ int optimize_linkedit(macho_header<typename A::P>* mh, uint64_t textOffsetInCach
 	// add room for N_INDR symbols for re-exported symbols
 	newSymCount += exports.size();
 
-	// copy symbol entries and strings from original cache file to new mapped dylib file
+	// everything before the string pool has a known size, the pool is appended once built
 	const uint64_t newSymTabOffset = (newDataInCodeOffset + dataInCodeSize + sizeof(pint_t) - 1) & (-sizeof(pint_t)); // pointer align
 	const uint64_t newIndSymTabOffset = newSymTabOffset + newSymCount*sizeof(macho_nlist<P>);
 	const uint64_t newStringPoolOffset = newIndSymTabOffset + dynamicSymTab->nindirectsyms()*sizeof(uint32_t);
-	macho_nlist<P>* const newSymTabStart = (macho_nlist<P>*)(((uint8_t*)mh) + newSymTabOffset);
-	char* const newStringPoolStart = (char*)mh + newStringPoolOffset;
+	newLinkEdit.assign(newStringPoolOffset - linkEditOffset, 0);
+	uint8_t* const newLinkEditStart = &newLinkEdit[0];
+
+	// copy function starts and data-in-code info from original cache file to new linkedit
+	if ( functionStarts != NULL )
+		memcpy(&newLinkEditStart[newFunctionStartsOffset - linkEditOffset], (char*)mapped_cache + functionStarts->dataoff(), functionStartsSize);
+	if ( dataInCode != NULL )
+		memcpy(&newLinkEditStart[newDataInCodeOffset - linkEditOffset], (char*)mapped_cache + dataInCode->dataoff(), dataInCodeSize);
+
+	// copy symbol entries and strings from original cache file to new linkedit
+	macho_nlist<P>* const newSymTabStart = (macho_nlist<P>*)&newLinkEditStart[newSymTabOffset - linkEditOffset];
 	const uint32_t* mergedIndSymTab = (uint32_t*)((char*)mapped_cache + dynamicSymTab->indirectsymoff());
 	const char* mergedStringPoolStart = (char*)mapped_cache + symtab->stroff();
 	const char* mergedStringPoolEnd = &mergedStringPoolStart[symtab->strsize()];
 	macho_nlist<P>* t = newSymTabStart;
-	int poolOffset = 0;
+	StringPool pool;
 	uint32_t symbolsCopied = 0;
-	newStringPoolStart[poolOffset++] = '\0'; // first pool entry is always empty string
 	for (const macho_nlist<P>* s = mergedSymTabStart; s != mergedSymTabend; ++s) {
 		// if we have better local symbol info, skip any locals here
 		if ( (localNlists != NULL) && ((s->n_type() & (N_TYPE|N_EXT)) == N_SECT) ) 
 			continue;
 		*t = *s;
-		t->set_n_strx(poolOffset);
 		const char* symName = &mergedStringPoolStart[s->n_strx()];
 		if ( symName > mergedStringPoolEnd )
 			symName = "<corrupt symbol name>";
-		strcpy(&newStringPoolStart[poolOffset], symName);
-		poolOffset += (strlen(symName) + 1);
+		t->set_n_strx(pool.add(symName));
 		++t;
 		++symbolsCopied;
 	}
 	// <rdar://problem/16529213> recreate N_INDR symbols in extracted dylibs for debugger
 	for (std::vector<mach_o::trie::Entry>::iterator it = exports.begin(); it != exports.end(); ++it) {
-		strcpy(&newStringPoolStart[poolOffset], it->name);
-		t->set_n_strx(poolOffset);
-		poolOffset += (strlen(it->name) + 1);
+		t->set_n_strx(pool.add(it->name));
 		t->set_n_type(N_INDR | N_EXT);
 		t->set_n_sect(0);
 		t->set_n_desc(0);
 		const char* importName = it->importName;
 		if ( *importName == '\0' )
 			importName = it->name;
-		strcpy(&newStringPoolStart[poolOffset], importName);
-		t->set_n_value(poolOffset);
-		poolOffset += (strlen(importName) + 1);
+		t->set_n_value(pool.add(importName));
 		++t;
 		++symbolsCopied;
 	}
@@ -322,9 +354,7 @@ int optimize_linkedit(macho_header<typename A::P>* mh, uint64_t textOffsetInCach
 			if ( localName > localStringsEnd )
 				localName = "<corrupt local symbol name>";
 			*t = localNlists[i];
-			t->set_n_strx(poolOffset);
-			strcpy(&newStringPoolStart[poolOffset], localName);
-			poolOffset += (strlen(localName) + 1);
+			t->set_n_strx(pool.add(localName));
 			++t;
 			++symbolsCopied;
 		}
@@ -335,12 +365,13 @@ int optimize_linkedit(macho_header<typename A::P>* mh, uint64_t textOffsetInCach
 		return -1;
 	}
 	
-	// pointer align string pool size
-	while ( (poolOffset % sizeof(pint_t)) != 0 )
-		++poolOffset; 
 	// copy indirect symbol table
-	uint32_t* newIndSymTab = (uint32_t*)((char*)mh + newIndSymTabOffset);
+	uint32_t* newIndSymTab = (uint32_t*)&newLinkEditStart[newIndSymTabOffset - linkEditOffset];
 	memcpy(newIndSymTab, mergedIndSymTab, dynamicSymTab->nindirectsyms()*sizeof(uint32_t));
+
+	// pointer align string pool size and append it
+	pool.align(sizeof(pint_t));
+	newLinkEdit.insert(newLinkEdit.end(), pool.begin(), pool.end());
 	
 	// update load commands
 	if ( functionStarts != NULL ) {
@@ -354,7 +385,7 @@ int optimize_linkedit(macho_header<typename A::P>* mh, uint64_t textOffsetInCach
 	symtab->set_nsyms(symbolsCopied);
 	symtab->set_symoff((uint32_t)newSymTabOffset);
 	symtab->set_stroff((uint32_t)newStringPoolOffset);
-	symtab->set_strsize(poolOffset);
+	symtab->set_strsize(pool.size());
 	dynamicSymTab->set_extreloff(0);
 	dynamicSymTab->set_nextrel(0);
 	dynamicSymTab->set_locreloff(0);
@@ -364,6 +395,7 @@ int optimize_linkedit(macho_header<typename A::P>* mh, uint64_t textOffsetInCach
 	linkEditSegCmd->set_vmsize( (linkEditSegCmd->filesize()+4095) & (-4096) );
 	
 	// return new size
+	*newLinkEditOffset = linkEditOffset;
 	*newSize = (symtab->stroff()+symtab->strsize()+4095) & (-4096);
 	
 	// <rdar://problem/17671438> Xcode 6 leaks in dyld_shared_cache_extract_dylibs
@@ -402,90 +434,141 @@ static void make_dirs(const char* file_path)
 
 
 
+static bool write_all(int fd, const void* buffer, uint64_t size, uint64_t offset)
+{
+	const uint8_t* p = (const uint8_t*)buffer;
+	while ( size != 0 ) {
+		// pwrite() may write less than asked, and fails for sizes above INT_MAX
+		ssize_t amount = pwrite(fd, p, (size_t)std::min(size, (uint64_t)0x40000000), offset);
+		if ( amount <= 0 )
+			return false;
+		p += amount;
+		size -= amount;
+		offset += amount;
+	}
+	return true;
+}
+
+
+// Writes one dylib into fd, appending it to the fat file already there, if any.
+// Segments are written straight from the mapped cache, only the load commands
+// and the new LINKEDIT are built in memory. Returns the number of bytes written,
+// which is 0 if the file already has this architecture, or -1 on error.
 template <typename A>
-size_t dylib_maker(const void* mapped_cache, std::vector<uint8_t> &dylib_data, const std::vector<seg_info>& segments) {		
+int64_t dylib_writer(const void* mapped_cache, int fd, const char* dylib_path, const std::vector<seg_info>& segments)
+{
 	typedef typename A::P P;
-    
-    size_t  additionalSize  = 0;
-	for(std::vector<seg_info>::const_iterator it=segments.begin(); it != segments.end(); ++it) {
-		additionalSize                          += it->sizem;
+
+	uint8_t		fatPage[4096];
+	fat_header*	fh					= reinterpret_cast<fat_header*>(fatPage);
+	fat_arch*	archs				= reinterpret_cast<fat_arch*>(fatPage + sizeof(fat_header));
+	uint32_t	nfat_archs			= 0;
+	uint64_t	offsetInFatFile		= 4096;
+
+	struct stat statbuf;
+	if ( fstat(fd, &statbuf) != 0 ) {
+		fprintf(stderr, "Error: stat failed for dyld file %s, errnor=%d\n", dylib_path, errno);
+		return -1;
 	}
-    
-    dylib_data.reserve(dylib_data.size() + additionalSize);
-    
-    uint32_t                nfat_archs          = 0;
-	uint32_t                offsetInFatFile     = 4096;
-    uint8_t                 *base_ptr           = &dylib_data.front();
-	    
-#define FH reinterpret_cast<fat_header*>(base_ptr)
-#define FA reinterpret_cast<fat_arch*>(base_ptr + (8 + (nfat_archs - 1) * sizeof(fat_arch)))
-    
-    if(dylib_data.size() >= 4096 && OSSwapBigToHostInt32(FH->magic) == FAT_MAGIC) {
+	if ( (statbuf.st_size >= 4096) && (pread(fd, fatPage, 4096, 0) == 4096) && (OSSwapBigToHostInt32(fh->magic) == FAT_MAGIC) ) {
 		// have fat header, append new arch to end
-        nfat_archs                              = OSSwapBigToHostInt32(FH->nfat_arch);
-		offsetInFatFile                         = OSSwapBigToHostInt32(FA->offset) + OSSwapBigToHostInt32(FA->size);
-    }
-    
-    dylib_data.resize(offsetInFatFile);
-    base_ptr                                    = &dylib_data.front();
-    
-    FH->magic                                   = OSSwapHostToBigInt32(FAT_MAGIC);
-    FH->nfat_arch                               = OSSwapHostToBigInt32(++nfat_archs);
-    
-    FA->cputype                                 = 0; // filled in later
-    FA->cpusubtype                              = 0; // filled in later
-    FA->offset                                  = OSSwapHostToBigInt32(offsetInFatFile);
-    FA->size                                    = 0; // filled in later
-    FA->align                                   = OSSwapHostToBigInt32(12);
-    
-	// Write regular segments into the buffer
-	uint64_t                totalSize           = 0;
-    uint64_t				textOffsetInCache	= 0;
-	for( std::vector<seg_info>::const_iterator it=segments.begin(); it != segments.end(); ++it) {
-        
-        if(strcmp(it->segName, "__TEXT") == 0 ) {
-			textOffsetInCache					= it->offset;
-            const macho_header<P>   *textMH     = reinterpret_cast<macho_header<P>*>((uint8_t*)mapped_cache+textOffsetInCache);
-            FA->cputype                         = OSSwapHostToBigInt32(textMH->cputype()); 
-            FA->cpusubtype                      = OSSwapHostToBigInt32(textMH->cpusubtype());
-            
-            // if this cputype/subtype already exist in fat header, then return immediately
-            for(uint32_t i=0; i < nfat_archs-1; ++i) {
-                fat_arch            *afa        = reinterpret_cast<fat_arch*>(base_ptr+8)+i;
-                
-                if(   afa->cputype == FA->cputype
-                   && afa->cpusubtype == FA->cpusubtype) {
-                    //fprintf(stderr, "arch already exists in fat dylib\n");
-                    dylib_data.resize(offsetInFatFile);
-                    return offsetInFatFile;
-                }
-            }
+		nfat_archs = OSSwapBigToHostInt32(fh->nfat_arch);
+		if ( (nfat_archs == 0) || (sizeof(fat_header) + (nfat_archs+1)*sizeof(fat_arch) > sizeof(fatPage)) ) {
+			fprintf(stderr, "Error: bad fat header in dylib file %s\n", dylib_path);
+			return -1;
 		}
-        
-		//printf("segName=%s, offset=0x%llX, size=0x%0llX\n", it->segName, it->offset, it->sizem);
-        std::copy(((uint8_t*)mapped_cache)+it->offset, ((uint8_t*)mapped_cache)+it->offset+it->sizem, std::back_inserter(dylib_data));
-        base_ptr                                = &dylib_data.front();
-        totalSize                               += it->sizem;
+		offsetInFatFile = OSSwapBigToHostInt32(archs[nfat_archs-1].offset) + OSSwapBigToHostInt32(archs[nfat_archs-1].size);
+	}
+	else {
+		bzero(fatPage, sizeof(fatPage));
 	}
-    
-	FA->size                                    = OSSwapHostToBigInt32(totalSize); 
-    
-	// optimize linkedit
-	uint64_t                newSize             = dylib_data.size();
-	optimize_linkedit<A>(((macho_header<P>*)(base_ptr+offsetInFatFile)), textOffsetInCache, mapped_cache, &newSize);
-	
-	// update fat header with new file size
-    dylib_data.resize(offsetInFatFile+newSize);
-    base_ptr                                    = &dylib_data.front();
-	FA->size                                    = OSSwapHostToBigInt32(newSize);
-#undef FH
-#undef FA
-	return offsetInFatFile;
-} 
 
+	uint64_t textOffsetInCache = 0;
+	uint64_t textSize = 0;
+	for (std::vector<seg_info>::const_iterator it=segments.begin(); it != segments.end(); ++it) {
+		if ( strcmp(it->segName, "__TEXT") == 0 ) {
+			textOffsetInCache = it->offset;
+			textSize = it->sizem;
+		}
+	}
+	const macho_header<P>* textMH = reinterpret_cast<const macho_header<P>*>((uint8_t*)mapped_cache+textOffsetInCache);
+	const uint64_t headerSize = sizeof(macho_header<P>) + textMH->sizeofcmds();
+	if ( (textSize == 0) || (headerSize > textSize) ) {
+		fprintf(stderr, "Error: __TEXT not found for %s\n", dylib_path);
+		return -1;
+	}
 
-int dyld_shared_cache_extract_dylibs_progress(const char* shared_cache_file_path, const char* extraction_root_path,
-													void (^progress)(unsigned current, unsigned total))
+	// if this cputype/subtype already exist in fat header, then return immediately
+	for (uint32_t i=0; i < nfat_archs; ++i) {
+		if (   (OSSwapBigToHostInt32(archs[i].cputype) == textMH->cputype())
+			&& (OSSwapBigToHostInt32(archs[i].cpusubtype) == textMH->cpusubtype()) ) {
+			//fprintf(stderr, "arch already exists in fat dylib\n");
+			return 0;
+		}
+	}
+
+	// optimize linkedit, in a copy of the load commands
+	std::vector<uint8_t>	header((uint8_t*)textMH, (uint8_t*)textMH + headerSize);
+	std::vector<uint8_t>	linkEdit;
+	uint64_t				linkEditOffset;
+	uint64_t				newSize;
+	if ( optimize_linkedit<A>((macho_header<P>*)&header[0], textOffsetInCache, mapped_cache, linkEdit, &linkEditOffset, &newSize) != 0 )
+		return -1;
+
+	// write regular segments, one after the other, then the new linkedit
+	int64_t  bytesWritten = 0;
+	uint64_t segOffset = 0;
+	bool     ok = true;
+	for (std::vector<seg_info>::const_iterator it=segments.begin(); ok && (it != segments.end()); ++it) {
+		if ( strcmp(it->segName, "__LINKEDIT") == 0 )
+			continue;
+		const uint8_t*	src			= (uint8_t*)mapped_cache + it->offset;
+		uint64_t		size		= it->sizem;
+		uint64_t		fileOffset	= offsetInFatFile + segOffset;
+		if ( it->offset == textOffsetInCache ) {
+			ok = write_all(fd, &header[0], headerSize, fileOffset);
+			src += headerSize;
+			size -= headerSize;
+			fileOffset += headerSize;
+		}
+		ok = ok && write_all(fd, src, size, fileOffset);
+		segOffset += it->sizem;
+		bytesWritten += it->sizem;
+	}
+	ok = ok && write_all(fd, &linkEdit[0], linkEdit.size(), offsetInFatFile + linkEditOffset);
+	bytesWritten += linkEdit.size();
+	// zero fill the rest of the last page
+	ok = ok && (ftruncate(fd, offsetInFatFile + newSize) == 0);
+
+	// add arch to fat header last, so it only ever points to complete slices
+	fat_arch* fa	= &archs[nfat_archs];
+	fa->cputype		= OSSwapHostToBigInt32(textMH->cputype());
+	fa->cpusubtype	= OSSwapHostToBigInt32(textMH->cpusubtype());
+	fa->offset		= OSSwapHostToBigInt32((uint32_t)offsetInFatFile);
+	fa->size		= OSSwapHostToBigInt32((uint32_t)newSize);
+	fa->align		= OSSwapHostToBigInt32(12);
+	fh->magic		= OSSwapHostToBigInt32(FAT_MAGIC);
+	fh->nfat_arch	= OSSwapHostToBigInt32(nfat_archs+1);
+	ok = ok && write_all(fd, fatPage, sizeof(fatPage), 0);
+	if ( !ok ) {
+		fprintf(stderr, "error writing %s, errnor=%d\n", dylib_path, errno);
+		return -1;
+	}
+	return bytesWritten + sizeof(fatPage);
+}
+
+
+// clock_gettime() rather than mach_absolute_time(), so this also builds for Linux hosts
+static uint64_t monotonic_nanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+int dyld_shared_cache_extract_dylibs_parallel(const char* shared_cache_file_path, const char* extraction_root_path, unsigned worker_count,
+											void (^progress)(const struct dyld_shared_cache_extract_progress* info))
 {
 	struct stat statbuf;
 	if (stat(shared_cache_file_path, &statbuf)) {
@@ -507,24 +590,24 @@ int dyld_shared_cache_extract_dylibs_progress(const char* shared_cache_file_path
     
     close(cache_fd);
 
-	// instantiate arch specific dylib maker
-    size_t (*dylib_create_func)(const void*, std::vector<uint8_t>&, const std::vector<seg_info>&) = NULL;
+	// instantiate arch specific dylib writer
+    int64_t (*dylib_create_func)(const void*, int, const char*, const std::vector<seg_info>&) = NULL;
 	     if ( strcmp((char*)mapped_cache, "dyld_v1    i386") == 0 ) 
-		dylib_create_func = dylib_maker<x86>;
+		dylib_create_func = dylib_writer<x86>;
 	else if ( strcmp((char*)mapped_cache, "dyld_v1  x86_64") == 0 ) 
-		dylib_create_func = dylib_maker<x86_64>;
+		dylib_create_func = dylib_writer<x86_64>;
 	else if ( strcmp((char*)mapped_cache, "dyld_v1 x86_64h") == 0 ) 
-		dylib_create_func = dylib_maker<x86_64>;
+		dylib_create_func = dylib_writer<x86_64>;
 	else if ( strcmp((char*)mapped_cache, "dyld_v1   armv5") == 0 ) 
-		dylib_create_func = dylib_maker<arm>;
+		dylib_create_func = dylib_writer<arm>;
 	else if ( strcmp((char*)mapped_cache, "dyld_v1   armv6") == 0 ) 
-		dylib_create_func = dylib_maker<arm>;
+		dylib_create_func = dylib_writer<arm>;
 	else if ( strcmp((char*)mapped_cache, "dyld_v1   armv7") == 0 ) 
-		dylib_create_func = dylib_maker<arm>;
+		dylib_create_func = dylib_writer<arm>;
 	else if ( strncmp((char*)mapped_cache, "dyld_v1  armv7", 14) == 0 ) 
-		dylib_create_func = dylib_maker<arm>;
+		dylib_create_func = dylib_writer<arm>;
 	else if ( strcmp((char*)mapped_cache, "dyld_v1   arm64") == 0 ) 
-		dylib_create_func = dylib_maker<arm64>;
+		dylib_create_func = dylib_writer<arm64>;
 	else {
 		fprintf(stderr, "Error: unrecognized dyld shared cache magic.\n");
         munmap(mapped_cache, statbuf.st_size);
@@ -543,13 +626,22 @@ int dyld_shared_cache_extract_dylibs_progress(const char* shared_cache_file_path
 		return result;
     }
 
+	// each worker only holds the load commands and LINKEDIT of one dylib, so default to one per cpu
+	if ( worker_count == 0 ) {
+		long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+		worker_count = (cpuCount > 0) ? (unsigned)cpuCount : 1;
+	}
+
 	// for each dylib instantiate a dylib file
     dispatch_group_t        group               = dispatch_group_create();
-    dispatch_semaphore_t    sema                = dispatch_semaphore_create(2);
+    dispatch_semaphore_t    sema                = dispatch_semaphore_create(worker_count);
     dispatch_queue_t        process_queue       = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0);
-    dispatch_queue_t        writer_queue        = dispatch_queue_create("dyld writer queue", 0);
+    dispatch_queue_t        progress_queue      = dispatch_queue_create("dyld progress queue", 0);
     
-	__block unsigned        count               = 0;
+	__block dyld_shared_cache_extract_progress info;
+	bzero(&info, sizeof(info));
+	info.total = (unsigned)map.size();
+	const uint64_t          startTime           = monotonic_nanoseconds();
     
 	for ( NameToSegments::iterator it = map.begin(); it != map.end(); ++it) {
 		dispatch_semaphore_wait(sema, DISPATCH_TIME_FOREVER);
@@ -565,59 +657,47 @@ int dyld_shared_cache_extract_dylibs_progress(const char* shared_cache_file_path
             make_dirs(dylib_path);
             
             // open file, create if does not already exist
+            int64_t written = -1;
             int fd = ::open(dylib_path, O_CREAT | O_EXLOCK | O_RDWR, 0644);
             if ( fd == -1 ) {
                 fprintf(stderr, "can't open or create dylib file %s, errnor=%d\n", dylib_path, errno);
-                result    = -1;
-                return;
             }
-            
-            struct stat statbuf;
-            if (fstat(fd, &statbuf)) {
-                fprintf(stderr, "Error: stat failed for dyld file %s, errnor=%d\n", dylib_path, errno);
+            else {
+                written = dylib_create_func(mapped_cache, fd, dylib_path, it->second);
                 close(fd);
-                result    = -1;
-                return;
             }
             
-            std::vector<uint8_t> *vec   = new std::vector<uint8_t>(statbuf.st_size);
-            if(pread(fd, &vec->front(), vec->size(), 0) != (long)vec->size()) {
-                fprintf(stderr, "can't read dylib file %s, errnor=%d\n", dylib_path, errno);
-                close(fd);
-                result    = -1;
-                return;
-            }
-            
-            const size_t    offset  = dylib_create_func(mapped_cache, *vec, it->second);
-            
-            dispatch_group_async(group, writer_queue, ^{
-                progress(count++, (unsigned)map.size());
-                
-                if(offset != vec->size()) {
-                    //Write out the first page, and everything after offset
-                    if(   pwrite(fd, &vec->front(), 4096, 0) == -1 
-                       || pwrite(fd, &vec->front() + offset, vec->size() - offset, offset) == -1) {
-                        fprintf(stderr, "error writing, errnor=%d\n", errno);
-                        result    = -1;
-                    }
-                }
-                
-                delete vec;
-                close(fd);
-                dispatch_semaphore_signal(sema);
+            dispatch_sync(progress_queue, ^{
+                if ( written < 0 )
+                    result = -1;
+                else
+                    info.bytesWritten += written;
+                ++info.current;
+                info.elapsedNanoseconds = monotonic_nanoseconds() - startTime;
+                progress(&info);
             });
+            dispatch_semaphore_signal(sema);
         });
 	}
     
     dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
     dispatch_release(group);
-    dispatch_release(writer_queue);
+    dispatch_release(sema);
+    dispatch_release(progress_queue);
     
     munmap(mapped_cache, statbuf.st_size);
 	return result;
 }
 
 
+int dyld_shared_cache_extract_dylibs_progress(const char* shared_cache_file_path, const char* extraction_root_path,
+													void (^progress)(unsigned current, unsigned total))
+{
+	return dyld_shared_cache_extract_dylibs_parallel(shared_cache_file_path, extraction_root_path, 0,
+													^(const dyld_shared_cache_extract_progress* info) { progress(info->current-1, info->total); } );
+}
+
+
 
 int dyld_shared_cache_extract_dylibs(const char* shared_cache_file_path, const char* extraction_root_path)
 {
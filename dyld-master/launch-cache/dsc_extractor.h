@@ -35,6 +35,18 @@ extern int dyld_shared_cache_extract_dylibs(const char* shared_cache_file_path,
 extern int dyld_shared_cache_extract_dylibs_progress(const char* shared_cache_file_path, const char* extraction_root_path,
 													void (^progress)(unsigned current, unsigned total));
 
+struct dyld_shared_cache_extract_progress {
+	unsigned	current;				// dylibs done so far
+	unsigned	total;
+	uint64_t	bytesWritten;			// so far, by all dylibs
+	uint64_t	elapsedNanoseconds;		// since extraction started
+};
+
+// Extracts dylibs on up to worker_count threads at once, or one per cpu if worker_count is 0.
+// progress is called after each dylib, never on two threads at once.
+extern int dyld_shared_cache_extract_dylibs_parallel(const char* shared_cache_file_path, const char* extraction_root_path, unsigned worker_count,
+													void (^progress)(const struct dyld_shared_cache_extract_progress* info));
+
 #ifdef __cplusplus
 }
 #endif 
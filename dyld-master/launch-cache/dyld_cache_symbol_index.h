@@ -0,0 +1,113 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*- 
+ *
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+#ifndef __DYLD_CACHE_SYMBOL_INDEX__
+#define __DYLD_CACHE_SYMBOL_INDEX__
+
+#include <stdint.h>
+
+//
+// A symbol index is a sidecar file for a dyld shared cache, written by
+// "dyld_shared_cache_util -build-index", that is used by mapping it, without
+// parsing anything. It has every symbol defined in a section by the dylibs
+// in the cache, globals and locals, with their unslid addresses.
+//
+// Symbols are sorted by address, so the symbol for an address is a binary
+// search. Mach-o symbols have no size, so a symbol's size is the distance to
+// the next higher symbol, cut off at the end of its section, and an address
+// past that is in no symbol. Names are found with a minimal-ish perfect hash:
+// the hash of a name picks a bucket, the bucket's seed picks the name's slot,
+// and the slot has the first of the symbols with that name in the by-name
+// order. Symbols with the same name, from different dylibs, are next to each
+// other there. A name not in the index still lands on some slot, so the name
+// there must be compared.
+//
+// All offsets are from the start of the file and 8 byte aligned, and all
+// values are in the byte order of the host that built the index.
+//
+
+#define DYLD_CACHE_SYMBOL_INDEX_MAGIC	"dsc_symindex_v2"
+#define DYLD_CACHE_SYMBOL_INDEX_SUFFIX	".symbolindex"
+#define DYLD_CACHE_SYMBOL_INDEX_NO_SLOT	0xFFFFFFFF
+
+struct dyld_cache_symbol_index_header
+{
+	char		magic[16];				// DYLD_CACHE_SYMBOL_INDEX_MAGIC
+	uint8_t		cacheUUID[16];			// uuid of the cache the index was built from
+	uint32_t	dylibCount;
+	uint32_t	symbolCount;
+	uint32_t	bucketCount;
+	uint32_t	slotCount;
+	uint64_t	dylibsOffset;			// dyld_cache_symbol_index_dylib[dylibCount]
+	uint64_t	symbolsOffset;			// dyld_cache_symbol_index_symbol[symbolCount], sorted by address
+	uint64_t	byNameOffset;			// uint32_t[symbolCount], symbol indexes sorted by name
+	uint64_t	seedsOffset;			// uint32_t[bucketCount]
+	uint64_t	slotsOffset;			// uint32_t[slotCount], index into by-name order, or DYLD_CACHE_SYMBOL_INDEX_NO_SLOT
+	uint64_t	stringsOffset;			// names and paths, each string once
+	uint64_t	stringsSize;
+};
+
+struct dyld_cache_symbol_index_dylib
+{
+	uint64_t	textAddress;			// unslid address of the mach header
+	uint32_t	pathOffset;				// into strings
+	uint32_t	padding;
+};
+
+struct dyld_cache_symbol_index_symbol
+{
+	uint64_t	address;				// unslid
+	uint64_t	size;
+	uint32_t	nameOffset;				// into strings
+	uint32_t	dylibIndex;
+};
+
+
+// 64-bit FNV-1a of a name, with the bits mixed so that both halves can be used
+static inline uint64_t dyld_cache_symbol_index_hash(const char* name)
+{
+	uint64_t h = 0xCBF29CE484222325ULL;
+	for (const char* s=name; *s != '\0'; ++s)
+		h = (h ^ (uint8_t)*s) * 0x100000001B3ULL;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static inline uint32_t dyld_cache_symbol_index_bucket(uint64_t hash, uint32_t bucketCount)
+{
+	return (uint32_t)((hash >> 32) % bucketCount);
+}
+
+static inline uint32_t dyld_cache_symbol_index_slot(uint64_t hash, uint32_t seed, uint32_t slotCount)
+{
+	uint64_t h = hash ^ (seed * 0x9E3779B97F4A7C15ULL);
+	h ^= h >> 29;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 32;
+	return (uint32_t)(h % slotCount);
+}
+
+
+#endif // __DYLD_CACHE_SYMBOL_INDEX__
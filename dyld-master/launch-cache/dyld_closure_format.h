@@ -0,0 +1,112 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef __DYLD_CLOSURE_FORMAT__
+#define __DYLD_CLOSURE_FORMAT__
+
+#include <stdint.h>
+
+//
+// A launch closure records how a program's launch was linked, so that dyld
+// can redo it without searching for dylibs or looking up symbols. It is
+// written by "dyld_closure_util -build" and used by dyld when named in
+// DYLD_LAUNCH_CLOSURE.
+//
+// Image 0 is the main executable, the others are in the order dyld loads
+// them. Each image has the (device, inode, mtime) of its file, checked by
+// dyld before the closure is used, the path dyld opens it by, and for each
+// of its LC_LOAD_* commands the image that name was found to be. Its non-lazy
+// binds are kept as the location, a segment index and offset, and the target,
+// an image index, segment index and offset from the start of that segment
+// with the addend already added. Lazy and weak binds are not kept, dyld still
+// does those.
+//
+// A target is only used as recorded if the image dyld loaded has the uuid in
+// the closure and was not loaded from the dyld shared cache, whose dylibs
+// have their segments laid out differently than the files on disk. Otherwise
+// dyld looks the symbol up again, by the name, ordinal, flags and addend kept
+// with the bind. If any interposing is registered dyld ignores the binds of
+// the closure, as interposing must be applied to each bound value.
+//
+// All offsets are from the start of the file and 8 byte aligned, and all
+// values are in the byte order of the host that built the closure.
+//
+// A dylib newly placed earlier in a search path than the one recorded is not
+// noticed, so closures must be rebuilt when software is installed.
+//
+
+#define DYLD_CLOSURE_MAGIC				"dyld_closure_v2"
+#define DYLD_CLOSURE_SUFFIX				".closure"
+#define DYLD_CLOSURE_NO_IMAGE			0xFFFFFFFF		// dependent was a missing weak dylib
+#define DYLD_CLOSURE_ABSOLUTE			0xFFFFFFFE		// bind target is targetOffset itself
+
+struct dyld_closure_header
+{
+	char		magic[16];				// DYLD_CLOSURE_MAGIC
+	uint32_t	cputype;
+	uint32_t	imageCount;
+	uint32_t	dependentCount;
+	uint32_t	bindCount;
+	uint64_t	imagesOffset;			// dyld_closure_image[imageCount]
+	uint64_t	dependentsOffset;		// dyld_closure_dependent[dependentCount]
+	uint64_t	bindsOffset;			// dyld_closure_bind[bindCount]
+	uint64_t	stringsOffset;			// paths, install names and symbol names, each string once
+	uint64_t	stringsSize;
+};
+
+struct dyld_closure_image
+{
+	uint64_t	device;
+	uint64_t	inode;
+	uint64_t	mtime;
+	uint8_t		uuid[16];				// all zero if the image has no LC_UUID
+	uint32_t	pathOffset;				// into strings
+	uint32_t	firstDependent;
+	uint32_t	dependentCount;			// one per LC_LOAD_* command, in order
+	uint32_t	firstBind;
+	uint32_t	bindCount;
+	uint32_t	padding;
+};
+
+struct dyld_closure_dependent
+{
+	uint32_t	nameOffset;				// into strings, as in the load command
+	uint32_t	imageIndex;				// or DYLD_CLOSURE_NO_IMAGE
+};
+
+struct dyld_closure_bind
+{
+	uint64_t	segOffset;				// location, from the start of segment segIndex
+	uint64_t	targetSegOffset;		// from the start of the target's segment targetSegIndex, addend included
+	int64_t		addend;
+	uint32_t	segIndex;
+	uint32_t	targetImage;			// or DYLD_CLOSURE_ABSOLUTE, then targetSegOffset is the value
+	uint32_t	targetSegIndex;
+	uint32_t	symbolNameOffset;		// into strings
+	int32_t		libraryOrdinal;			// as in the bind opcodes
+	uint32_t	symbolFlags;			// BIND_SYMBOL_FLAGS_*
+};
+
+
+#endif // __DYLD_CLOSURE_FORMAT__
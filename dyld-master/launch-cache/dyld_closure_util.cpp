@@ -0,0 +1,934 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <mach/machine.h>
+#include <mach-o/loader.h>
+#include <mach-o/fat.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "Architectures.hpp"
+#include "MachOFileAbstraction.hpp"
+#include "MachOTrie.hpp"
+#include "dyld_closure_format.h"
+
+#ifndef EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE
+	#define EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE 0x02
+#endif
+
+//
+// dyld_closure_util builds, checks and prints launch closures, see
+// dyld_closure_format.h. It finds a program's dylibs and resolves its binds
+// the way dyld does at launch, but only reads files, so it runs on any host,
+// against the running system or a copy of one under -root. dev, inode and
+// mtime are taken from the files under the root, so a closure built from a
+// copy only validates where those same files are mounted.
+//
+// Programs that dyld would link differently for reasons the closure cannot
+// record are refused: flat namespace images, classic LINKEDIT, and binds
+// other than pointers in writable segments.
+//
+
+static void usage()
+{
+	fprintf(stderr, "Usage: dyld_closure_util [-root <path>] [-arch <arch>] -build <executable> [-o <closure>]\n"
+					"       dyld_closure_util [-root <path>] -validate <closure>\n"
+					"       dyld_closure_util -dump <closure> [-v]\n");
+}
+
+__attribute__((noreturn, format(printf, 1, 2)))
+static void throwf(const char* format, ...)
+{
+	va_list	list;
+	char*	p;
+	va_start(list, format);
+	vasprintf(&p, format, list);
+	va_end(list);
+	const char*	t = p;
+	throw t;
+}
+
+struct ArchInfo {
+	const char*		name;
+	cpu_type_t		cputype;
+	cpu_subtype_t	cpusubtype;		// -1 matches any
+};
+
+static const ArchInfo sArchInfos[] = {
+	{ "i386",		CPU_TYPE_I386,		-1 },
+	{ "x86_64",		CPU_TYPE_X86_64,	3 },	// CPU_SUBTYPE_X86_64_ALL
+	{ "x86_64h",	CPU_TYPE_X86_64,	8 },	// CPU_SUBTYPE_X86_64_H
+	{ "armv7",		CPU_TYPE_ARM,		9 },	// CPU_SUBTYPE_ARM_V7
+	{ "armv7s",		CPU_TYPE_ARM,		11 },	// CPU_SUBTYPE_ARM_V7S
+	{ "arm64",		CPU_TYPE_ARM64,		-1 },
+	{ NULL,			0,					0 }
+};
+
+
+//
+// One image of the closure being built
+//
+struct Dependent {
+	const char*		name;			// in the load command
+	uint32_t		cmd;			// LC_LOAD_DYLIB, LC_LOAD_WEAK_DYLIB, ...
+	uint32_t		imageIndex;		// or DYLD_CLOSURE_NO_IMAGE
+};
+
+struct Segment {
+	uint64_t		vmAddr;
+	uint64_t		vmSize;
+	bool			writable;
+};
+
+struct Bind {
+	dyld_closure_bind	bind;
+	const char*			symbolName;		// symbolNameOffset is set when the closure is written
+};
+
+typedef std::unordered_map<std::string, mach_o::trie::Entry> ExportMap;
+
+struct Image {
+	std::string					path;				// as dyld opens it, without the root
+	struct stat					statBuf;
+	const uint8_t*				mapping;
+	size_t						mappingSize;
+	const uint8_t*				mh;
+	bool						is64;
+	uint32_t					flags;
+	uint8_t						uuid[16];
+	uint64_t					textVmAddr;			// unslid address of the mach header
+	std::vector<Segment>		segments;			// as dyld counts them, without zero sized ones
+	std::vector<Dependent>		dependents;
+	std::vector<std::string>	rpaths;				// @loader_path and @executable_path expanded
+	const uint8_t*				bindStart;
+	const uint8_t*				bindEnd;
+	const uint8_t*				exportStart;
+	const uint8_t*				exportEnd;
+	bool						dependentsLoaded;
+	ExportMap*					exports;			// parsed on first lookup
+	std::vector<Bind>			binds;
+};
+
+// the rpaths dyld would search for an image's @rpath dependents, its own then its loaders'
+struct RPathChain {
+	const RPathChain*					next;
+	const std::vector<std::string>*		paths;
+};
+
+
+class ClosureBuilder
+{
+public:
+						ClosureBuilder(const char* root, const ArchInfo* arch) : fRoot(root), fArch(arch) {}
+	void				build(const char* executablePath);
+	bool				write(const char* closurePath);
+
+private:
+	std::string			rootPath(const std::string& path) const		{ return fRoot + path; }
+	uint32_t			addImage(const std::string& path, const struct stat& statBuf);
+	template <typename A>
+	void				parseImage(Image& image);
+	void				loadDependents(uint32_t index, const RPathChain* loaderRPaths);
+	uint32_t			findDependent(uint32_t loaderIndex, const Dependent& dependent, const RPathChain* rpaths);
+	bool				tryPath(const std::string& path, uint32_t& index);
+	const ExportMap&	exportsOf(uint32_t index);
+	bool				findExport(uint32_t index, const std::string& name, uint32_t& foundIn, mach_o::trie::Entry& entry, unsigned depth);
+	void				resolveBinds(uint32_t index);
+	void				addBind(uint32_t index, uint8_t segIndex, uint64_t segOffset, uint8_t type, long ordinal,
+								const char* symbolName, uint8_t symbolFlags, int64_t addend);
+
+	std::string								fRoot;
+	const ArchInfo*							fArch;
+	std::vector<Image>						fImages;
+	std::unordered_map<std::string, uint32_t>	fByFile;		// "dev:inode" to image index
+};
+
+
+static std::string directoryOf(const std::string& path)
+{
+	size_t slash = path.rfind('/');
+	return (slash == std::string::npos) ? std::string(".") : path.substr(0, slash);
+}
+
+static bool startsWith(const char* str, const char* prefix, const char*& rest)
+{
+	size_t len = strlen(prefix);
+	if ( strncmp(str, prefix, len) != 0 )
+		return false;
+	rest = str + len;
+	return true;
+}
+
+uint32_t ClosureBuilder::addImage(const std::string& path, const struct stat& statBuf)
+{
+	char key[64];
+	snprintf(key, sizeof(key), "%llu:%llu", (unsigned long long)statBuf.st_dev, (unsigned long long)statBuf.st_ino);
+	std::unordered_map<std::string, uint32_t>::iterator pos = fByFile.find(key);
+	if ( pos != fByFile.end() )
+		return pos->second;
+
+	std::string fullPath = rootPath(path);
+	int fd = ::open(fullPath.c_str(), O_RDONLY);
+	if ( fd == -1 )
+		throwf("can't open %s, errno=%d", fullPath.c_str(), errno);
+	const size_t size = (size_t)statBuf.st_size;
+	const uint8_t* mapping = (uint8_t*)::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if ( mapping == (uint8_t*)MAP_FAILED )
+		throwf("can't map %s, errno=%d", fullPath.c_str(), errno);
+
+	// pick the slice for the arch
+	const uint8_t* mh = NULL;
+	uint64_t sliceSize = 0;
+	const fat_header* fh = (fat_header*)mapping;
+	if ( (size >= sizeof(fat_header)) && (BigEndian::get32(fh->magic) == FAT_MAGIC) ) {
+		const fat_arch* archs = (fat_arch*)(mapping + sizeof(fat_header));
+		const uint32_t archCount = BigEndian::get32(fh->nfat_arch);
+		if ( sizeof(fat_header) + (uint64_t)archCount*sizeof(fat_arch) > size )
+			throwf("truncated fat header in %s", fullPath.c_str());
+		for (uint32_t i=0; i < archCount; ++i) {
+			if ( (cpu_type_t)BigEndian::get32(archs[i].cputype) != fArch->cputype )
+				continue;
+			if ( (fArch->cpusubtype != -1) && ((cpu_subtype_t)(BigEndian::get32(archs[i].cpusubtype) & ~CPU_SUBTYPE_MASK) != fArch->cpusubtype) )
+				continue;
+			const uint64_t offset = BigEndian::get32(archs[i].offset);
+			sliceSize = BigEndian::get32(archs[i].size);
+			if ( offset + sliceSize > size )
+				throwf("truncated slice in %s", fullPath.c_str());
+			mh = mapping + offset;
+			break;
+		}
+		if ( mh == NULL )
+			throwf("%s has no %s slice", fullPath.c_str(), fArch->name);
+	}
+	else {
+		mh = mapping;
+		sliceSize = size;
+	}
+	if ( sliceSize < sizeof(macho_header<Pointer32<LittleEndian> >) )
+		throwf("%s is not a mach-o file", fullPath.c_str());
+	const uint32_t magic = LittleEndian::get32(*(uint32_t*)mh);
+	if ( (magic != MH_MAGIC) && (magic != MH_MAGIC_64) )
+		throwf("%s is not a mach-o file", fullPath.c_str());
+	if ( (cpu_type_t)LittleEndian::get32(((mach_header*)mh)->cputype) != fArch->cputype )
+		throwf("%s is not %s", fullPath.c_str(), fArch->name);
+
+	const uint32_t index = (uint32_t)fImages.size();
+	fImages.push_back(Image());
+	Image& image = fImages.back();
+	image.path = path;
+	image.statBuf = statBuf;
+	image.mapping = mapping;
+	image.mappingSize = size;
+	image.mh = mh;
+	image.is64 = (magic == MH_MAGIC_64);
+	image.bindStart = image.bindEnd = NULL;
+	image.exportStart = image.exportEnd = NULL;
+	image.dependentsLoaded = false;
+	image.exports = NULL;
+	bzero(image.uuid, sizeof(image.uuid));
+	image.textVmAddr = 0;
+	if ( image.is64 )
+		parseImage<x86_64>(image);
+	else
+		parseImage<x86>(image);
+	fByFile[key] = index;
+	return index;
+}
+
+template <typename A>
+void ClosureBuilder::parseImage(Image& image)
+{
+	typedef typename A::P		P;
+	const macho_header<P>* mh = (const macho_header<P>*)image.mh;
+	image.flags = mh->flags();
+	if ( (image.flags & MH_TWOLEVEL) == 0 )
+		throwf("%s uses flat namespace", image.path.c_str());
+
+	const uint8_t* cmds = image.mh + sizeof(macho_header<P>);
+	const uint8_t* cmdsEnd = cmds + mh->sizeofcmds();
+	if ( cmdsEnd > image.mapping + image.mappingSize )
+		throwf("load commands extend beyond end of %s", image.path.c_str());
+	const macho_dyld_info_command<P>* dyldInfo = NULL;
+	const uint8_t* p = cmds;
+	for (uint32_t i=0; i < mh->ncmds(); ++i) {
+		const macho_load_command<P>* cmd = (const macho_load_command<P>*)p;
+		if ( (cmd->cmdsize() < 8) || (p + cmd->cmdsize() > cmdsEnd) )
+			throwf("malformed load command in %s", image.path.c_str());
+		switch ( cmd->cmd() ) {
+			case macho_segment_command<P>::CMD: {
+				const macho_segment_command<P>* seg = (const macho_segment_command<P>*)cmd;
+				// dyld ignores zero-sized segments
+				if ( seg->vmsize() != 0 ) {
+					Segment segment;
+					segment.vmAddr = seg->vmaddr();
+					segment.vmSize = seg->vmsize();
+					segment.writable = ((seg->initprot() & VM_PROT_WRITE) != 0);
+					image.segments.push_back(segment);
+				}
+				// the mach header is at the start of the segment that maps the start of the file
+				if ( (seg->fileoff() == 0) && (seg->filesize() != 0) )
+					image.textVmAddr = seg->vmaddr();
+				break;
+			}
+			case LC_LOAD_DYLIB:
+			case LC_LOAD_WEAK_DYLIB:
+			case LC_REEXPORT_DYLIB:
+			case LC_LOAD_UPWARD_DYLIB: {
+				Dependent dependent;
+				dependent.name = ((const macho_dylib_command<P>*)cmd)->name();
+				dependent.cmd = cmd->cmd();
+				dependent.imageIndex = DYLD_CLOSURE_NO_IMAGE;
+				image.dependents.push_back(dependent);
+				break;
+			}
+			case LC_RPATH: {
+				const char* rpath = (const char*)cmd + LittleEndian::get32(((const rpath_command*)cmd)->path.offset);
+				const char* rest;
+				if ( startsWith(rpath, "@loader_path", rest) )
+					image.rpaths.push_back(directoryOf(image.path) + rest);
+				else if ( startsWith(rpath, "@executable_path", rest) )
+					image.rpaths.push_back(directoryOf(fImages.empty() ? image.path : fImages[0].path) + rest);
+				else
+					image.rpaths.push_back(rpath);
+				break;
+			}
+			case LC_UUID:
+				memcpy(image.uuid, ((const macho_uuid_command<P>*)cmd)->uuid(), 16);
+				break;
+			case LC_DYLD_INFO:
+			case LC_DYLD_INFO_ONLY:
+				dyldInfo = (const macho_dyld_info_command<P>*)cmd;
+				break;
+		}
+		p += cmd->cmdsize();
+	}
+	if ( dyldInfo == NULL )
+		throwf("%s uses classic LINKEDIT", image.path.c_str());
+	// dyld_info offsets are from the start of the slice
+	const uint8_t* sliceEnd = image.mapping + image.mappingSize;
+	image.bindStart = image.mh + dyldInfo->bind_off();
+	image.bindEnd = image.bindStart + dyldInfo->bind_size();
+	image.exportStart = image.mh + dyldInfo->export_off();
+	image.exportEnd = image.exportStart + dyldInfo->export_size();
+	if ( (image.bindEnd > sliceEnd) || (image.exportEnd > sliceEnd) )
+		throwf("LINKEDIT extends beyond end of %s", image.path.c_str());
+}
+
+// returns true and sets index if path exists under the root
+bool ClosureBuilder::tryPath(const std::string& path, uint32_t& index)
+{
+	struct stat statBuf;
+	if ( ::stat(rootPath(path).c_str(), &statBuf) != 0 )
+		return false;
+	index = addImage(path, statBuf);
+	return true;
+}
+
+// the same search dyld's loadPhase0() through loadPhase6() does with no DYLD_ variables set
+uint32_t ClosureBuilder::findDependent(uint32_t loaderIndex, const Dependent& dependent, const RPathChain* rpaths)
+{
+	const char* name = dependent.name;
+	const char* rest;
+	uint32_t index;
+	if ( startsWith(name, "@executable_path/", rest) ) {
+		if ( tryPath(directoryOf(fImages[0].path) + "/" + rest, index) )
+			return index;
+	}
+	else if ( startsWith(name, "@loader_path/", rest) ) {
+		if ( tryPath(directoryOf(fImages[loaderIndex].path) + "/" + rest, index) )
+			return index;
+	}
+	else if ( startsWith(name, "@rpath/", rest) ) {
+		for (const RPathChain* rp=rpaths; rp != NULL; rp=rp->next) {
+			for (std::vector<std::string>::const_iterator it=rp->paths->begin(); it != rp->paths->end(); ++it) {
+				if ( tryPath(*it + "/" + rest, index) )
+					return index;
+			}
+		}
+	}
+	else {
+		if ( tryPath(name, index) )
+			return index;
+		// default fallback paths, by framework partial path or leaf name
+		const char* frameworkPartial = strstr(name, ".framework/");
+		if ( frameworkPartial != NULL ) {
+			while ( (frameworkPartial > name) && (frameworkPartial[-1] != '/') )
+				--frameworkPartial;
+			static const char* const frameworkFallbacks[] = { "/Library/Frameworks/", "/System/Library/Frameworks/", NULL };
+			for (const char* const* fp=frameworkFallbacks; *fp != NULL; ++fp) {
+				if ( tryPath(std::string(*fp) + frameworkPartial, index) )
+					return index;
+			}
+		}
+		const char* leaf = strrchr(name, '/');
+		leaf = (leaf != NULL) ? leaf+1 : name;
+		static const char* const libraryFallbacks[] = { "/usr/local/lib/", "/usr/lib/", NULL };
+		for (const char* const* lp=libraryFallbacks; *lp != NULL; ++lp) {
+			if ( tryPath(std::string(*lp) + leaf, index) )
+				return index;
+		}
+	}
+	if ( dependent.cmd == LC_LOAD_WEAK_DYLIB )
+		return DYLD_CLOSURE_NO_IMAGE;
+	throwf("can't find %s, needed by %s", name, fImages[loaderIndex].path.c_str());
+}
+
+// the same order as ImageLoader::recursiveLoadLibraries(): all dependents of an image, then theirs
+void ClosureBuilder::loadDependents(uint32_t index, const RPathChain* loaderRPaths)
+{
+	if ( fImages[index].dependentsLoaded )
+		return;
+	fImages[index].dependentsLoaded = true;
+	const RPathChain rpaths = { loaderRPaths, &fImages[index].rpaths };
+	const size_t dependentCount = fImages[index].dependents.size();
+	for (size_t d=0; d < dependentCount; ++d) {
+		uint32_t found = findDependent(index, fImages[index].dependents[d], &rpaths);
+		fImages[index].dependents[d].imageIndex = found;
+	}
+	// rpaths may move as images are added, so copy them for the chain
+	std::vector<std::string> myRPaths = fImages[index].rpaths;
+	const RPathChain chain = { loaderRPaths, &myRPaths };
+	for (size_t d=0; d < dependentCount; ++d) {
+		uint32_t dep = fImages[index].dependents[d].imageIndex;
+		if ( dep != DYLD_CLOSURE_NO_IMAGE )
+			loadDependents(dep, &chain);
+	}
+}
+
+const ExportMap& ClosureBuilder::exportsOf(uint32_t index)
+{
+	Image& image = fImages[index];
+	if ( image.exports == NULL ) {
+		image.exports = new ExportMap();
+		std::vector<mach_o::trie::Entry> entries;
+		mach_o::trie::parseTrie(image.exportStart, image.exportEnd, entries);
+		for (std::vector<mach_o::trie::Entry>::iterator it=entries.begin(); it != entries.end(); ++it)
+			(*image.exports)[it->name] = *it;
+	}
+	return *image.exports;
+}
+
+// like ImageLoaderMachOCompressed::findExportedSymbol(), including re-exported dylibs
+bool ClosureBuilder::findExport(uint32_t index, const std::string& name, uint32_t& foundIn, mach_o::trie::Entry& entry, unsigned depth)
+{
+	if ( depth > 64 )
+		throwf("re-export cycle looking for %s", name.c_str());
+	const ExportMap& exports = exportsOf(index);
+	ExportMap::const_iterator pos = exports.find(name);
+	if ( pos != exports.end() ) {
+		if ( pos->second.flags & EXPORT_SYMBOL_FLAGS_REEXPORT ) {
+			const uint64_t ordinal = pos->second.other;
+			if ( (ordinal == 0) || (ordinal > fImages[index].dependents.size()) )
+				throwf("bad re-export ordinal for %s in %s", name.c_str(), fImages[index].path.c_str());
+			const uint32_t dep = fImages[index].dependents[ordinal-1].imageIndex;
+			if ( dep == DYLD_CLOSURE_NO_IMAGE )
+				return false;
+			const char* importName = pos->second.importName;
+			return findExport(dep, (importName[0] != '\0') ? std::string(importName) : name, foundIn, entry, depth+1);
+		}
+		foundIn = index;
+		entry = pos->second;
+		return true;
+	}
+	const std::vector<Dependent>& dependents = fImages[index].dependents;
+	for (std::vector<Dependent>::const_iterator it=dependents.begin(); it != dependents.end(); ++it) {
+		if ( (it->cmd == LC_REEXPORT_DYLIB) && (it->imageIndex != DYLD_CLOSURE_NO_IMAGE) ) {
+			if ( findExport(it->imageIndex, name, foundIn, entry, depth+1) )
+				return true;
+		}
+	}
+	return false;
+}
+
+void ClosureBuilder::addBind(uint32_t index, uint8_t segIndex, uint64_t segOffset, uint8_t type, long ordinal,
+							 const char* symbolName, uint8_t symbolFlags, int64_t addend)
+{
+	const Image& image = fImages[index];
+	const uint32_t pointerSize = image.is64 ? 8 : 4;
+	if ( type != BIND_TYPE_POINTER )
+		throwf("%s has a bind of type %d to %s", image.path.c_str(), type, symbolName);
+	if ( segIndex >= image.segments.size() )
+		throwf("%s binds %s in segment %d which does not exist", image.path.c_str(), symbolName, segIndex);
+	if ( !image.segments[segIndex].writable || (segOffset + pointerSize > image.segments[segIndex].vmSize) )
+		throwf("%s binds %s outside of a writable segment", image.path.c_str(), symbolName);
+
+	uint32_t targetImage;
+	if ( ordinal == BIND_SPECIAL_DYLIB_SELF )
+		targetImage = index;
+	else if ( ordinal == BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE )
+		targetImage = 0;
+	else if ( ordinal == BIND_SPECIAL_DYLIB_FLAT_LOOKUP )
+		throwf("%s looks up %s with flat namespace", image.path.c_str(), symbolName);
+	else if ( (ordinal < 0) || ((unsigned long)ordinal > image.dependents.size()) )
+		throwf("%s has bad library ordinal %ld for %s", image.path.c_str(), ordinal, symbolName);
+	else
+		targetImage = image.dependents[ordinal-1].imageIndex;
+
+	Bind bind;
+	bzero(&bind.bind, sizeof(bind.bind));
+	bind.bind.segIndex = segIndex;
+	bind.bind.segOffset = segOffset;
+	bind.bind.addend = addend;
+	bind.bind.libraryOrdinal = (int32_t)ordinal;
+	bind.bind.symbolFlags = symbolFlags;
+	bind.symbolName = symbolName;
+	uint32_t foundIn;
+	mach_o::trie::Entry entry;
+	if ( (targetImage != DYLD_CLOSURE_NO_IMAGE) && findExport(targetImage, symbolName, foundIn, entry, 0) ) {
+		// dyld binds non-lazy pointers to a resolver's stub, not what the resolver returns
+		if ( (entry.flags & EXPORT_SYMBOL_FLAGS_KIND_MASK) == EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE ) {
+			bind.bind.targetImage = DYLD_CLOSURE_ABSOLUTE;
+			bind.bind.targetSegOffset = entry.address + addend;
+		}
+		else {
+			// segments do not keep their distances from the mach header when a dylib is put in the
+			// shared cache, so the target is kept relative to the segment the symbol is in
+			const Image& target = fImages[foundIn];
+			const uint64_t address = target.textVmAddr + entry.address;
+			uint32_t targetSegIndex = 0;
+			while ( (targetSegIndex < target.segments.size())
+				 && ((address < target.segments[targetSegIndex].vmAddr) || (address >= target.segments[targetSegIndex].vmAddr + target.segments[targetSegIndex].vmSize)) )
+				++targetSegIndex;
+			if ( targetSegIndex == target.segments.size() )
+				throwf("%s exports %s outside of its segments", target.path.c_str(), symbolName);
+			bind.bind.targetImage = foundIn;
+			bind.bind.targetSegIndex = targetSegIndex;
+			bind.bind.targetSegOffset = address + addend - target.segments[targetSegIndex].vmAddr;
+		}
+	}
+	else if ( symbolFlags & BIND_SYMBOL_FLAGS_WEAK_IMPORT ) {
+		bind.bind.targetImage = DYLD_CLOSURE_ABSOLUTE;
+		bind.bind.targetSegOffset = addend;
+	}
+	else {
+		throwf("symbol %s not found, expected in %s, needed by %s", symbolName,
+			   (targetImage != DYLD_CLOSURE_NO_IMAGE) ? fImages[targetImage].path.c_str() : "a missing dylib", image.path.c_str());
+	}
+	if ( !image.is64 )
+		bind.bind.targetSegOffset &= 0xFFFFFFFFULL;
+	fImages[index].binds.push_back(bind);
+}
+
+// the non-lazy binds, decoded as ImageLoaderMachOCompressed::eachBind() does
+void ClosureBuilder::resolveBinds(uint32_t index)
+{
+	const uint64_t pointerSize = fImages[index].is64 ? 8 : 4;
+	const uint8_t* p = fImages[index].bindStart;
+	const uint8_t* const end = fImages[index].bindEnd;
+	uint8_t type = 0;
+	uint8_t segIndex = 0;
+	uint64_t segOffset = 0;
+	const char* symbolName = NULL;
+	uint8_t symbolFlags = 0;
+	long ordinal = 0;
+	int64_t addend = 0;
+	uint64_t count;
+	uint64_t skip;
+	bool done = false;
+	while ( !done && (p < end) ) {
+		uint8_t immediate = *p & BIND_IMMEDIATE_MASK;
+		uint8_t opcode = *p & BIND_OPCODE_MASK;
+		++p;
+		switch ( opcode ) {
+			case BIND_OPCODE_DONE:
+				done = true;
+				break;
+			case BIND_OPCODE_SET_DYLIB_ORDINAL_IMM:
+				ordinal = immediate;
+				break;
+			case BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB:
+				ordinal = (long)read_uleb128(p, end);
+				break;
+			case BIND_OPCODE_SET_DYLIB_SPECIAL_IMM:
+				// the special ordinals are negative numbers
+				if ( immediate == 0 )
+					ordinal = 0;
+				else
+					ordinal = (int8_t)(BIND_OPCODE_MASK | immediate);
+				break;
+			case BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM:
+				symbolFlags = immediate;
+				symbolName = (char*)p;
+				while ( (p < end) && (*p != '\0') )
+					++p;
+				++p;
+				break;
+			case BIND_OPCODE_SET_TYPE_IMM:
+				type = immediate;
+				break;
+			case BIND_OPCODE_SET_ADDEND_SLEB:
+				addend = read_sleb128(p, end);
+				break;
+			case BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+				segIndex = immediate;
+				segOffset = read_uleb128(p, end);
+				break;
+			case BIND_OPCODE_ADD_ADDR_ULEB:
+				segOffset += read_uleb128(p, end);
+				break;
+			case BIND_OPCODE_DO_BIND:
+				addBind(index, segIndex, segOffset, type, ordinal, symbolName, symbolFlags, addend);
+				segOffset += pointerSize;
+				break;
+			case BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB:
+				addBind(index, segIndex, segOffset, type, ordinal, symbolName, symbolFlags, addend);
+				segOffset += read_uleb128(p, end) + pointerSize;
+				break;
+			case BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED:
+				addBind(index, segIndex, segOffset, type, ordinal, symbolName, symbolFlags, addend);
+				segOffset += immediate*pointerSize + pointerSize;
+				break;
+			case BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB:
+				count = read_uleb128(p, end);
+				skip = read_uleb128(p, end);
+				for (uint64_t i=0; i < count; ++i) {
+					addBind(index, segIndex, segOffset, type, ordinal, symbolName, symbolFlags, addend);
+					segOffset += skip + pointerSize;
+				}
+				break;
+			default:
+				throwf("bad bind opcode %d in %s", *(p-1), fImages[index].path.c_str());
+		}
+	}
+}
+
+void ClosureBuilder::build(const char* executablePath)
+{
+	struct stat statBuf;
+	if ( ::stat(rootPath(executablePath).c_str(), &statBuf) != 0 )
+		throwf("can't find %s", rootPath(executablePath).c_str());
+	addImage(executablePath, statBuf);
+	if ( LittleEndian::get32(((mach_header*)fImages[0].mh)->filetype) != MH_EXECUTE )
+		throwf("%s is not an executable", executablePath);
+	loadDependents(0, NULL);
+	for (uint32_t i=0; i < fImages.size(); ++i)
+		resolveBinds(i);
+}
+
+static uint64_t align8(uint64_t offset)
+{
+	return (offset + 7) & (-8);
+}
+
+bool ClosureBuilder::write(const char* closurePath)
+{
+	// strings, each stored once
+	std::vector<char> strings(1, '\0');
+	std::unordered_map<std::string, uint32_t> stringOffsets;
+	struct StringAdder {
+		static uint32_t add(std::vector<char>& strings, std::unordered_map<std::string, uint32_t>& offsets, const char* str) {
+			std::unordered_map<std::string, uint32_t>::iterator pos = offsets.find(str);
+			if ( pos != offsets.end() )
+				return pos->second;
+			uint32_t offset = (uint32_t)strings.size();
+			strings.insert(strings.end(), str, str+strlen(str)+1);
+			offsets[str] = offset;
+			return offset;
+		}
+	};
+
+	std::vector<dyld_closure_image> images(fImages.size());
+	std::vector<dyld_closure_dependent> dependents;
+	std::vector<dyld_closure_bind> binds;
+	for (uint32_t i=0; i < fImages.size(); ++i) {
+		const Image& image = fImages[i];
+		dyld_closure_image& info = images[i];
+		bzero(&info, sizeof(info));
+		info.device = image.statBuf.st_dev;
+		info.inode = image.statBuf.st_ino;
+		info.mtime = image.statBuf.st_mtime;
+		memcpy(info.uuid, image.uuid, 16);
+		info.pathOffset = StringAdder::add(strings, stringOffsets, image.path.c_str());
+		info.firstDependent = (uint32_t)dependents.size();
+		info.dependentCount = (uint32_t)image.dependents.size();
+		for (std::vector<Dependent>::const_iterator it=image.dependents.begin(); it != image.dependents.end(); ++it) {
+			dyld_closure_dependent dependent;
+			dependent.nameOffset = StringAdder::add(strings, stringOffsets, it->name);
+			dependent.imageIndex = it->imageIndex;
+			dependents.push_back(dependent);
+		}
+		info.firstBind = (uint32_t)binds.size();
+		info.bindCount = (uint32_t)image.binds.size();
+		for (std::vector<Bind>::const_iterator it=image.binds.begin(); it != image.binds.end(); ++it) {
+			dyld_closure_bind bind = it->bind;
+			bind.symbolNameOffset = StringAdder::add(strings, stringOffsets, it->symbolName);
+			binds.push_back(bind);
+		}
+	}
+
+	dyld_closure_header header;
+	bzero(&header, sizeof(header));
+	strcpy(header.magic, DYLD_CLOSURE_MAGIC);
+	header.cputype			= fArch->cputype;
+	header.imageCount		= (uint32_t)images.size();
+	header.dependentCount	= (uint32_t)dependents.size();
+	header.bindCount		= (uint32_t)binds.size();
+	header.imagesOffset		= align8(sizeof(header));
+	header.dependentsOffset	= align8(header.imagesOffset + images.size()*sizeof(dyld_closure_image));
+	header.bindsOffset		= align8(header.dependentsOffset + dependents.size()*sizeof(dyld_closure_dependent));
+	header.stringsOffset	= align8(header.bindsOffset + binds.size()*sizeof(dyld_closure_bind));
+	header.stringsSize		= strings.size();
+
+	std::vector<uint8_t> buffer(header.stringsOffset + header.stringsSize, 0);
+	memcpy(&buffer[0], &header, sizeof(header));
+	memcpy(&buffer[header.imagesOffset], &images[0], images.size()*sizeof(dyld_closure_image));
+	if ( !dependents.empty() )
+		memcpy(&buffer[header.dependentsOffset], &dependents[0], dependents.size()*sizeof(dyld_closure_dependent));
+	if ( !binds.empty() )
+		memcpy(&buffer[header.bindsOffset], &binds[0], binds.size()*sizeof(dyld_closure_bind));
+	memcpy(&buffer[header.stringsOffset], &strings[0], strings.size());
+
+	// write to a temp file and rename, so dyld never maps a partial closure
+	char tempPath[PATH_MAX];
+	snprintf(tempPath, sizeof(tempPath), "%s.tmp%d", closurePath, getpid());
+	FILE* file = fopen(tempPath, "w");
+	if ( file == NULL ) {
+		fprintf(stderr, "Error: can't create %s, errno=%d\n", tempPath, errno);
+		return false;
+	}
+	bool ok = (fwrite(&buffer[0], buffer.size(), 1, file) == 1);
+	ok = (fclose(file) == 0) && ok;
+	if ( !ok || (rename(tempPath, closurePath) != 0) ) {
+		fprintf(stderr, "Error: can't write %s, errno=%d\n", closurePath, errno);
+		unlink(tempPath);
+		return false;
+	}
+	printf("%u images, %u binds written to %s\n", header.imageCount, header.bindCount, closurePath);
+	return true;
+}
+
+
+/*
+ * Map a closure, checking that it is well formed the same way dyld does
+ */
+static const dyld_closure_header* map_closure(const char* closurePath, uint64_t& size)
+{
+	struct stat statbuf;
+	int fd = ::open(closurePath, O_RDONLY);
+	if ( (fd < 0) || (::fstat(fd, &statbuf) != 0) ) {
+		fprintf(stderr, "Error: can't open closure %s, errno=%d\n", closurePath, errno);
+		exit(1);
+	}
+	size = statbuf.st_size;
+	const dyld_closure_header* header = NULL;
+	if ( size >= sizeof(dyld_closure_header) )
+		header = (dyld_closure_header*)::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if ( (header == NULL) || (header == MAP_FAILED) || (strcmp(header->magic, DYLD_CLOSURE_MAGIC) != 0) ) {
+		fprintf(stderr, "Error: %s is not a launch closure\n", closurePath);
+		exit(1);
+	}
+	if (   (header->imagesOffset + (uint64_t)header->imageCount*sizeof(dyld_closure_image) > size)
+		|| (header->dependentsOffset + (uint64_t)header->dependentCount*sizeof(dyld_closure_dependent) > size)
+		|| (header->bindsOffset + (uint64_t)header->bindCount*sizeof(dyld_closure_bind) > size)
+		|| (header->stringsOffset + header->stringsSize > size)
+		|| (header->stringsSize == 0) || (((char*)header)[header->stringsOffset + header->stringsSize - 1] != '\0')
+		|| (header->imageCount == 0) ) {
+		fprintf(stderr, "Error: launch closure %s is truncated\n", closurePath);
+		exit(1);
+	}
+	const dyld_closure_image* images = (dyld_closure_image*)((uint8_t*)header + header->imagesOffset);
+	const dyld_closure_dependent* dependents = (dyld_closure_dependent*)((uint8_t*)header + header->dependentsOffset);
+	const dyld_closure_bind* binds = (dyld_closure_bind*)((uint8_t*)header + header->bindsOffset);
+	for (uint32_t i=0; i < header->imageCount; ++i) {
+		bool bad = (images[i].pathOffset >= header->stringsSize)
+				|| ((uint64_t)images[i].firstDependent + images[i].dependentCount > header->dependentCount)
+				|| ((uint64_t)images[i].firstBind + images[i].bindCount > header->bindCount);
+		for (uint32_t d=images[i].firstDependent; !bad && (d < images[i].firstDependent + images[i].dependentCount); ++d)
+			bad = (dependents[d].nameOffset >= header->stringsSize) || ((dependents[d].imageIndex >= header->imageCount) && (dependents[d].imageIndex != DYLD_CLOSURE_NO_IMAGE));
+		for (uint32_t b=images[i].firstBind; !bad && (b < images[i].firstBind + images[i].bindCount); ++b)
+			bad = ((binds[b].targetImage >= header->imageCount) && (binds[b].targetImage != DYLD_CLOSURE_ABSOLUTE)) || (binds[b].symbolNameOffset >= header->stringsSize);
+		if ( bad ) {
+			fprintf(stderr, "Error: launch closure %s is malformed\n", closurePath);
+			exit(1);
+		}
+	}
+	return header;
+}
+
+static const char* closure_string(const dyld_closure_header* header, uint32_t offset)
+{
+	return (char*)header + header->stringsOffset + offset;
+}
+
+/*
+ * Check every file in the closure is still the one it was built from
+ */
+static bool validate_closure(const dyld_closure_header* header, const std::string& root)
+{
+	const dyld_closure_image* images = (dyld_closure_image*)((uint8_t*)header + header->imagesOffset);
+	uint32_t staleCount = 0;
+	for (uint32_t i=0; i < header->imageCount; ++i) {
+		const char* path = closure_string(header, images[i].pathOffset);
+		std::string fullPath = root + path;
+		struct stat statBuf;
+		if ( ::stat(fullPath.c_str(), &statBuf) != 0 ) {
+			printf("missing: %s\n", path);
+			++staleCount;
+		}
+		else if ( ((uint64_t)statBuf.st_dev != images[i].device) || ((uint64_t)statBuf.st_ino != images[i].inode) || ((uint64_t)statBuf.st_mtime != images[i].mtime) ) {
+			printf("changed: %s\n", path);
+			++staleCount;
+		}
+	}
+	if ( staleCount != 0 ) {
+		printf("%u of %u images have changed, the closure must be rebuilt\n", staleCount, header->imageCount);
+		return false;
+	}
+	printf("all %u images unchanged\n", header->imageCount);
+	return true;
+}
+
+static void dump_closure(const dyld_closure_header* header, bool verbose)
+{
+	const dyld_closure_image* images = (dyld_closure_image*)((uint8_t*)header + header->imagesOffset);
+	const dyld_closure_dependent* dependents = (dyld_closure_dependent*)((uint8_t*)header + header->dependentsOffset);
+	const dyld_closure_bind* binds = (dyld_closure_bind*)((uint8_t*)header + header->bindsOffset);
+	printf("cputype: 0x%08X, %u images, %u binds\n", header->cputype, header->imageCount, header->bindCount);
+	for (uint32_t i=0; i < header->imageCount; ++i) {
+		const dyld_closure_image& image = images[i];
+		const uint8_t* u = image.uuid;
+		printf("[%u] %s\n", i, closure_string(header, image.pathOffset));
+		printf("    uuid: %02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X, dev: %llu, inode: %llu, mtime: %llu, binds: %u\n",
+			   u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7], u[8], u[9], u[10], u[11], u[12], u[13], u[14], u[15],
+			   image.device, image.inode, image.mtime, image.bindCount);
+		for (uint32_t d=image.firstDependent; d < image.firstDependent + image.dependentCount; ++d) {
+			if ( dependents[d].imageIndex == DYLD_CLOSURE_NO_IMAGE )
+				printf("    %s => missing\n", closure_string(header, dependents[d].nameOffset));
+			else
+				printf("    %s => [%u]\n", closure_string(header, dependents[d].nameOffset), dependents[d].imageIndex);
+		}
+		if ( !verbose )
+			continue;
+		for (uint32_t b=image.firstBind; b < image.firstBind + image.bindCount; ++b) {
+			const char* symbolName = closure_string(header, binds[b].symbolNameOffset);
+			if ( binds[b].targetImage == DYLD_CLOSURE_ABSOLUTE )
+				printf("    seg %u + 0x%08llX = 0x%08llX (%s)\n", binds[b].segIndex, binds[b].segOffset, binds[b].targetSegOffset, symbolName);
+			else
+				printf("    seg %u + 0x%08llX = [%u] seg %u + 0x%08llX (%s)\n", binds[b].segIndex, binds[b].segOffset,
+					   binds[b].targetImage, binds[b].targetSegIndex, binds[b].targetSegOffset, symbolName);
+		}
+	}
+}
+
+
+int main(int argc, const char* argv[])
+{
+	enum { modeNone, modeBuild, modeValidate, modeDump } mode = modeNone;
+	const char* root = "";
+	const char* archName = NULL;
+	const char* target = NULL;
+	const char* outputPath = NULL;
+	bool verbose = false;
+	for (int i=1; i < argc; ++i) {
+		const char* opt = argv[i];
+		bool needsArg = (strcmp(opt, "-root") == 0) || (strcmp(opt, "-arch") == 0) || (strcmp(opt, "-o") == 0)
+					 || (strcmp(opt, "-build") == 0) || (strcmp(opt, "-validate") == 0) || (strcmp(opt, "-dump") == 0);
+		if ( needsArg && (i+1 >= argc) ) {
+			fprintf(stderr, "Error: option %s requires an argument\n", opt);
+			usage();
+			exit(1);
+		}
+		if ( strcmp(opt, "-root") == 0 )
+			root = argv[++i];
+		else if ( strcmp(opt, "-arch") == 0 )
+			archName = argv[++i];
+		else if ( strcmp(opt, "-o") == 0 )
+			outputPath = argv[++i];
+		else if ( strcmp(opt, "-v") == 0 )
+			verbose = true;
+		else if ( needsArg && (mode == modeNone) ) {
+			mode = (strcmp(opt, "-build") == 0) ? modeBuild : (strcmp(opt, "-validate") == 0) ? modeValidate : modeDump;
+			target = argv[++i];
+		}
+		else {
+			fprintf(stderr, "Error: unrecognized option %s\n", opt);
+			usage();
+			exit(1);
+		}
+	}
+	if ( mode == modeNone ) {
+		usage();
+		exit(1);
+	}
+	// the root is prepended to absolute paths
+	std::string rootPath = root;
+	while ( !rootPath.empty() && (rootPath[rootPath.size()-1] == '/') )
+		rootPath.erase(rootPath.size()-1);
+
+	if ( mode == modeBuild ) {
+		if ( target[0] != '/' ) {
+			fprintf(stderr, "Error: executable path must be absolute, as the program is run\n");
+			exit(1);
+		}
+		const ArchInfo* arch = &sArchInfos[1];
+		if ( archName != NULL ) {
+			for (arch=sArchInfos; arch->name != NULL; ++arch) {
+				if ( strcmp(arch->name, archName) == 0 )
+					break;
+			}
+			if ( arch->name == NULL ) {
+				fprintf(stderr, "Error: unknown architecture %s\n", archName);
+				exit(1);
+			}
+		}
+		std::string closurePath;
+		if ( outputPath != NULL ) {
+			closurePath = outputPath;
+		}
+		else {
+			const char* leaf = strrchr(target, '/') + 1;
+			closurePath = std::string(leaf) + DYLD_CLOSURE_SUFFIX;
+		}
+		ClosureBuilder builder(rootPath.c_str(), arch);
+		try {
+			builder.build(target);
+		}
+		catch (const char* msg) {
+			fprintf(stderr, "Error: %s\n", msg);
+			exit(1);
+		}
+		return builder.write(closurePath.c_str()) ? 0 : 1;
+	}
+
+	uint64_t size;
+	const dyld_closure_header* header = map_closure(target, size);
+	if ( mode == modeValidate )
+		return validate_closure(header, rootPath) ? 0 : 1;
+	dump_closure(header, verbose);
+	return 0;
+}
@@ -37,9 +37,12 @@
 
 #include <map>
 #include <vector>
+#include <unordered_map>
+#include <algorithm>
 
 #include "dsc_iterator.h"
 #include "dyld_cache_format.h"
+#include "dyld_cache_symbol_index.h"
 #include "Architectures.hpp"
 #include "MachOFileAbstraction.hpp"
 #include "CacheFileAbstraction.hpp"
@@ -52,12 +55,18 @@ enum Mode {
 	modeSlideInfo,
 	modeLinkEdit,
 	modeInfo,
-	modeSize
+	modeSize,
+	modeBuildIndex,
+	modeLookup,
+	modeSymbolicate
 };
 
 struct Options {
 	Mode		mode;
 	const char*	dependentsOfPath;
+	const char*	lookupName;
+	uint64_t	symbolicateAddress;
+	const char*	indexPath;
 	const void*	mappedCache;
 	bool		printUUIDs;
 	bool		printVMAddrs;
@@ -76,17 +85,46 @@ struct TextInfoSorter {
 	}
 };
 
+struct IndexDylib {
+	const char*		path;
+	uint64_t		textAddress;
+};
+
+struct IndexSymbol {
+	uint64_t		address;
+	uint64_t		sectionEnd;
+	const char*		name;
+	uint32_t		dylibIndex;
+};
+
 struct Results {
 	std::map<uint32_t, const char*>	pageToContent;
 	uint64_t						linkeditBase;
 	bool							dependentTargetFound;
 	std::vector<TextInfo>			textSegments;
+	std::vector<IndexDylib>			indexDylibs;
+	std::vector<IndexSymbol>		indexSymbols;
+};
+
+class CStringHash {
+public:
+	size_t operator()(const char* __s) const {
+		size_t __h = 0;
+		for ( ; *__s; ++__s)
+			__h = 5 * __h + *__s;
+		return __h;
+	};
+};
+class CStringEquals {
+public:
+	bool operator()(const char* left, const char* right) const { return (strcmp(left, right) == 0); }
 };
 
 
 
 void usage() {
-	fprintf(stderr, "Usage: dyld_shared_cache_util -list [ -uuid ] [-vmaddr] | -dependents <dylib-path> [ -versions ] | -linkedit | -map [ shared-cache-file ] | -slide_info | -info\n");
+	fprintf(stderr, "Usage: dyld_shared_cache_util -list [ -uuid ] [-vmaddr] | -dependents <dylib-path> [ -versions ] | -linkedit | -map [ shared-cache-file ] | -slide_info | -info\n"
+					"       dyld_shared_cache_util -build-index | -lookup <symbol-name> | -symbolicate <address> [ -index <index-file> ] [ shared-cache-file ]\n");
 }
 
 #if __x86_64__
@@ -329,9 +367,392 @@ void print_map(const dyld_shared_cache_dylib_info* dylibInfo, const dyld_shared_
 }
 
 
+/*
+ * Add the symbols defined in a section from an nlist array, for -build-index
+ */
+template <typename P>
+static void add_defined_symbols(const macho_nlist<P>* symbols, uint32_t count, const char* strings, uint32_t stringsSize,
+									const std::vector<uint64_t>& sectionEnds, bool skipLocals, uint32_t dylibIndex, Results& results)
+{
+	for (uint32_t i=0; i < count; ++i) {
+		const macho_nlist<P>& sym = symbols[i];
+		if ( (sym.n_type() & N_STAB) || ((sym.n_type() & N_TYPE) != N_SECT) )
+			continue;
+		if ( skipLocals && ((sym.n_type() & N_EXT) == 0) )
+			continue;
+		if ( sym.n_strx() >= stringsSize )
+			continue;
+		if ( (sym.n_sect() == NO_SECT) || (sym.n_sect() > sectionEnds.size()) )
+			continue;
+		IndexSymbol symbol;
+		symbol.address = sym.n_value();
+		symbol.sectionEnd = sectionEnds[sym.n_sect()-1];
+		symbol.name = &strings[sym.n_strx()];
+		symbol.dylibIndex = dylibIndex;
+		results.indexSymbols.push_back(symbol);
+	}
+}
+
+/*
+ * Collect every symbol a dylib defines, including locals stored in the unmapped part of the cache
+ */
+template <typename A>
+void collect_symbols(const dyld_shared_cache_dylib_info* dylibInfo, const dyld_shared_cache_segment_info* segInfo, 
+																		const Options& options, Results& results) 
+{
+	typedef typename A::P		P;
+	typedef typename A::P::E	E;
+
+	if ( strcmp(segInfo->name, "__TEXT") != 0 )
+		return;
+	if ( dylibInfo->isAlias )
+		return;
+
+	const macho_header<P>* mh = (const macho_header<P>*)dylibInfo->machHeader;
+	const macho_symtab_command<P>* symtab = NULL;
+	std::vector<uint64_t> sectionEnds;	// by n_sect-1
+	const macho_load_command<P>* cmd = (macho_load_command<P>*)((uintptr_t)mh + sizeof(macho_header<P>));
+	for (uint32_t i = 0; i < mh->ncmds(); ++i) {
+		if ( cmd->cmd() == LC_SYMTAB ) {
+			symtab = (macho_symtab_command<P>*)cmd;
+		}
+		else if ( cmd->cmd() == macho_segment_command<P>::CMD ) {
+			const macho_segment_command<P>* segCmd = (macho_segment_command<P>*)cmd;
+			const macho_section<P>* const sectionsStart = (macho_section<P>*)((char*)segCmd + sizeof(macho_segment_command<P>));
+			const macho_section<P>* const sectionsEnd = &sectionsStart[segCmd->nsects()];
+			for (const macho_section<P>* sect=sectionsStart; sect < sectionsEnd; ++sect)
+				sectionEnds.push_back(sect->addr() + sect->size());
+		}
+		cmd = (const macho_load_command<P>*)(((uint8_t*)cmd)+cmd->cmdsize());
+	}
+	if ( symtab == NULL )
+		return;
+
+	IndexDylib dylib;
+	dylib.path = dylibInfo->path;
+	dylib.textAddress = segInfo->address;
+	const uint32_t dylibIndex = (uint32_t)results.indexDylibs.size();
+	results.indexDylibs.push_back(dylib);
+
+	// look for local symbol info in unmapped part of shared cache, the locals in the symbol table are then placeholders
+	const uint8_t* cache = (uint8_t*)options.mappedCache;
+	const dyldCacheHeader<E>* header = (dyldCacheHeader<E>*)cache;
+	bool localsFound = false;
+	if ( (header->mappingOffset() > offsetof(dyld_cache_header,localSymbolsSize)) && (header->localSymbolsOffset() != 0) ) {
+		const dyldCacheLocalSymbolsInfo<E>* localInfo = (dyldCacheLocalSymbolsInfo<E>*)(cache + header->localSymbolsOffset());
+		const dyldCacheLocalSymbolEntry<E>* entries = (dyldCacheLocalSymbolEntry<E>*)(cache + header->localSymbolsOffset() + localInfo->entriesOffset());
+		const macho_nlist<P>* allLocalNlists = (macho_nlist<P>*)(((uint8_t*)localInfo) + localInfo->nlistOffset());
+		const char* localStrings = ((char*)localInfo) + localInfo->stringsOffset();
+		for (uint32_t i=0; i < localInfo->entriesCount(); ++i) {
+			if ( entries[i].dylibOffset() == segInfo->fileOffset ) {
+				add_defined_symbols<P>(&allLocalNlists[entries[i].nlistStartIndex()], entries[i].nlistCount(), localStrings, localInfo->stringsSize(),
+										sectionEnds, false, dylibIndex, results);
+				localsFound = true;
+				break;
+			}
+		}
+	}
+	add_defined_symbols<P>((macho_nlist<P>*)(cache + symtab->symoff()), symtab->nsyms(), (char*)cache + symtab->stroff(), symtab->strsize(),
+							sectionEnds, localsFound, dylibIndex, results);
+}
+
+
+struct IndexSymbolAddressSorter {
+	bool operator()(const IndexSymbol& left, const IndexSymbol& right) const {
+		if ( left.address != right.address )
+			return (left.address < right.address);
+		return (strcmp(left.name, right.name) < 0);
+	}
+};
+
+struct IndexSymbolNameSorter {
+	IndexSymbolNameSorter(const std::vector<IndexSymbol>& s) : symbols(s) {}
+	bool operator()(uint32_t left, uint32_t right) const {
+		int result = strcmp(symbols[left].name, symbols[right].name);
+		if ( result != 0 )
+			return (result < 0);
+		return (left < right);
+	}
+	const std::vector<IndexSymbol>& symbols;
+};
+
+struct BucketSizeSorter {
+	BucketSizeSorter(const std::vector<std::vector<uint32_t> >& b) : buckets(b) {}
+	bool operator()(uint32_t left, uint32_t right) const {
+		if ( buckets[left].size() != buckets[right].size() )
+			return (buckets[left].size() > buckets[right].size());
+		return (left < right);
+	}
+	const std::vector<std::vector<uint32_t> >& buckets;
+};
+
+static uint64_t align8(uint64_t offset)
+{
+	return (offset + 7) & (-8);
+}
+
+/*
+ * Write the symbols collected by collect_symbols() as a symbol index, see dyld_cache_symbol_index.h
+ */
+static bool write_symbol_index(const char* indexPath, const uint8_t cacheUUID[16], Results& results)
+{
+	std::vector<IndexSymbol>& symbols = results.indexSymbols;
+	std::sort(symbols.begin(), symbols.end(), IndexSymbolAddressSorter());
+	const uint32_t symbolCount = (uint32_t)symbols.size();
+
+	// a symbol runs to the next higher symbol, but not past the end of its section
+	std::vector<uint64_t> sizes(symbolCount);
+	uint64_t nextAddress = UINT64_MAX;
+	for (uint32_t i=symbolCount; i > 0; --i) {
+		const IndexSymbol& symbol = symbols[i-1];
+		const uint64_t end = std::min(nextAddress, symbol.sectionEnd);
+		sizes[i-1] = (end > symbol.address) ? (end - symbol.address) : 0;
+		if ( (i == 1) || (symbols[i-2].address != symbol.address) )
+			nextAddress = symbol.address;
+	}
+
+	// strings, each stored once
+	std::vector<char> strings(1, '\0');
+	std::unordered_map<const char*, uint32_t, CStringHash, CStringEquals> stringOffsets;
+	std::vector<uint32_t> nameOffsets(symbolCount);
+	std::vector<uint32_t> pathOffsets(results.indexDylibs.size());
+	for (uint32_t i=0; i < symbolCount + pathOffsets.size(); ++i) {
+		const char* str = (i < symbolCount) ? symbols[i].name : results.indexDylibs[i-symbolCount].path;
+		uint32_t offset;
+		std::unordered_map<const char*, uint32_t, CStringHash, CStringEquals>::iterator pos = stringOffsets.find(str);
+		if ( pos != stringOffsets.end() ) {
+			offset = pos->second;
+		}
+		else {
+			offset = (uint32_t)strings.size();
+			strings.insert(strings.end(), str, str+strlen(str)+1);
+			stringOffsets[str] = offset;
+		}
+		if ( i < symbolCount )
+			nameOffsets[i] = offset;
+		else
+			pathOffsets[i-symbolCount] = offset;
+	}
+
+	// by-name order, and the first symbol of each distinct name
+	std::vector<uint32_t> byName(symbolCount);
+	for (uint32_t i=0; i < symbolCount; ++i)
+		byName[i] = i;
+	std::sort(byName.begin(), byName.end(), IndexSymbolNameSorter(symbols));
+	std::vector<uint32_t> nameStarts;
+	for (uint32_t i=0; i < symbolCount; ++i) {
+		if ( (i == 0) || (strcmp(symbols[byName[i-1]].name, symbols[byName[i]].name) != 0) )
+			nameStarts.push_back(i);
+	}
+
+	// perfect hash of the distinct names, placing the largest buckets first while there is the most room
+	const uint32_t nameCount = (uint32_t)nameStarts.size();
+	const uint32_t bucketCount = nameCount/4 + 1;
+	const uint32_t slotCount = nameCount + nameCount/8 + 1;
+	std::vector<uint64_t> hashes(nameCount);
+	std::vector<std::vector<uint32_t> > buckets(bucketCount);
+	for (uint32_t i=0; i < nameCount; ++i) {
+		hashes[i] = dyld_cache_symbol_index_hash(symbols[byName[nameStarts[i]]].name);
+		buckets[dyld_cache_symbol_index_bucket(hashes[i], bucketCount)].push_back(i);
+	}
+	std::vector<uint32_t> bucketOrder(bucketCount);
+	for (uint32_t i=0; i < bucketCount; ++i)
+		bucketOrder[i] = i;
+	std::sort(bucketOrder.begin(), bucketOrder.end(), BucketSizeSorter(buckets));
+	std::vector<uint32_t> seeds(bucketCount, 0);
+	std::vector<uint32_t> slots(slotCount, DYLD_CACHE_SYMBOL_INDEX_NO_SLOT);
+	std::vector<uint32_t> bucketSlots;
+	for (std::vector<uint32_t>::iterator bit = bucketOrder.begin(); bit != bucketOrder.end(); ++bit) {
+		const std::vector<uint32_t>& bucket = buckets[*bit];
+		if ( bucket.empty() )
+			break;
+		bool placed = false;
+		for (uint32_t seed=1; !placed && (seed < 0x1000000); ++seed) {
+			bucketSlots.clear();
+			placed = true;
+			for (std::vector<uint32_t>::const_iterator nit = bucket.begin(); nit != bucket.end(); ++nit) {
+				uint32_t slot = dyld_cache_symbol_index_slot(hashes[*nit], seed, slotCount);
+				if ( (slots[slot] != DYLD_CACHE_SYMBOL_INDEX_NO_SLOT) || (std::find(bucketSlots.begin(), bucketSlots.end(), slot) != bucketSlots.end()) ) {
+					placed = false;
+					break;
+				}
+				bucketSlots.push_back(slot);
+			}
+			if ( placed ) {
+				seeds[*bit] = seed;
+				for (uint32_t i=0; i < bucket.size(); ++i)
+					slots[bucketSlots[i]] = nameStarts[bucket[i]];
+			}
+		}
+		if ( !placed ) {
+			fprintf(stderr, "Error: could not build symbol name hash table\n");
+			return false;
+		}
+	}
+
+	// lay out file
+	dyld_cache_symbol_index_header header;
+	bzero(&header, sizeof(header));
+	strcpy(header.magic, DYLD_CACHE_SYMBOL_INDEX_MAGIC);
+	memcpy(header.cacheUUID, cacheUUID, 16);
+	header.dylibCount		= (uint32_t)results.indexDylibs.size();
+	header.symbolCount		= symbolCount;
+	header.bucketCount		= bucketCount;
+	header.slotCount		= slotCount;
+	header.dylibsOffset		= align8(sizeof(header));
+	header.symbolsOffset	= align8(header.dylibsOffset + header.dylibCount*sizeof(dyld_cache_symbol_index_dylib));
+	header.byNameOffset		= align8(header.symbolsOffset + symbolCount*sizeof(dyld_cache_symbol_index_symbol));
+	header.seedsOffset		= align8(header.byNameOffset + symbolCount*sizeof(uint32_t));
+	header.slotsOffset		= align8(header.seedsOffset + bucketCount*sizeof(uint32_t));
+	header.stringsOffset	= align8(header.slotsOffset + slotCount*sizeof(uint32_t));
+	header.stringsSize		= strings.size();
+
+	std::vector<uint8_t> buffer(header.stringsOffset + header.stringsSize, 0);
+	memcpy(&buffer[0], &header, sizeof(header));
+	dyld_cache_symbol_index_dylib* dylibs = (dyld_cache_symbol_index_dylib*)&buffer[header.dylibsOffset];
+	for (uint32_t i=0; i < header.dylibCount; ++i) {
+		dylibs[i].textAddress = results.indexDylibs[i].textAddress;
+		dylibs[i].pathOffset = pathOffsets[i];
+	}
+	dyld_cache_symbol_index_symbol* indexSymbols = (dyld_cache_symbol_index_symbol*)&buffer[header.symbolsOffset];
+	for (uint32_t i=0; i < symbolCount; ++i) {
+		indexSymbols[i].address = symbols[i].address;
+		indexSymbols[i].size = sizes[i];
+		indexSymbols[i].nameOffset = nameOffsets[i];
+		indexSymbols[i].dylibIndex = symbols[i].dylibIndex;
+	}
+	if ( symbolCount != 0 )
+		memcpy(&buffer[header.byNameOffset], &byName[0], symbolCount*sizeof(uint32_t));
+	memcpy(&buffer[header.seedsOffset], &seeds[0], bucketCount*sizeof(uint32_t));
+	memcpy(&buffer[header.slotsOffset], &slots[0], slotCount*sizeof(uint32_t));
+	memcpy(&buffer[header.stringsOffset], &strings[0], strings.size());
+
+	// write to a temp file and rename, so readers never map a partial index
+	char tempPath[PATH_MAX];
+	snprintf(tempPath, sizeof(tempPath), "%s.tmp%d", indexPath, getpid());
+	FILE* file = fopen(tempPath, "w");
+	if ( file == NULL ) {
+		fprintf(stderr, "Error: can't create %s, errno=%d\n", tempPath, errno);
+		return false;
+	}
+	bool ok = (fwrite(&buffer[0], buffer.size(), 1, file) == 1);
+	ok = (fclose(file) == 0) && ok;
+	if ( !ok || (rename(tempPath, indexPath) != 0) ) {
+		fprintf(stderr, "Error: can't write %s, errno=%d\n", indexPath, errno);
+		unlink(tempPath);
+		return false;
+	}
+	printf("%u symbols (%u names) from %u dylibs written to %s\n", symbolCount, nameCount, header.dylibCount, indexPath);
+	return true;
+}
+
+
+/*
+ * Map a symbol index, checking that it was built from the cache
+ */
+static const dyld_cache_symbol_index_header* map_symbol_index(const char* indexPath, const uint8_t cacheUUID[16])
+{
+	struct stat statbuf;
+	int fd = ::open(indexPath, O_RDONLY);
+	if ( (fd < 0) || (::fstat(fd, &statbuf) != 0) ) {
+		fprintf(stderr, "Error: can't open symbol index %s, errno=%d, use -build-index to make it\n", indexPath, errno);
+		exit(1);
+	}
+	const uint64_t size = statbuf.st_size;
+	const dyld_cache_symbol_index_header* header = NULL;
+	if ( size >= sizeof(dyld_cache_symbol_index_header) )
+		header = (dyld_cache_symbol_index_header*)::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if ( (header == NULL) || (header == MAP_FAILED) || (strcmp(header->magic, DYLD_CACHE_SYMBOL_INDEX_MAGIC) != 0) ) {
+		fprintf(stderr, "Error: %s is not a symbol index\n", indexPath);
+		exit(1);
+	}
+	if (   (header->dylibsOffset + (uint64_t)header->dylibCount*sizeof(dyld_cache_symbol_index_dylib) > size)
+		|| (header->symbolsOffset + (uint64_t)header->symbolCount*sizeof(dyld_cache_symbol_index_symbol) > size)
+		|| (header->byNameOffset + (uint64_t)header->symbolCount*sizeof(uint32_t) > size)
+		|| (header->seedsOffset + (uint64_t)header->bucketCount*sizeof(uint32_t) > size)
+		|| (header->slotsOffset + (uint64_t)header->slotCount*sizeof(uint32_t) > size)
+		|| (header->stringsOffset + header->stringsSize > size)
+		|| (header->bucketCount == 0) || (header->slotCount == 0) ) {
+		fprintf(stderr, "Error: symbol index %s is truncated\n", indexPath);
+		exit(1);
+	}
+	if ( memcmp(header->cacheUUID, cacheUUID, 16) != 0 ) {
+		fprintf(stderr, "Error: symbol index %s was built from a different cache, use -build-index to update it\n", indexPath);
+		exit(1);
+	}
+	return header;
+}
+
+static const char* index_string(const dyld_cache_symbol_index_header* header, uint32_t offset)
+{
+	return (offset < header->stringsSize) ? (char*)header + header->stringsOffset + offset : "<corrupt string>";
+}
+
+/*
+ * Print every symbol named name, one hash probe
+ */
+static bool lookup_symbol(const dyld_cache_symbol_index_header* header, const char* name)
+{
+	const uint8_t* base = (uint8_t*)header;
+	const dyld_cache_symbol_index_dylib* dylibs = (dyld_cache_symbol_index_dylib*)(base + header->dylibsOffset);
+	const dyld_cache_symbol_index_symbol* symbols = (dyld_cache_symbol_index_symbol*)(base + header->symbolsOffset);
+	const uint32_t* byName = (uint32_t*)(base + header->byNameOffset);
+	const uint32_t* seeds = (uint32_t*)(base + header->seedsOffset);
+	const uint32_t* slots = (uint32_t*)(base + header->slotsOffset);
+
+	const uint64_t hash = dyld_cache_symbol_index_hash(name);
+	const uint32_t seed = seeds[dyld_cache_symbol_index_bucket(hash, header->bucketCount)];
+	bool found = false;
+	for (uint32_t i = slots[dyld_cache_symbol_index_slot(hash, seed, header->slotCount)]; i < header->symbolCount; ++i) {
+		const dyld_cache_symbol_index_symbol& symbol = symbols[byName[i]];
+		if ( strcmp(index_string(header, symbol.nameOffset), name) != 0 )
+			break;
+		const char* path = (symbol.dylibIndex < header->dylibCount) ? index_string(header, dylibs[symbol.dylibIndex].pathOffset) : "?";
+		printf("0x%08llX %s (in %s)\n", symbol.address, name, path);
+		found = true;
+	}
+	return found;
+}
+
+/*
+ * Print the symbol containing address, a binary search, or return false if address is past the end of the symbol below it
+ */
+static bool symbolicate_address(const dyld_cache_symbol_index_header* header, uint64_t address)
+{
+	const uint8_t* base = (uint8_t*)header;
+	const dyld_cache_symbol_index_dylib* dylibs = (dyld_cache_symbol_index_dylib*)(base + header->dylibsOffset);
+	const dyld_cache_symbol_index_symbol* symbols = (dyld_cache_symbol_index_symbol*)(base + header->symbolsOffset);
+
+	// find last symbol at or below address
+	uint32_t low = 0;
+	uint32_t high = header->symbolCount;
+	while ( low < high ) {
+		uint32_t mid = low + (high - low)/2;
+		if ( symbols[mid].address <= address )
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if ( low == 0 )
+		return false;
+
+	// of the symbols at that address, use one that reaches address, in case some are labels at the end of a section
+	uint32_t match = low-1;
+	for (uint32_t i=low-1; (i > 0) && (symbols[i-1].address == symbols[match].address) && (address - symbols[match].address >= symbols[match].size); --i)
+		match = i-1;
+	const dyld_cache_symbol_index_symbol& symbol = symbols[match];
+	if ( address - symbol.address >= symbol.size )
+		return false;
+	const char* path = (symbol.dylibIndex < header->dylibCount) ? index_string(header, dylibs[symbol.dylibIndex].pathOffset) : "?";
+	printf("0x%08llX %s + %llu (in %s)\n", address, index_string(header, symbol.nameOffset), address - symbol.address, path);
+	return true;
+}
+
+
 static void checkMode(Mode mode) {
 	if ( mode != modeNone ) {
-		fprintf(stderr, "Error: select one of: -list, -dependents, -info, -slide_info, -linkedit, -map, or -size\n");
+		fprintf(stderr, "Error: select one of: -list, -dependents, -info, -slide_info, -linkedit, -map, -size, -build-index, -lookup, or -symbolicate\n");
 		usage();
 		exit(1);
 	}
@@ -348,6 +769,9 @@ int main (int argc, const char* argv[]) {
     options.printDylibVersions = false;
 	options.printInodes = false;
     options.dependentsOfPath = NULL;
+	options.lookupName = NULL;
+	options.symbolicateAddress = 0;
+	options.indexPath = NULL;
     
     for (uint32_t i = 1; i < argc; i++) {
         const char* opt = argv[i];
@@ -385,6 +809,38 @@ int main (int argc, const char* argv[]) {
 			else if (strcmp(opt, "-size") == 0) {
 				checkMode(options.mode);
 				options.mode = modeSize;
+            } 
+			else if (strcmp(opt, "-build-index") == 0) {
+				checkMode(options.mode);
+				options.mode = modeBuildIndex;
+            } 
+			else if (strcmp(opt, "-lookup") == 0) {
+				checkMode(options.mode);
+				options.mode = modeLookup;
+				options.lookupName = argv[++i];
+                if ( i >= argc ) {
+                    fprintf(stderr, "Error: option -lookup requires an argument\n");
+                    usage();
+                    exit(1);
+                }
+            } 
+			else if (strcmp(opt, "-symbolicate") == 0) {
+				checkMode(options.mode);
+				options.mode = modeSymbolicate;
+                if ( ++i >= argc ) {
+                    fprintf(stderr, "Error: option -symbolicate requires an argument\n");
+                    usage();
+                    exit(1);
+                }
+				options.symbolicateAddress = strtoull(argv[i], NULL, 0);
+            } 
+			else if (strcmp(opt, "-index") == 0) {
+				options.indexPath = argv[++i];
+                if ( i >= argc ) {
+                    fprintf(stderr, "Error: option -index requires an argument\n");
+                    usage();
+                    exit(1);
+                }
             } 
 			else if (strcmp(opt, "-uuid") == 0) {
                 options.printUUIDs = true;
@@ -410,7 +866,7 @@ int main (int argc, const char* argv[]) {
     }
     
 	if ( options.mode == modeNone ) {
-		fprintf(stderr, "Error: select one of -list, -dependents, -info, -linkedit, or -map\n");
+		fprintf(stderr, "Error: select one of -list, -dependents, -info, -linkedit, -map, -build-index, -lookup, or -symbolicate\n");
 		usage();
 		exit(1);
 	}
@@ -449,6 +905,17 @@ int main (int argc, const char* argv[]) {
 		exit(1);
 	}
 	
+	// the symbol index is next to the cache unless -index says otherwise
+	char indexPath[PATH_MAX];
+	if ( options.indexPath != NULL )
+		strlcpy(indexPath, options.indexPath, PATH_MAX);
+	else
+		snprintf(indexPath, PATH_MAX, "%s%s", sharedCachePath, DYLD_CACHE_SYMBOL_INDEX_SUFFIX);
+	uint8_t cacheUUID[16];
+	bzero(cacheUUID, sizeof(cacheUUID));
+	if ( ((dyldCacheHeader<LittleEndian>*)options.mappedCache)->mappingOffset() >= 0x68 )
+		memcpy(cacheUUID, ((dyldCacheHeader<LittleEndian>*)options.mappedCache)->uuid(), 16);
+
 	if ( options.mode == modeSlideInfo ) {
 		const dyldCacheHeader<LittleEndian>* header = (dyldCacheHeader<LittleEndian>*)options.mappedCache;
 		if ( header->slideInfoOffset() == 0 ) {
@@ -502,6 +969,21 @@ int main (int argc, const char* argv[]) {
 				printf("    code sign   %3lluMB,  0x%08llX -> 0x%08llX\n", size/(1024*1024), csAddr, csAddr + size);
 		}
 	}
+	else if ( (options.mode == modeLookup) || (options.mode == modeSymbolicate) ) {
+		const dyld_cache_symbol_index_header* index = map_symbol_index(indexPath, cacheUUID);
+		if ( options.mode == modeLookup ) {
+			if ( !lookup_symbol(index, options.lookupName) ) {
+				fprintf(stderr, "Error: symbol %s not found in the shared cache at\n  %s\n", options.lookupName, sharedCachePath);
+				exit(1);
+			}
+		}
+		else {
+			if ( !symbolicate_address(index, options.symbolicateAddress) ) {
+				fprintf(stderr, "Error: no symbol for address 0x%08llX in the shared cache at\n  %s\n", options.symbolicateAddress, sharedCachePath);
+				exit(1);
+			}
+		}
+	}
 	else {
 		segment_callback_t callback;
 		if ( strcmp((char*)options.mappedCache, "dyld_v1    i386") == 0 ) {
@@ -521,9 +1003,14 @@ int main (int argc, const char* argv[]) {
 				case modeSize:
 					callback = collect_size<x86>;
 					break;
+				case modeBuildIndex:
+					callback = collect_symbols<x86>;
+					break;
 				case modeNone:
 				case modeInfo:
 				case modeSlideInfo:
+				case modeLookup:
+				case modeSymbolicate:
 					break;
 			}
 		}		
@@ -545,9 +1032,14 @@ int main (int argc, const char* argv[]) {
 				case modeSize:
 					callback = collect_size<x86_64>;
 					break;
+				case modeBuildIndex:
+					callback = collect_symbols<x86_64>;
+					break;
 				case modeNone:
 				case modeInfo:
 				case modeSlideInfo:
+				case modeLookup:
+				case modeSymbolicate:
 					break;
 			}
 		}		
@@ -569,9 +1061,14 @@ int main (int argc, const char* argv[]) {
 				case modeSize:
 					callback = collect_size<arm>;
 					break;
+				case modeBuildIndex:
+					callback = collect_symbols<arm>;
+					break;
 				case modeNone:
 				case modeInfo:
 				case modeSlideInfo:
+				case modeLookup:
+				case modeSymbolicate:
 					break;
 			}
 		}		
@@ -592,9 +1089,14 @@ int main (int argc, const char* argv[]) {
 				case modeSize:
 					callback = collect_size<arm64>;
 					break;
+				case modeBuildIndex:
+					callback = collect_symbols<arm64>;
+					break;
 				case modeNone:
 				case modeInfo:
 				case modeSlideInfo:
+				case modeLookup:
+				case modeSymbolicate:
 					break;
 			}
 		}		
@@ -626,6 +1128,10 @@ int main (int argc, const char* argv[]) {
 				printf(" 0x%08llX  %s\n", it->textSize, it->path);
 			}
 		}
+		else if ( options.mode == modeBuildIndex ) {
+			if ( !write_symbol_index(indexPath, cacheUUID, results) )
+				exit(1);
+		}
 		
 		if ( (options.mode == modeDependencies) && options.dependentsOfPath && !results.dependentTargetFound) {
 			fprintf(stderr, "Error: could not find '%s' in the shared cache at\n  %s\n", options.dependentsOfPath, sharedCachePath);
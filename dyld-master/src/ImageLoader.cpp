@@ -58,6 +58,10 @@ uint64_t								ImageLoader::fgTotalBindTime;
 uint64_t								ImageLoader::fgTotalWeakBindTime;
 uint64_t								ImageLoader::fgTotalDOF;
 uint64_t								ImageLoader::fgTotalInitTime;
+SymbolLookupCache<ImageLoader>			ImageLoader::fgSymbolLookupCache;
+WeakCoalescingTable<ImageLoader>		ImageLoader::fgWeakCoalescingTable;
+bool									ImageLoader::fgLinkingInParallel = false;
+const char								ImageLoader::fgNeedsLinkingThread[] = "needs the linking thread";
 uint16_t								ImageLoader::fgLoadOrdinal = 0;
 std::vector<ImageLoader::InterposeTuple>ImageLoader::fgInterposingTuples;
 uintptr_t								ImageLoader::fgNextPIEDylibAddress = 0;
@@ -90,6 +94,7 @@ void ImageLoader::deleteImage(ImageLoader* image)
 
 ImageLoader::~ImageLoader()
 {
+	fgWeakCoalescingTable.forget(this);
 	if ( fRealPath != NULL ) 
 		delete [] fRealPath;
 	if ( fPathOwnedByImage && (fPath != NULL) ) 
@@ -407,12 +412,26 @@ void ImageLoader::link(const LinkContext& context, bool forceLazysBound, bool pr
 	context.clearAllDepths();
 	this->recursiveUpdateDepth(context.imageCount());
 
+	// DYLD_PARALLEL_LINK rebases and binds images on worker threads, when it can
+	std::vector<ImageLoader*> unboundImages;
+	const bool inParallel = this->canLinkInParallel(context, forceLazysBound, unboundImages);
+
+	// all images are loaded, so exported symbol lookups can be remembered until link is done
+	// (the cache is not thread safe, so a parallel link only uses it for weak binding)
+	SymbolLookupCache<ImageLoader>::Session lookupSession(fgSymbolLookupCache, !context.symbolLookupCacheDisabled && !inParallel);
+
 	uint64_t t2 = mach_absolute_time();
- 	this->recursiveRebase(context);
+	if ( inParallel )
+		this->parallelRebase(context, unboundImages);
+	else
+		this->recursiveRebase(context);
 	context.notifyBatch(dyld_image_state_rebased);
 
 	uint64_t t3 = mach_absolute_time();
- 	this->recursiveBind(context, forceLazysBound, neverUnload);
+	if ( inParallel )
+		this->parallelBind(context, unboundImages, forceLazysBound, neverUnload);
+	else
+		this->recursiveBind(context, forceLazysBound, neverUnload);
 
 	uint64_t t4 = mach_absolute_time();
 	if ( !context.linkingMainExecutable )
@@ -798,11 +817,462 @@ void ImageLoader::recursiveBind(const LinkContext& context, bool forceLazysBound
 	}
 }
 
+//
+// DYLD_PARALLEL_LINK
+//
+// Rebasing an image only writes to that image, and binding its non-lazy pointers
+// only reads the export tries of other images (resolvers are not run), so images
+// can be rebased and bound at the same time on a few worker threads.  All images
+// are rebased at once.  Binds run in waves by depth, so an image is bound after
+// the images it depends on, as recursiveBind() does.  Notifications, state changes,
+// and errors are all handled afterwards on this thread in the serial order.
+//
+// This thread holds the dyld lock while the workers run, so a worker must never
+// do anything that can take it or that touches dyld's global state.  Workers only
+// run doParallelFixups(), which writes fixups in one image.  Anything else that
+// doRebase() and doBind() do (freeing LINKEDIT, the crash log message) is done
+// here by doneParallelFixups() and around the jobs.  A worker that would have to
+// do more (a flat lookup, recording a missing symbol) throws fgNeedsLinkingThread
+// instead, and the rest of the link is done serially on this thread.
+//
+// Worker threads come from libSystem, so a parallel link is only possible once
+// libSystem is initialized (dlopen() and friends), never for the main executable
+// or inserted libraries.  Weak binding (coalescing) stays serial, after all binds.
+//
+static const unsigned int kParallelLinkMaxWorkers = 4;
+
+static void printTime(const char* msg, uint64_t partTime, uint64_t totalTime);
+
+bool ImageLoader::canLinkInParallel(const LinkContext& context, bool forceLazysBound, std::vector<ImageLoader*>& images)
+{
+	if ( !context.parallelLink || (context.applyInParallel == NULL) || context.linkingMainExecutable )
+		return false;
+	
+	// lazy binds can run resolvers
+	if ( forceLazysBound )
+		return false;
+	
+	// keep log output and interposing in the order the serial link does them
+	if ( context.verboseRebase || context.verboseBind || context.verbosePrebinding || (fgInterposingTuples.size() != 0) )
+		return false;
+	
+	// a lookup cache session from an outer link would be shared by the workers
+	if ( fgSymbolLookupCache.active() )
+		return false;
+	
+	std::vector<ImageLoader*> visited;
+	this->recursiveGetUnboundImages(visited, images);
+	if ( images.size() < 2 )
+		return false;
+	for (std::vector<ImageLoader*>::iterator it=images.begin(); it != images.end(); ++it) {
+		if ( !(*it)->supportsParallelLink() )
+			return false;
+	}
+	return true;
+}
+
+// images that recursiveBind() would bind, in the order it would bind them
+void ImageLoader::recursiveGetUnboundImages(std::vector<ImageLoader*>& visited, std::vector<ImageLoader*>& images)
+{
+	if ( fState >= dyld_image_state_bound )
+		return;
+	// break cycles
+	for (std::vector<ImageLoader*>::iterator it=visited.begin(); it != visited.end(); ++it) {
+		if ( *it == this )
+			return;
+	}
+	visited.push_back(this);
+	
+	for(unsigned int i=0; i < libraryCount(); ++i) {
+		ImageLoader* dependentImage = libImage(i);
+		if ( dependentImage != NULL )
+			dependentImage->recursiveGetUnboundImages(visited, images);
+	}
+	images.push_back(this);
+}
+
+void ImageLoader::parallelLinkWorker(void* ctx, size_t)
+{
+	ParallelLinkWork& work = *(ParallelLinkWork*)ctx;
+	for (int32_t i = OSAtomicIncrement32(&work.next) - 1; i < work.count; i = OSAtomicIncrement32(&work.next) - 1) {
+		ParallelLinkJob& job = work.jobs[i];
+		uint64_t t0 = mach_absolute_time();
+		try {
+			job.image->doParallelFixups(work.context, work.bind);
+		}
+		catch (const char* msg) {
+			job.error = msg;
+		}
+		catch (...) {
+			// nothing else can be thrown back to the linking thread
+			job.error = "unexpected exception";
+		}
+		job.time = mach_absolute_time() - t0;
+	}
+}
+
+// returns the time spent by the workers, which is what doing the jobs one at a time would take
+uint64_t ImageLoader::runParallelLinkJobs(const LinkContext& context, ParallelLinkJob jobs[], unsigned int count, bool bind)
+{
+	if ( count == 0 )
+		return 0;
+	ParallelLinkWork work;
+	work.context = context;
+	work.context.linkingOnWorkerThread = true;
+	work.jobs = jobs;
+	work.count = count;
+	work.next = 0;
+	work.bind = bind;
+	for (unsigned int i=0; i < count; ++i) {
+		jobs[i].error = NULL;
+		jobs[i].time = 0;
+	}
+	
+	fgLinkingInParallel = true;
+	(*context.applyInParallel)((count < kParallelLinkMaxWorkers) ? count : kParallelLinkMaxWorkers, &work, &parallelLinkWorker);
+	fgLinkingInParallel = false;
+	
+	uint64_t workTime = 0;
+	for (unsigned int i=0; i < count; ++i)
+		workTime += jobs[i].time;
+	return workTime;
+}
+
+void ImageLoader::parallelRebase(const LinkContext& context, const std::vector<ImageLoader*>& images)
+{
+	uint64_t t0 = mach_absolute_time();
+	ParallelLinkJob jobs[images.size()];
+	unsigned int count = 0;
+	for (std::vector<ImageLoader*>::const_iterator it=images.begin(); it != images.end(); ++it) {
+		ImageLoader* image = *it;
+		if ( image->fState < dyld_image_state_rebased ) {
+			image->fState = dyld_image_state_rebased;
+			jobs[count++].image = image;
+		}
+	}
+	// the crash log message is one per process, so workers leave it alone
+	CRSetCrashLogMessage2(this->getPath());
+	uint64_t workTime = runParallelLinkJobs(context, jobs, count, false);
+	
+	// finish, notify, and report the first error, as recursiveRebase() would have
+	for (unsigned int i=0; i < count; ++i) {
+		if ( jobs[i].error != NULL ) {
+			// images that were rebased cannot be rebased again, so only the failed ones go back
+			for (unsigned int j=i; j < count; ++j) {
+				if ( jobs[j].error == NULL )
+					continue;
+				jobs[j].image->fState = dyld_image_state_dependents_mapped;
+				if ( j != i )
+					free((void*)jobs[j].error);
+			}
+			CRSetCrashLogMessage2(NULL);
+			throw jobs[i].error;
+		}
+		jobs[i].image->doneParallelFixups(context, false);
+		context.notifySingle(dyld_image_state_rebased, jobs[i].image);
+	}
+	CRSetCrashLogMessage2(NULL);
+	
+	if ( context.verboseParallelLink && (workTime != 0) ) {
+		dyld::log("dyld: parallel link of %s: rebased %u images\n", this->getShortName(), count);
+		printTime("dyld:   rebase time (compared to one image at a time)", mach_absolute_time() - t0, workTime);
+	}
+}
+
+void ImageLoader::parallelBind(const LinkContext& context, const std::vector<ImageLoader*>& images, bool forceLazysBound, bool neverUnload)
+{
+	uint64_t t0 = mach_absolute_time();
+	
+	// order by depth, deepest first, keeping the recursiveBind() order within a depth
+	// an image is always less deep than the images it depends on, so images of the same depth are independent
+	const unsigned int count = (unsigned int)images.size();
+	ParallelLinkJob jobs[count];
+	for (unsigned int i=0; i < count; ++i) {
+		unsigned int j = i;
+		for ( ; (j > 0) && (jobs[j-1].image->fDepth < images[i]->fDepth); --j)
+			jobs[j] = jobs[j-1];
+		jobs[j].image = images[i];
+	}
+	
+	// the crash log message is one per process, so workers leave it alone
+	CRSetCrashLogMessage2(this->getPath());
+	uint64_t workTime = 0;
+	unsigned int waveCount = 0;
+	for (unsigned int waveStart=0, waveEnd; waveStart < count; waveStart = waveEnd) {
+		for (waveEnd=waveStart+1; (waveEnd < count) && (jobs[waveEnd].image->fDepth == jobs[waveStart].image->fDepth); ++waveEnd)
+			;
+		for (unsigned int i=waveStart; i < waveEnd; ++i)
+			jobs[i].image->fState = dyld_image_state_bound;
+		workTime += runParallelLinkJobs(context, &jobs[waveStart], waveEnd-waveStart, true);
+		++waveCount;
+		
+		bool failed = false;
+		for (unsigned int i=waveStart; i < waveEnd; ++i) {
+			if ( jobs[i].error != NULL ) {
+				if ( jobs[i].error != fgNeedsLinkingThread )
+					free((void*)jobs[i].error);
+				failed = true;
+			}
+		}
+		if ( failed ) {
+			// binding is repeatable, so bind what is left one at a time, which does what
+			// the workers could not, or throws the error a serial link would have and
+			// records it the same way
+			for (unsigned int i=waveStart; i < count; ++i)
+				jobs[i].image->fState = dyld_image_state_rebased;
+			CRSetCrashLogMessage2(NULL);
+			this->recursiveBind(context, forceLazysBound, neverUnload);
+			return;
+		}
+		
+		for (unsigned int i=waveStart; i < waveEnd; ++i) {
+			ImageLoader* image = jobs[i].image;
+			image->doneParallelFixups(context, true);
+			// mark if lazys are also bound
+			if ( forceLazysBound || image->usablePrebinding(context) )
+				image->fAllLazyPointersBound = true;
+			// mark as never-unload if requested
+			if ( neverUnload )
+				image->setNeverUnload();
+			context.notifySingle(dyld_image_state_bound, image);
+		}
+	}
+	CRSetCrashLogMessage2(NULL);
+	
+	if ( context.verboseParallelLink && (workTime != 0) ) {
+		dyld::log("dyld: parallel link of %s: bound %u images in %u waves\n", this->getShortName(), count, waveCount);
+		printTime("dyld:   bind time (compared to one image at a time)", mach_absolute_time() - t0, workTime);
+	}
+}
+
+// Walks the sorted weak symbol lists of all images in step, coalescing each
+// name found in more than one of them.
+void ImageLoader::weakBindWithMerge(const LinkContext& context, ImageLoader* images[], int count)
+{
+	// make symbol iterators for each
+	ImageLoader::CoalIterator iterators[count];
+	ImageLoader::CoalIterator* sortedIts[count];
+	for(int i=0; i < count; ++i) {
+		// 对镜像进行排序
+		images[i]->initializeCoalIterator(iterators[i], i);
+		sortedIts[i] = &iterators[i];
+	}
+	
+	// walk all symbols keeping iterators in sync by 
+	// only ever incrementing the iterator with the lowest symbol 
+	int doneCount = 0;
+	while ( doneCount != count ) {
+		//for(int i=0; i < count; ++i)
+		//	dyld::log("sym[%d]=%s ", sortedIts[i]->loadOrder, sortedIts[i]->symbolName);
+		//dyld::log("\n");
+		// increment iterator with lowest symbol
+		// 收集需要进行绑定的弱符号
+		if ( sortedIts[0]->image->incrementCoalIterator(*sortedIts[0]) )
+			++doneCount; 
+		// re-sort iterators
+		for(int i=1; i < count; ++i) {
+			int result = strcmp(sortedIts[i-1]->symbolName, sortedIts[i]->symbolName);
+			if ( result == 0 )
+				sortedIts[i-1]->symbolMatches = true;
+			if ( result > 0 ) {
+				// new one is bigger then next, so swap
+				ImageLoader::CoalIterator* temp = sortedIts[i-1];
+				sortedIts[i-1] = sortedIts[i];
+				sortedIts[i] = temp;
+			}
+			if ( result < 0 )
+				break;
+		}
+		// process all matching symbols just before incrementing the lowest one that matches
+		if ( sortedIts[0]->symbolMatches && !sortedIts[0]->done ) {
+			const char* nameToCoalesce = sortedIts[0]->symbolName;
+			// pick first symbol in load order (and non-weak overrides weak)
+			uintptr_t targetAddr = 0;
+			ImageLoader* targetImage = NULL;
+			for(int i=0; i < count; ++i) {
+				if ( strcmp(iterators[i].symbolName, nameToCoalesce) == 0 ) {
+					if ( context.verboseWeakBind )
+						dyld::log("dyld: weak bind, found %s weak=%d in %s \n", nameToCoalesce, iterators[i].weakSymbol, iterators[i].image->getPath());
+					if ( iterators[i].weakSymbol ) {
+						if ( targetAddr == 0 ) {
+							// 按照映像的加载顺序在导出表中查找符号的地址
+							targetAddr = iterators[i].image->getAddressCoalIterator(iterators[i], context);
+							if ( targetAddr != 0 )
+								targetImage = iterators[i].image;
+						}
+					}
+					else {
+						targetAddr = iterators[i].image->getAddressCoalIterator(iterators[i], context);
+						if ( targetAddr != 0 ) {
+							targetImage = iterators[i].image;
+							// strong implementation found, stop searching
+							break;
+						}
+					}
+				}
+			}
+			// tell each to bind to this symbol (unless already bound)
+			if ( targetAddr != 0 ) {
+				if ( context.verboseWeakBind )
+					dyld::log("dyld: weak binding all uses of %s to copy from %s\n", nameToCoalesce, targetImage->getShortName());
+				for(int i=0; i < count; ++i) {
+					if ( strcmp(iterators[i].symbolName, nameToCoalesce) == 0 ) {
+						if ( context.verboseWeakBind )
+							dyld::log("dyld: weak bind, setting all uses of %s in %s to 0x%lX from %s\n", nameToCoalesce, iterators[i].image->getShortName(), targetAddr, targetImage->getShortName());
+						if ( ! iterators[i].image->fWeakSymbolsBound )
+							// 绑定操作
+							iterators[i].image->updateUsesCoalIterator(iterators[i], targetAddr, targetImage, context);
+						iterators[i].symbolMatches = false; 
+					}
+				}
+			}
+			
+		}
+	}
+}
+
+// Returns the address of the definition of an entry's name in its image, or 0,
+// looking it up only the first time it is needed.
+uintptr_t ImageLoader::weakDefinitionAddress(const LinkContext& context, WeakCoalescingTable<ImageLoader>::Entry& entry)
+{
+	if ( ! entry.addressKnown ) {
+		ImageLoader* image = fgWeakCoalescingTable.image(entry.image);
+		CoalIterator it;
+		image->initializeCoalIterator(it, entry.image);
+		it.symbolName = entry.name;
+		it.weakSymbol = entry.weakSymbol;
+		it.curIndex = entry.curIndex;
+		entry.address = image->getAddressCoalIterator(it, context);
+		entry.addressKnown = true;
+	}
+	return entry.address;
+}
+
+// Picks what all uses of the name of entry first, and of the entries chained
+// to it, are bound to, and records it as the target of those added by this
+// weakBind(). Same as weakBindWithMerge(): the first definition in load order,
+// unless some image has a non-weak one, and only if more than one image has the name.
+void ImageLoader::pickWeakTarget(const LinkContext& context, uint32_t first)
+{
+	WeakCoalescingTable<ImageLoader>& table = fgWeakCoalescingTable;
+	const char* name = table.entry(first).name;
+	bool inOtherImage = false;
+	for(uint32_t i=table.entry(first).next; i != 0; i=table.entry(i).next) {
+		if ( table.entry(i).image != table.entry(first).image ) {
+			inOtherImage = true;
+			break;
+		}
+	}
+	uintptr_t targetAddr = 0;
+	ImageLoader* targetImage = NULL;
+	if ( inOtherImage ) {
+		uint32_t i = first;
+		do {
+			WeakCoalescingTable<ImageLoader>::Entry& entry = table.entry(i);
+			ImageLoader* image = table.image(entry.image);
+			if ( context.verboseWeakBind )
+				dyld::log("dyld: weak bind, found %s weak=%d in %s \n", name, entry.weakSymbol, image->getPath());
+			if ( entry.weakSymbol ) {
+				if ( targetAddr == 0 ) {
+					targetAddr = weakDefinitionAddress(context, entry);
+					if ( targetAddr != 0 )
+						targetImage = image;
+				}
+			}
+			else {
+				targetAddr = weakDefinitionAddress(context, entry);
+				if ( targetAddr != 0 ) {
+					targetImage = image;
+					// strong implementation found, stop searching
+					break;
+				}
+			}
+		} while ( (i = table.entry(i).next) != 0 );
+		if ( (targetAddr != 0) && context.verboseWeakBind )
+			dyld::log("dyld: weak binding all uses of %s to copy from %s\n", name, targetImage->getShortName());
+	}
+	uint32_t i = first;
+	do {
+		if ( i >= table.firstNewEntry() ) {
+			WeakCoalescingTable<ImageLoader>::Target& target = table.target(i);
+			target.address = targetAddr;
+			target.image = targetImage;
+			target.picked = true;
+		}
+	} while ( (i = table.entry(i).next) != 0 );
+}
+
+// Coalesces weak symbols by name. Every weak symbol of every image goes in
+// fgWeakCoalescingTable, chained to the other entries with the same name, so
+// the definition for each name is picked with one lookup instead of by merging
+// the sorted symbol lists of all images. The uses in each image are then
+// updated in one pass over its own list. Images coalesced by an earlier
+// weakBind() stay in the table, along with the definitions looked up in them.
+// Returns false, having changed nothing, if the table could not be allocated.
+bool ImageLoader::weakBindWithTable(const LinkContext& context, ImageLoader* images[], int count)
+{
+	WeakCoalescingTable<ImageLoader>& table = fgWeakCoalescingTable;
+	const uint32_t firstNewImage = table.keep(images, count);
+	try {
+		// add the weak symbols of the images not in the table yet, in load order
+		for(uint32_t i=firstNewImage; i < (uint32_t)count; ++i) {
+			ImageLoader* image = images[i];
+			if ( ! table.addImage(image) ) {
+				table.clear();
+				return false;
+			}
+			CoalIterator it;
+			image->initializeCoalIterator(it, i);
+			while ( ! image->incrementCoalIterator(it) ) {
+				if ( ! table.addEntry(it.symbolName, it.curIndex, it.weakSymbol) ) {
+					table.clear();
+					return false;
+				}
+			}
+		}
+		if ( ! table.allocTargets() ) {
+			table.clear();
+			return false;
+		}
+
+		// pick a target for each name in an image not yet weak bound
+		for(uint32_t i=table.firstNewEntry(); i < table.entryCount(); ++i) {
+			if ( ! images[table.entry(i).image]->fWeakSymbolsBound && ! table.target(i).picked )
+				pickWeakTarget(context, table.firstWithName(i));
+		}
+
+		// then bind the uses in each image, walking its symbols in the same order they were added
+		for(uint32_t i=firstNewImage; i < (uint32_t)count; ++i) {
+			ImageLoader* image = images[i];
+			if ( image->fWeakSymbolsBound )
+				continue;
+			CoalIterator it;
+			image->initializeCoalIterator(it, i);
+			for(uint32_t e=table.firstEntryOfImage(i); ! image->incrementCoalIterator(it); ++e) {
+				const WeakCoalescingTable<ImageLoader>::Target& target = table.target(e);
+				if ( target.address == 0 )
+					continue;
+				if ( context.verboseWeakBind )
+					dyld::log("dyld: weak bind, setting all uses of %s in %s to 0x%lX from %s\n", it.symbolName, image->getShortName(), target.address, target.image->getShortName());
+				image->updateUsesCoalIterator(it, target.address, target.image, context);
+			}
+		}
+	}
+	catch (...) {
+		table.clear();
+		throw;
+	}
+	table.freeTargets();
+	return true;
+}
+
 void ImageLoader::weakBind(const LinkContext& context)
 {
 	if ( context.verboseWeakBind )
 		dyld::log("dyld: weak bind start:\n");
 	uint64_t t1 = mach_absolute_time();
+	// no-op when called from link(), which already has a session
+	SymbolLookupCache<ImageLoader>::Session lookupSession(fgSymbolLookupCache, !context.symbolLookupCacheDisabled);
 	// get set of ImageLoaders that participate in coalecsing
 	ImageLoader* imagesNeedingCoalescing[fgImagesRequiringCoalescing];
 	// 将sAllImages中所有含有弱符号的映像合并成一个列表
@@ -824,88 +1294,12 @@ void ImageLoader::weakBind(const LinkContext& context)
 
 	// don't need to do any coalescing if only one image has overrides, or all have already been done
 	if ( (countOfImagesWithWeakDefinitionsNotInSharedCache > 0) && (countNotYetWeakBound > 0) ) {
-		// make symbol iterators for each
-		ImageLoader::CoalIterator iterators[count];
-		ImageLoader::CoalIterator* sortedIts[count];
-		for(int i=0; i < count; ++i) {
-			// 对镜像进行排序
-			imagesNeedingCoalescing[i]->initializeCoalIterator(iterators[i], i);
-			sortedIts[i] = &iterators[i];
-			if ( context.verboseWeakBind )
+		if ( context.verboseWeakBind ) {
+			for(int i=0; i < count; ++i)
 				dyld::log("dyld: weak bind load order %d/%d for %s\n", i, count, imagesNeedingCoalescing[i]->getPath());
 		}
-		
-		// walk all symbols keeping iterators in sync by 
-		// only ever incrementing the iterator with the lowest symbol 
-		int doneCount = 0;
-		while ( doneCount != count ) {
-			//for(int i=0; i < count; ++i)
-			//	dyld::log("sym[%d]=%s ", sortedIts[i]->loadOrder, sortedIts[i]->symbolName);
-			//dyld::log("\n");
-			// increment iterator with lowest symbol
-			// 收集需要进行绑定的弱符号
-			if ( sortedIts[0]->image->incrementCoalIterator(*sortedIts[0]) )
-				++doneCount; 
-			// re-sort iterators
-			for(int i=1; i < count; ++i) {
-				int result = strcmp(sortedIts[i-1]->symbolName, sortedIts[i]->symbolName);
-				if ( result == 0 )
-					sortedIts[i-1]->symbolMatches = true;
-				if ( result > 0 ) {
-					// new one is bigger then next, so swap
-					ImageLoader::CoalIterator* temp = sortedIts[i-1];
-					sortedIts[i-1] = sortedIts[i];
-					sortedIts[i] = temp;
-				}
-				if ( result < 0 )
-					break;
-			}
-			// process all matching symbols just before incrementing the lowest one that matches
-			if ( sortedIts[0]->symbolMatches && !sortedIts[0]->done ) {
-				const char* nameToCoalesce = sortedIts[0]->symbolName;
-				// pick first symbol in load order (and non-weak overrides weak)
-				uintptr_t targetAddr = 0;
-				ImageLoader* targetImage = NULL;
-				for(int i=0; i < count; ++i) {
-					if ( strcmp(iterators[i].symbolName, nameToCoalesce) == 0 ) {
-						if ( context.verboseWeakBind )
-							dyld::log("dyld: weak bind, found %s weak=%d in %s \n", nameToCoalesce, iterators[i].weakSymbol, iterators[i].image->getPath());
-						if ( iterators[i].weakSymbol ) {
-							if ( targetAddr == 0 ) {
-								// 按照映像的加载顺序在导出表中查找符号的地址
-								targetAddr = iterators[i].image->getAddressCoalIterator(iterators[i], context);
-								if ( targetAddr != 0 )
-									targetImage = iterators[i].image;
-							}
-						}
-						else {
-							targetAddr = iterators[i].image->getAddressCoalIterator(iterators[i], context);
-							if ( targetAddr != 0 ) {
-								targetImage = iterators[i].image;
-								// strong implementation found, stop searching
-								break;
-							}
-						}
-					}
-				}
-				// tell each to bind to this symbol (unless already bound)
-				if ( targetAddr != 0 ) {
-					if ( context.verboseWeakBind )
-						dyld::log("dyld: weak binding all uses of %s to copy from %s\n", nameToCoalesce, targetImage->getShortName());
-					for(int i=0; i < count; ++i) {
-						if ( strcmp(iterators[i].symbolName, nameToCoalesce) == 0 ) {
-							if ( context.verboseWeakBind )
-								dyld::log("dyld: weak bind, setting all uses of %s in %s to 0x%lX from %s\n", nameToCoalesce, iterators[i].image->getShortName(), targetAddr, targetImage->getShortName());
-							if ( ! iterators[i].image->fWeakSymbolsBound )
-								// 绑定操作
-								iterators[i].image->updateUsesCoalIterator(iterators[i], targetAddr, targetImage, context);
-							iterators[i].symbolMatches = false; 
-						}
-					}
-				}
-				
-			}
-		}
+		if ( context.weakBindTableDisabled || !weakBindWithTable(context, imagesNeedingCoalescing, count) )
+			weakBindWithMerge(context, imagesNeedingCoalescing, count);
 		
 		// mark all as having all weak symbols bound
 		for(int i=0; i < count; ++i) {
@@ -1109,6 +1503,13 @@ void ImageLoader::printStatistics(unsigned int imageCount, const InitializerTimi
 		dyld::log("total binding symbol lookups: %s, average images searched per symbol: %u.%u\n", 
 				commatize(fgTotalBindSymbolsResolved, commaNum1), avgInt, avgTenths);
 	}
+	if ( fgSymbolLookupCache.hits() != 0 ) {
+		uint64_t lookups = fgSymbolLookupCache.hits() + fgSymbolLookupCache.misses();
+		uint32_t hitPercentTimesTen = (uint32_t)((fgSymbolLookupCache.hits() * 1000) / lookups);
+		dyld::log("total symbol lookup cache hits: %s of %s (%u.%u%%)\n", commatize(fgSymbolLookupCache.hits(), commaNum1),
+				commatize(lookups, commaNum2), hitPercentTimesTen/10, hitPercentTimesTen%10);
+		printTime("total binding time saved by symbol lookup cache", fgSymbolLookupCache.timeSaved(), totalTime);
+	}
 	printTime("total binding fixups time", fgTotalBindTime, totalTime);
 	printTime("total weak binding fixups time", fgTotalWeakBindTime, totalTime);
 	dyld::log("total bindings lazily fixed up: %s of %s\n", commatize(fgTotalLazyBindFixups, commaNum1), commatize(fgTotalPossibleLazyBindFixups, commaNum2));
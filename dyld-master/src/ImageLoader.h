@@ -39,6 +39,7 @@
 #include <TargetConditionals.h>
 #include <vector>
 #include <new>
+#include <libkern/OSAtomic.h>
 
 #if __arm__
  #include <mach/vm_page_size.h>
@@ -155,6 +156,9 @@ namespace dyld {
 extern "C" 	int   vm_alloc(vm_address_t* addr, vm_size_t size, uint32_t flags);
 extern "C" 	void* xmmap(void* addr, size_t len, int prot, int flags, int fd, off_t offset);
 
+#include "SymbolLookupCache.h"
+#include "WeakCoalescingTable.h"
+
 
 #if __LP64__
 	struct macho_header				: public mach_header_64  {};
@@ -180,6 +184,7 @@ extern "C" 	void* xmmap(void* addr, size_t len, int prot, int flags, int fd, off
 #endif
 
 
+struct dyld_closure_bind;
 
 struct ProgramVars
 {
@@ -264,6 +269,9 @@ public:
 										const char* errorTargetDylibPath, const char* errorSymbol);
 		ImageLoader*	(*findImageContainingAddress)(const void* addr);
 		void			(*addDynamicReference)(ImageLoader* from, ImageLoader* to);
+		void			(*applyInParallel)(size_t iterations, void* ctx, void (*work)(void* ctx, size_t index));
+		bool			(*launchClosureBinds)(const ImageLoader* image, const dyld_closure_bind** binds, uint32_t* count,
+											const ImageLoader* const** targets, const char** strings);
 		
 #if SUPPORT_OLD_CRT_INITIALIZATION
 		void			(*setRunInitialzersOldWay)();
@@ -286,9 +294,13 @@ public:
 		bool			codeSigningEnforced;
 		bool			mainExecutableCodeSigned;
 		bool			preFetchDisabled;
+		bool			symbolLookupCacheDisabled;
+		bool			weakBindTableDisabled;
+		bool			parallelLink;
 		bool			prebinding;
 		bool			bindFlat;
 		bool			linkingMainExecutable;
+		bool			linkingOnWorkerThread;		// set in the copy a parallel link's workers use
 		bool			startedInitializingMainExecutable;
 		bool			processIsRestricted;
 		bool			processRequiresLibraryValidation;
@@ -306,6 +318,7 @@ public:
 		bool			verboseRPaths;
 		bool			verboseInterposing;
 		bool			verboseCodeSignatures;
+		bool			verboseParallelLink;
 	};
 	
 	struct CoalIterator
@@ -521,6 +534,13 @@ public:
 	
 										// image has or uses weak definitions that need runtime coalescing
 	virtual bool						participatesInCoalescing() const = 0;
+	
+										// DYLD_PARALLEL_LINK splits doRebase() and doBind() in two: the fixups, which only
+										// write to this image and never re-enter dyld, so can run on a worker thread, and
+										// the rest, which the linking thread does afterwards
+	virtual bool						supportsParallelLink() const { return false; }
+	virtual void						doParallelFixups(const LinkContext& context, bool bind) { }
+	virtual void						doneParallelFixups(const LinkContext& context, bool bind) { }
 		
 										// if image has a UUID, copy into parameter and return true
 	virtual	bool						getUUID(uuid_t) const = 0;
@@ -679,6 +699,11 @@ protected:
 	void				recursiveInitialization(const LinkContext& context, mach_port_t this_thread,
 												ImageLoader::InitializerTimingList&, ImageLoader::UninitedUpwards&);
 
+						// DYLD_PARALLEL_LINK versions of recursiveRebase() and recursiveBind()
+	bool				canLinkInParallel(const LinkContext& context, bool forceLazysBound, std::vector<ImageLoader*>& images);
+	void				parallelRebase(const LinkContext& context, const std::vector<ImageLoader*>& images);
+	void				parallelBind(const LinkContext& context, const std::vector<ImageLoader*>& images, bool forceLazysBound, bool neverUnload);
+
 								// fill in information about dependent libraries (array length is fLibraryCount)
 	virtual void				doGetDependentLibraries(DependentLibraryInfo libs[]) = 0;
 	
@@ -731,6 +756,14 @@ protected:
 	
 	static uintptr_t			interposedAddress(const LinkContext& context, uintptr_t address, const ImageLoader* notInImage, const ImageLoader* onlyInImage=NULL);
 	
+								// statistics are also updated by worker threads during a parallel link
+	static void					addToStatistic(uint32_t& counter, uint32_t amount) {
+									if ( fgLinkingInParallel )
+										OSAtomicAdd32(amount, (volatile int32_t*)&counter);
+									else
+										counter += amount;
+								}
+	
 	static uintptr_t			fgNextPIEDylibAddress;
 	static uint32_t				fgImagesWithUsedPrebinding;
 	static uint32_t				fgImagesUsedFromSharedCache;
@@ -751,6 +784,10 @@ protected:
 	static uint64_t				fgTotalWeakBindTime;
 	static uint64_t				fgTotalDOF;
 	static uint64_t				fgTotalInitTime;
+	static SymbolLookupCache<ImageLoader>	fgSymbolLookupCache;
+	static WeakCoalescingTable<ImageLoader>	fgWeakCoalescingTable;
+	static bool					fgLinkingInParallel;
+	static const char			fgNeedsLinkingThread[];		// thrown by a worker for work it must not do
 	static std::vector<InterposeTuple>	fgInterposingTuples;
 	
 	const char*					fPath;
@@ -776,6 +813,26 @@ private:
 	void						processInitializers(const LinkContext& context, mach_port_t this_thread,
 													InitializerTimingList& timingInfo, ImageLoader::UninitedUpwards& ups);
 
+	struct ParallelLinkJob {
+		ImageLoader*			image;
+		const char*				error;		// message thrown by doParallelFixups()
+		uint64_t				time;		// spent on this image by its worker
+	};
+	struct ParallelLinkWork {
+		LinkContext				context;	// the linking thread's, with linkingOnWorkerThread set
+		ParallelLinkJob*		jobs;
+		int32_t					count;
+		volatile int32_t		next;		// index of the next job a worker takes
+		bool					bind;
+	};
+	void						recursiveGetUnboundImages(std::vector<ImageLoader*>& visited, std::vector<ImageLoader*>& images);
+	static uint64_t				runParallelLinkJobs(const LinkContext& context, ParallelLinkJob jobs[], unsigned int count, bool bind);
+	static void					parallelLinkWorker(void* ctx, size_t index);
+	static void					weakBindWithMerge(const LinkContext& context, ImageLoader* images[], int count);
+	static bool					weakBindWithTable(const LinkContext& context, ImageLoader* images[], int count);
+	static void					pickWeakTarget(const LinkContext& context, uint32_t first);
+	static uintptr_t			weakDefinitionAddress(const LinkContext& context, WeakCoalescingTable<ImageLoader>::Entry& entry);
+
 
 	recursive_lock*				fInitializerRecursiveLock;
 	uint16_t					fDepth;
@@ -1300,7 +1300,7 @@ void ImageLoaderMachO::doRebase(const LinkContext& context)
 	// if prebound and loaded at prebound address, then no need to rebase
 	if ( this->usablePrebinding(context) ) {
 		// skip rebasing because prebinding is valid
-		++fgImagesWithUsedPrebinding; // bump totals for statistics
+		addToStatistic(fgImagesWithUsedPrebinding, 1); // bump totals for statistics
 		return;
 	}
 
@@ -1553,6 +1553,9 @@ void __attribute__((noreturn)) ImageLoaderMachO::throwSymbolNotFound(const LinkC
 																	const char* referencedFrom, const char* fromVersMismatch,
 																	const char* expectedIn)
 {
+	// the error strings are global, so a worker leaves the error to the linking thread
+	if ( context.linkingOnWorkerThread )
+		throw fgNeedsLinkingThread;
 	// record values for possible use by CrashReporter or Finder
 	(*context.setErrorStrings)(dyld_error_kind_symbol_missing, referencedFrom, expectedIn, symbol);
 	dyld::throwf("Symbol not found: %s\n  Referenced from: %s%s\n  Expected in: %s\n",
@@ -1633,7 +1636,7 @@ uintptr_t ImageLoaderMachO::bindLocation(const LinkContext& context, uintptr_t l
 	}
 	
 	// update statistics
-	++fgTotalBindFixups;
+	addToStatistic(fgTotalBindFixups, 1);
 	
 	return newValue;
 }
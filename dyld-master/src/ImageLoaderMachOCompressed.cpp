@@ -39,6 +39,9 @@
 #include <mach/thread_status.h>
 #include <mach-o/loader.h> 
 #include "ImageLoaderMachOCompressed.h"
+#include "RebaseSpans.h"
+#include "LinkEditPaging.h"
+#include "dyld_closure_format.h"
 #include "mach-o/dyld_images.h"
 
 #ifndef EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE
@@ -194,7 +197,7 @@ ImageLoaderMachOCompressed* ImageLoaderMachOCompressed::instantiateFromFile(cons
 		// don't do this on prebound images or if prefetching is disabled
         if ( !context.preFetchDisabled && !image->isPrebindable()) {
 			image->preFetchDATA(fd, offsetInFat, context);
-			image->markSequentialLINKEDIT(context);
+			image->preFetchLINKEDIT(context);
 		}
 	}
 	catch (...) {
@@ -355,77 +358,74 @@ void ImageLoaderMachOCompressed::setLibImage(unsigned int libIndex, ImageLoader*
 }
 
 
-void ImageLoaderMachOCompressed::markFreeLINKEDIT(const LinkContext& context)
+// LinkEditPagingPlan handler that passes each run of pages on to madvise()
+struct LinkEditAdviser
 {
-	// mark that we are done with rebase and bind info 
-	markLINKEDIT(context, MADV_FREE);
+				LinkEditAdviser(const ImageLoader::LinkContext& context, const char* path, int advise, const char* adviseName)
+					: context(context), path(path), advise(advise), adviseName(adviseName), bytes(0) {}
+	void		operator()(uintptr_t start, uintptr_t end) {
+					// not worth a system call for a single page
+					if ( (end-start) <= dyld_page_size )
+						return;
+					madvise((void*)start, end-start, advise);
+					bytes += (end-start);
+					if ( context.verboseMapping )
+						dyld::log("%18s %s 0x%0lX -> 0x%0lX for %s\n", "__LINKEDIT", adviseName, start, end-1, path);
+				}
+	const ImageLoader::LinkContext&	context;
+	const char*						path;
+	int								advise;
+	const char*						adviseName;
+	uint64_t						bytes;
+};
+
+void ImageLoaderMachOCompressed::makeLinkEditPlan(LinkEditPagingPlan& plan)
+{
+	// rebase info is only read if not loaded at preferred address
+	if ( fSlide != 0 )
+		plan.add((uintptr_t)fLinkEditBase + fDyldInfo->rebase_off, fDyldInfo->rebase_size, LinkEditPagingPlan::kRebase);
+	plan.add((uintptr_t)fLinkEditBase + fDyldInfo->bind_off, fDyldInfo->bind_size, LinkEditPagingPlan::kBind);
+	plan.add((uintptr_t)fLinkEditBase + fDyldInfo->weak_bind_off, fDyldInfo->weak_bind_size, LinkEditPagingPlan::kWeakBind);
+	plan.add((uintptr_t)fLinkEditBase + fDyldInfo->lazy_bind_off, fDyldInfo->lazy_bind_size, LinkEditPagingPlan::kLazyBind);
+	plan.add((uintptr_t)fLinkEditBase + fDyldInfo->export_off, fDyldInfo->export_size, LinkEditPagingPlan::kExports);
 }
 
-void ImageLoaderMachOCompressed::markSequentialLINKEDIT(const LinkContext& context)
+void ImageLoaderMachOCompressed::preFetchLINKEDIT(const LinkContext& context)
 {
-	// mark the rebase and bind info and using sequential access
-	markLINKEDIT(context, MADV_SEQUENTIAL);
+	// Read in what link() will need: the rebase and bind info of this image, and
+	// its exports for the images that bind to it. Lazy bind info is usually
+	// only read later, one symbol at a time, so is left to be faulted in.
+	LinkEditPagingPlan plan(dyld_page_size);
+	this->makeLinkEditPlan(plan);
+	LinkEditAdviser adviser(context, this->getPath(), MADV_WILLNEED, "willneed");
+	plan.forEachRun(LinkEditPagingPlan::kRebase | LinkEditPagingPlan::kBind | LinkEditPagingPlan::kWeakBind | LinkEditPagingPlan::kExports, adviser);
+	fgTotalBytesPreFetched += adviser.bytes;
 }
 
-void ImageLoaderMachOCompressed::markLINKEDIT(const LinkContext& context, int advise)
+void ImageLoaderMachOCompressed::freeLINKEDIT(const LinkContext& context, uint8_t donePhases)
 {
-	// if not loaded at preferred address, mark rebase info 
-	uintptr_t start = 0;
-	if ( (fSlide != 0) && (fDyldInfo->rebase_size != 0) ) 
-		start = (uintptr_t)fLinkEditBase + fDyldInfo->rebase_off;
-	else if ( fDyldInfo->bind_off != 0 )
-		start = (uintptr_t)fLinkEditBase + fDyldInfo->bind_off;
-	else
-		return; // no binding info to prefetch
-		
-	// end is at end of bind info
-	uintptr_t end = 0;
-	if ( fDyldInfo->bind_off != 0 )
-		end = (uintptr_t)fLinkEditBase + fDyldInfo->bind_off + fDyldInfo->bind_size;
-	else if ( fDyldInfo->rebase_off != 0 )
-		end = (uintptr_t)fLinkEditBase + fDyldInfo->rebase_off + fDyldInfo->rebase_size;
-	else
-		return;
-		
-			
-	// round to whole pages
-	start = dyld_page_trunc(start);
-	end = dyld_page_round(end);
-
-	// do nothing if only one page of rebase/bind info
-	if ( (end-start) <= dyld_page_size )
-		return;
-	
-	// tell kernel about our access to these pages
-	madvise((void*)start, end-start, advise);
-	if ( context.verboseMapping ) {
-		const char* adstr = "sequential";
-		if ( advise == MADV_FREE )
-			adstr = "free";
-		dyld::log("%18s %s 0x%0lX -> 0x%0lX for %s\n", "__LINKEDIT", adstr, start, end-1, this->getPath());
-	}
+	// tell kernel we are done with the pages only the finished phases read,
+	// weak bind and export info are read again by later dlopen() and dlsym()
+	LinkEditPagingPlan plan(dyld_page_size);
+	this->makeLinkEditPlan(plan);
+	LinkEditAdviser adviser(context, this->getPath(), MADV_FREE, "free");
+	plan.forEachDoneRun(donePhases, adviser);
 }
 
 
 
-void ImageLoaderMachOCompressed::rebaseAt(const LinkContext& context, uintptr_t addr, uintptr_t slide, uint8_t type)
+// forEachSpan() handler for DYLD_PRINT_REBASINGS
+struct VerboseRebaseSpanSlider
 {
-	if ( context.verboseRebase ) {
-		dyld::log("dyld: rebase: %s:*0x%08lX += 0x%08lX\n", this->getShortName(), (uintptr_t)addr, slide);
-	}
-	//dyld::log("0x%08lX type=%d\n", addr, type);
-	uintptr_t* locationToFix = (uintptr_t*)addr;
-	switch (type) {
-		case REBASE_TYPE_POINTER:
-			*locationToFix += slide;
-			break;
-		case REBASE_TYPE_TEXT_ABSOLUTE32:
-			*locationToFix += slide;
-			break;
-		default:
-			dyld::throwf("bad rebase type %d", type);
-	}
-}
+				VerboseRebaseSpanSlider(const char* imageName, uintptr_t slide) : imageName(imageName), slide(slide) {}
+	void		operator()(const RebaseSpanDecoder<uintptr_t>::Span& span) {
+					for (uintptr_t i=0; i < span.count; ++i)
+						dyld::log("dyld: rebase: %s:*0x%08lX += 0x%08lX\n", imageName, span.address + i*span.stride, slide);
+					applyRebaseSpan<uintptr_t>(span, slide);
+				}
+	const char*	imageName;
+	uintptr_t	slide;
+};
 
 void ImageLoaderMachOCompressed::throwBadRebaseAddress(uintptr_t address, uintptr_t segmentEndAddress, int segmentIndex, 
 										const uint8_t* startOpcodes, const uint8_t* endOpcodes, const uint8_t* pos)
@@ -438,84 +438,54 @@ void ImageLoaderMachOCompressed::throwBadRebaseAddress(uintptr_t address, uintpt
 void ImageLoaderMachOCompressed::rebase(const LinkContext& context)
 {
 	CRSetCrashLogMessage2(this->getPath());
+	this->rebaseFixups(context);
+
+	// rebase info is not read again
+	if ( !context.preFetchDisabled )
+		this->freeLINKEDIT(context, LinkEditPagingPlan::kRebase);
+	CRSetCrashLogMessage2(NULL);
+}
+
+void ImageLoaderMachOCompressed::rebaseFixups(const LinkContext& context)
+{
 	const uintptr_t slide = this->fSlide;
 	const uint8_t* const start = fLinkEditBase + fDyldInfo->rebase_off;
 	const uint8_t* const end = &start[fDyldInfo->rebase_size];
-	const uint8_t* p = start;
 
 	try {
-		uint8_t type = 0;
-		int segmentIndex = 0;
-		uintptr_t address = segActualLoadAddress(0);
-		uintptr_t segmentEndAddress = segActualEndAddress(0);
-		uintptr_t count;
-		uintptr_t skip;
-		bool done = false;
-		while ( !done && (p < end) ) {
-			uint8_t immediate = *p & REBASE_IMMEDIATE_MASK;
-			uint8_t opcode = *p & REBASE_OPCODE_MASK;
-			++p;
-			switch (opcode) {
-				case REBASE_OPCODE_DONE:
-					done = true;
-					break;
-				case REBASE_OPCODE_SET_TYPE_IMM:
-					type = immediate;
-					break;
-				case REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
-					segmentIndex = immediate;
-					if ( segmentIndex >= fSegmentsCount )
-						dyld::throwf("REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB has segment %d which is too large (0..%d)",
-								segmentIndex, fSegmentsCount-1);
-					address = segActualLoadAddress(segmentIndex) + read_uleb128(p, end);
-					segmentEndAddress = segActualEndAddress(segmentIndex);
-					break;
-				case REBASE_OPCODE_ADD_ADDR_ULEB:
-					address += read_uleb128(p, end);
-					break;
-				case REBASE_OPCODE_ADD_ADDR_IMM_SCALED:
-					address += immediate*sizeof(uintptr_t);
-					break;
-				case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
-					for (int i=0; i < immediate; ++i) {
-						if ( address >= segmentEndAddress ) 
-							throwBadRebaseAddress(address, segmentEndAddress, segmentIndex, start, end, p);
-						rebaseAt(context, address, slide, type);
-						address += sizeof(uintptr_t);
-					}
-					fgTotalRebaseFixups += immediate;
-					break;
-				case REBASE_OPCODE_DO_REBASE_ULEB_TIMES:
-					count = read_uleb128(p, end);
-					for (uint32_t i=0; i < count; ++i) {
-						if ( address >= segmentEndAddress ) 
-							throwBadRebaseAddress(address, segmentEndAddress, segmentIndex, start, end, p);
-						rebaseAt(context, address, slide, type);
-						address += sizeof(uintptr_t);
-					}
-					fgTotalRebaseFixups += count;
-					break;
-				case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
-					if ( address >= segmentEndAddress ) 
-						throwBadRebaseAddress(address, segmentEndAddress, segmentIndex, start, end, p);
-					rebaseAt(context, address, slide, type);
-					address += read_uleb128(p, end) + sizeof(uintptr_t);
-					++fgTotalRebaseFixups;
-					break;
-				case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB:
-					count = read_uleb128(p, end);
-					skip = read_uleb128(p, end);
-					for (uint32_t i=0; i < count; ++i) {
-						if ( address >= segmentEndAddress ) 
-							throwBadRebaseAddress(address, segmentEndAddress, segmentIndex, start, end, p);
-						rebaseAt(context, address, slide, type);
-						address += skip + sizeof(uintptr_t);
-					}
-					fgTotalRebaseFixups += count;
-					break;
-				default:
-					dyld::throwf("bad rebase opcode %d", *p);
-			}
+		uintptr_t segStarts[fSegmentsCount];
+		uintptr_t segEnds[fSegmentsCount];
+		for (unsigned int i=0; i < fSegmentsCount; ++i) {
+			segStarts[i] = segActualLoadAddress(i);
+			segEnds[i] = segActualEndAddress(i);
+		}
+		// decode opcodes into runs of locations, sliding each run as it is decoded
+		RebaseSpanDecoder<uintptr_t> decoder(start, end, segStarts, segEnds, fSegmentsCount);
+		if ( context.verboseRebase ) {
+			VerboseRebaseSpanSlider slider(this->getShortName(), slide);
+			decoder.forEachSpan(slider);
+		}
+		else {
+			RebaseSpanSlider<uintptr_t> slider(slide);
+			decoder.forEachSpan(slider);
+		}
+		addToStatistic(fgTotalRebaseFixups, (uint32_t)decoder.totalCount());
+		switch ( decoder.error() ) {
+			case RebaseSpanDecoder<uintptr_t>::kNoError:
+				break;
+			case RebaseSpanDecoder<uintptr_t>::kBadUleb:
+				dyld::throwf("malformed uleb128");
+			case RebaseSpanDecoder<uintptr_t>::kBadSegment:
+				dyld::throwf("REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB has segment %d which is too large (0..%d)",
+						decoder.errorSegment(), fSegmentsCount-1);
+			case RebaseSpanDecoder<uintptr_t>::kBadAddress:
+				throwBadRebaseAddress(decoder.errorAddress(), segEnds[decoder.errorSegment()], decoder.errorSegment(),
+						start, end, start + decoder.errorOffset());
+				break;
+			case RebaseSpanDecoder<uintptr_t>::kBadType:
+				dyld::throwf("bad rebase type %d", decoder.errorValue());
+			case RebaseSpanDecoder<uintptr_t>::kBadOpcode:
+				dyld::throwf("bad rebase opcode %d", decoder.errorValue());
 		}
 	}
 	catch (const char* msg) {
@@ -523,7 +493,6 @@ void ImageLoaderMachOCompressed::rebase(const LinkContext& context)
 		free((void*)msg);
 		throw newMsg;
 	}
-	CRSetCrashLogMessage2(NULL);
 }
 
 //
@@ -598,10 +567,34 @@ const ImageLoader::Symbol* ImageLoaderMachOCompressed::findExportedSymbol(const
 	//dyld::log("Compressed::findExportedSymbol(%s) in %s\n", symbol, this->getShortName());
 	if ( fDyldInfo->export_size == 0 )
 		return NULL;
+	if ( !fgSymbolLookupCache.active() )
+		return this->findExportedSymbolInTrie(symbol, foundIn);
+
+	// during a link, binds, lazy binds, and weak binds share one cache of lookups
+	uint32_t hash;
+	const Symbol* sym;
+	const ImageLoader* cachedFoundIn;
+	if ( fgSymbolLookupCache.find(this, symbol, hash, sym, cachedFoundIn) ) {
+		if ( (sym != NULL) && (foundIn != NULL) )
+			*foundIn = cachedFoundIn;
+		return sym;
+	}
+	uint64_t t0 = mach_absolute_time();
+	const ImageLoader* walkFoundIn = NULL;
+	sym = this->findExportedSymbolInTrie(symbol, &walkFoundIn);
+	fgSymbolLookupCache.add(this, symbol, hash, sym, walkFoundIn, mach_absolute_time() - t0);
+	if ( (sym != NULL) && (foundIn != NULL) )
+		*foundIn = walkFoundIn;
+	return sym;
+}
+
+
+const ImageLoader::Symbol* ImageLoaderMachOCompressed::findExportedSymbolInTrie(const char* symbol, const ImageLoader** foundIn) const
+{
 #if LOG_BINDINGS
 	dyld::logBindings("%s: %s\n", this->getShortName(), symbol);
 #endif
-	++ImageLoaderMachO::fgSymbolTrieSearchs;
+	addToStatistic(ImageLoaderMachO::fgSymbolTrieSearchs, 1);
 	const uint8_t* start = &fLinkEditBase[fDyldInfo->export_off];
 	const uint8_t* end = &start[fDyldInfo->export_size];
 	const uint8_t* foundNodeStart = this->trieWalk(start, end, symbol); 
@@ -732,6 +725,9 @@ const char* ImageLoaderMachOCompressed::importedSymbolName(const Symbol* symbol)
 uintptr_t ImageLoaderMachOCompressed::resolveFlat(const LinkContext& context, const char* symbolName, bool weak_import, 
 													bool runResolver, const ImageLoader** foundIn)
 {
+	// adding a dynamic reference takes a lock
+	if ( context.linkingOnWorkerThread )
+		throw fgNeedsLinkingThread;
 	const Symbol* sym;
 	if ( context.flatExportFinder(symbolName, &sym, foundIn) ) {
 		if ( *foundIn != this )
@@ -877,6 +873,57 @@ void ImageLoaderMachOCompressed::throwBadBindingAddress(uintptr_t address, uintp
 }
 
 
+// Does the non-lazy binds of this image as recorded in the launch closure, if
+// there is one and it has this image. Binds to an image that is not the file
+// the closure was built from are looked up again. Returns false without
+// binding anything if any location or target does not fit what is loaded, so
+// that the opcodes are run instead.
+bool ImageLoaderMachOCompressed::bindFromLaunchClosure(const LinkContext& context)
+{
+	const dyld_closure_bind* binds;
+	uint32_t count;
+	const ImageLoader* const* targets;
+	const char* strings;
+	if ( (context.launchClosureBinds == NULL) || !context.launchClosureBinds(this, &binds, &count, &targets, &strings) )
+		return false;
+	// bindLocation() applies interposing, the closure's values have not been
+	if ( fgInterposingTuples.size() != 0 )
+		return false;
+
+	for (uint32_t i=0; i < count; ++i) {
+		const dyld_closure_bind& bind = binds[i];
+		if ( (bind.segIndex >= fSegmentsCount) || !segWriteable(bind.segIndex) || (bind.segOffset + sizeof(uintptr_t) > segSize(bind.segIndex)) )
+			return false;
+		if ( (bind.targetImage != DYLD_CLOSURE_ABSOLUTE) && (targets[bind.targetImage] != NULL) && (bind.targetSegIndex >= targets[bind.targetImage]->segmentCount()) )
+			return false;
+	}
+	LastLookup last = { 0, 0, NULL, 0, NULL };
+	uint32_t lookedUpCount = 0;
+	for (uint32_t i=0; i < count; ++i) {
+		const dyld_closure_bind& bind = binds[i];
+		const uintptr_t address = segActualLoadAddress(bind.segIndex) + (uintptr_t)bind.segOffset;
+		uintptr_t value = (uintptr_t)bind.targetSegOffset;
+		if ( bind.targetImage != DYLD_CLOSURE_ABSOLUTE ) {
+			const ImageLoader* target = targets[bind.targetImage];
+			if ( target == NULL ) {
+				this->bindAt(context, address, BIND_TYPE_POINTER, &strings[bind.symbolNameOffset], (uint8_t)bind.symbolFlags,
+							(intptr_t)bind.addend, bind.libraryOrdinal, "", &last);
+				++lookedUpCount;
+				continue;
+			}
+			value += target->segActualLoadAddress(bind.targetSegIndex);
+		}
+		uintptr_t* location = (uintptr_t*)address;
+		if ( context.verboseBind )
+			dyld::log("dyld: closure bind: %s:0x%08lX = 0x%08lX\n", this->getShortName(), (uintptr_t)location, value);
+		// test first so we don't needless dirty pages
+		if ( *location != value )
+			*location = value;
+	}
+	addToStatistic(fgTotalBindFixups, count - lookedUpCount);
+	return true;
+}
+
 void ImageLoaderMachOCompressed::doBind(const LinkContext& context, bool forceLazysBound)
 {
 	CRSetCrashLogMessage2(this->getPath());
@@ -894,8 +941,9 @@ void ImageLoaderMachOCompressed::doBind(const LinkContext& context, bool forceLa
 			this->makeTextSegmentWritable(context, true);
 	#endif
 	
-		// run through all binding opcodes
-		eachBind(context, &ImageLoaderMachOCompressed::bindAt);
+		// run through all binding opcodes, unless a launch closure has them resolved already
+		if ( !this->bindFromLaunchClosure(context) )
+			eachBind(context, &ImageLoaderMachOCompressed::bindAt);
 			
 	#if TEXT_RELOC_SUPPORT
 		// if there were __TEXT fixups, restore write protection
@@ -915,8 +963,13 @@ void ImageLoaderMachOCompressed::doBind(const LinkContext& context, bool forceLa
 			this->updateOptimizedLazyPointers(context);
 	
 		// tell kernel we are done with chunks of LINKEDIT
-		if ( !context.preFetchDisabled ) 
-			this->markFreeLINKEDIT(context);
+		if ( !context.preFetchDisabled ) {
+			uint8_t done = LinkEditPagingPlan::kRebase | LinkEditPagingPlan::kBind;
+			// the shared cache's LINKEDIT is read by every image in it, so leave its lazy bind info be
+			if ( forceLazysBound && !fInSharedCache )
+				done |= LinkEditPagingPlan::kLazyBind;
+			this->freeLINKEDIT(context, done);
+		}
 	}
 	
 	// set up dyld entry points in image
@@ -926,6 +979,47 @@ void ImageLoaderMachOCompressed::doBind(const LinkContext& context, bool forceLa
 }
 
 
+bool ImageLoaderMachOCompressed::supportsParallelLink() const
+{
+	// binding a main executable also sets up the program vars, and prebinding, __TEXT
+	// fixups, and the lazy pointers of images in the shared cache all need more than
+	// fixups in __DATA
+	if ( this->isExecutable() || this->isPrebindable() || fInSharedCache )
+		return false;
+#if TEXT_RELOC_SUPPORT
+	if ( fTextSegmentRebases || fTextSegmentBinds )
+		return false;
+#endif
+	return true;
+}
+
+// the parts of doRebase() and doBind() that a parallel link's workers do, for an
+// image that supportsParallelLink() and with lazy pointers left to be bound lazily
+void ImageLoaderMachOCompressed::doParallelFixups(const LinkContext& context, bool bind)
+{
+	if ( bind ) {
+		if ( !this->bindFromLaunchClosure(context) )
+			eachBind(context, &ImageLoaderMachOCompressed::bindAt);
+	}
+	else if ( fSlide != 0 ) {
+		this->rebaseFixups(context);
+	}
+}
+
+// and the rest, on the linking thread after the workers are done
+void ImageLoaderMachOCompressed::doneParallelFixups(const LinkContext& context, bool bind)
+{
+	if ( bind ) {
+		if ( !context.preFetchDisabled )
+			this->freeLINKEDIT(context, LinkEditPagingPlan::kRebase | LinkEditPagingPlan::kBind);
+		this->setupLazyPointerHandler(context);
+	}
+	else if ( (fSlide != 0) && !context.preFetchDisabled ) {
+		this->freeLINKEDIT(context, LinkEditPagingPlan::kRebase);
+	}
+}
+
+
 void ImageLoaderMachOCompressed::doBindJustLazies(const LinkContext& context)
 {
 	eachLazyBind(context, &ImageLoaderMachOCompressed::bindAt);
@@ -30,6 +30,7 @@
 
 #include "ImageLoaderMachO.h"
 
+class LinkEditPagingPlan;
 
 //
 // ImageLoaderMachOCompressed is the concrete subclass of ImageLoader which loads mach-o files 
@@ -59,6 +60,9 @@ public:
 	virtual void						setLibImage(unsigned int, ImageLoader*, bool, bool);
 	virtual void						doBind(const LinkContext& context, bool forceLazysBound);
 	virtual void						doBindJustLazies(const LinkContext& context);
+	virtual bool						supportsParallelLink() const;
+	virtual void						doParallelFixups(const LinkContext& context, bool bind);
+	virtual void						doneParallelFixups(const LinkContext& context, bool bind);
 	virtual uintptr_t					doBindLazySymbol(uintptr_t* lazyPointer, const LinkContext& context);
 	virtual uintptr_t					doBindFastLazySymbol(uint32_t lazyBindingInfoOffset, const LinkContext& context, void (*lock)(), void (*unlock)());
 	virtual const char*					findClosestSymbol(const void* addr, const void** closestAddr) const;
@@ -77,6 +81,7 @@ protected:
 	virtual	bool						hasSubLibrary(const LinkContext& context, const ImageLoader* child) const { return false; }
 	virtual uint32_t*					segmentCommandOffsets() const;
 	virtual	void						rebase(const LinkContext& context);
+	void								rebaseFixups(const LinkContext& context);
 	virtual const ImageLoader::Symbol*	findExportedSymbol(const char* name, const ImageLoader** foundIn) const;
 	virtual bool						containsSymbol(const void* addr) const;
 	virtual uintptr_t					exportedSymbolAddress(const LinkContext& context, const Symbol* symbol, const ImageLoader* requestor, bool runResolver) const;
@@ -108,17 +113,17 @@ private:
 																	uint32_t segOffsets[], unsigned int libCount);
 	static ImageLoaderMachOCompressed*	instantiateStart(const macho_header* mh, const char* path, unsigned int segCount, unsigned int libCount);
 	void								instantiateFinish(const LinkContext& context);
-	void								markSequentialLINKEDIT(const LinkContext& context);
-	void								markFreeLINKEDIT(const LinkContext& context);
-	void								markLINKEDIT(const LinkContext& context, int advise);
+	void								makeLinkEditPlan(LinkEditPagingPlan& plan);
+	void								preFetchLINKEDIT(const LinkContext& context);
+	void								freeLINKEDIT(const LinkContext& context, uint8_t donePhases);
 
-	void								rebaseAt(const LinkContext& context, uintptr_t addr, uintptr_t slide, uint8_t type);
 	void								throwBadRebaseAddress(uintptr_t address, uintptr_t segmentEndAddress, int segmentIndex, 
 												const uint8_t* startOpcodes, const uint8_t* endOpcodes, const uint8_t* pos);
 	uintptr_t							bindAt(const LinkContext& context, uintptr_t addr, uint8_t type, const char* symbolName, 
 												uint8_t symboFlags, intptr_t addend, long libraryOrdinal, const char* msg,
 												LastLookup* last, bool runResolver=false);
 	void								bindCompressed(const LinkContext& context);
+	bool								bindFromLaunchClosure(const LinkContext& context);
 	void								throwBadBindingAddress(uintptr_t address, uintptr_t segmentEndAddress, int segmentIndex, 
 												const uint8_t* startOpcodes, const uint8_t* endOpcodes, const uint8_t* pos);
 	uintptr_t							resolve(const LinkContext& context, const char* symbolName, 
@@ -134,6 +139,7 @@ private:
 	uintptr_t							dynamicInterposeAt(const LinkContext& context, uintptr_t addr, uint8_t type, const char*, 
 												uint8_t, intptr_t, long, const char*, LastLookup*, bool runResolver);
 	static const uint8_t*				trieWalk(const uint8_t* start, const uint8_t* end, const  char* s);
+	const ImageLoader::Symbol*			findExportedSymbolInTrie(const char* name, const ImageLoader** foundIn) const;
     void                                updateOptimizedLazyPointers(const LinkContext& context);
     void                                updateAlternateLazyPointer(uint8_t* stub, void** originalLazyPointerAddr, const LinkContext& context);
 	void								registerEncryption(const struct encryption_info_command* encryptCmd, const LinkContext& context);
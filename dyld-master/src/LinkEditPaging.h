@@ -0,0 +1,164 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __LINKEDIT_PAGING__
+#define __LINKEDIT_PAGING__
+
+#include <stdint.h>
+
+//
+// LinkEditPagingPlan says which pages of an image's compressed LINKEDIT each
+// phase of linking reads, so dyld can have the kernel read them in before
+// they are needed and let them go once no later phase needs them.
+//
+// Each blob (rebase, bind, weak bind, lazy bind and export info) is added
+// with the phase that reads it. Blobs are rounded out to whole pages and the
+// pages are cut into pieces at every blob boundary, each piece recording
+// every phase that reads any of it, so a page shared by the end of the
+// rebase info and the start of the bind info belongs to both.
+//
+// forEachRun() hands back the pieces read by any of the given phases, with
+// adjacent pieces merged, so that one madvise() covers as many pages as it
+// can. forEachDoneRun() hands back the pieces all of whose phases are done,
+// and never a page some phase still to come will read.
+//
+// There are at most five blobs, so the plan lives on the stack and needs
+// no allocation. Addresses are wherever the caller has LINKEDIT, mapped by
+// dyld or by a host tool.
+//
+class LinkEditPagingPlan
+{
+public:
+	enum Phase { kRebase=0x01, kBind=0x02, kWeakBind=0x04, kLazyBind=0x08, kExports=0x10 };
+
+					LinkEditPagingPlan(uintptr_t pageSize) : fPageSize(pageSize), fBlobCount(0), fPieceCount(0) {}
+
+	void			add(uintptr_t start, uintptr_t size, uint8_t phase);
+
+					// calls handler(start, end) for each run of pages any of phases reads
+	template <typename H>
+	void			forEachRun(uint8_t phases, H& handler)			{ build(); forEach(phases, 0, handler); }
+
+					// calls handler(start, end) for each run of pages only read by phases in done
+	template <typename H>
+	void			forEachDoneRun(uint8_t done, H& handler)		{ build(); forEach(0xFF, (uint8_t)~done, handler); }
+
+private:
+	enum { kMaxBlobs = 5, kMaxPieces = 2*kMaxBlobs - 1 };
+
+	struct Range {
+		uintptr_t	start;
+		uintptr_t	end;
+		uint8_t		phases;
+	};
+
+	void			build();
+	template <typename H>
+	void			forEach(uint8_t want, uint8_t notWant, H& handler);
+
+	uintptr_t		fPageSize;
+	Range			fBlobs[kMaxBlobs];
+	Range			fPieces[kMaxPieces];
+	uint32_t		fBlobCount;
+	uint32_t		fPieceCount;		// 0 until built
+};
+
+
+inline void LinkEditPagingPlan::add(uintptr_t start, uintptr_t size, uint8_t phase)
+{
+	if ( (size == 0) || (fBlobCount == kMaxBlobs) )
+		return;
+	Range& blob = fBlobs[fBlobCount++];
+	blob.start = start & ~(fPageSize-1);
+	blob.end = (start + size + fPageSize-1) & ~(fPageSize-1);
+	blob.phases = phase;
+	fPieceCount = 0;
+}
+
+inline void LinkEditPagingPlan::build()
+{
+	if ( (fPieceCount != 0) || (fBlobCount == 0) )
+		return;
+
+	// every blob start and end, sorted and unique
+	uintptr_t bounds[2*kMaxBlobs];
+	uint32_t boundCount = 0;
+	for (uint32_t i=0; i < fBlobCount; ++i) {
+		const uintptr_t ends[2] = { fBlobs[i].start, fBlobs[i].end };
+		for (int e=0; e < 2; ++e) {
+			uint32_t j = 0;
+			while ( (j < boundCount) && (bounds[j] < ends[e]) )
+				++j;
+			if ( (j < boundCount) && (bounds[j] == ends[e]) )
+				continue;
+			for (uint32_t k=boundCount; k > j; --k)
+				bounds[k] = bounds[k-1];
+			bounds[j] = ends[e];
+			++boundCount;
+		}
+	}
+
+	// each stretch between two bounds is read by every blob covering it
+	for (uint32_t i=0; i+1 < boundCount; ++i) {
+		uint8_t phases = 0;
+		for (uint32_t b=0; b < fBlobCount; ++b) {
+			if ( (fBlobs[b].start <= bounds[i]) && (bounds[i+1] <= fBlobs[b].end) )
+				phases |= fBlobs[b].phases;
+		}
+		if ( phases == 0 )
+			continue;	// gap between blobs
+		Range& piece = fPieces[fPieceCount++];
+		piece.start = bounds[i];
+		piece.end = bounds[i+1];
+		piece.phases = phases;
+	}
+}
+
+// Calls handler with each run of adjacent pieces read by a phase in want and
+// by none in notWant.
+template <typename H>
+void LinkEditPagingPlan::forEach(uint8_t want, uint8_t notWant, H& handler)
+{
+	uintptr_t runStart = 0;
+	uintptr_t runEnd = 0;
+	for (uint32_t i=0; i < fPieceCount; ++i) {
+		const Range& piece = fPieces[i];
+		if ( !(piece.phases & want) || (piece.phases & notWant) )
+			continue;
+		if ( (runEnd != 0) && (piece.start == runEnd) ) {
+			runEnd = piece.end;
+			continue;
+		}
+		if ( runEnd != 0 )
+			handler(runStart, runEnd);
+		runStart = piece.start;
+		runEnd = piece.end;
+	}
+	if ( runEnd != 0 )
+		handler(runStart, runEnd);
+}
+
+
+#endif // __LINKEDIT_PAGING__
@@ -0,0 +1,256 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __MAPPED_RANGE_INDEX__
+#define __MAPPED_RANGE_INDEX__
+
+#include <stdint.h>
+#include <string.h>
+#include <mach/mach.h>
+#include <libkern/OSAtomic.h>
+
+#include <algorithm>
+
+//
+// MappedRangeIndex maps addresses to the image whose segments contain them.
+//
+// Updates are only made with the dyld lock held, so there is one writer at
+// a time. Readers (dladdr() and friends, often called from crash reporters
+// and sampling profilers) never take a lock and never write to the index.
+//
+// The index is a snapshot published through one pointer.  A snapshot holds a
+// sorted array of non-overlapping [start, end) ranges, searched with a
+// branch-free binary search, followed by a short unsorted tail that new
+// ranges are appended to in place. A tail slot is filled in before the tail
+// count that covers it is published, so readers never see a partial record.
+// When the tail is full, or an image is removed, the writer merges everything
+// into the other of two snapshot buffers and publishes that one instead.
+//
+// Removing an image clears its image fields in place first, so a reader
+// still in the old snapshot finds nothing rather than a stale image.
+//
+// A reader can still be searching the buffer the writer is about to merge
+// into. The writer bumps fGeneration before it starts, and a reader that
+// sees fGeneration change while it searched starts over. Until then the
+// reader may see a mix of old and new records, so every count it reads is
+// clamped to the buffer's capacity, which never changes.
+//
+// Buffers are allocated in whole pages with vm_alloc() (declared in
+// ImageLoader.h), as during launch malloc() is dyld's pool, which cannot free
+// and cannot hand out a block larger than a pool chunk. A buffer that is too
+// small for a merge is replaced by one twice the size it needs. The one it
+// replaces is never unmapped, since a reader may still be in it, but it is
+// less than half the size of its replacement, so all of them together take
+// less space than the two live buffers.
+//
+// There is no constructor, so a static instance is zero filled and needs no
+// initializer.
+//
+template <typename I>
+class MappedRangeIndex
+{
+public:
+	void		add(I* image, uintptr_t start, uintptr_t end);
+	void		remove(I* image);
+	I*			find(uintptr_t target);
+
+private:
+	enum { kTailCapacity = 64 };
+
+	struct Range {
+		uintptr_t		start;
+		uintptr_t		end;
+		I* volatile		image;		// NULL once the image is removed
+	};
+
+	struct Snapshot {
+		uint32_t			capacity;	// ranges this buffer can hold
+		volatile uint32_t	sortedCount;
+		volatile uint32_t	tailCount;
+		Range				ranges[];	// sortedCount sorted, then up to kTailCapacity
+	};
+
+	static Snapshot*	newSnapshot(uint32_t capacity);
+	static bool			startsBefore(const Range& a, const Range& b) { return a.start < b.start; }
+	void				rebuild(const Range* extra);
+
+	Snapshot* volatile	fCurrent;
+	Snapshot*			fSpare;			// the buffer that is not current
+	volatile uint32_t	fGeneration;	// bumped before fSpare is overwritten
+};
+
+
+template <typename I>
+typename MappedRangeIndex<I>::Snapshot* MappedRangeIndex<I>::newSnapshot(uint32_t capacity)
+{
+	// new pages are zero filled
+	vm_size_t size = round_page(sizeof(Snapshot) + capacity * sizeof(Range));
+	vm_address_t addr = 0;
+	if ( vm_alloc(&addr, size, VM_FLAGS_ANYWHERE | VM_MAKE_TAG(VM_MEMORY_DYLD)) != KERN_SUCCESS )
+		return NULL;
+	Snapshot* result = (Snapshot*)addr;
+	result->capacity = (uint32_t)((size - sizeof(Snapshot)) / sizeof(Range));
+	return result;
+}
+
+// Replace the current snapshot with one that has every live range sorted,
+// plus extra if it is not NULL. If no buffer big enough can be allocated,
+// the index is left as it was and extra is not added.
+template <typename I>
+void MappedRangeIndex<I>::rebuild(const Range* extra)
+{
+	Snapshot* old = fCurrent;
+	uint32_t oldSorted = (old != NULL) ? old->sortedCount : 0;
+	uint32_t oldTail = (old != NULL) ? old->tailCount : 0;
+
+	uint32_t count = (extra != NULL) ? 1 : 0;
+	for (uint32_t i=0; i < oldSorted+oldTail; ++i) {
+		if ( old->ranges[i].image != NULL )
+			++count;
+	}
+
+	Snapshot* snap = fSpare;
+	if ( (snap == NULL) || (snap->capacity < count + kTailCapacity) ) {
+		// the one being replaced stays mapped, a reader may still be in it
+		snap = newSnapshot(2 * (count + kTailCapacity));
+		if ( snap == NULL )
+			return;
+	}
+	else {
+		// any reader still in the spare buffer will see this and start over
+		OSAtomicIncrement32Barrier((volatile int32_t*)&fGeneration);
+		snap->sortedCount = 0;
+		snap->tailCount = 0;
+		OSMemoryBarrier();
+	}
+
+	Range* out = snap->ranges;
+	for (uint32_t i=0; i < oldSorted; ++i) {
+		if ( old->ranges[i].image != NULL )
+			*out++ = old->ranges[i];
+	}
+	Range* tail = out;
+	for (uint32_t i=oldSorted; i < oldSorted+oldTail; ++i) {
+		if ( old->ranges[i].image != NULL )
+			*out++ = old->ranges[i];
+	}
+	if ( extra != NULL )
+		*out++ = *extra;
+	// the sorted part stays sorted, so only the tail needs sorting before the merge
+	std::sort(tail, out, &startsBefore);
+	std::inplace_merge(snap->ranges, tail, out, &startsBefore);
+	snap->sortedCount = count;
+
+	// publish with a barrier so that any reader will see a complete snapshot
+	OSMemoryBarrier();
+	fCurrent = snap;
+	OSMemoryBarrier();
+	fSpare = old;
+}
+
+template <typename I>
+void MappedRangeIndex<I>::add(I* image, uintptr_t start, uintptr_t end)
+{
+	Snapshot* snap = fCurrent;
+	if ( (snap != NULL) && (snap->tailCount < kTailCapacity) ) {
+		Range& slot = snap->ranges[snap->sortedCount + snap->tailCount];
+		slot.start = start;
+		slot.end = end;
+		slot.image = image;
+		// make the record visible before the count that covers it
+		OSMemoryBarrier();
+		snap->tailCount = snap->tailCount + 1;
+		return;
+	}
+	Range range = { start, end, image };
+	rebuild(&range);
+}
+
+template <typename I>
+void MappedRangeIndex<I>::remove(I* image)
+{
+	Snapshot* snap = fCurrent;
+	if ( snap == NULL )
+		return;
+	bool found = false;
+	for (uint32_t i=0; i < snap->sortedCount+snap->tailCount; ++i) {
+		if ( snap->ranges[i].image == image ) {
+			// clear with a barrier so that any reader will see consistent records
+			OSMemoryBarrier();
+			snap->ranges[i].image = NULL;
+			found = true;
+		}
+	}
+	if ( found )
+		rebuild(NULL);
+}
+
+template <typename I>
+I* MappedRangeIndex<I>::find(uintptr_t target)
+{
+	for (;;) {
+		uint32_t generation = fGeneration;
+		OSMemoryBarrier();
+		Snapshot* snap = fCurrent;
+		if ( snap == NULL )
+			return NULL;
+		I* result = NULL;
+		// counts may be mid-update if the writer is reusing this buffer
+		uint32_t capacity = snap->capacity;
+		uint32_t sortedCount = std::min((uint32_t)snap->sortedCount, capacity);
+		uint32_t tailCount = snap->tailCount;
+		OSMemoryBarrier();
+		tailCount = std::min(tailCount, capacity - sortedCount);
+
+		// find the last sorted range starting at or below target
+		const Range* base = snap->ranges;
+		uint32_t n = sortedCount;
+		if ( n != 0 ) {
+			while ( n > 1 ) {
+				uint32_t half = n / 2;
+				base = (base[half].start <= target) ? &base[half] : base;
+				n -= half;
+			}
+			if ( (base->start <= target) && (target < base->end) )
+				result = base->image;
+		}
+		if ( result == NULL ) {
+			const Range* tail = &snap->ranges[sortedCount];
+			for (uint32_t i=0; i < tailCount; ++i) {
+				if ( (tail[i].start <= target) && (target < tail[i].end) ) {
+					result = tail[i].image;
+					break;
+				}
+			}
+		}
+
+		OSMemoryBarrier();
+		if ( fGeneration == generation )
+			return result;
+	}
+}
+
+
+#endif // __MAPPED_RANGE_INDEX__
@@ -0,0 +1,273 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __REBASE_SPANS__
+#define __REBASE_SPANS__
+
+#include <stdint.h>
+#include <mach-o/loader.h>
+
+//
+// RebaseSpanDecoder turns the REBASE_OPCODE_* stream of an image into runs
+// of equally spaced locations, (address, stride, count), instead of one call
+// per location, and checks each run against its segment once.
+//
+// forEachSpan() hands each run to its caller as soon as it is decoded, in the
+// order ld emitted them, which is address order, so pages are touched
+// sequentially. applyRebaseSpan() slides every location in a run; runs of
+// adjacent pointers are a plain loop over an array, which the compiler can
+// vectorize. Decoding a batch of runs before applying any, or folding single
+// rebases into longer runs first, was measured to be slower, as the stores
+// then no longer overlap with decoding.
+//
+// Addresses are where the caller has the segments, the real load address in
+// dyld or a mapped file on the host. pint_t is the pointer size of the image.
+// Decoding errors are returned rather than thrown so that dyld and host tools
+// can each report them their own way.
+//
+template <typename pint_t>
+class RebaseSpanDecoder
+{
+public:
+	enum Error { kNoError, kBadUleb, kBadSegment, kBadAddress, kBadType, kBadOpcode };
+
+	struct Span {
+		uintptr_t	address;		// first location to slide
+		uintptr_t	stride;			// bytes from one location to the next
+		uintptr_t	count;
+		uint8_t		type;
+	};
+
+				RebaseSpanDecoder(const uint8_t* start, const uint8_t* end, const uintptr_t segStarts[], const uintptr_t segEnds[], uint32_t segCount);
+
+					// calls handler(span) for each run in order, returns false on error
+	template <typename H>
+	bool			forEachSpan(H& handler);
+
+	Error			error() const			{ return fError; }
+	uintptr_t		errorAddress() const	{ return fAddress; }	// for kBadAddress
+	uint32_t		errorSegment() const	{ return fSegIndex; }	// for kBadSegment, kBadAddress
+	uint8_t			errorValue() const		{ return fErrorValue; }	// bad type or opcode
+	uintptr_t		errorOffset() const		{ return (uintptr_t)(fPos - fStart); }
+	uintptr_t		totalCount() const		{ return fTotalCount; }
+
+private:
+	// decoding state, kept on the stack while decoding so that it stays in
+	// registers instead of being reloaded after every store through a span
+	struct Cursor {
+		const uint8_t*	pos;
+		uintptr_t		address;
+		uintptr_t		segEnd;
+		uintptr_t		total;
+		uint8_t			type;
+		Error			error;
+	};
+
+	static bool		readUleb(Cursor& c, const uint8_t* end, uintptr_t& result);
+	template <typename H>
+	static bool		add(Cursor& c, H& handler, uintptr_t stride, uintptr_t count);
+
+	const uint8_t*		fStart;
+	const uint8_t*		fEnd;
+	const uint8_t*		fPos;
+	const uintptr_t*	fSegStarts;
+	const uintptr_t*	fSegEnds;
+	uint32_t			fSegCount;
+	uint32_t			fSegIndex;
+	uintptr_t			fAddress;
+	uintptr_t			fTotalCount;
+	uint8_t				fErrorValue;
+	Error				fError;
+};
+
+
+template <typename pint_t>
+RebaseSpanDecoder<pint_t>::RebaseSpanDecoder(const uint8_t* start, const uint8_t* end, const uintptr_t segStarts[], const uintptr_t segEnds[], uint32_t segCount)
+	: fStart(start), fEnd(end), fPos(start), fSegStarts(segStarts), fSegEnds(segEnds), fSegCount(segCount),
+	  fSegIndex(0), fAddress(segStarts[0]), fTotalCount(0), fErrorValue(0), fError(kNoError)
+{
+}
+
+template <typename pint_t>
+inline bool RebaseSpanDecoder<pint_t>::readUleb(Cursor& c, const uint8_t* end, uintptr_t& result)
+{
+	// most values fit in one byte
+	if ( (c.pos < end) && !(*c.pos & 0x80) ) {
+		result = *c.pos++;
+		return true;
+	}
+	uint64_t value = 0;
+	int bit = 0;
+	do {
+		if ( (c.pos == end) || (bit > 63) ) {
+			c.error = kBadUleb;
+			return false;
+		}
+		value |= ((uint64_t)(*c.pos & 0x7f) << bit);
+		bit += 7;
+	} while ( *c.pos++ & 0x80 );
+	result = (uintptr_t)value;
+	return true;
+}
+
+// Hands off the run of count locations stride apart starting at c.address,
+// and advances c.address past them.
+template <typename pint_t>
+template <typename H>
+inline bool RebaseSpanDecoder<pint_t>::add(Cursor& c, H& handler, uintptr_t stride, uintptr_t count)
+{
+	if ( count == 0 )
+		return true;
+	if ( (c.type != REBASE_TYPE_POINTER) && (c.type != REBASE_TYPE_TEXT_ABSOLUTE32) ) {
+		c.error = kBadType;
+		return false;
+	}
+	// every location, not just the first, must be inside the segment
+	uintptr_t lastOffset;
+	if ( (c.address >= c.segEnd) || __builtin_mul_overflow(count-1, stride, &lastOffset) || (lastOffset >= c.segEnd - c.address) ) {
+		// report the first location outside, or the highest address if that
+		// one is past the top of the address space
+		if ( c.address < c.segEnd ) {
+			uintptr_t inside = c.segEnd - c.address;
+			uintptr_t steps = inside/stride + ((inside % stride) != 0);
+			uintptr_t offset;
+			if ( __builtin_mul_overflow(steps, stride, &offset) || __builtin_add_overflow(c.address, offset, &c.address) )
+				c.address = UINTPTR_MAX;
+		}
+		c.error = kBadAddress;
+		return false;
+	}
+	c.total += count;
+
+	Span span;
+	span.address = c.address;
+	span.stride = stride;
+	span.count = count;
+	span.type = c.type;
+	handler(span);
+	c.address += count*stride;
+	return true;
+}
+
+template <typename pint_t>
+template <typename H>
+bool RebaseSpanDecoder<pint_t>::forEachSpan(H& handler)
+{
+	Cursor c;
+	c.pos = fStart;
+	c.address = fSegStarts[0];
+	c.segEnd = fSegEnds[0];
+	c.total = 0;
+	c.type = 0;
+	c.error = kNoError;
+	const uint8_t* const end = fEnd;
+	bool done = false;
+	uintptr_t count;
+	uintptr_t skip;
+	while ( !done && (c.error == kNoError) && (c.pos < end) ) {
+		uint8_t immediate = *c.pos & REBASE_IMMEDIATE_MASK;
+		uint8_t opcode = *c.pos & REBASE_OPCODE_MASK;
+		++c.pos;
+		switch (opcode) {
+			case REBASE_OPCODE_DONE:
+				done = true;
+				break;
+			case REBASE_OPCODE_SET_TYPE_IMM:
+				c.type = immediate;
+				break;
+			case REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+				fSegIndex = immediate;
+				if ( fSegIndex >= fSegCount ) {
+					c.error = kBadSegment;
+					break;
+				}
+				c.segEnd = fSegEnds[fSegIndex];
+				if ( readUleb(c, end, skip) )
+					c.address = fSegStarts[fSegIndex] + skip;
+				break;
+			case REBASE_OPCODE_ADD_ADDR_ULEB:
+				if ( readUleb(c, end, skip) )
+					c.address += skip;
+				break;
+			case REBASE_OPCODE_ADD_ADDR_IMM_SCALED:
+				c.address += immediate*sizeof(pint_t);
+				break;
+			case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
+				add(c, handler, sizeof(pint_t), immediate);
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES:
+				if ( readUleb(c, end, count) )
+					add(c, handler, sizeof(pint_t), count);
+				break;
+			case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
+				if ( add(c, handler, sizeof(pint_t), 1) && readUleb(c, end, skip) )
+					c.address += skip;
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB:
+				if ( readUleb(c, end, count) && readUleb(c, end, skip) )
+					add(c, handler, skip + sizeof(pint_t), count);
+				break;
+			default:
+				c.error = kBadOpcode;
+				fErrorValue = opcode;
+				break;
+		}
+	}
+	fPos = c.pos;
+	fAddress = c.address;
+	fTotalCount = c.total;
+	fError = c.error;
+	if ( fError == kBadType )
+		fErrorValue = c.type;
+	return (fError == kNoError);
+}
+
+
+template <typename pint_t>
+inline void applyRebaseSpan(const typename RebaseSpanDecoder<pint_t>::Span& span, pint_t slide)
+{
+	if ( span.stride == sizeof(pint_t) ) {
+		pint_t* loc = (pint_t*)span.address;
+		for (uintptr_t i=0; i < span.count; ++i)
+			loc[i] += slide;
+	}
+	else {
+		uint8_t* loc = (uint8_t*)span.address;
+		for (uintptr_t i=0; i < span.count; ++i, loc += span.stride)
+			*(pint_t*)loc += slide;
+	}
+}
+
+// Handler for forEachSpan() that slides every run by the same amount.
+template <typename pint_t>
+struct RebaseSpanSlider
+{
+				RebaseSpanSlider(pint_t slide) : slide(slide) {}
+	void		operator()(const typename RebaseSpanDecoder<pint_t>::Span& span) { applyRebaseSpan<pint_t>(span, slide); }
+	pint_t		slide;
+};
+
+
+#endif // __REBASE_SPANS__
@@ -0,0 +1,222 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __SYMBOL_LOOKUP_CACHE__
+#define __SYMBOL_LOOKUP_CACHE__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mach/mach.h>
+
+//
+// SymbolLookupCache memoizes an image's exported symbol lookups for the
+// length of one link session, which is the rebase/bind/weak-bind part of
+// ImageLoader::link() or a stand-alone weakBind().
+//
+// Binding thousands of symbols against the same few dylibs walks the same
+// export trie prefixes over and over, and flat and weak lookups ask every
+// image for symbols most of them do not have. Each result, found or not,
+// is kept under (image, name hash) so the next lookup of that symbol in that
+// image is one probe. The Symbol* is cached rather than its address, so
+// resolvers and interposing still run on every bind.
+//
+// All lookups are made with the dyld lock held. Cached names are not copied;
+// they point into LINKEDIT of images that stay mapped for the whole session.
+// The table is freed when the session ends, so no entry outlives an image.
+// It is allocated in whole pages with vm_alloc(), declared in ImageLoader.h
+// before it includes this file, as during launch malloc() is dyld's pool,
+// which cannot free and cannot hand out a block larger than a pool chunk.
+//
+// There is no constructor, so a static instance is zero filled and needs no
+// initializer. The counters are kept across sessions for printStatistics().
+//
+template <typename I>
+class SymbolLookupCache
+{
+public:
+	typedef typename I::Symbol Symbol;
+
+	class Session {
+	public:
+					Session(SymbolLookupCache& cache, bool enable) : fCache(cache), fOwner(enable && !cache.fActive) { if ( fOwner ) fCache.begin(); }
+					~Session() { if ( fOwner ) fCache.end(); }
+	private:
+		SymbolLookupCache&	fCache;
+		bool				fOwner;
+	};
+
+	bool			active() const { return fActive; }
+	bool			find(const I* image, const char* name, uint32_t& hash, const Symbol*& symbol, const I*& foundIn);
+	void			add(const I* image, const char* name, uint32_t hash, const Symbol* symbol, const I* foundIn, uint64_t lookupTime);
+
+	uint64_t		hits() const { return fHits; }
+	uint64_t		misses() const { return fMisses; }
+					// what the hits would have cost at the average cost of a miss
+	uint64_t		timeSaved() const { return (fMisses != 0) ? (fMissTime / fMisses) * fHits : 0; }
+
+private:
+	enum { kInitialCapacity = 1024 };
+
+	struct Entry {
+		const I*		image;		// NULL if unused
+		const char*		name;
+		uint32_t		hash;
+		const Symbol*	symbol;		// NULL if not exported by image
+		const I*		foundIn;
+	};
+
+	static Entry*	allocEntries(uint32_t capacity);
+	static void		freeEntries(Entry* entries, uint32_t capacity);
+	static uint32_t	hashName(const char* name);
+	static uint32_t	slotFor(const I* image, uint32_t hash) { return hash ^ (uint32_t)(((uintptr_t)image >> 4) * 0x9E3779B1); }
+	void			begin();
+	void			end();
+	void			grow();
+
+	Entry*			fEntries;
+	uint32_t		fCapacity;		// always a power of 2
+	uint32_t		fCount;
+	bool			fActive;
+	uint64_t		fHits;
+	uint64_t		fMisses;
+	uint64_t		fMissTime;
+};
+
+
+template <typename I>
+typename SymbolLookupCache<I>::Entry* SymbolLookupCache<I>::allocEntries(uint32_t capacity)
+{
+	// new pages are zero filled
+	vm_address_t addr = 0;
+	if ( vm_alloc(&addr, capacity*sizeof(Entry), VM_FLAGS_ANYWHERE | VM_MAKE_TAG(VM_MEMORY_DYLD)) != KERN_SUCCESS )
+		return NULL;
+	return (Entry*)addr;
+}
+
+template <typename I>
+void SymbolLookupCache<I>::freeEntries(Entry* entries, uint32_t capacity)
+{
+	if ( entries != NULL )
+		vm_deallocate(mach_task_self(), (vm_address_t)entries, capacity*sizeof(Entry));
+}
+
+template <typename I>
+uint32_t SymbolLookupCache<I>::hashName(const char* name)
+{
+	// FNV-1a, the symbols of one dylib often differ only in their last few characters
+	uint32_t h = 2166136261u;
+	for (const char* s=name; *s != '\0'; ++s)
+		h = (h ^ (uint8_t)*s) * 16777619u;
+	return h;
+}
+
+template <typename I>
+void SymbolLookupCache<I>::begin()
+{
+	fActive = true;
+	fCount = 0;
+}
+
+template <typename I>
+void SymbolLookupCache<I>::end()
+{
+	fActive = false;
+	freeEntries(fEntries, fCapacity);
+	fEntries = NULL;
+	fCapacity = 0;
+	fCount = 0;
+}
+
+template <typename I>
+void SymbolLookupCache<I>::grow()
+{
+	Entry* oldEntries = fEntries;
+	uint32_t oldCapacity = fCapacity;
+	uint32_t newCapacity = (oldCapacity != 0) ? oldCapacity*2 : (uint32_t)kInitialCapacity;
+	Entry* newEntries = allocEntries(newCapacity);
+	if ( newEntries == NULL )
+		return;		// keep going with the table we have, or with none
+	for (uint32_t i=0; i < oldCapacity; ++i) {
+		const Entry& e = oldEntries[i];
+		if ( e.image == NULL )
+			continue;
+		uint32_t slot = slotFor(e.image, e.hash) & (newCapacity-1);
+		while ( newEntries[slot].image != NULL )
+			slot = (slot + 1) & (newCapacity-1);
+		newEntries[slot] = e;
+	}
+	freeEntries(oldEntries, oldCapacity);
+	fEntries = newEntries;
+	fCapacity = newCapacity;
+}
+
+// Returns true and sets symbol and foundIn if image was already searched
+// for name this session. Otherwise sets hash for the add() that follows.
+template <typename I>
+bool SymbolLookupCache<I>::find(const I* image, const char* name, uint32_t& hash, const Symbol*& symbol, const I*& foundIn)
+{
+	hash = hashName(name);
+	if ( fCount == 0 )
+		return false;
+	uint32_t mask = fCapacity - 1;
+	for (uint32_t slot = slotFor(image, hash) & mask; fEntries[slot].image != NULL; slot = (slot + 1) & mask) {
+		const Entry& e = fEntries[slot];
+		if ( (e.image == image) && (e.hash == hash) && ((e.name == name) || (strcmp(e.name, name) == 0)) ) {
+			++fHits;
+			symbol = e.symbol;
+			foundIn = e.foundIn;
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename I>
+void SymbolLookupCache<I>::add(const I* image, const char* name, uint32_t hash, const Symbol* symbol, const I* foundIn, uint64_t lookupTime)
+{
+	++fMisses;
+	fMissTime += lookupTime;
+	// keep the table at most 3/4 full
+	if ( (fCount+1)*4 > fCapacity*3 ) {
+		grow();
+		if ( (fCount+1)*4 > fCapacity*3 )
+			return;
+	}
+	uint32_t mask = fCapacity - 1;
+	uint32_t slot = slotFor(image, hash) & mask;
+	while ( fEntries[slot].image != NULL )
+		slot = (slot + 1) & mask;
+	Entry& e = fEntries[slot];
+	e.image = image;
+	e.name = name;
+	e.hash = hash;
+	e.symbol = symbol;
+	e.foundIn = foundIn;
+	++fCount;
+}
+
+
+#endif // __SYMBOL_LOOKUP_CACHE__
@@ -0,0 +1,325 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __WEAK_COALESCING_TABLE__
+#define __WEAK_COALESCING_TABLE__
+
+#include <stdint.h>
+#include <string.h>
+#include <mach/mach.h>
+
+//
+// WeakCoalescingTable holds every weak symbol name of the images that take
+// part in coalescing, in load order, with the entries for each name chained
+// together, so ImageLoader::weakBind() can find all images that define or use
+// a name with one lookup instead of merging the sorted lists of all images.
+//
+// Images that have been coalesced never change again, so their entries, and
+// the addresses of the definitions found in them, are kept for the next
+// weakBind(). keep() checks that the images in the table are still the first
+// of the coalescing images, and forget() drops everything when one of them is
+// unloaded. Names are not copied, they point into LINKEDIT of those images.
+// The targets, what each name added since keep() is bound to, are only kept
+// for one weakBind().
+//
+// There is no constructor, so a static instance is zero filled and needs no
+// initializer. Memory is allocated in whole pages with vm_alloc(), declared in
+// ImageLoader.h before it includes this file, as during launch malloc() is
+// dyld's pool, which cannot free and cannot hand out large blocks. An add
+// returns false if memory runs out.
+//
+template <typename I>
+class WeakCoalescingTable
+{
+public:
+	struct Entry {
+		const char*		name;
+		uintptr_t		curIndex;		// CoalIterator position after name, for getAddressCoalIterator()
+		uintptr_t		address;		// definition in this image, if addressKnown
+		uint32_t		hash;
+		uint32_t		next;			// next entry with this name, in load order, or 0
+		uint32_t		image;			// index into the images of the table
+		uint8_t			weakSymbol;
+		uint8_t			addressKnown;
+	};
+
+	struct Target {
+		uintptr_t		address;		// 0 if uses of the name are left alone
+		I*				image;
+		bool			picked;
+	};
+
+					// returns how many images are still in the table, which are images[0..result)
+	uint32_t		keep(I* const images[], uint32_t count);
+	bool			addImage(I* image);
+					// add a name of the last image added
+	bool			addEntry(const char* name, uintptr_t curIndex, bool weakSymbol);
+	void			forget(const I* image);
+	void			clear();
+	bool			allocTargets();
+	void			freeTargets();
+
+	uint32_t		imageCount() const			{ return fImageCount; }
+	I*				image(uint32_t index) const	{ return fImages[index].image; }
+	uint32_t		firstEntryOfImage(uint32_t index) const { return fImages[index].firstEntry; }
+	uint32_t		entryCount() const			{ return fEntryCount; }
+	uint32_t		firstNewEntry() const		{ return fFirstNewEntry; }
+	Entry&			entry(uint32_t index)		{ return fEntries[index]; }
+	Target&			target(uint32_t index)		{ return fTargets[index - fFirstNewEntry]; }
+					// index of the first entry, in load order, with the same name as entry index
+	uint32_t		firstWithName(uint32_t index) const { return findSlot(fEntries[index].name, fEntries[index].hash)->head - 1; }
+
+private:
+	struct ImageInfo {
+		I*			image;
+		uint32_t	firstEntry;
+	};
+	struct Slot {
+		uint32_t	head;		// first entry with a name plus 1, or 0 if unused
+		uint32_t	tail;		// last entry with that name
+	};
+	enum { kInitialEntries = 4096, kInitialSlots = 8192, kInitialImages = 512 };
+
+	static void*	allocPages(size_t size);
+	static void		freePages(void* p, size_t size);
+	static bool		grow(void*& array, uint32_t& capacity, uint32_t initialCapacity, size_t elementSize);
+	static uint32_t	hashName(const char* name);
+	Slot*			findSlot(const char* name, uint32_t hash) const;
+	bool			growSlots();
+
+	ImageInfo*		fImages;
+	Entry*			fEntries;
+	Slot*			fSlots;
+	Target*			fTargets;
+	uint32_t		fImageCount;
+	uint32_t		fImageCapacity;
+	uint32_t		fEntryCount;
+	uint32_t		fEntryCapacity;
+	uint32_t		fSlotCapacity;		// always a power of 2
+	uint32_t		fNameCount;
+	uint32_t		fFirstNewEntry;		// entries before this were added by an earlier weakBind()
+	uint32_t		fTargetCount;
+};
+
+
+template <typename I>
+void* WeakCoalescingTable<I>::allocPages(size_t size)
+{
+	// new pages are zero filled
+	vm_address_t addr = 0;
+	if ( vm_alloc(&addr, size, VM_FLAGS_ANYWHERE | VM_MAKE_TAG(VM_MEMORY_DYLD)) != KERN_SUCCESS )
+		return NULL;
+	return (void*)addr;
+}
+
+template <typename I>
+void WeakCoalescingTable<I>::freePages(void* p, size_t size)
+{
+	if ( p != NULL )
+		vm_deallocate(mach_task_self(), (vm_address_t)p, size);
+}
+
+// doubles an array, keeping its contents
+template <typename I>
+bool WeakCoalescingTable<I>::grow(void*& array, uint32_t& capacity, uint32_t initialCapacity, size_t elementSize)
+{
+	uint32_t newCapacity = (capacity != 0) ? capacity*2 : initialCapacity;
+	void* newArray = allocPages(newCapacity*elementSize);
+	if ( newArray == NULL )
+		return false;
+	if ( array != NULL ) {
+		memcpy(newArray, array, capacity*elementSize);
+		freePages(array, capacity*elementSize);
+	}
+	array = newArray;
+	capacity = newCapacity;
+	return true;
+}
+
+template <typename I>
+uint32_t WeakCoalescingTable<I>::hashName(const char* name)
+{
+	// FNV-1a, C++ weak symbols often share long prefixes
+	uint32_t h = 2166136261u;
+	for (const char* s=name; *s != '\0'; ++s)
+		h = (h ^ (uint8_t)*s) * 16777619u;
+	return h;
+}
+
+// returns the slot for name, or the unused slot where it would go
+template <typename I>
+typename WeakCoalescingTable<I>::Slot* WeakCoalescingTable<I>::findSlot(const char* name, uint32_t hash) const
+{
+	uint32_t mask = fSlotCapacity - 1;
+	for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+		Slot* slot = &fSlots[i];
+		if ( slot->head == 0 )
+			return slot;
+		const Entry& first = fEntries[slot->head-1];
+		if ( (first.hash == hash) && ((first.name == name) || (strcmp(first.name, name) == 0)) )
+			return slot;
+	}
+}
+
+template <typename I>
+bool WeakCoalescingTable<I>::growSlots()
+{
+	Slot* oldSlots = fSlots;
+	uint32_t oldCapacity = fSlotCapacity;
+	uint32_t newCapacity = (oldCapacity != 0) ? oldCapacity*2 : (uint32_t)kInitialSlots;
+	Slot* newSlots = (Slot*)allocPages(newCapacity*sizeof(Slot));
+	if ( newSlots == NULL )
+		return false;
+	for (uint32_t i=0; i < oldCapacity; ++i) {
+		if ( oldSlots[i].head == 0 )
+			continue;
+		uint32_t j = fEntries[oldSlots[i].head-1].hash & (newCapacity-1);
+		while ( newSlots[j].head != 0 )
+			j = (j + 1) & (newCapacity-1);
+		newSlots[j] = oldSlots[i];
+	}
+	freePages(oldSlots, oldCapacity*sizeof(Slot));
+	fSlots = newSlots;
+	fSlotCapacity = newCapacity;
+	return true;
+}
+
+template <typename I>
+uint32_t WeakCoalescingTable<I>::keep(I* const images[], uint32_t count)
+{
+	if ( fImageCount > count ) {
+		clear();
+		return 0;
+	}
+	for (uint32_t i=0; i < fImageCount; ++i) {
+		if ( fImages[i].image != images[i] ) {
+			clear();
+			return 0;
+		}
+	}
+	fFirstNewEntry = fEntryCount;
+	return fImageCount;
+}
+
+template <typename I>
+bool WeakCoalescingTable<I>::addImage(I* image)
+{
+	if ( (fImageCount == fImageCapacity) && !grow((void*&)fImages, fImageCapacity, kInitialImages, sizeof(ImageInfo)) )
+		return false;
+	fImages[fImageCount].image = image;
+	fImages[fImageCount].firstEntry = fEntryCount;
+	++fImageCount;
+	return true;
+}
+
+template <typename I>
+bool WeakCoalescingTable<I>::addEntry(const char* name, uintptr_t curIndex, bool weakSymbol)
+{
+	if ( (fEntryCount == fEntryCapacity) && !grow((void*&)fEntries, fEntryCapacity, kInitialEntries, sizeof(Entry)) )
+		return false;
+	// keep the slots at most 3/4 full
+	if ( ((fNameCount+1)*4 > fSlotCapacity*3) && !growSlots() )
+		return false;
+
+	uint32_t index = fEntryCount;
+	Entry& e = fEntries[index];
+	e.name = name;
+	e.curIndex = curIndex;
+	e.address = 0;
+	e.hash = hashName(name);
+	e.next = 0;
+	e.image = fImageCount - 1;
+	e.weakSymbol = weakSymbol;
+	e.addressKnown = false;
+
+	// chain to the last entry with the same name, entry 0 is never a next
+	Slot* slot = findSlot(name, e.hash);
+	if ( slot->head == 0 ) {
+		slot->head = index + 1;
+		++fNameCount;
+	}
+	else {
+		fEntries[slot->tail].next = index;
+	}
+	slot->tail = index;
+	++fEntryCount;
+	return true;
+}
+
+template <typename I>
+void WeakCoalescingTable<I>::forget(const I* image)
+{
+	for (uint32_t i=0; i < fImageCount; ++i) {
+		if ( fImages[i].image == image ) {
+			clear();
+			return;
+		}
+	}
+}
+
+template <typename I>
+void WeakCoalescingTable<I>::clear()
+{
+	freeTargets();
+	freePages(fImages, fImageCapacity*sizeof(ImageInfo));
+	freePages(fEntries, fEntryCapacity*sizeof(Entry));
+	freePages(fSlots, fSlotCapacity*sizeof(Slot));
+	fImages = NULL;
+	fEntries = NULL;
+	fSlots = NULL;
+	fImageCount = 0;
+	fImageCapacity = 0;
+	fEntryCount = 0;
+	fEntryCapacity = 0;
+	fSlotCapacity = 0;
+	fNameCount = 0;
+	fFirstNewEntry = 0;
+}
+
+// makes a Target, not yet picked, for each entry added since keep()
+template <typename I>
+bool WeakCoalescingTable<I>::allocTargets()
+{
+	freeTargets();
+	uint32_t count = fEntryCount - fFirstNewEntry;
+	if ( count == 0 )
+		return true;
+	fTargets = (Target*)allocPages(count*sizeof(Target));
+	if ( fTargets == NULL )
+		return false;
+	fTargetCount = count;
+	return true;
+}
+
+template <typename I>
+void WeakCoalescingTable<I>::freeTargets()
+{
+	freePages(fTargets, fTargetCount*sizeof(Target));
+	fTargets = NULL;
+	fTargetCount = 0;
+}
+
+
+#endif // __WEAK_COALESCING_TABLE__
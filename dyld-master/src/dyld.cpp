@@ -97,7 +97,9 @@
 #include "dyldSyscallInterface.h"
 #if DYLD_SHARED_CACHE_SUPPORT
 #include "dyld_cache_format.h"
+#include "dyld_closure_format.h"
 #endif
+#include "MappedRangeIndex.h"
 #include <coreSymbolicationDyldSupport.h>
 #if TARGET_IPHONE_SIMULATOR
 	extern "C" void xcoresymbolication_load_notifier(void *connection, uint64_t load_timestamp, const char *image_path, const struct mach_header *mach_header);
@@ -185,6 +187,7 @@ struct EnvironmentVariables {
 	const char* const *			LD_LIBRARY_PATH;			// for unix conformance
 	const char* const *			DYLD_VERSIONED_LIBRARY_PATH;
 	const char* const *			DYLD_VERSIONED_FRAMEWORK_PATH;
+	const char*					DYLD_LAUNCH_CLOSURE;
 	bool						DYLD_PRINT_LIBRARIES;
 	bool						DYLD_PRINT_LIBRARIES_POST_LAUNCH;
 	bool						DYLD_BIND_AT_LAUNCH;
@@ -289,81 +292,28 @@ static bool							sLogToFile = false;
 static char							sLoadingCrashMessage[1024] = "dyld: launch, loading dependent libraries";
 
 //
-// The MappedRanges structure is used for fast address->image lookups.
-// The table is only updated when the dyld lock is held, so we don't
+// The mapped range index is used for fast address->image lookups.
+// The index is only updated when the dyld lock is held, so we don't
 // need to worry about multiple writers.  But readers may look at this
-// data without holding the lock. Therefore, all updates must be done
-// in an order that will never cause readers to see inconsistent data.
-// The general rule is that if the image field is non-NULL then
-// the other fields are valid.
+// data without holding the lock. See MappedRangeIndex.h for how
+// updates are published to them.
 //
-struct MappedRanges
-{
-	enum { count=400 };
-	struct {
-		ImageLoader*	image;
-		uintptr_t		start;
-		uintptr_t		end;
-	} array[count];
-	MappedRanges*		next;
-};
-
-static MappedRanges			sMappedRangesStart;
+static MappedRangeIndex<ImageLoader>	sMappedRanges;
 
 void addMappedRange(ImageLoader* image, uintptr_t start, uintptr_t end)
 {
 	//dyld::log("addMappedRange(0x%lX->0x%lX) for %s\n", start, end, image->getShortName());
-	for (MappedRanges* p = &sMappedRangesStart; p != NULL; p = p->next) {
-		for (int i=0; i < MappedRanges::count; ++i) {
-			if ( p->array[i].image == NULL ) {
-				p->array[i].start = start;
-				p->array[i].end = end;
-				// add image field last with a barrier so that any reader will see consistent records
-				OSMemoryBarrier();
-				p->array[i].image = image;
-				return;
-			}
-		}
-	}
-	// table must be full, chain another
-	MappedRanges* newRanges = (MappedRanges*)malloc(sizeof(MappedRanges));
-	bzero(newRanges, sizeof(MappedRanges));
-	newRanges->array[0].start = start;
-	newRanges->array[0].end = end;
-	newRanges->array[0].image = image;
-	for (MappedRanges* p = &sMappedRangesStart; p != NULL; p = p->next) {
-		if ( p->next == NULL ) {
-			OSMemoryBarrier();
-			p->next = newRanges;
-			break;
-		}
-	}
+	sMappedRanges.add(image, start, end);
 }
 
 void removedMappedRanges(ImageLoader* image)
 {
-	for (MappedRanges* p = &sMappedRangesStart; p != NULL; p = p->next) {
-		for (int i=0; i < MappedRanges::count; ++i) {
-			if ( p->array[i].image == image ) {
-				// clear with a barrier so that any reader will see consistent records
-				OSMemoryBarrier();
-				p->array[i].image = NULL;
-			}
-		}
-	}
+	sMappedRanges.remove(image);
 }
 
 ImageLoader* findMappedRange(uintptr_t target)
 {
-	for (MappedRanges* p = &sMappedRangesStart; p != NULL; p = p->next) {
-		for (int i=0; i < MappedRanges::count; ++i) {
-			if ( p->array[i].image != NULL ) {
-				if ( (p->array[i].start <= target) && (target < p->array[i].end) )
-					return p->array[i].image;
-			}
-		}
-	}
-	return NULL;
+	return sMappedRanges.find(target);
 }
 
 
@@ -1472,6 +1422,18 @@ void processDyldEnvironmentVariable(const char* key, const char* value, const ch
 	else if ( strcmp(key, "DYLD_DISABLE_PREFETCH") == 0 ) {
 		gLinkContext.preFetchDisabled = true;
 	}
+	else if ( strcmp(key, "DYLD_DISABLE_SYMBOL_LOOKUP_CACHE") == 0 ) {
+		gLinkContext.symbolLookupCacheDisabled = true;
+	}
+	else if ( strcmp(key, "DYLD_DISABLE_WEAK_BIND_TABLE") == 0 ) {
+		gLinkContext.weakBindTableDisabled = true;
+	}
+	else if ( strcmp(key, "DYLD_PARALLEL_LINK") == 0 ) {
+		gLinkContext.parallelLink = true;
+	}
+	else if ( strcmp(key, "DYLD_LAUNCH_CLOSURE") == 0 ) {
+		sEnv.DYLD_LAUNCH_CLOSURE = value;
+	}
 	else if ( strcmp(key, "DYLD_PRINT_LIBRARIES") == 0 ) {
 		sEnv.DYLD_PRINT_LIBRARIES = true;
 	}
@@ -1500,6 +1462,8 @@ void processDyldEnvironmentVariable(const char* key, const char* value, const ch
 	}
 	else if ( strcmp(key, "DYLD_PRINT_STATISTICS") == 0 ) {
 		sEnv.DYLD_PRINT_STATISTICS = true;
+		// parallel links happen after launch, so are reported as they happen
+		gLinkContext.verboseParallelLink = true;
 	}
 	else if ( strcmp(key, "DYLD_PRINT_SEGMENTS") == 0 ) {
 		gLinkContext.verboseMapping = true;
@@ -4040,8 +4004,236 @@ void registerImageStateBatchChangeHandler(dyld_image_states state, dyld_image_st
 	}
 }
 
+//
+// A launch closure (see dyld_closure_format.h) is only used while the main
+// executable is linked. Each closure image is recorded here as it is loaded,
+// so that its dependents and bind targets can be found by closure index.
+//
+static const dyld_closure_header*	sLaunchClosure = NULL;
+static size_t						sLaunchClosureSize = 0;
+static ImageLoader**				sLaunchClosureImages = NULL;		// by closure index, NULL until loaded
+static const ImageLoader**			sLaunchClosureTargets = NULL;		// by closure index, NULL if binds to it must be looked up
+
+static const char* launchClosureString(uint32_t offset)
+{
+	return (char*)sLaunchClosure + sLaunchClosure->stringsOffset + offset;
+}
+
+static const dyld_closure_image* launchClosureImage(uint32_t index)
+{
+	return (dyld_closure_image*)((uint8_t*)sLaunchClosure + sLaunchClosure->imagesOffset) + index;
+}
+
+static bool launchClosureFileMatches(const dyld_closure_image* image, const char* path)
+{
+	struct stat stat_buf;
+	if ( stat(path, &stat_buf) != 0 )
+		return false;
+	return ( (stat_buf.st_dev == (dev_t)image->device) && (stat_buf.st_ino == (ino_t)image->inode) && (stat_buf.st_mtime == (time_t)image->mtime) );
+}
+
+// returns why the mapped closure cannot be used for this launch, or NULL if it can
+static const char* launchClosureProblem(const macho_header* mainExecutableMH)
+{
+	const dyld_closure_header* header = sLaunchClosure;
+	const uint64_t size = sLaunchClosureSize;
+	if ( (size < sizeof(dyld_closure_header)) || (strcmp(header->magic, DYLD_CLOSURE_MAGIC) != 0) )
+		return "not a launch closure";
+	if (   (header->imagesOffset + (uint64_t)header->imageCount*sizeof(dyld_closure_image) > size)
+		|| (header->dependentsOffset + (uint64_t)header->dependentCount*sizeof(dyld_closure_dependent) > size)
+		|| (header->bindsOffset + (uint64_t)header->bindCount*sizeof(dyld_closure_bind) > size)
+		|| (header->stringsOffset + header->stringsSize > size)
+		|| (header->stringsSize == 0) || (launchClosureString(0)[header->stringsSize-1] != '\0')
+		|| (header->imageCount == 0) )
+		return "truncated";
+	if ( header->cputype != (uint32_t)mainExecutableMH->cputype )
+		return "built for a different architecture";
+	const dyld_closure_dependent* dependents = (dyld_closure_dependent*)((uint8_t*)header + header->dependentsOffset);
+	const dyld_closure_bind* binds = (dyld_closure_bind*)((uint8_t*)header + header->bindsOffset);
+	for (uint32_t i=0; i < header->imageCount; ++i) {
+		const dyld_closure_image* image = launchClosureImage(i);
+		if (   (image->pathOffset >= header->stringsSize)
+			|| ((uint64_t)image->firstDependent + image->dependentCount > header->dependentCount)
+			|| ((uint64_t)image->firstBind + image->bindCount > header->bindCount) )
+			return "malformed";
+		for (uint32_t d=image->firstDependent; d < image->firstDependent + image->dependentCount; ++d) {
+			if ( (dependents[d].nameOffset >= header->stringsSize) || ((dependents[d].imageIndex >= header->imageCount) && (dependents[d].imageIndex != DYLD_CLOSURE_NO_IMAGE)) )
+				return "malformed";
+		}
+		for (uint32_t b=image->firstBind; b < image->firstBind + image->bindCount; ++b) {
+			if ( ((binds[b].targetImage >= header->imageCount) && (binds[b].targetImage != DYLD_CLOSURE_ABSOLUTE)) || (binds[b].symbolNameOffset >= header->stringsSize) )
+				return "malformed";
+		}
+		// every file must be the one the closure was built from
+		if ( !launchClosureFileMatches(image, (i == 0) ? sExecPath : launchClosureString(image->pathOffset)) )
+			return (i == 0) ? "main executable has changed" : "a dylib has changed";
+	}
+	return NULL;
+}
+
+static void unmapLaunchClosure()
+{
+	if ( sLaunchClosure == NULL )
+		return;
+	munmap((void*)sLaunchClosure, sLaunchClosureSize);
+	delete [] sLaunchClosureImages;
+	delete [] sLaunchClosureTargets;
+	sLaunchClosure = NULL;
+	sLaunchClosureSize = 0;
+	sLaunchClosureImages = NULL;
+	sLaunchClosureTargets = NULL;
+}
+
+// Binds can only go where the closure says if the image is the file it was built from. A dylib
+// loaded from the shared cache has the same path, device, inode and mtime, but not the same layout.
+static bool launchClosureImageMatches(uint32_t index, const ImageLoader* image)
+{
+	if ( image->inSharedCache() )
+		return false;
+	uuid_t uuid;
+	if ( !image->getUUID(uuid) )
+		bzero(uuid, sizeof(uuid));
+	return ( memcmp(uuid, launchClosureImage(index)->uuid, sizeof(uuid)) == 0 );
+}
+
+static void mapLaunchClosure(const macho_header* mainExecutableMH)
+{
+	const char* path = sEnv.DYLD_LAUNCH_CLOSURE;
+	const char* problem = NULL;
+	// anything that changes which files are loaded makes a closure wrong
+	if ( sProcessIsRestricted )
+		problem = "process is restricted";
+	else if (   (sEnv.DYLD_INSERT_LIBRARIES != NULL) || (sEnv.DYLD_LIBRARY_PATH != NULL) || (sEnv.DYLD_FRAMEWORK_PATH != NULL)
+			 || (sEnv.LD_LIBRARY_PATH != NULL) || (sEnv.DYLD_VERSIONED_LIBRARY_PATH != NULL) || (sEnv.DYLD_VERSIONED_FRAMEWORK_PATH != NULL)
+			 || (gLinkContext.rootPaths != NULL) || (gLinkContext.imageSuffix != NULL) || gLinkContext.bindFlat )
+		problem = "DYLD_ environment variables change which images are loaded";
+	else {
+		struct stat stat_buf;
+		int fd = my_open(path, O_RDONLY, 0);
+		if ( fd == -1 ) {
+			problem = "cannot be opened";
+		}
+		else {
+			if ( (fstat(fd, &stat_buf) == 0) && (stat_buf.st_size >= (off_t)sizeof(dyld_closure_header)) ) {
+				void* p = mmap(NULL, (size_t)stat_buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if ( p != MAP_FAILED ) {
+					sLaunchClosure = (dyld_closure_header*)p;
+					sLaunchClosureSize = (size_t)stat_buf.st_size;
+				}
+			}
+			close(fd);
+			if ( sLaunchClosure == NULL )
+				problem = "not a launch closure";
+			else
+				problem = launchClosureProblem(mainExecutableMH);
+		}
+	}
+	if ( problem != NULL ) {
+		if ( gLinkContext.verboseWarnings )
+			dyld::log("dyld: warning, launch closure %s not used: %s\n", path, problem);
+		if ( sLaunchClosure != NULL ) {
+			munmap((void*)sLaunchClosure, sLaunchClosureSize);
+			sLaunchClosure = NULL;
+			sLaunchClosureSize = 0;
+		}
+		return;
+	}
+
+	const uint32_t imageCount = sLaunchClosure->imageCount;
+	sLaunchClosureImages = new ImageLoader*[imageCount];
+	sLaunchClosureTargets = new const ImageLoader*[imageCount];
+	bzero(sLaunchClosureImages, imageCount*sizeof(ImageLoader*));
+	bzero(sLaunchClosureTargets, imageCount*sizeof(ImageLoader*));
+	sLaunchClosureImages[0] = sMainExecutable;
+	if ( launchClosureImageMatches(0, sMainExecutable) )
+		sLaunchClosureTargets[0] = sMainExecutable;
+}
+
+static uint32_t launchClosureIndexOf(const ImageLoader* image)
+{
+	for (uint32_t i=0; i < sLaunchClosure->imageCount; ++i) {
+		if ( sLaunchClosureImages[i] == image )
+			return i;
+	}
+	return DYLD_CLOSURE_NO_IMAGE;
+}
+
+// Loads libraryName, a dependent of the image whose path is origin, from where
+// the closure says it is. Returns NULL if the closure does not know, in which
+// case wasMissing is set if the closure says libraryName was not found.
+static ImageLoader* launchClosureLoad(const char* libraryName, const char* origin, bool& wasMissing)
+{
+	wasMissing = false;
+	// origin is the getPath() of the image loading its dependents
+	uint32_t loaderIndex = DYLD_CLOSURE_NO_IMAGE;
+	for (uint32_t i=0; i < sLaunchClosure->imageCount; ++i) {
+		if ( (sLaunchClosureImages[i] != NULL) && (sLaunchClosureImages[i]->getPath() == origin) ) {
+			loaderIndex = i;
+			break;
+		}
+	}
+	if ( loaderIndex == DYLD_CLOSURE_NO_IMAGE )
+		return NULL;
+	const dyld_closure_image* loader = launchClosureImage(loaderIndex);
+	const dyld_closure_dependent* dependents = (dyld_closure_dependent*)((uint8_t*)sLaunchClosure + sLaunchClosure->dependentsOffset) + loader->firstDependent;
+	for (uint32_t d=0; d < loader->dependentCount; ++d) {
+		if ( strcmp(launchClosureString(dependents[d].nameOffset), libraryName) != 0 )
+			continue;
+		const uint32_t index = dependents[d].imageIndex;
+		if ( index == DYLD_CLOSURE_NO_IMAGE ) {
+			wasMissing = true;
+			return NULL;
+		}
+		if ( sLaunchClosureImages[index] != NULL )
+			return sLaunchClosureImages[index];
+		dyld::LoadContext context;
+		context.useSearchPaths		= false;
+		context.useFallbackPaths	= false;
+		context.useLdLibraryPath	= false;
+		context.implicitRPath		= false;
+		context.matchByInstallName	= false;
+		context.dontLoad			= false;
+		context.mustBeBundle		= false;
+		context.mustBeDylib			= true;
+		context.canBePIE			= false;
+		context.origin				= NULL;
+		context.rpath				= NULL;
+		ImageLoader* image = load(launchClosureString(launchClosureImage(index)->pathOffset), context);
+		sLaunchClosureImages[index] = image;
+		if ( launchClosureImageMatches(index, image) )
+			sLaunchClosureTargets[index] = image;
+		return image;
+	}
+	return NULL;
+}
+
+// gLinkContext.launchClosureBinds, hands ImageLoaderMachOCompressed::doBind() the closure's binds for image
+static bool launchClosureBinds(const ImageLoader* image, const dyld_closure_bind** binds, uint32_t* count,
+								const ImageLoader* const** targets, const char** strings)
+{
+	if ( sLaunchClosure == NULL )
+		return false;
+	const uint32_t index = launchClosureIndexOf(image);
+	if ( (index == DYLD_CLOSURE_NO_IMAGE) || (sLaunchClosureTargets[index] == NULL) )
+		return false;
+	const dyld_closure_image* info = launchClosureImage(index);
+	*binds = (dyld_closure_bind*)((uint8_t*)sLaunchClosure + sLaunchClosure->bindsOffset) + info->firstBind;
+	*count = info->bindCount;
+	*targets = sLaunchClosureTargets;
+	*strings = launchClosureString(0);
+	return true;
+}
+
 static ImageLoader* libraryLocator(const char* libraryName, bool search, const char* origin, const ImageLoader::RPathChain* rpaths)
 {
+	// while the main executable is linked, a launch closure knows where each dependent is
+	bool closureSaysMissing = false;
+	if ( (sLaunchClosure != NULL) && search && (origin != NULL) ) {
+		ImageLoader* image = launchClosureLoad(libraryName, origin, closureSaysMissing);
+		if ( image != NULL )
+			return image;
+	}
+
 	dyld::LoadContext context;
 	context.useSearchPaths		= search;
 	context.useFallbackPaths	= search;
@@ -4054,7 +4246,14 @@ static ImageLoader* libraryLocator(const char* libraryName, bool search, const c
 	context.canBePIE			= false;
 	context.origin				= origin;
 	context.rpath				= rpaths;
-	return load(libraryName, context);
+	ImageLoader* image = load(libraryName, context);
+	if ( closureSaysMissing ) {
+		// a weak dylib has appeared since the closure was built, binds to it are not in the closure
+		if ( gLinkContext.verboseWarnings )
+			dyld::log("dyld: warning, launch closure %s not used: %s is no longer missing\n", sEnv.DYLD_LAUNCH_CLOSURE, libraryName);
+		unmapLaunchClosure();
+	}
+	return image;
 }
 
 static const char* basename(const char* path)
@@ -4070,6 +4269,7 @@ static const char* basename(const char* path)
 static void setContext(const macho_header* mainExecutableMH, int argc, const char* argv[], const char* envp[], const char* apple[])
 {
 	gLinkContext.loadLibrary			= &libraryLocator;
+	gLinkContext.launchClosureBinds		= &launchClosureBinds;
 	gLinkContext.terminationRecorder	= &terminationRecorder;
 	gLinkContext.flatExportFinder		= &flatFindExportedSymbol;
 	gLinkContext.coalescedExportFinder	= &findCoalescedExportedSymbol;
@@ -4919,6 +5119,10 @@ _main(const macho_header* mainExecutableMH, uintptr_t mainExecutableSlide,
 		checkVersionedPaths();
 	#endif
 
+		// use a launch closure instead of searching for dylibs and symbols
+		if ( sEnv.DYLD_LAUNCH_CLOSURE != NULL )
+			mapLaunchClosure(mainExecutableMH);
+
 		// load any inserted libraries
 		// 4 加载插入的动态库
 		// 遍历 `DYLD_INSERT_LIBRARIES` 环境变量, 调用`loadInsertedDylib`方法加载所有要插入的库,
@@ -4939,6 +5143,7 @@ _main(const macho_header* mainExecutableMH, uintptr_t mainExecutableSlide,
 		gLinkContext.linkingMainExecutable = true;
 		// link方法
 		link(sMainExecutable, sEnv.DYLD_BIND_AT_LAUNCH, true, ImageLoader::RPathChain(NULL, NULL));
+		unmapLaunchClosure();
 		// 设置永不递归卸载
 		sMainExecutable->setNeverUnloadRecursive();
 		// mach-o header中的MH_FORCE_FLAT
@@ -1274,6 +1274,10 @@ static void registerThreadHelpers(const dyld::LibSystemHelpers* helpers)
 			__Unwind_SjLj_SetThreadKey(key);
 	}
 #endif
+
+	// worker threads for DYLD_PARALLEL_LINK
+	if ( helpers->version >= 14 )
+		dyld::gLinkContext.applyInParallel = helpers->applyInParallel;
 }
 
 
@@ -30,6 +30,7 @@
 #include <crt_externs.h>
 #include <Availability.h>
 #include <vproc_priv.h>
+#include <dispatch/dispatch.h>
 
 #include "mach-o/dyld.h"
 #include "mach-o/dyld_priv.h"
@@ -1375,9 +1376,15 @@ static void shared_cache_out_of_date()
 }
 #endif // DYLD_SHARED_CACHE_SUPPORT
 
+// used by dyld to rebase and bind images on worker threads
+static void applyInParallel(size_t iterations, void* ctx, void (*work)(void* ctx, size_t index))
+{
+	dispatch_apply_f(iterations, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ctx, work);
+}
+
 
 // the table passed to dyld containing thread helpers
-static dyld::LibSystemHelpers sHelpers = { 13, &dyldGlobalLockAcquire, &dyldGlobalLockRelease,
+static dyld::LibSystemHelpers sHelpers = { 14, &dyldGlobalLockAcquire, &dyldGlobalLockRelease,
 									&getPerThreadBufferFor_dlerror, &malloc, &free, &__cxa_atexit,
 						#if DYLD_SHARED_CACHE_SUPPORT
 									&shared_cache_missing, &shared_cache_out_of_date,
@@ -1394,7 +1401,8 @@ static dyld::LibSystemHelpers sHelpers = { 13, &dyldGlobalLockAcquire, &dyldGlob
 									&isLaunchdOwned,
 									&vm_allocate,
 									&mmap,
-									&__cxa_finalize_ranges};
+									&__cxa_finalize_ranges,
+									&applyInParallel};
 
 
 //
@@ -74,6 +74,8 @@ namespace dyld {
 		void*		(*mmap)(void* addr, size_t len, int prot, int flags, int fd, off_t offset);
 		// added in version 13
 		void		(*cxa_finalize_ranges)(const struct __cxa_range_t ranges[], int count);
+		// added in version 14
+		void		(*applyInParallel)(size_t iterations, void* ctx, void (*work)(void* ctx, size_t index));
 	};
 #if __cplusplus
 }
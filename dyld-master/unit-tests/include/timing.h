@@ -0,0 +1,16 @@
+#include <stdint.h>
+#include <time.h>
+
+//
+// Monotonic time in nanoseconds for the host-side benchmarks.
+// clock_gettime() is on both OS X and Linux hosts, mach_absolute_time() is not.
+//
+static
+inline
+uint64_t
+nanotime(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,702 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+#include <stdio.h>  // fprintf(), NULL
+#include <stdlib.h> // exit(), EXIT_SUCCESS
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mach-o/fat.h>
+#include <vector>
+#include <unordered_map>
+
+#include "test.h" // PASS(), FAIL(), XPASS(), XFAIL()
+#include "timing.h" // nanotime()
+
+#include "MachOFileAbstraction.hpp"
+#include "Architectures.hpp"
+#include "MachOFixupRuns.hpp"
+
+static const unsigned kRounds = 10;
+
+void throwf(const char* format, ...)
+{
+	va_list	list;
+	char*	p;
+	va_start(list, format);
+	vasprintf(&p, format, list);
+	va_end(list);
+	const char*	t = p;
+	throw t;
+}
+
+
+//
+// An image's segments copied into memory, each given its own new address the
+// way update_dyld_shared_cache lays __TEXT and __DATA out in different regions.
+//
+struct Segment
+{
+	uint64_t	address;
+	uint64_t	newAddress;
+	uint64_t	size;
+	uint8_t*	content;
+};
+
+struct Image
+{
+	std::vector<Segment>	segs;
+
+	void add(const uint8_t* fileContent, size_t fileSize, uint64_t address, uint64_t vmSize) {
+		Segment seg;
+		seg.address = address;
+		seg.newAddress = address + 0x10000000ULL*(segs.size()+1);
+		seg.size = vmSize;
+		seg.content = (uint8_t*)calloc(vmSize ? vmSize : 1, 1);
+		memcpy(seg.content, fileContent, fileSize < vmSize ? fileSize : vmSize);
+		segs.push_back(seg);
+	}
+	void copyFrom(const Image& other) {
+		for (size_t i=0; i < other.segs.size(); ++i) {
+			add(other.segs[i].content, other.segs[i].size, other.segs[i].address, other.segs[i].size);
+			segs.back().newAddress = other.segs[i].newAddress;
+		}
+	}
+	bool sameAs(const Image& other) const {
+		for (size_t i=0; i < segs.size(); ++i) {
+			if ( memcmp(segs[i].content, other.segs[i].content, segs[i].size) != 0 )
+				return false;
+		}
+		return true;
+	}
+	~Image() {
+		for (size_t i=0; i < segs.size(); ++i)
+			free(segs[i].content);
+	}
+};
+
+// the same hash table Binder<A> looks exports up in
+struct CStringHash {
+	size_t operator()(const char* __s) const {
+		size_t __h = 0;
+		for ( ; *__s; ++__s)
+			__h = 5 * __h + *__s;
+		return __h;
+	};
+};
+struct CStringEquals {
+	bool operator()(const char* left, const char* right) const { return (strcmp(left, right) == 0); }
+};
+typedef std::unordered_map<const char*, uint64_t, CStringHash, CStringEquals> SymbolMap;
+
+
+//
+// The loops update_dyld_shared_cache used before: every location re-checks
+// its segment, finds the segment its pointer points into, and every bind
+// looks its symbol up.
+//
+template <typename P>
+static void __attribute__((noinline)) rebaseAt(const Image& image, unsigned segIndex, uint64_t segOffset, uint8_t type, std::vector<void*>& pointersInData)
+{
+	typedef typename P::uint_t pint_t;
+	if ( segIndex >= image.segs.size() )
+		throw "bad segment index in rebase info";
+	uint8_t* mappedAddr = image.segs[segIndex].content + segOffset;
+	pint_t* mappedAddrP = (pint_t*)mappedAddr;
+	uint32_t* mappedAddr32 = (uint32_t*)mappedAddr;
+	pint_t valueP;
+	switch ( type ) {
+		case REBASE_TYPE_POINTER:
+			valueP = P::getP(*mappedAddrP);
+			break;
+		case REBASE_TYPE_TEXT_ABSOLUTE32:
+			valueP = P::E::get32(*mappedAddr32);
+			break;
+		default:
+			throw "bad rebase type";
+	}
+	for (std::vector<Segment>::const_iterator it=image.segs.begin(); it != image.segs.end(); ++it) {
+		if ( (it->address <= valueP) && (it->size != 0) && (valueP < it->address + it->size) ) {
+			if ( type == REBASE_TYPE_POINTER )
+				P::setP(*mappedAddrP, valueP + (pint_t)(it->newAddress - it->address));
+			else
+				P::E::set32(*mappedAddr32, (uint32_t)(valueP + (it->newAddress - it->address)));
+			pointersInData.push_back(mappedAddr);
+			return;
+		}
+	}
+	throw "pointer cannot be rebased";
+}
+
+template <typename P>
+static void rebaseOneAtATime(const Image& image, const uint8_t* p, const uint8_t* end, std::vector<void*>& pointersInData)
+{
+	const uint64_t pointerSize = sizeof(typename P::uint_t);
+	uint8_t type = 0;
+	unsigned segIndex = 0;
+	uint64_t segOffset = 0;
+	uint64_t count;
+	uint64_t skip;
+	bool done = false;
+	while ( !done && (p < end) ) {
+		uint8_t immediate = *p & REBASE_IMMEDIATE_MASK;
+		uint8_t opcode = *p & REBASE_OPCODE_MASK;
+		++p;
+		switch (opcode) {
+			case REBASE_OPCODE_DONE:
+				done = true;
+				break;
+			case REBASE_OPCODE_SET_TYPE_IMM:
+				type = immediate;
+				break;
+			case REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+				segIndex = immediate;
+				segOffset = read_uleb128(p, end);
+				break;
+			case REBASE_OPCODE_ADD_ADDR_ULEB:
+				segOffset += read_uleb128(p, end);
+				break;
+			case REBASE_OPCODE_ADD_ADDR_IMM_SCALED:
+				segOffset += immediate*pointerSize;
+				break;
+			case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
+				for (int i=0; i < immediate; ++i) {
+					rebaseAt<P>(image, segIndex, segOffset, type, pointersInData);
+					segOffset += pointerSize;
+				}
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES:
+				count = read_uleb128(p, end);
+				for (uint64_t i=0; i < count; ++i) {
+					rebaseAt<P>(image, segIndex, segOffset, type, pointersInData);
+					segOffset += pointerSize;
+				}
+				break;
+			case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
+				rebaseAt<P>(image, segIndex, segOffset, type, pointersInData);
+				segOffset += read_uleb128(p, end) + pointerSize;
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB:
+				count = read_uleb128(p, end);
+				skip = read_uleb128(p, end);
+				for (uint64_t i=0; i < count; ++i) {
+					rebaseAt<P>(image, segIndex, segOffset, type, pointersInData);
+					segOffset += skip + pointerSize;
+				}
+				break;
+			default:
+				throw "bad rebase opcode";
+		}
+	}
+}
+
+template <typename P>
+static void __attribute__((noinline)) bindAt(const Image& image, const SymbolMap& symbols, unsigned segIndex, uint64_t segOffset, uint8_t type,
+											 const char* symbolName, int64_t addend, std::vector<void*>& pointersInData)
+{
+	typedef typename P::uint_t pint_t;
+	if ( segIndex >= image.segs.size() )
+		throw "bad segment index in bind info";
+	SymbolMap::const_iterator pos = symbols.find(symbolName);
+	if ( pos == symbols.end() )
+		throw "could not bind symbol";
+	if ( type != BIND_TYPE_POINTER )
+		throw "bad bind type";
+	pint_t* mappedAddrP = (pint_t*)(image.segs[segIndex].content + segOffset);
+	P::setP(*mappedAddrP, (pint_t)(pos->second + addend));
+	pointersInData.push_back(mappedAddrP);
+}
+
+template <typename P>
+static void bindOneAtATime(const Image& image, const SymbolMap& symbols, const uint8_t* p, const uint8_t* end, std::vector<void*>& pointersInData)
+{
+	const uint64_t pointerSize = sizeof(typename P::uint_t);
+	uint8_t type = 0;
+	unsigned segIndex = 0;
+	uint64_t segOffset = 0;
+	const char* symbolName = NULL;
+	int64_t addend = 0;
+	uint64_t count;
+	uint64_t skip;
+	bool done = false;
+	while ( !done && (p < end) ) {
+		uint8_t immediate = *p & BIND_IMMEDIATE_MASK;
+		uint8_t opcode = *p & BIND_OPCODE_MASK;
+		++p;
+		switch (opcode) {
+			case BIND_OPCODE_DONE:
+				done = true;
+				break;
+			case BIND_OPCODE_SET_DYLIB_ORDINAL_IMM:
+			case BIND_OPCODE_SET_DYLIB_SPECIAL_IMM:
+				break;
+			case BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB:
+				read_uleb128(p, end);
+				break;
+			case BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM:
+				symbolName = (char*)p;
+				while (*p != '\0')
+					++p;
+				++p;
+				break;
+			case BIND_OPCODE_SET_TYPE_IMM:
+				type = immediate;
+				break;
+			case BIND_OPCODE_SET_ADDEND_SLEB:
+				addend = read_sleb128(p, end);
+				break;
+			case BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+				segIndex = immediate;
+				segOffset = read_uleb128(p, end);
+				break;
+			case BIND_OPCODE_ADD_ADDR_ULEB:
+				segOffset += read_uleb128(p, end);
+				break;
+			case BIND_OPCODE_DO_BIND:
+				bindAt<P>(image, symbols, segIndex, segOffset, type, symbolName, addend, pointersInData);
+				segOffset += pointerSize;
+				break;
+			case BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB:
+				bindAt<P>(image, symbols, segIndex, segOffset, type, symbolName, addend, pointersInData);
+				segOffset += read_uleb128(p, end) + pointerSize;
+				break;
+			case BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED:
+				bindAt<P>(image, symbols, segIndex, segOffset, type, symbolName, addend, pointersInData);
+				segOffset += immediate*pointerSize + pointerSize;
+				break;
+			case BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB:
+				count = read_uleb128(p, end);
+				skip = read_uleb128(p, end);
+				for (uint64_t i=0; i < count; ++i) {
+					bindAt<P>(image, symbols, segIndex, segOffset, type, symbolName, addend, pointersInData);
+					segOffset += skip + pointerSize;
+				}
+				break;
+			default:
+				throw "bad bind opcode";
+		}
+	}
+}
+
+
+//
+// The way Rebaser<A>::applyRebaseRun() and Binder<A>::bindDyldInfoRun() do it now.
+//
+template <typename P>
+struct RebaseRunHandler
+{
+	typedef typename P::uint_t pint_t;
+	const Image*			image;
+	std::vector<void*>*		pointersInData;
+
+	void operator()(const MachORebaseRun& run) {
+		if ( run.count == 0 )
+			return;
+		if ( run.segIndex >= image->segs.size() )
+			throw "bad segment index in rebase info";
+		const Segment& seg = image->segs[run.segIndex];
+		if ( (run.segOffset >= seg.size) || ((run.count-1) > (seg.size - run.segOffset - 1)/run.stride) )
+			throw "rebase run extends beyond the segment";
+		if ( run.type != REBASE_TYPE_POINTER ) {
+			for (uint64_t i=0; i < run.count; ++i)
+				rebaseAt<P>(*image, run.segIndex, run.segOffset + i*run.stride, run.type, *pointersInData);
+			return;
+		}
+		uint64_t targetStart = 1;
+		uint64_t targetEnd = 0;
+		pint_t slide = 0;
+		uint8_t* mappedAddr = seg.content + run.segOffset;
+		for (uint64_t i=0; i < run.count; ++i, mappedAddr += run.stride) {
+			pint_t* mappedAddrP = (pint_t*)mappedAddr;
+			pint_t valueP = P::getP(*mappedAddrP);
+			if ( (valueP < targetStart) || (valueP >= targetEnd) ) {
+				const Segment* target = NULL;
+				for (std::vector<Segment>::const_iterator it=image->segs.begin(); it != image->segs.end(); ++it) {
+					if ( (it->address <= valueP) && (it->size != 0) && (valueP < it->address + it->size) ) {
+						target = &*it;
+						break;
+					}
+				}
+				if ( target == NULL )
+					throw "pointer cannot be rebased";
+				targetStart = target->address;
+				targetEnd = target->address + target->size;
+				slide = (pint_t)(target->newAddress - target->address);
+			}
+			P::setP(*mappedAddrP, valueP + slide);
+			pointersInData->push_back(mappedAddr);
+		}
+	}
+};
+
+template <typename P>
+struct BindRunHandler
+{
+	typedef typename P::uint_t pint_t;
+	const Image*			image;
+	const SymbolMap*		symbols;
+	std::vector<void*>*		pointersInData;
+	const char*				lastSymbol;
+	uint64_t				lastAddress;
+
+	void operator()(const MachOBindRun& run) {
+		if ( run.count == 0 )
+			return;
+		if ( run.symbolName != lastSymbol ) {
+			SymbolMap::const_iterator pos = symbols->find(run.symbolName);
+			if ( pos == symbols->end() )
+				throw "could not bind symbol";
+			lastSymbol = run.symbolName;
+			lastAddress = pos->second;
+		}
+		if ( run.segIndex >= image->segs.size() )
+			throw "bad segment index in bind info";
+		const Segment& seg = image->segs[run.segIndex];
+		if ( (run.segOffset >= seg.size) || ((run.count-1) > (seg.size - run.segOffset - 1)/run.stride) )
+			throw "bind run extends beyond the segment";
+		if ( run.type != BIND_TYPE_POINTER )
+			throw "bad bind type";
+		const pint_t value = (pint_t)(lastAddress + run.addend);
+		uint8_t* mappedAddr = seg.content + run.segOffset;
+		for (uint64_t i=0; i < run.count; ++i, mappedAddr += run.stride) {
+			P::setP(*(pint_t*)mappedAddr, value);
+			pointersInData->push_back(mappedAddr);
+		}
+	}
+};
+
+// every symbol named in bind info, each given a made up address
+template <typename P>
+struct SymbolCollector
+{
+	SymbolMap*	symbols;
+
+	void operator()(const MachOBindRun& run) {
+		if ( symbols->find(run.symbolName) == symbols->end() )
+			(*symbols)[run.symbolName] = 0x7FFF0000ULL + 0x10*symbols->size();
+	}
+};
+
+
+// Times both ways over the same fixups, and checks they agree.
+template <typename P>
+static bool bench(const char* name, const Image& original, const uint8_t* rebaseStart, const uint8_t* rebaseEnd,
+				  const uint8_t* bindStart, const uint8_t* bindEnd)
+{
+	SymbolMap symbols;
+	Image oneAtATime;
+	Image inRuns;
+	oneAtATime.copyFrom(original);
+	inRuns.copyFrom(original);
+	std::vector<void*> oldPointers;
+	std::vector<void*> newPointers;
+	size_t oldRebaseCount = 0;
+	size_t oldBindCount = 0;
+	uint64_t oldRebaseTime = 0;
+	uint64_t newRebaseTime = 0;
+	uint64_t oldBindTime = 0;
+	uint64_t newBindTime = 0;
+	try {
+		SymbolCollector<P> collector = { &symbols };
+		forEachBindRun<P>(bindStart, bindEnd, collector);
+		for (unsigned i=0; i < kRounds; ++i) {
+			// start each round from the original content, as a cache build does
+			for (size_t s=0; s < original.segs.size(); ++s) {
+				memcpy(oneAtATime.segs[s].content, original.segs[s].content, original.segs[s].size);
+				memcpy(inRuns.segs[s].content, original.segs[s].content, original.segs[s].size);
+			}
+			oldPointers.clear();
+			newPointers.clear();
+			RebaseRunHandler<P> rebaser = { &inRuns, &newPointers };
+			BindRunHandler<P> binder = { &inRuns, &symbols, &newPointers, NULL, 0 };
+			uint64_t t0 = nanotime();
+			rebaseOneAtATime<P>(oneAtATime, rebaseStart, rebaseEnd, oldPointers);
+			uint64_t t1 = nanotime();
+			forEachRebaseRun<P>(rebaseStart, rebaseEnd, rebaser);
+			uint64_t t2 = nanotime();
+			oldRebaseCount = oldPointers.size();
+			bindOneAtATime<P>(oneAtATime, symbols, bindStart, bindEnd, oldPointers);
+			uint64_t t3 = nanotime();
+			forEachBindRun<P>(bindStart, bindEnd, binder);
+			uint64_t t4 = nanotime();
+			oldBindCount = oldPointers.size() - oldRebaseCount;
+			oldRebaseTime += t1 - t0;
+			newRebaseTime += t2 - t1;
+			oldBindTime += t3 - t2;
+			newBindTime += t4 - t3;
+		}
+	}
+	catch (const char* msg) {
+		FAIL("cache-fixup-runs: %s in %s", msg, name);
+		return false;
+	}
+	if ( (oldPointers.size() != newPointers.size()) || !inRuns.sameAs(oneAtATime) ) {
+		FAIL("cache-fixup-runs: %s fixed up differently", name);
+		return false;
+	}
+	// pointersInData must list the same locations, each list relative to its own copy
+	for (size_t i=0; i < oldPointers.size(); ++i) {
+		bool matched = false;
+		for (size_t s=0; s < original.segs.size(); ++s) {
+			const uint8_t* o = (uint8_t*)oldPointers[i];
+			const uint8_t* n = (uint8_t*)newPointers[i];
+			if ( (o >= oneAtATime.segs[s].content) && (o < oneAtATime.segs[s].content + original.segs[s].size) ) {
+				matched = ((n - inRuns.segs[s].content) == (o - oneAtATime.segs[s].content));
+				break;
+			}
+		}
+		if ( !matched ) {
+			FAIL("cache-fixup-runs: %s recorded pointer %lu differently", name, (unsigned long)i);
+			return false;
+		}
+	}
+	if ( oldRebaseCount != 0 ) {
+		printf("%-30s %8lu rebases: one at a time %5.2f ns/rebase, runs %5.2f ns/rebase\n",
+			   name, (unsigned long)oldRebaseCount, (double)oldRebaseTime/kRounds/oldRebaseCount, (double)newRebaseTime/kRounds/oldRebaseCount);
+	}
+	if ( oldBindCount != 0 ) {
+		printf("%-30s %8lu binds:   one at a time %5.2f ns/bind,   runs %5.2f ns/bind\n",
+			   name, (unsigned long)oldBindCount, (double)oldBindTime/kRounds/oldBindCount, (double)newBindTime/kRounds/oldBindCount);
+	}
+	return true;
+}
+
+
+static void appendUleb(std::vector<uint8_t>& out, uint64_t value)
+{
+	do {
+		uint8_t byte = value & 0x7F;
+		value >>= 7;
+		if ( value != 0 )
+			byte |= 0x80;
+		out.push_back(byte);
+	} while ( value != 0 );
+}
+
+//
+// Fixups like a large framework's: __DATA pointers into __TEXT and __DATA in
+// runs and singles, and __DATA_CONST references to a few thousand imported
+// symbols, many of them bound at dozens of places each.
+//
+template <typename P>
+static bool synthetic(const char* name)
+{
+	typedef typename P::uint_t pint_t;
+	const uint64_t pointerSize = sizeof(pint_t);
+	const uint64_t textAddress = 0x1000;
+	const uint64_t textSize = 8*1024*1024;
+	const uint64_t dataAddress = textAddress + textSize;
+	const uint64_t dataSize = 16*1024*1024;
+	const uint64_t constAddress = dataAddress + dataSize;
+	const uint64_t constSize = 4*1024*1024;
+
+	uint64_t seed = 1;
+	std::vector<uint8_t> data(dataSize);
+	uint64_t targetBase = textAddress;
+	uint64_t targetSize = textSize;
+	for (uint64_t i=0; i < dataSize; i += pointerSize) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		// mostly pointers into __TEXT, some into __DATA, neighbours usually into the same one
+		if ( (seed >> 59) == 0 ) {
+			bool text = ((seed >> 20) % 4) != 0;
+			targetBase = text ? textAddress : dataAddress;
+			targetSize = text ? textSize : dataSize;
+		}
+		P::setP(*(pint_t*)&data[i], (pint_t)(targetBase + (seed >> 24) % targetSize));
+	}
+	Image image;
+	image.add(NULL, 0, textAddress, textSize);
+	image.add(&data[0], dataSize, dataAddress, dataSize);
+	image.add(NULL, 0, constAddress, constSize);
+
+	std::vector<uint8_t> rebases;
+	rebases.push_back(REBASE_OPCODE_SET_TYPE_IMM | REBASE_TYPE_POINTER);
+	rebases.push_back(REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+	appendUleb(rebases, 0);
+	uint64_t offset = 0;
+	while ( offset + 0x10000 < dataSize ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		unsigned n = 1 + (unsigned)((seed >> 33) % 40);
+		switch ( (seed >> 24) % 4 ) {
+			case 0:
+				rebases.push_back(REBASE_OPCODE_DO_REBASE_ULEB_TIMES);
+				appendUleb(rebases, n);
+				offset += n*pointerSize;
+				break;
+			case 1:
+				rebases.push_back(REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB);
+				appendUleb(rebases, n);
+				appendUleb(rebases, 2*pointerSize);
+				offset += n*3*pointerSize;
+				break;
+			case 2:
+				for (unsigned i=0; i < n; ++i) {
+					rebases.push_back(REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB);
+					appendUleb(rebases, pointerSize);
+				}
+				offset += n*2*pointerSize;
+				break;
+			case 3:
+				rebases.push_back(REBASE_OPCODE_DO_REBASE_IMM_TIMES | (n & 0xF));
+				offset += (n & 0xF)*pointerSize;
+				break;
+		}
+		unsigned gap = (unsigned)((seed >> 40) % 8);
+		rebases.push_back(REBASE_OPCODE_ADD_ADDR_IMM_SCALED | gap);
+		offset += gap*pointerSize;
+	}
+	rebases.push_back(REBASE_OPCODE_DONE);
+
+	// ld sorts binds by symbol, each symbol's locations in address order
+	std::vector<uint8_t> binds;
+	binds.push_back(BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER);
+	binds.push_back(BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | 1);
+	const unsigned symbolCount = 4000;
+	const uint64_t slotsPerSymbol = constSize / pointerSize / symbolCount;
+	for (unsigned s=0; s < symbolCount; ++s) {
+		char symbolName[64];
+		snprintf(symbolName, sizeof(symbolName), "_OBJC_CLASS_$_SomeFrameworkClass%u", s);
+		binds.push_back(BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM);
+		binds.insert(binds.end(), symbolName, symbolName+strlen(symbolName)+1);
+		binds.push_back(BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 2);
+		appendUleb(binds, s*pointerSize);
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		// symbols are spread across the segment, every symbolCount'th slot
+		uint64_t n = 1 + (seed >> 33) % (slotsPerSymbol - 1);
+		if ( (seed >> 24) % 4 == 0 ) {
+			binds.push_back(BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB);
+			appendUleb(binds, (symbolCount-1)*pointerSize);
+		}
+		else {
+			binds.push_back(BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB);
+			appendUleb(binds, n);
+			appendUleb(binds, (symbolCount-1)*pointerSize);
+		}
+	}
+	binds.push_back(BIND_OPCODE_DONE);
+
+	return bench<P>(name, image, &rebases[0], &rebases[0] + rebases.size(), &binds[0], &binds[0] + binds.size());
+}
+
+
+template <typename A>
+static bool benchImage(const char* name, const uint8_t* image, size_t size)
+{
+	typedef typename A::P			P;
+
+	const macho_header<P>* mh = (const macho_header<P>*)image;
+	const uint8_t* cmds = image + sizeof(macho_header<P>);
+	const uint8_t* cmdsEnd = cmds + mh->sizeofcmds();
+	if ( cmdsEnd > image + size )
+		return true;
+	Image segs;
+	const macho_dyld_info_command<P>* dyldInfo = NULL;
+	for (const uint8_t* p = cmds; p < cmdsEnd; ) {
+		const macho_load_command<P>* cmd = (const macho_load_command<P>*)p;
+		if ( cmd->cmdsize() == 0 )
+			break;
+		if ( cmd->cmd() == macho_segment_command<P>::CMD ) {
+			const macho_segment_command<P>* seg = (const macho_segment_command<P>*)cmd;
+			// __PAGEZERO is all address space and no content
+			size_t vmSize = (seg->initprot() == 0) ? 0 : (size_t)seg->vmsize();
+			if ( seg->fileoff() + seg->filesize() > size )
+				return true;
+			segs.add(image + seg->fileoff(), (size_t)seg->filesize(), seg->vmaddr(), vmSize);
+		}
+		else if ( (cmd->cmd() == LC_DYLD_INFO) || (cmd->cmd() == LC_DYLD_INFO_ONLY) ) {
+			dyldInfo = (const macho_dyld_info_command<P>*)cmd;
+		}
+		p += cmd->cmdsize();
+	}
+	if ( (dyldInfo == NULL) || segs.segs.empty() )
+		return true;
+	if (   ((uint64_t)dyldInfo->rebase_off() + dyldInfo->rebase_size() > size)
+		|| ((uint64_t)dyldInfo->bind_off() + dyldInfo->bind_size() > size) )
+		return true;
+	const uint8_t* rebaseStart = image + dyldInfo->rebase_off();
+	const uint8_t* bindStart = image + dyldInfo->bind_off();
+	return bench<P>(name, segs, rebaseStart, rebaseStart + dyldInfo->rebase_size(), bindStart, bindStart + dyldInfo->bind_size());
+}
+
+static bool benchSlice(const char* path, const uint8_t* image, size_t size)
+{
+	const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	if ( size < sizeof(uint32_t) )
+		return true;
+	switch ( LittleEndian::get32(*(uint32_t*)image) ) {
+		case MH_MAGIC_64:
+			return benchImage<x86_64>(name, image, size);
+		case MH_MAGIC:
+			return benchImage<x86>(name, image, size);
+	}
+	return true;
+}
+
+static bool benchFile(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if ( fd == -1 ) {
+		FAIL("cache-fixup-runs: can't open %s", path);
+		return false;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	const uint8_t* file = (uint8_t*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( file == (uint8_t*)MAP_FAILED ) {
+		FAIL("cache-fixup-runs: can't map %s", path);
+		return false;
+	}
+	bool result = true;
+	const fat_header* fh = (const fat_header*)file;
+	if ( ((size_t)st.st_size >= sizeof(fat_header)) && (BigEndian::get32(fh->magic) == FAT_MAGIC) ) {
+		const fat_arch* archs = (const fat_arch*)(file + sizeof(fat_header));
+		for (uint32_t i=0; result && (i < BigEndian::get32(fh->nfat_arch)); ++i) {
+			uint32_t offset = BigEndian::get32(archs[i].offset);
+			uint32_t sliceSize = BigEndian::get32(archs[i].size);
+			if ( (uint64_t)offset + sliceSize <= (uint64_t)st.st_size )
+				result = benchSlice(path, file + offset, sliceSize);
+		}
+	}
+	else {
+		result = benchSlice(path, file, (size_t)st.st_size);
+	}
+	munmap((void*)file, (size_t)st.st_size);
+	return result;
+}
+
+
+int main(int argc, const char* argv[])
+{
+	if ( !synthetic<x86::P>("synthetic 32-bit") || !synthetic<x86_64::P>("synthetic 64-bit") )
+		return EXIT_SUCCESS;
+	for (int i=1; i < argc; ++i) {
+		if ( !benchFile(argv[i]) )
+			return EXIT_SUCCESS;
+	}
+
+	PASS("cache-fixup-runs");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+#include <stdio.h>  // fprintf(), NULL
+#include <stdlib.h> // exit(), EXIT_SUCCESS
+#include <string.h>
+#include <dlfcn.h>
+
+#include "test.h" // PASS(), FAIL(), XPASS(), XFAIL()
+
+
+///
+/// This tests that dlopen() links a bundle and its dylibs correctly,
+/// with and without DYLD_PARALLEL_LINK, and that a missing symbol
+/// is reported the same way in both cases, as are flat lookups.
+///
+
+
+int main()
+{
+	// first with nothing loaded yet, so all four images are linked together
+	if ( dlopen("bad.bundle", RTLD_LAZY) != NULL ) {
+		FAIL("dlopen-parallel-link: dlopen(bad.bundle) succeeded but baseExtra does not exist");
+		exit(0);
+	}
+	const char* msg = dlerror();
+	if ( (strstr(msg, "baseExtra") == NULL) || (strstr(msg, "bad.bundle") == NULL) ) {
+		FAIL("dlopen-parallel-link: dlopen(bad.bundle) error message did not name baseExtra and bad.bundle: %s", msg);
+		exit(0);
+	}
+
+	void* handle = dlopen("test.bundle", RTLD_LAZY);
+	if ( handle == NULL ) {
+		FAIL("dlopen-parallel-link: dlopen(test.bundle) failed: %s", dlerror());
+		exit(0);
+	}
+	int (*check)() = (int (*)())dlsym(handle, "bundleCheck");
+	if ( check == NULL ) {
+		FAIL("dlopen-parallel-link: bundleCheck not found");
+		exit(0);
+	}
+	// mid1() and mid2() each return base()+baseValue
+	int result = (*check)();
+	if ( result != 11+11+10 ) {
+		FAIL("dlopen-parallel-link: bundleCheck() returned %d", result);
+		exit(0);
+	}
+
+	// libmid3 and flat.bundle are linked together, and flat.bundle binds to the rest by flat lookups
+	void* flatHandle = dlopen("flat.bundle", RTLD_LAZY);
+	if ( flatHandle == NULL ) {
+		FAIL("dlopen-parallel-link: dlopen(flat.bundle) failed: %s", dlerror());
+		exit(0);
+	}
+	int (*flatCheck)() = (int (*)())dlsym(flatHandle, "bundleCheck");
+	if ( (flatCheck == NULL) || ((*flatCheck)() != 11+11+10) ) {
+		FAIL("dlopen-parallel-link: flat.bundle bound wrong");
+		exit(0);
+	}
+
+	PASS("dlopen-parallel-link");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+#include <stdio.h>  // fprintf(), NULL
+#include <stdlib.h> // exit(), EXIT_SUCCESS
+#include <dlfcn.h>
+
+#include "test.h" // PASS(), FAIL(), XPASS(), XFAIL()
+
+
+///
+/// This tests that weak symbols of bundles loaded one after another are
+/// coalesced with those of the images already loaded, the first definition
+/// in load order winning.
+///
+
+int __attribute__((weak)) coalMain = 1;
+
+typedef int* (*GetterProc)();
+
+static GetterProc getter(void* handle, const char* name)
+{
+	GetterProc proc = (GetterProc)dlsym(handle, name);
+	if ( proc == NULL ) {
+		FAIL("dlopen-weak-coalesce: %s not found", name);
+		exit(0);
+	}
+	return proc;
+}
+
+static void* load(const char* path)
+{
+	void* handle = dlopen(path, RTLD_LAZY);
+	if ( handle == NULL ) {
+		FAIL("dlopen-weak-coalesce: dlopen(%s) failed: %s", path, dlerror());
+		exit(0);
+	}
+	return handle;
+}
+
+int main()
+{
+	void* handle1 = load("test1.bundle");
+	if ( (*getter(handle1, "bundleCoalMain"))() != &coalMain ) {
+		FAIL("dlopen-weak-coalesce: test1.bundle did not use coalMain from main");
+		exit(0);
+	}
+
+	void* handle2 = load("test2.bundle");
+	if ( (*getter(handle2, "bundleCoalMain"))() != &coalMain ) {
+		FAIL("dlopen-weak-coalesce: test2.bundle did not use coalMain from main");
+		exit(0);
+	}
+	int* coalBundles1 = (*getter(handle1, "bundleCoalBundles"))();
+	int* coalBundles2 = (*getter(handle2, "bundleCoalBundles"))();
+	if ( (coalBundles1 != coalBundles2) || (*coalBundles2 != 2) ) {
+		FAIL("dlopen-weak-coalesce: test2.bundle did not use coalBundles from test1.bundle");
+		exit(0);
+	}
+
+	PASS("dlopen-weak-coalesce");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+#include <stdio.h>  // fprintf(), NULL
+#include <stdlib.h> // exit(), EXIT_SUCCESS
+#include <string.h>
+#include <limits.h> // PATH_MAX
+#include <fcntl.h>
+#include <unistd.h>
+#include <fts.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "test.h" // PASS(), FAIL(), XPASS(), XFAIL()
+
+#include "dsc_extractor.h"
+
+
+//
+// dyld_shared_cache_extract_dylibs_parallel() with one worker does the dylibs
+// one after another, as the extractor always used to. With one worker per cpu
+// every dylib must come out the same.
+//
+
+static bool extract(const char* cachePath, const char* dir, unsigned workers)
+{
+	__block unsigned calls = 0;
+	__block bool inOrder = true;
+	int result = dyld_shared_cache_extract_dylibs_parallel(cachePath, dir, workers, ^(const struct dyld_shared_cache_extract_progress* info) {
+		if ( info->current != ++calls )
+			inOrder = false;
+	});
+	if ( result != 0 ) {
+		FAIL("dsc-extractor-parallel: extracting %s with %u workers returned %d", cachePath, workers, result);
+		return false;
+	}
+	if ( (calls == 0) || !inOrder ) {
+		FAIL("dsc-extractor-parallel: progress with %u workers was not called once per dylib", workers);
+		return false;
+	}
+	return true;
+}
+
+static bool sameContents(const char* path1, const char* path2)
+{
+	bool same = false;
+	int fd1 = open(path1, O_RDONLY);
+	int fd2 = open(path2, O_RDONLY);
+	struct stat stat1;
+	struct stat stat2;
+	if ( (fd1 != -1) && (fd2 != -1) && (fstat(fd1, &stat1) == 0) && (fstat(fd2, &stat2) == 0) && (stat1.st_size == stat2.st_size) ) {
+		if ( stat1.st_size == 0 ) {
+			same = true;
+		}
+		else {
+			void* p1 = mmap(NULL, (size_t)stat1.st_size, PROT_READ, MAP_PRIVATE, fd1, 0);
+			void* p2 = mmap(NULL, (size_t)stat2.st_size, PROT_READ, MAP_PRIVATE, fd2, 0);
+			if ( (p1 != MAP_FAILED) && (p2 != MAP_FAILED) )
+				same = (memcmp(p1, p2, (size_t)stat1.st_size) == 0);
+			if ( p1 != MAP_FAILED )
+				munmap(p1, (size_t)stat1.st_size);
+			if ( p2 != MAP_FAILED )
+				munmap(p2, (size_t)stat2.st_size);
+		}
+	}
+	if ( fd1 != -1 )
+		close(fd1);
+	if ( fd2 != -1 )
+		close(fd2);
+	return same;
+}
+
+// counts the files under dir, comparing each to the one at the same path under otherDir if not NULL
+static long compareTree(const char* dir, const char* otherDir)
+{
+	char* const roots[] = { (char*)dir, NULL };
+	FTS* fts = fts_open(roots, FTS_PHYSICAL, NULL);
+	if ( fts == NULL )
+		return -1;
+	long count = 0;
+	size_t dirLen = strlen(dir);
+	for (FTSENT* entry = fts_read(fts); entry != NULL; entry = fts_read(fts)) {
+		if ( entry->fts_info != FTS_F )
+			continue;
+		++count;
+		if ( otherDir != NULL ) {
+			char otherPath[PATH_MAX];
+			snprintf(otherPath, sizeof(otherPath), "%s%s", otherDir, entry->fts_path + dirLen);
+			if ( !sameContents(entry->fts_path, otherPath) ) {
+				FAIL("dsc-extractor-parallel: %s and %s differ", entry->fts_path, otherPath);
+				count = -1;
+				break;
+			}
+		}
+	}
+	fts_close(fts);
+	return count;
+}
+
+
+int main(int argc, const char* argv[])
+{
+	if ( argc != 4 ) {
+		UNSUPPORTED("dsc-extractor-parallel: no shared cache found");
+		return EXIT_SUCCESS;
+	}
+	const char* cachePath = argv[1];
+	const char* serialDir = argv[2];
+	const char* parallelDir = argv[3];
+
+	if ( !extract(cachePath, serialDir, 1) || !extract(cachePath, parallelDir, 0) )
+		return EXIT_SUCCESS;
+
+	long serialCount = compareTree(serialDir, parallelDir);
+	if ( serialCount < 0 )
+		return EXIT_SUCCESS;
+	long parallelCount = compareTree(parallelDir, NULL);
+	if ( (serialCount == 0) || (parallelCount != serialCount) ) {
+		FAIL("dsc-extractor-parallel: %ld dylibs extracted with one worker, %ld with one per cpu", serialCount, parallelCount);
+		return EXIT_SUCCESS;
+	}
+
+	PASS("dsc-extractor-parallel");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+#include <stdio.h>  // fprintf(), NULL
+#include <stdlib.h> // exit(), EXIT_SUCCESS
+#include <string.h>
+#include <limits.h> // PATH_MAX
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <mach-o/dyld.h>
+#include <mach-o/dyld_images.h>
+#include <mach-o/getsect.h>
+#include <mach/mach.h>
+
+#include "test.h" // PASS(), FAIL(), XPASS(), XFAIL()
+
+#include "dyld_cache_format.h"
+
+
+static const char* sUtil;
+static const char* sIndex;
+static const char* sCache;
+
+//
+// Runs dyld_shared_cache_util on the cache and index, returns its exit status
+// and the first line it printed
+//
+static int util(char line[], size_t lineSize, const char* options)
+{
+	char command[3*PATH_MAX];
+	snprintf(command, sizeof(command), "%s %s -index %s %s 2>/dev/null", sUtil, options, sIndex, sCache);
+	FILE* output = popen(command, "r");
+	if ( output == NULL ) {
+		FAIL("dsc-symbol-index: can't run %s", command);
+		exit(0);
+	}
+	line[0] = '\0';
+	if ( fgets(line, (int)lineSize, output) == NULL )
+		line[0] = '\0';
+	char rest[256];
+	while ( fgets(rest, sizeof(rest), output) != NULL )
+		;
+	return pclose(output);
+}
+
+//
+// The cache file this process is using is the one whose uuid dyld reports
+//
+static const char* currentCache(int count, const char* caches[], const uint8_t uuid[16])
+{
+	for (int i=0; i < count; ++i) {
+		struct dyld_cache_header header;
+		int fd = open(caches[i], O_RDONLY);
+		if ( fd == -1 )
+			continue;
+		ssize_t amount = pread(fd, &header, sizeof(header), 0);
+		close(fd);
+		if ( (amount == sizeof(header)) && (header.mappingOffset >= offsetof(struct dyld_cache_header, cacheType)) && (memcmp(header.uuid, uuid, 16) == 0) )
+			return caches[i];
+	}
+	return NULL;
+}
+
+
+int main(int argc, const char* argv[])
+{
+	task_dyld_info_data_t task_dyld_info;
+	mach_msg_type_number_t count = TASK_DYLD_INFO_COUNT;
+	if ( task_info(mach_task_self(), TASK_DYLD_INFO, (task_info_t)&task_dyld_info, &count) ) {
+		FAIL("dsc-symbol-index: task_info() failed");
+		return EXIT_SUCCESS;
+	}
+	struct dyld_all_image_infos* infos = (struct dyld_all_image_infos*)(uintptr_t)task_dyld_info.all_image_info_addr;
+	if ( (infos->version < 12) || (argc < 3) ) {
+		UNSUPPORTED("dsc-symbol-index: no shared cache");
+		return EXIT_SUCCESS;
+	}
+	sUtil = argv[1];
+	sIndex = argv[2];
+	sCache = currentCache(argc-3, &argv[3], infos->sharedCacheUUID);
+	if ( sCache == NULL ) {
+		UNSUPPORTED("dsc-symbol-index: the shared cache in use is not one of the cache files");
+		return EXIT_SUCCESS;
+	}
+
+	// where malloc is in the cache, unslid
+	Dl_info info;
+	if ( (dladdr(&malloc, &info) == 0) || ((((struct mach_header*)info.dli_fbase)->flags & 0x80000000) == 0) ) {
+		FAIL("dsc-symbol-index: image containing _malloc not in shared cache");
+		return EXIT_SUCCESS;
+	}
+	const uint64_t mallocAddress = (uintptr_t)&malloc - infos->sharedCacheSlide;
+
+	char line[PATH_MAX+256];
+	if ( util(line, sizeof(line), "-build-index") != 0 ) {
+		FAIL("dsc-symbol-index: -build-index of %s failed", sCache);
+		return EXIT_SUCCESS;
+	}
+
+	unsigned long long address = 0;
+	if ( (util(line, sizeof(line), "-lookup _malloc") != 0) || (sscanf(line, "0x%llX", &address) != 1) || (address != mallocAddress) ) {
+		FAIL("dsc-symbol-index: -lookup _malloc printed \"%s\", expected 0x%08llX", line, mallocAddress);
+		return EXIT_SUCCESS;
+	}
+
+	char options[64];
+	snprintf(options, sizeof(options), "-symbolicate 0x%llX", mallocAddress + 1);
+	if ( (util(line, sizeof(line), options) != 0) || (strstr(line, " _malloc + 1 ") == NULL) ) {
+		FAIL("dsc-symbol-index: %s printed \"%s\", expected _malloc + 1", options, line);
+		return EXIT_SUCCESS;
+	}
+
+	// cstrings have no symbols, so the start of __cstring is past the end of the symbol before it
+#if __LP64__
+	const struct section_64* cstrings = getsectbynamefromheader_64((struct mach_header_64*)info.dli_fbase, "__TEXT", "__cstring");
+#else
+	const struct section* cstrings = getsectbynamefromheader((struct mach_header*)info.dli_fbase, "__TEXT", "__cstring");
+#endif
+	if ( cstrings != NULL ) {
+		snprintf(options, sizeof(options), "-symbolicate 0x%llX", (unsigned long long)cstrings->addr);
+		if ( util(line, sizeof(line), options) == 0 ) {
+			FAIL("dsc-symbol-index: %s printed \"%s\", expected no symbol", options, line);
+			return EXIT_SUCCESS;
+		}
+	}
+
+	PASS("dsc-symbol-index");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+#include <stdio.h>  // fprintf(), NULL
+#include <stdlib.h> // exit(), EXIT_SUCCESS, atoi()
+#include <dlfcn.h>
+
+#include "test.h" // PASS(), FAIL(), XPASS(), XFAIL()
+
+extern int fooData;
+extern int foo();
+
+// initialized pointers are bound when main is linked, which a closure replays
+int*	pfooData = &fooData;
+int		(*pfoo)() = &foo;
+
+// __stdoutp is data in libSystem, which is loaded from the shared cache, where
+// its __DATA is not where it is relative to __TEXT in the dylib on disk
+FILE**	pstdoutp = &__stdoutp;
+char*	pstdoutpEnd = (char*)&__stdoutp + sizeof(FILE*);
+
+int main(int argc, const char* argv[])
+{
+	int expectedResult = atoi(argv[1]);
+	if ( *pfooData != expectedResult )
+		FAIL("launch-closure: fooData is %d, expected %d", *pfooData, expectedResult);
+	else if ( (*pfoo)() != expectedResult )
+		FAIL("launch-closure: foo() returned %d, expected %d", (*pfoo)(), expectedResult);
+	else if ( pstdoutp != dlsym(RTLD_DEFAULT, "__stdoutp") )
+		FAIL("launch-closure: &__stdoutp bound to %p, expected %p", pstdoutp, dlsym(RTLD_DEFAULT, "__stdoutp"));
+	else if ( pstdoutpEnd != (char*)pstdoutp + sizeof(FILE*) )
+		FAIL("launch-closure: &__stdoutp + %lu bound to %p, expected %p", sizeof(FILE*), pstdoutpEnd, (char*)pstdoutp + sizeof(FILE*));
+	else
+		PASS("launch-closure");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+#include <stdio.h>  // fprintf(), NULL
+#include <stdlib.h> // exit(), EXIT_SUCCESS
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <mach-o/fat.h>
+#include <vector>
+
+#include "test.h" // PASS(), FAIL(), XPASS(), XFAIL()
+
+#include "MachOFileAbstraction.hpp"
+#include "Architectures.hpp"
+#include "LinkEditPaging.h"
+
+static const unsigned kRounds = 10;
+
+enum Strategy { kNoAdvice, kSequential, kPlan, kStrategyCount };
+static const char* const kStrategyNames[kStrategyCount] = { "no advice", "sequential", "plan" };
+
+// file offsets of an image's compressed LINKEDIT blobs, in the order link() reads them
+struct Blobs
+{
+	enum { kRebase, kBind, kWeakBind, kLazyBind, kExports, kCount };
+	uint64_t	offset[kCount];
+	uint64_t	size[kCount];
+};
+
+static const uint8_t kBlobPhases[Blobs::kCount] = {
+	LinkEditPagingPlan::kRebase, LinkEditPagingPlan::kBind, LinkEditPagingPlan::kWeakBind,
+	LinkEditPagingPlan::kLazyBind, LinkEditPagingPlan::kExports
+};
+
+static uint64_t now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static uintptr_t pageSize()
+{
+	return (uintptr_t)sysconf(_SC_PAGESIZE);
+}
+
+
+//
+// Checks the plan against working out, one page at a time, which phases
+// read each page.
+//
+struct RunCollector
+{
+	void		operator()(uintptr_t start, uintptr_t end) { runs.push_back(start); runs.push_back(end); }
+	std::vector<uintptr_t>	runs;
+};
+
+static bool samePages(const RunCollector& collected, const std::vector<bool>& expected, uintptr_t base, uintptr_t page)
+{
+	std::vector<bool> got(expected.size(), false);
+	for (size_t i=0; i < collected.runs.size(); i += 2) {
+		// runs are in address order and never touch, else they would be one run
+		if ( (i != 0) && (collected.runs[i] <= collected.runs[i-1]) )
+			return false;
+		for (uintptr_t a=collected.runs[i]; a < collected.runs[i+1]; a += page)
+			got[(a - base)/page] = true;
+	}
+	return (got == expected);
+}
+
+static bool checkPlan()
+{
+	const uintptr_t page = 0x1000;
+	const uintptr_t base = 0x100000;
+	const unsigned pageCount = 64;
+	uint64_t seed = 1;
+	for (unsigned round=0; round < 2000; ++round) {
+		LinkEditPagingPlan plan(page);
+		std::vector<uint8_t> pagePhases(pageCount, 0);
+		for (unsigned b=0; b < Blobs::kCount; ++b) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			uintptr_t start = base + (uintptr_t)((seed >> 33) % ((pageCount-16)*page));
+			uintptr_t size = (uintptr_t)((seed >> 17) % (8*page));
+			if ( (seed >> 60) == 0 )
+				size = 0;	// image without this kind of info
+			plan.add(start, size, kBlobPhases[b]);
+			for (uintptr_t a=start & ~(page-1); (size != 0) && (a < start+size); a += page)
+				pagePhases[(a - base)/page] |= kBlobPhases[b];
+		}
+		for (unsigned phases=1; phases < 0x20; ++phases) {
+			std::vector<bool> read(pageCount);
+			std::vector<bool> done(pageCount);
+			for (unsigned i=0; i < pageCount; ++i) {
+				read[i] = (pagePhases[i] & phases) != 0;
+				done[i] = (pagePhases[i] != 0) && ((pagePhases[i] & ~phases) == 0);
+			}
+			RunCollector readRuns;
+			plan.forEachRun((uint8_t)phases, readRuns);
+			if ( !samePages(readRuns, read, base, page) ) {
+				FAIL("linkedit-paging: wrong pages prefetched for phases 0x%02X", phases);
+				return false;
+			}
+			RunCollector doneRuns;
+			plan.forEachDoneRun((uint8_t)phases, doneRuns);
+			if ( !samePages(doneRuns, done, base, page) ) {
+				FAIL("linkedit-paging: wrong pages released after phases 0x%02X", phases);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+//
+// Maps the file afresh with none of it cached and reads its LINKEDIT blobs in
+// link() order, advising the kernel as the strategy says, and adds the page
+// faults taken and the time spent to the totals.
+//
+struct Totals
+{
+	uint64_t	minorFaults;
+	uint64_t	majorFaults;
+	uint64_t	nanoseconds;
+};
+
+struct Adviser
+{
+				Adviser(int advice) : advice(advice) {}
+	void		operator()(uintptr_t start, uintptr_t end) { madvise((void*)start, end-start, advice); }
+	int			advice;
+};
+
+static volatile uint8_t sSink;
+
+static void readBlob(const uint8_t* base, const Blobs& blobs, unsigned b)
+{
+	// opcode interpreters and trie walks read every byte
+	uint8_t sum = 0;
+	const uint8_t* p = base + blobs.offset[b];
+	for (uint64_t i=0; i < blobs.size[b]; ++i)
+		sum += p[i];
+	sSink += sum;
+}
+
+static bool measure(const char* path, uint64_t sliceOffset, const Blobs& blobs, Strategy strategy, Totals& totals)
+{
+	int fd = open(path, O_RDONLY);
+	if ( fd == -1 ) {
+		FAIL("linkedit-paging: can't open %s", path);
+		return false;
+	}
+	struct stat st;
+	fstat(fd, &st);
+#ifdef POSIX_FADV_DONTNEED
+	posix_fadvise(fd, 0, st.st_size, POSIX_FADV_DONTNEED);
+#endif
+	uint8_t* file = (uint8_t*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( file == (uint8_t*)MAP_FAILED ) {
+		FAIL("linkedit-paging: can't map %s", path);
+		return false;
+	}
+#ifndef POSIX_FADV_DONTNEED
+	msync(file, (size_t)st.st_size, MS_INVALIDATE);
+#endif
+	const uint8_t* base = file + sliceOffset;
+
+	LinkEditPagingPlan plan(pageSize());
+	for (unsigned b=0; b < Blobs::kCount; ++b)
+		plan.add((uintptr_t)base + blobs.offset[b], (uintptr_t)blobs.size[b], kBlobPhases[b]);
+
+	struct rusage before;
+	getrusage(RUSAGE_SELF, &before);
+	uint64_t t0 = now();
+
+	// what instantiateFromFile() does
+	if ( strategy == kSequential ) {
+		// the single range dyld used to advise, from the rebase info to the end of the bind info
+		uintptr_t start = (uintptr_t)base + blobs.offset[Blobs::kRebase];
+		uintptr_t end = (uintptr_t)base + blobs.offset[Blobs::kBind] + blobs.size[Blobs::kBind];
+		start &= ~(pageSize()-1);
+		if ( end > start )
+			madvise((void*)start, end-start, MADV_SEQUENTIAL);
+	}
+	else if ( strategy == kPlan ) {
+		Adviser willNeed(MADV_WILLNEED);
+		plan.forEachRun(LinkEditPagingPlan::kRebase | LinkEditPagingPlan::kBind | LinkEditPagingPlan::kWeakBind | LinkEditPagingPlan::kExports, willNeed);
+	}
+
+	// what link() does, with other images binding to this one's exports
+	Adviser dontNeed(MADV_DONTNEED);
+	readBlob(base, blobs, Blobs::kRebase);
+	if ( strategy == kPlan )
+		plan.forEachDoneRun(LinkEditPagingPlan::kRebase, dontNeed);
+	readBlob(base, blobs, Blobs::kBind);
+	readBlob(base, blobs, Blobs::kExports);
+	if ( strategy == kPlan )
+		plan.forEachDoneRun(LinkEditPagingPlan::kRebase | LinkEditPagingPlan::kBind, dontNeed);
+	readBlob(base, blobs, Blobs::kWeakBind);
+
+	uint64_t t1 = now();
+	struct rusage after;
+	getrusage(RUSAGE_SELF, &after);
+	totals.minorFaults += after.ru_minflt - before.ru_minflt;
+	totals.majorFaults += after.ru_majflt - before.ru_majflt;
+	totals.nanoseconds += t1 - t0;
+
+	munmap(file, (size_t)st.st_size);
+	return true;
+}
+
+static bool bench(const char* name, const char* path, uint64_t sliceOffset, const Blobs& blobs)
+{
+	uint64_t linkEditBytes = 0;
+	for (unsigned b=0; b < Blobs::kCount; ++b)
+		linkEditBytes += blobs.size[b];
+	if ( linkEditBytes == 0 )
+		return true;
+	printf("%-28s %8llu bytes of rebase, bind and export info\n", name, (unsigned long long)linkEditBytes);
+	for (int s=0; s < kStrategyCount; ++s) {
+		Totals totals = { 0, 0, 0 };
+		for (unsigned i=0; i < kRounds; ++i) {
+			if ( !measure(path, sliceOffset, blobs, (Strategy)s, totals) )
+				return false;
+		}
+		printf("    %-12s %8.1f minor faults, %6.1f major faults, %8.1f us\n", kStrategyNames[s],
+			   (double)totals.minorFaults/kRounds, (double)totals.majorFaults/kRounds, (double)totals.nanoseconds/kRounds/1000);
+	}
+	return true;
+}
+
+
+//
+// LINKEDIT laid out the way ld lays out a large framework's, in a scratch file.
+//
+static bool synthetic()
+{
+	static const uint64_t kSizes[Blobs::kCount] = { 300*1024, 900*1024, 20*1024, 400*1024, 1200*1024 };
+	Blobs blobs;
+	uint64_t offset = 0x4000;	// after the load commands
+	for (unsigned b=0; b < Blobs::kCount; ++b) {
+		blobs.offset[b] = offset;
+		blobs.size[b] = kSizes[b];
+		offset += kSizes[b];
+	}
+
+	char path[] = "/tmp/linkedit-paging-XXXXXX";
+	int fd = mkstemp(path);
+	if ( fd == -1 ) {
+		FAIL("linkedit-paging: can't create scratch file");
+		return false;
+	}
+	std::vector<uint8_t> content((size_t)offset);
+	uint64_t seed = 1;
+	for (size_t i=0; i < content.size(); ++i) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		content[i] = (uint8_t)(seed >> 56);
+	}
+	bool written = (write(fd, &content[0], content.size()) == (ssize_t)content.size()) && (fsync(fd) == 0);
+	close(fd);
+	bool result = written && bench("synthetic (2.8MB LINKEDIT)", path, 0, blobs);
+	unlink(path);
+	if ( !written )
+		FAIL("linkedit-paging: can't write scratch file");
+	return result;
+}
+
+
+template <typename A>
+static bool benchImage(const char* name, const char* path, const uint8_t* image, uint64_t sliceOffset, size_t size)
+{
+	typedef typename A::P			P;
+
+	const macho_header<P>* mh = (const macho_header<P>*)image;
+	const uint8_t* cmds = image + sizeof(macho_header<P>);
+	const uint8_t* cmdsEnd = cmds + mh->sizeofcmds();
+	if ( cmdsEnd > image + size )
+		return true;
+	const macho_dyld_info_command<P>* dyldInfo = NULL;
+	for (const uint8_t* p = cmds; p < cmdsEnd; ) {
+		const macho_load_command<P>* cmd = (const macho_load_command<P>*)p;
+		if ( cmd->cmdsize() == 0 )
+			break;
+		if ( (cmd->cmd() == LC_DYLD_INFO) || (cmd->cmd() == LC_DYLD_INFO_ONLY) )
+			dyldInfo = (const macho_dyld_info_command<P>*)cmd;
+		p += cmd->cmdsize();
+	}
+	if ( dyldInfo == NULL )
+		return true;
+	Blobs blobs;
+	blobs.offset[Blobs::kRebase]	= dyldInfo->rebase_off();		blobs.size[Blobs::kRebase]		= dyldInfo->rebase_size();
+	blobs.offset[Blobs::kBind]		= dyldInfo->bind_off();			blobs.size[Blobs::kBind]		= dyldInfo->bind_size();
+	blobs.offset[Blobs::kWeakBind]	= dyldInfo->weak_bind_off();	blobs.size[Blobs::kWeakBind]	= dyldInfo->weak_bind_size();
+	blobs.offset[Blobs::kLazyBind]	= dyldInfo->lazy_bind_off();	blobs.size[Blobs::kLazyBind]	= dyldInfo->lazy_bind_size();
+	blobs.offset[Blobs::kExports]	= dyldInfo->export_off();		blobs.size[Blobs::kExports]		= dyldInfo->export_size();
+	for (unsigned b=0; b < Blobs::kCount; ++b) {
+		if ( blobs.offset[b] + blobs.size[b] > size )
+			return true;
+	}
+	return bench(name, path, sliceOffset, blobs);
+}
+
+static bool benchSlice(const char* path, const uint8_t* image, uint64_t sliceOffset, size_t size)
+{
+	const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	if ( size < sizeof(uint32_t) )
+		return true;
+	switch ( LittleEndian::get32(*(uint32_t*)image) ) {
+		case MH_MAGIC_64:
+			return benchImage<x86_64>(name, path, image, sliceOffset, size);
+		case MH_MAGIC:
+			return benchImage<x86>(name, path, image, sliceOffset, size);
+	}
+	return true;
+}
+
+static bool benchFile(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if ( fd == -1 ) {
+		FAIL("linkedit-paging: can't open %s", path);
+		return false;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	const uint8_t* file = (uint8_t*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( file == (uint8_t*)MAP_FAILED ) {
+		FAIL("linkedit-paging: can't map %s", path);
+		return false;
+	}
+	bool result = true;
+	const fat_header* fh = (const fat_header*)file;
+	if ( ((size_t)st.st_size >= sizeof(fat_header)) && (BigEndian::get32(fh->magic) == FAT_MAGIC) ) {
+		const fat_arch* archs = (const fat_arch*)(file + sizeof(fat_header));
+		for (uint32_t i=0; result && (i < BigEndian::get32(fh->nfat_arch)); ++i) {
+			uint32_t offset = BigEndian::get32(archs[i].offset);
+			uint32_t sliceSize = BigEndian::get32(archs[i].size);
+			if ( (uint64_t)offset + sliceSize <= (uint64_t)st.st_size )
+				result = benchSlice(path, file + offset, offset, sliceSize);
+		}
+	}
+	else {
+		result = benchSlice(path, file, 0, (size_t)st.st_size);
+	}
+	munmap((void*)file, (size_t)st.st_size);
+	return result;
+}
+
+
+int main(int argc, const char* argv[])
+{
+	if ( !checkPlan() || !synthetic() )
+		return EXIT_SUCCESS;
+	for (int i=1; i < argc; ++i) {
+		if ( !benchFile(argv[i]) )
+			return EXIT_SUCCESS;
+	}
+
+	PASS("linkedit-paging");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+#include <stdio.h>  // fprintf(), NULL
+#include <stdlib.h> // exit(), EXIT_SUCCESS
+#include <string.h>
+#include <pthread.h>
+#include <mach/mach.h>
+
+#include "test.h" // PASS(), FAIL(), XPASS(), XFAIL()
+#include "timing.h" // nanotime()
+
+// MappedRangeIndex.h allocates with dyld's vm_alloc()
+extern "C" int vm_alloc(vm_address_t* addr, vm_size_t size, uint32_t flags)
+{
+	return vm_allocate(mach_task_self(), addr, size, flags);
+}
+
+#include "MappedRangeIndex.h"
+
+//
+// Each fake image has two ranges, like __TEXT+__DATA and __LINKEDIT
+// separated by a gap, placed in shuffled order in the address space.
+//
+
+struct FakeImage { int index; };
+
+// The chunked linear table dyld used before, for comparison.
+struct LinearRanges
+{
+	enum { count=400 };
+	struct {
+		FakeImage*		image;
+		uintptr_t		start;
+		uintptr_t		end;
+	} array[count];
+	LinearRanges*		next;
+
+	void add(FakeImage* image, uintptr_t start, uintptr_t end) {
+		for (LinearRanges* p = this; p != NULL; p = p->next) {
+			for (int i=0; i < count; ++i) {
+				if ( p->array[i].image == NULL ) {
+					p->array[i].start = start;
+					p->array[i].end = end;
+					p->array[i].image = image;
+					return;
+				}
+			}
+			if ( p->next == NULL )
+				p->next = (LinearRanges*)calloc(1, sizeof(LinearRanges));
+		}
+	}
+
+	FakeImage* find(uintptr_t target) {
+		for (LinearRanges* p = this; p != NULL; p = p->next) {
+			for (int i=0; i < count; ++i) {
+				if ( p->array[i].image != NULL ) {
+					if ( (p->array[i].start <= target) && (target < p->array[i].end) )
+						return p->array[i].image;
+				}
+			}
+		}
+		return NULL;
+	}
+};
+
+static const uintptr_t kBase       = 0x100000000ULL;
+static const uintptr_t kImageSpan  = 0x100000;
+static const uintptr_t kTextSize   = 0x40000;
+static const uintptr_t kLinkEditAt = 0x80000;
+static const uintptr_t kLinkEdit   = 0x10000;
+static const unsigned  kLookups    = 1000000;
+
+// slot of image i in the address space
+static unsigned slotFor(unsigned i, unsigned n)
+{
+	return (unsigned)(((uint64_t)i * 7919) % n);
+}
+
+static bool bench(unsigned n)
+{
+	FakeImage* images = new FakeImage[n];
+	MappedRangeIndex<FakeImage>* index = (MappedRangeIndex<FakeImage>*)calloc(1, sizeof(MappedRangeIndex<FakeImage>));
+	LinearRanges* linear = (LinearRanges*)calloc(1, sizeof(LinearRanges));
+	for (unsigned i=0; i < n; ++i) {
+		images[i].index = i;
+		uintptr_t base = kBase + slotFor(i, n) * kImageSpan;
+		index->add(&images[i], base, base + kTextSize);
+		index->add(&images[i], base + kLinkEditAt, base + kLinkEditAt + kLinkEdit);
+		linear->add(&images[i], base, base + kTextSize);
+		linear->add(&images[i], base + kLinkEditAt, base + kLinkEditAt + kLinkEdit);
+	}
+
+	// addresses in images, in gaps, and past the end
+	uintptr_t* targets = new uintptr_t[kLookups];
+	uint64_t seed = 1;
+	for (unsigned i=0; i < kLookups; ++i) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		targets[i] = kBase + (uintptr_t)((seed >> 16) % ((uint64_t)(n + 1) * kImageSpan));
+	}
+
+	for (unsigned i=0; i < kLookups; i += 97) {
+		if ( index->find(targets[i]) != linear->find(targets[i]) ) {
+			FAIL("mapped-range-index: wrong image for 0x%lX with %u images", targets[i], n);
+			return false;
+		}
+	}
+
+	uintptr_t sum = 0;
+	uint64_t t0 = nanotime();
+	for (unsigned i=0; i < kLookups; ++i)
+		sum += (uintptr_t)index->find(targets[i]);
+	uint64_t t1 = nanotime();
+	unsigned linearLookups = kLookups / 100;
+	for (unsigned i=0; i < linearLookups; ++i)
+		sum += (uintptr_t)linear->find(targets[i]);
+	uint64_t t2 = nanotime();
+
+	printf("%5u images: index %6.1f ns/lookup, linear %8.1f ns/lookup (%lx)\n",
+		   n, (double)(t1-t0)/kLookups, (double)(t2-t1)/linearLookups, (unsigned long)(sum & 1));
+
+	// removing images must stop them being found
+	for (unsigned i=0; i < n; i += 3)
+		index->remove(&images[i]);
+	for (unsigned i=0; i < n; ++i) {
+		uintptr_t base = kBase + slotFor(i, n) * kImageSpan;
+		FakeImage* expected = (i % 3 == 0) ? NULL : &images[i];
+		if ( (index->find(base) != expected) || (index->find(base + kLinkEditAt) != expected) ) {
+			FAIL("mapped-range-index: image %u wrong after removal", i);
+			return false;
+		}
+	}
+
+	delete[] targets;
+	return true;
+}
+
+
+//
+// Readers must always get the right image or NULL while the writer
+// adds and removes images underneath them.
+//
+static MappedRangeIndex<FakeImage>	sShared;
+static FakeImage					sSharedImages[1000];
+static volatile bool				sDone;
+static volatile bool				sBad;
+
+static void* reader(void*)
+{
+	uint64_t seed = (uintptr_t)pthread_self();
+	while ( !sDone ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		unsigned i = (unsigned)((seed >> 16) % 1000);
+		uintptr_t base = kBase + i * kImageSpan;
+		FakeImage* image = sShared.find(base + kTextSize/2);
+		if ( (image != NULL) && (image != &sSharedImages[i]) )
+			sBad = true;
+	}
+	return NULL;
+}
+
+static bool concurrent()
+{
+	pthread_t threads[4];
+	for (int t=0; t < 4; ++t)
+		pthread_create(&threads[t], NULL, &reader, NULL);
+	for (int round=0; round < 20; ++round) {
+		for (unsigned i=0; i < 1000; ++i) {
+			uintptr_t base = kBase + i * kImageSpan;
+			sShared.add(&sSharedImages[i], base, base + kTextSize);
+		}
+		for (unsigned i=0; i < 1000; ++i)
+			sShared.remove(&sSharedImages[i]);
+	}
+	sDone = true;
+	for (int t=0; t < 4; ++t)
+		pthread_join(threads[t], NULL);
+	if ( sBad ) {
+		FAIL("mapped-range-index: reader saw the wrong image");
+		return false;
+	}
+	return true;
+}
+
+
+int main()
+{
+	unsigned counts[] = { 100, 500, 1000, 2000, 5000 };
+	for (unsigned i=0; i < sizeof(counts)/sizeof(counts[0]); ++i) {
+		if ( !bench(counts[i]) )
+			return EXIT_SUCCESS;
+	}
+	if ( !concurrent() )
+		return EXIT_SUCCESS;
+
+	PASS("mapped-range-index");
+	return EXIT_SUCCESS;
+}
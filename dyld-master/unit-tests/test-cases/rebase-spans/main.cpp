@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2020 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+#include <stdio.h>  // fprintf(), NULL
+#include <stdlib.h> // exit(), EXIT_SUCCESS
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mach-o/fat.h>
+#include <vector>
+
+#include "test.h" // PASS(), FAIL(), XPASS(), XFAIL()
+#include "timing.h" // nanotime()
+
+#include "MachOFileAbstraction.hpp"
+#include "Architectures.hpp"
+#include "RebaseSpans.h"
+
+static const unsigned kRounds = 20;
+
+
+//
+// An image's segments copied into memory at their sizes, with its rebase info.
+//
+struct Segments
+{
+	std::vector<uintptr_t>	starts;
+	std::vector<uintptr_t>	ends;
+	std::vector<uint8_t*>	contents;
+	std::vector<size_t>		sizes;
+
+	void add(const uint8_t* fileContent, size_t fileSize, size_t vmSize) {
+		uint8_t* mem = (uint8_t*)calloc(vmSize ? vmSize : 1, 1);
+		memcpy(mem, fileContent, fileSize < vmSize ? fileSize : vmSize);
+		starts.push_back((uintptr_t)mem);
+		ends.push_back((uintptr_t)mem + vmSize);
+		contents.push_back(mem);
+		sizes.push_back(vmSize);
+	}
+	void copyFrom(const Segments& other) {
+		for (size_t i=0; i < other.contents.size(); ++i)
+			add(other.contents[i], other.sizes[i], other.sizes[i]);
+	}
+	bool sameAs(const Segments& other) const {
+		for (size_t i=0; i < contents.size(); ++i) {
+			if ( memcmp(contents[i], other.contents[i], sizes[i]) != 0 )
+				return false;
+		}
+		return true;
+	}
+	~Segments() {
+		for (size_t i=0; i < contents.size(); ++i)
+			free(contents[i]);
+	}
+};
+
+
+// The interpreter dyld used before: bounds check and write one location at a time.
+template <typename pint_t>
+static void __attribute__((noinline)) rebaseAt(uintptr_t addr, pint_t slide, uint8_t type)
+{
+	pint_t* locationToFix = (pint_t*)addr;
+	switch (type) {
+		case REBASE_TYPE_POINTER:
+		case REBASE_TYPE_TEXT_ABSOLUTE32:
+			*locationToFix += slide;
+			break;
+		default:
+			throw "bad rebase type";
+	}
+}
+
+template <typename pint_t>
+static uintptr_t rebaseOneAtATime(const Segments& segs, const uint8_t* start, const uint8_t* end, pint_t slide)
+{
+	const uint8_t* p = start;
+	uint8_t type = 0;
+	int segmentIndex = 0;
+	uintptr_t address = segs.starts[0];
+	uintptr_t segmentEndAddress = segs.ends[0];
+	uintptr_t count;
+	uintptr_t skip;
+	uintptr_t total = 0;
+	bool done = false;
+	while ( !done && (p < end) ) {
+		uint8_t immediate = *p & REBASE_IMMEDIATE_MASK;
+		uint8_t opcode = *p & REBASE_OPCODE_MASK;
+		++p;
+		switch (opcode) {
+			case REBASE_OPCODE_DONE:
+				done = true;
+				break;
+			case REBASE_OPCODE_SET_TYPE_IMM:
+				type = immediate;
+				break;
+			case REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+				segmentIndex = immediate;
+				if ( segmentIndex >= (int)segs.starts.size() )
+					throw "bad segment";
+				address = segs.starts[segmentIndex] + read_uleb128(p, end);
+				segmentEndAddress = segs.ends[segmentIndex];
+				break;
+			case REBASE_OPCODE_ADD_ADDR_ULEB:
+				address += read_uleb128(p, end);
+				break;
+			case REBASE_OPCODE_ADD_ADDR_IMM_SCALED:
+				address += immediate*sizeof(pint_t);
+				break;
+			case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
+				for (int i=0; i < immediate; ++i) {
+					if ( address >= segmentEndAddress )
+						throw "bad address";
+					rebaseAt<pint_t>(address, slide, type);
+					address += sizeof(pint_t);
+				}
+				total += immediate;
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES:
+				count = read_uleb128(p, end);
+				for (uint32_t i=0; i < count; ++i) {
+					if ( address >= segmentEndAddress )
+						throw "bad address";
+					rebaseAt<pint_t>(address, slide, type);
+					address += sizeof(pint_t);
+				}
+				total += count;
+				break;
+			case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
+				if ( address >= segmentEndAddress )
+					throw "bad address";
+				rebaseAt<pint_t>(address, slide, type);
+				address += read_uleb128(p, end) + sizeof(pint_t);
+				++total;
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB:
+				count = read_uleb128(p, end);
+				skip = read_uleb128(p, end);
+				for (uint32_t i=0; i < count; ++i) {
+					if ( address >= segmentEndAddress )
+						throw "bad address";
+					rebaseAt<pint_t>(address, slide, type);
+					address += skip + sizeof(pint_t);
+				}
+				total += count;
+				break;
+			default:
+				throw "bad rebase opcode";
+		}
+	}
+	return total;
+}
+
+// The way dyld does it now, as in ImageLoaderMachOCompressed::rebase().
+template <typename pint_t>
+static uintptr_t rebaseInSpans(const Segments& segs, const uint8_t* start, const uint8_t* end, pint_t slide)
+{
+	RebaseSpanDecoder<pint_t> decoder(start, end, &segs.starts[0], &segs.ends[0], (uint32_t)segs.starts.size());
+	RebaseSpanSlider<pint_t> slider(slide);
+	if ( !decoder.forEachSpan(slider) )
+		throw "bad rebase info";
+	return decoder.totalCount();
+}
+
+
+// Times both engines over the same rebase info, and checks they agree.
+template <typename pint_t>
+static bool bench(const char* name, const Segments& original, const uint8_t* start, const uint8_t* end)
+{
+	Segments oneAtATime;
+	Segments inSpans;
+	oneAtATime.copyFrom(original);
+	inSpans.copyFrom(original);
+	const pint_t slide = (pint_t)0x10004000;
+
+	uintptr_t oldCount = 0;
+	uintptr_t newCount = 0;
+	uint64_t oldTime = 0;
+	uint64_t newTime = 0;
+	try {
+		for (unsigned i=0; i < kRounds; ++i) {
+			uint64_t t0 = nanotime();
+			oldCount = rebaseOneAtATime<pint_t>(oneAtATime, start, end, slide);
+			uint64_t t1 = nanotime();
+			newCount = rebaseInSpans<pint_t>(inSpans, start, end, slide);
+			uint64_t t2 = nanotime();
+			oldTime += t1 - t0;
+			newTime += t2 - t1;
+		}
+	}
+	catch (const char* msg) {
+		FAIL("rebase-spans: %s in %s", msg, name);
+		return false;
+	}
+	if ( (oldCount != newCount) || !inSpans.sameAs(oneAtATime) ) {
+		FAIL("rebase-spans: %s rebased differently", name);
+		return false;
+	}
+	if ( oldCount != 0 ) {
+		printf("%-28s %8lu rebases: one at a time %5.2f ns/rebase, spans %5.2f ns/rebase\n",
+			   name, (unsigned long)oldCount, (double)oldTime/kRounds/oldCount, (double)newTime/kRounds/newCount);
+	}
+	return true;
+}
+
+
+//
+// Rebase info like a large framework's: runs of pointers (vtables, arrays),
+// every third word of method lists, and scattered singles.
+//
+static void appendUleb(std::vector<uint8_t>& out, uint64_t value)
+{
+	do {
+		uint8_t byte = value & 0x7F;
+		value >>= 7;
+		if ( value != 0 )
+			byte |= 0x80;
+		out.push_back(byte);
+	} while ( value != 0 );
+}
+
+// Runs count locations with the given ULEB skip from the start of __TEXT,
+// which must be rejected with expectedAddress reported.
+static bool rejects(const Segments& segs, uint64_t skip, unsigned count, uintptr_t expectedAddress)
+{
+	std::vector<uint8_t> bad;
+	bad.push_back(REBASE_OPCODE_SET_TYPE_IMM | REBASE_TYPE_POINTER);
+	bad.push_back(REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0);
+	appendUleb(bad, 0);
+	bad.push_back(REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB);
+	appendUleb(bad, count);
+	appendUleb(bad, skip);
+	bad.push_back(REBASE_OPCODE_DONE);
+	RebaseSpanDecoder<uint64_t> decoder(&bad[0], &bad[0] + bad.size(), &segs.starts[0], &segs.ends[0], 2);
+	RebaseSpanSlider<uint64_t> slider(0);
+	if ( decoder.forEachSpan(slider) || (decoder.error() != RebaseSpanDecoder<uint64_t>::kBadAddress)
+		|| (decoder.errorAddress() != expectedAddress) ) {
+		FAIL("rebase-spans: run with skip 0x%llX reported 0x%lX, not 0x%lX", (unsigned long long)skip,
+			 (unsigned long)decoder.errorAddress(), (unsigned long)expectedAddress);
+		return false;
+	}
+	return true;
+}
+
+static bool synthetic()
+{
+	const size_t dataSize = 32*1024*1024;
+	std::vector<uint8_t> content(dataSize);
+	for (size_t i=0; i < dataSize; i += 8)
+		*(uint64_t*)&content[i] = 0x100000000ULL + i;
+	Segments segs;
+	segs.add(&content[0], 0, 0x1000);	// __TEXT has no rebases
+	segs.add(&content[0], dataSize, dataSize);
+
+	std::vector<uint8_t> info;
+	info.push_back(REBASE_OPCODE_SET_TYPE_IMM | REBASE_TYPE_POINTER);
+	info.push_back(REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+	appendUleb(info, 0);
+	uint64_t offset = 0;
+	uint64_t seed = 1;
+	while ( offset + 0x10000 < dataSize ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		unsigned n = 1 + (unsigned)((seed >> 33) % 40);
+		switch ( (seed >> 24) % 4 ) {
+			case 0:
+				info.push_back(REBASE_OPCODE_DO_REBASE_ULEB_TIMES);
+				appendUleb(info, n);
+				offset += n*8;
+				break;
+			case 1:
+				info.push_back(REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB);
+				appendUleb(info, n);
+				appendUleb(info, 16);
+				offset += n*24;
+				break;
+			case 2:
+				for (unsigned i=0; i < n; ++i) {
+					info.push_back(REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB);
+					appendUleb(info, 8);
+				}
+				offset += n*16;
+				break;
+			case 3:
+				info.push_back(REBASE_OPCODE_DO_REBASE_IMM_TIMES | (n & 0xF));
+				offset += (n & 0xF)*8;
+				break;
+		}
+		unsigned gap = (unsigned)((seed >> 40) % 8);
+		info.push_back(REBASE_OPCODE_ADD_ADDR_IMM_SCALED | gap);
+		offset += gap*8;
+	}
+	info.push_back(REBASE_OPCODE_DONE);
+
+	if ( !bench<uint64_t>("synthetic (32MB __DATA)", segs, &info[0], &info[0] + info.size()) )
+		return false;
+
+	// a run that steps off the end of its segment must be rejected
+	std::vector<uint8_t> bad;
+	bad.push_back(REBASE_OPCODE_SET_TYPE_IMM | REBASE_TYPE_POINTER);
+	bad.push_back(REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 0);
+	appendUleb(bad, 0x1000 - 3*8);
+	bad.push_back(REBASE_OPCODE_DO_REBASE_IMM_TIMES | 4);
+	bad.push_back(REBASE_OPCODE_DONE);
+	RebaseSpanDecoder<uint64_t> decoder(&bad[0], &bad[0] + bad.size(), &segs.starts[0], &segs.ends[0], 2);
+	RebaseSpanSlider<uint64_t> slider(0);
+	if ( decoder.forEachSpan(slider) || (decoder.error() != RebaseSpanDecoder<uint64_t>::kBadAddress)
+		|| (decoder.errorAddress() != segs.ends[0]) ) {
+		FAIL("rebase-spans: run past the end of a segment was not rejected");
+		return false;
+	}
+
+	// the first location outside is reported without stepping to it
+	if ( !rejects(segs, 0x100, 100, segs.starts[0] + 16*0x108) )
+		return false;
+	// even when it is past the top of the address space
+	if ( !rejects(segs, (uint64_t)-16, 2, UINTPTR_MAX) )
+		return false;
+	return true;
+}
+
+
+template <typename A>
+static bool benchImage(const char* name, const uint8_t* image, size_t size)
+{
+	typedef typename A::P			P;
+	typedef typename P::uint_t		pint_t;
+
+	const macho_header<P>* mh = (const macho_header<P>*)image;
+	const uint8_t* cmds = image + sizeof(macho_header<P>);
+	const uint8_t* cmdsEnd = cmds + mh->sizeofcmds();
+	if ( cmdsEnd > image + size )
+		return true;
+	Segments segs;
+	const macho_dyld_info_command<P>* dyldInfo = NULL;
+	for (const uint8_t* p = cmds; p < cmdsEnd; ) {
+		const macho_load_command<P>* cmd = (const macho_load_command<P>*)p;
+		if ( cmd->cmdsize() == 0 )
+			break;
+		if ( cmd->cmd() == macho_segment_command<P>::CMD ) {
+			const macho_segment_command<P>* seg = (const macho_segment_command<P>*)cmd;
+			// __PAGEZERO is all address space and no content
+			size_t vmSize = (seg->initprot() == 0) ? 0 : (size_t)seg->vmsize();
+			if ( seg->fileoff() + seg->filesize() > size )
+				return true;
+			segs.add(image + seg->fileoff(), (size_t)seg->filesize(), vmSize);
+		}
+		else if ( (cmd->cmd() == LC_DYLD_INFO) || (cmd->cmd() == LC_DYLD_INFO_ONLY) ) {
+			dyldInfo = (const macho_dyld_info_command<P>*)cmd;
+		}
+		p += cmd->cmdsize();
+	}
+	if ( (dyldInfo == NULL) || (dyldInfo->rebase_size() == 0) || segs.starts.empty() )
+		return true;
+	if ( (uint64_t)dyldInfo->rebase_off() + dyldInfo->rebase_size() > size )
+		return true;
+	const uint8_t* start = image + dyldInfo->rebase_off();
+	return bench<pint_t>(name, segs, start, start + dyldInfo->rebase_size());
+}
+
+static bool benchSlice(const char* path, const uint8_t* image, size_t size)
+{
+	const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	if ( size < sizeof(uint32_t) )
+		return true;
+	switch ( LittleEndian::get32(*(uint32_t*)image) ) {
+		case MH_MAGIC_64:
+			return benchImage<x86_64>(name, image, size);
+		case MH_MAGIC:
+			return benchImage<x86>(name, image, size);
+	}
+	return true;
+}
+
+static bool benchFile(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if ( fd == -1 ) {
+		FAIL("rebase-spans: can't open %s", path);
+		return false;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	const uint8_t* file = (uint8_t*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( file == (uint8_t*)MAP_FAILED ) {
+		FAIL("rebase-spans: can't map %s", path);
+		return false;
+	}
+	bool result = true;
+	const fat_header* fh = (const fat_header*)file;
+	if ( ((size_t)st.st_size >= sizeof(fat_header)) && (BigEndian::get32(fh->magic) == FAT_MAGIC) ) {
+		const fat_arch* archs = (const fat_arch*)(file + sizeof(fat_header));
+		for (uint32_t i=0; result && (i < BigEndian::get32(fh->nfat_arch)); ++i) {
+			uint32_t offset = BigEndian::get32(archs[i].offset);
+			uint32_t sliceSize = BigEndian::get32(archs[i].size);
+			if ( (uint64_t)offset + sliceSize <= (uint64_t)st.st_size )
+				result = benchSlice(path, file + offset, sliceSize);
+		}
+	}
+	else {
+		result = benchSlice(path, file, (size_t)st.st_size);
+	}
+	munmap((void*)file, (size_t)st.st_size);
+	return result;
+}
+
+
+int main(int argc, const char* argv[])
+{
+	if ( !synthetic() )
+		return EXIT_SUCCESS;
+	for (int i=1; i < argc; ++i) {
+		if ( !benchFile(argv[i]) )
+			return EXIT_SUCCESS;
+	}
+
+	PASS("rebase-spans");
+	return EXIT_SUCCESS;
+}
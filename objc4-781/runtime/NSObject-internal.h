@@ -130,11 +130,19 @@ struct AutoreleasePoolPageData
 	AutoreleasePoolPage *child;
 	uint32_t const depth;
 	uint32_t hiwat;
+	uint32_t const size;  // bytes, including this header; power of 2
 
-	AutoreleasePoolPageData(__unsafe_unretained id* _next, pthread_t _thread, AutoreleasePoolPage* _parent, uint32_t _depth, uint32_t _hiwat)
+#if __LP64__
+	// Entry layout: (extra autorelease count << ENTRY_COUNT_SHIFT) | object.
+	// Heap object addresses fit in the low 48 bits.
+	static int const ENTRY_COUNT_SHIFT = 48;
+	static uintptr_t const ENTRY_OBJECT_MASK = (1UL << ENTRY_COUNT_SHIFT) - 1;
+#endif
+
+	AutoreleasePoolPageData(__unsafe_unretained id* _next, pthread_t _thread, AutoreleasePoolPage* _parent, uint32_t _depth, uint32_t _hiwat, uint32_t _size)
 		: magic(), next(_next), thread(_thread),
 		  parent(_parent), child(nil),
-		  depth(_depth), hiwat(_hiwat)
+		  depth(_depth), hiwat(_hiwat), size(_size)
 	{
 	}
 };
@@ -38,6 +38,7 @@
 #include <Block.h>
 #include <map>
 #include <execinfo.h>
+#include <os/tsd.h>
 #include "NSObject-internal.h"
 
 @interface NSInvocation
@@ -51,6 +52,14 @@ OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_parent_offset = __buil
 OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_child_offset  = __builtin_offsetof(AutoreleasePoolPageData, child);
 OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_depth_offset  = __builtin_offsetof(AutoreleasePoolPageData, depth);
 OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_hiwat_offset  = __builtin_offsetof(AutoreleasePoolPageData, hiwat);
+OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_size_offset   = __builtin_offsetof(AutoreleasePoolPageData, size);
+#if __LP64__
+OBJC_EXTERN const uintptr_t objc_debug_autoreleasepoolpage_ptr_mask     = AutoreleasePoolPageData::ENTRY_OBJECT_MASK;
+OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_count_shift   = AutoreleasePoolPageData::ENTRY_COUNT_SHIFT;
+#else
+OBJC_EXTERN const uintptr_t objc_debug_autoreleasepoolpage_ptr_mask     = ~(uintptr_t)0;
+OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_count_shift   = 0;
+#endif
 #if __OBJC2__
 OBJC_EXTERN const uint32_t objc_class_abi_version = OBJC_CLASS_ABI_VERSION_MAX;
 #endif
@@ -178,27 +187,109 @@ static StripedMap<SideTable>& SideTables() {
     return SideTablesMap.get();
 }
 
+
+// Retain counts that overflowed out of a nonpointer isa, not yet 
+// added to the side table. Each CPU has its own buffer so that hot 
+// objects with overflowed retain counts do not serialize every core 
+// on their side table's lock.
+//
+// Deltas are only ever added here (by rootRetain's overflow path, 
+// with the buffer lock held across the isa update). Anything that 
+// reads or subtracts the side table count folds the object's deltas 
+// in first, so the exact count is only reconciled when rootRelease 
+// borrows from the side table, i.e. when the count might hit zero.
+//
+// Lock order: a SideTable lock precedes every SideTableDeltas lock.
+struct SideTableDeltas {
+    enum { Capacity = 8 };
+
+    spinlock_t slock;
+    // Disguised for the same reason as RefcountMap. nil is an empty slot.
+    DisguisedPtr<objc_object> objects[Capacity];
+    size_t deltas[Capacity];
+    unsigned count;
+
+    SideTableDeltas() {
+        memset(objects, 0, sizeof(objects));
+        memset(deltas, 0, sizeof(deltas));
+        count = 0;
+    }
+
+    void lock() { slock.lock(); }
+    void unlock() { slock.unlock(); }
+    void forceReset() { slock.forceReset(); }
+
+    // Returns the slot for obj, or Capacity if it has none.
+    unsigned find(objc_object *obj) {
+        for (unsigned i = 0; i < Capacity; i++) {
+            if (objects[i] == obj) return i;
+        }
+        return Capacity;
+    }
+
+    // Returns the slot for obj, allocating one if necessary, 
+    // or Capacity if the buffer is full.
+    unsigned reserve(objc_object *obj) {
+        unsigned i = find(obj);
+        if (i < Capacity  ||  count == Capacity) return i;
+        for (i = 0; i < Capacity; i++) {
+            if (!objects[i]) {
+                objects[i] = obj;
+                deltas[i] = 0;
+                count++;
+                return i;
+            }
+        }
+        return Capacity;
+    }
+
+    // Removes and returns the delta in slot i.
+    size_t take(unsigned i) {
+        size_t delta = deltas[i];
+        objects[i] = nullptr;
+        deltas[i] = 0;
+        count--;
+        return delta;
+    }
+};
+
+static objc::ExplicitInit<StripedMap<SideTableDeltas>> SideTableDeltasMap;
+
+static StripedMap<SideTableDeltas>& AllSideTableDeltas() {
+    return SideTableDeltasMap.get();
+}
+
+static SideTableDeltas& CurrentSideTableDeltas() {
+    return AllSideTableDeltas().stripeAtIndex(_os_cpu_number());
+}
+
 // anonymous namespace
 };
 
 void SideTableLockAll() {
     SideTables().lockAll();
+    AllSideTableDeltas().lockAll();
 }
 
 void SideTableUnlockAll() {
+    AllSideTableDeltas().unlockAll();
     SideTables().unlockAll();
 }
 
 void SideTableForceResetAll() {
+    AllSideTableDeltas().forceResetAll();
     SideTables().forceResetAll();
 }
 
 void SideTableDefineLockOrder() {
     SideTables().defineLockOrder();
+    AllSideTableDeltas().defineLockOrder();
+    SideTables().precedeLock(AllSideTableDeltas().getLock(0));
 }
 
 void SideTableLocksPrecedeLock(const void *newlock) {
     SideTables().precedeLock(newlock);
+    AllSideTableDeltas().precedeLock(newlock);
 }
 
 void SideTableLocksSucceedLock(const void *oldlock) {
@@ -594,6 +685,11 @@ objc_moveWeak(id *dst, id *src)
      and deleted as necessary. 
    Thread-local storage points to the hot page, where newly autoreleased 
      objects are stored. 
+   On LP64 an object autoreleased several times in a row takes one entry:
+     the high bits of the entry count the extra autoreleases.
+   Pages start at SIZE bytes. Once a thread's stack is GROWTH_DEPTH pages 
+     deep each new page is twice the size of its parent, up to MAX_SIZE. 
+     Every page is aligned to its own size.
 **********************************************************************/
 
 BREAKPOINT_FUNCTION(void objc_autoreleaseNoPool(id obj));
@@ -615,6 +711,17 @@ private:
 	static pthread_key_t const key = AUTORELEASE_POOL_KEY;
 	static uint8_t const SCRIBBLE = 0xA3;  // 0xA3A3A3A3 after releasing
 	static size_t const COUNT = SIZE / sizeof(id);
+	static size_t const MAX_SIZE = SIZE << 4;
+	static uint32_t const GROWTH_DEPTH = 4;
+
+#if __LP64__
+    // Entries may count repeated autoreleases, 
+    // see AutoreleasePoolPageData::ENTRY_COUNT_SHIFT.
+#   define SUPPORT_AUTORELEASE_COALESCING 1
+    static uintptr_t const ENTRY_COUNT_MAX = ~0UL >> ENTRY_COUNT_SHIFT;
+#else
+#   define SUPPORT_AUTORELEASE_COALESCING 0
+#endif
 
     // EMPTY_POOL_PLACEHOLDER is stored in TLS when exactly one pool is 
     // pushed and it has never contained any objects. This saves memory 
@@ -624,10 +731,10 @@ private:
 
 #   define POOL_BOUNDARY nil
 
-    // SIZE-sizeof(*this) bytes of contents follow
+    // size-sizeof(*this) bytes of contents follow
 
-    static void * operator new(size_t size) {
-        return malloc_zone_memalign(malloc_default_zone(), SIZE, SIZE);
+    static void * operator new(size_t, size_t pageSize) {
+        return malloc_zone_memalign(malloc_default_zone(), pageSize, pageSize);
     }
     static void operator delete(void * p) {
         return free(p);
@@ -635,7 +742,7 @@ private:
 
     inline void protect() {
 #if PROTECT_AUTORELEASEPOOL
-        mprotect(this, SIZE, PROT_READ);
+        mprotect(this, size, PROT_READ);
         check();
 #endif
     }
@@ -643,16 +750,35 @@ private:
     inline void unprotect() {
 #if PROTECT_AUTORELEASEPOOL
         check();
-        mprotect(this, SIZE, PROT_READ | PROT_WRITE);
+        mprotect(this, size, PROT_READ | PROT_WRITE);
 #endif
     }
 
-	AutoreleasePoolPage(AutoreleasePoolPage *newParent) :
+    // Size of a new page whose parent is newParent.
+    static size_t sizeForChild(AutoreleasePoolPage *newParent)
+    {
+        if (!newParent  ||  newParent->depth + 1 < GROWTH_DEPTH  ||  
+            DisableAutoreleasePageGrowth  ||  DebugPoolAllocation)
+        {
+            return SIZE;
+        }
+        size_t pageSize = (size_t)newParent->size * 2;
+        return pageSize < MAX_SIZE ? pageSize : MAX_SIZE;
+    }
+
+    static AutoreleasePoolPage *newPage(AutoreleasePoolPage *newParent)
+    {
+        size_t pageSize = sizeForChild(newParent);
+        return new (pageSize) AutoreleasePoolPage(newParent, pageSize);
+    }
+
+	AutoreleasePoolPage(AutoreleasePoolPage *newParent, size_t pageSize) :
 		AutoreleasePoolPageData(begin(),
 								objc_thread_self(),
 								newParent,
 								newParent ? 1+newParent->depth : 0,
-								newParent ? newParent->hiwat : 0)
+								newParent ? newParent->hiwat : 0,
+								(uint32_t)pageSize)
     { 
         if (parent) {
             parent->check();
@@ -729,7 +855,7 @@ private:
     }
 
     id * end() {
-        return (id *) ((uint8_t *)this+SIZE);
+        return (id *) ((uint8_t *)this+size);
     }
 
     bool empty() {
@@ -754,6 +880,47 @@ private:
         return ret;
     }
 
+    // If obj is the newest entry on this page, count another 
+    // autorelease of it in that entry and return the entry.
+    // Otherwise return nil. Works even when the page is full.
+    id *coalesce(id obj)
+    {
+#if SUPPORT_AUTORELEASE_COALESCING
+        if (empty()  ||  DisableAutoreleaseCoalescing) return nil;
+        uintptr_t *entry = (uintptr_t *)next - 1;
+        if ((*entry & ENTRY_OBJECT_MASK) != (uintptr_t)obj  ||  
+            (*entry >> ENTRY_COUNT_SHIFT) == ENTRY_COUNT_MAX) 
+        {
+            return nil;
+        }
+        unprotect();
+        *entry += 1UL << ENTRY_COUNT_SHIFT;
+        protect();
+        return (id *)entry;
+#else
+        return nil;
+#endif
+    }
+
+    // The object in an entry, and how many times it was autoreleased.
+    static id entryObject(id *entry)
+    {
+#if SUPPORT_AUTORELEASE_COALESCING
+        return (id)(*(uintptr_t *)entry & ENTRY_OBJECT_MASK);
+#else
+        return *entry;
+#endif
+    }
+
+    static size_t entryCount(id *entry)
+    {
+#if SUPPORT_AUTORELEASE_COALESCING
+        return 1 + (*(uintptr_t *)entry >> ENTRY_COUNT_SHIFT);
+#else
+        return 1;
+#endif
+    }
+
     void releaseAll() 
     {
         releaseUntil(begin());
@@ -776,12 +943,16 @@ private:
             }
 
             page->unprotect();
-            id obj = *--page->next;
+            id *entry = --page->next;
+            id obj = entryObject(entry);
+            size_t count = entryCount(entry);
             memset((void*)page->next, SCRIBBLE, sizeof(*page->next));
             page->protect();
 
             if (obj != POOL_BOUNDARY) {
-                objc_release(obj);
+                do {
+                    objc_release(obj);
+                } while (--count);
             }
         }
 
@@ -802,6 +973,11 @@ private:
         AutoreleasePoolPage *page = this;
         while (page->child) page = page->child;
 
+        // Pages are freed in batches rather than one at a time.
+        enum { BATCH = 16 };
+        void *dead[BATCH];
+        unsigned deadCount = 0;
+
         AutoreleasePoolPage *deathptr;
         do {
             deathptr = page;
@@ -811,8 +987,17 @@ private:
                 page->child = nil;
                 page->protect();
             }
-            delete deathptr;
+            deathptr->~AutoreleasePoolPage();
+            dead[deadCount++] = deathptr;
+            if (deadCount == BATCH) {
+                malloc_zone_batch_free(malloc_default_zone(), dead, deadCount);
+                deadCount = 0;
+            }
         } while (deathptr != this);
+
+        if (deadCount) {
+            malloc_zone_batch_free(malloc_default_zone(), dead, deadCount);
+        }
     }
 
     static void tls_dealloc(void *p) 
@@ -845,15 +1030,23 @@ private:
 
     static AutoreleasePoolPage *pageForPointer(uintptr_t p) 
     {
-        AutoreleasePoolPage *result;
-        uintptr_t offset = p % SIZE;
-
-        ASSERT(offset >= sizeof(AutoreleasePoolPage));
-
-        result = (AutoreleasePoolPage *)(p - offset);
-        result->fastcheck();
+        // Every page is aligned to its own size, which is a multiple of 
+        // SIZE. Try each possible size from the smallest up. Every 
+        // candidate before the right one lies inside the same page, 
+        // where the contents can't look like a page header.
+        for (size_t pageSize = SIZE; pageSize <= MAX_SIZE; pageSize *= 2) {
+            uintptr_t offset = p % pageSize;
+            auto result = (AutoreleasePoolPage *)(p - offset);
+            if (result->magic.fastcheck()  &&  pageSize <= result->size) {
+                ASSERT(offset >= sizeof(AutoreleasePoolPage));
+                result->fastcheck();
+                return result;
+            }
+        }
 
-        return result;
+        // Not a pool page at all.
+        auto result = (AutoreleasePoolPage *)(p - p % SIZE);
+        result->busted_die();
     }
 
 
@@ -901,6 +1094,9 @@ private:
     static inline id *autoreleaseFast(id obj)
     {
         AutoreleasePoolPage *page = hotPage();
+        if (page && obj != POOL_BOUNDARY) {
+            if (id *entry = page->coalesce(obj)) return entry;
+        }
         if (page && !page->full()) {
             return page->add(obj);
         } else if (page) {
@@ -921,7 +1117,7 @@ private:
 
         do {
             if (page->child) page = page->child;
-            else page = new AutoreleasePoolPage(page);
+            else page = newPage(page);
         } while (page->full());
 
         setHotPage(page);
@@ -964,7 +1160,7 @@ private:
         // We are pushing an object or a non-placeholder'd pool.
 
         // Install the first page.
-        AutoreleasePoolPage *page = new AutoreleasePoolPage(nil);
+        AutoreleasePoolPage *page = newPage(nil);
         setHotPage(page);
         
         // Push a boundary on behalf of the previously-placeholder'd pool.
@@ -991,7 +1187,7 @@ public:
         ASSERT(obj);
         ASSERT(!obj->isTaggedPointer());
         id *dest __unused = autoreleaseFast(obj);
-        ASSERT(!dest  ||  dest == EMPTY_POOL_PLACEHOLDER  ||  *dest == obj);
+        ASSERT(!dest  ||  dest == EMPTY_POOL_PLACEHOLDER  ||  entryObject(dest) == obj);
         return obj;
     }
 
@@ -1128,11 +1324,17 @@ public:
                      this == coldPage() ? "(cold)" : "");
         check(false);
         for (id *p = begin(); p < next; p++) {
-            if (*p == POOL_BOUNDARY) {
+            id obj = entryObject(p);
+            size_t count = entryCount(p);
+            if (obj == POOL_BOUNDARY) {
                 _objc_inform("[%p]  ################  POOL %p", p, p);
+            } else if (count > 1) {
+                _objc_inform("[%p]  %#16lx  %s  (x%zu)", p, 
+                             (unsigned long)obj, object_getClassName(obj), 
+                             count);
             } else {
                 _objc_inform("[%p]  %#16lx  %s", 
-                             p, (unsigned long)*p, object_getClassName(*p));
+                             p, (unsigned long)obj, object_getClassName(obj));
             }
         }
     }
@@ -1144,9 +1346,11 @@ public:
         _objc_inform("AUTORELEASE POOLS for thread %p", objc_thread_self());
 
         AutoreleasePoolPage *page;
-        ptrdiff_t objects = 0;
+        size_t objects = 0;
         for (page = coldPage(); page; page = page->child) {
-            objects += page->next - page->begin();
+            for (id *p = page->begin(); p < page->next; p++) {
+                objects += entryCount(p);
+            }
         }
         _objc_inform("%llu releases pending.", (unsigned long long)objects);
 
@@ -1170,8 +1374,12 @@ public:
     {
         // Check and propagate high water mark
         // Ignore high water marks under 256 to suppress noise.
+        // The mark counts pool entries, so a coalesced run counts once.
         AutoreleasePoolPage *p = hotPage();
-        uint32_t mark = p->depth*COUNT + (uint32_t)(p->next - p->begin());
+        uint32_t mark = (uint32_t)(p->next - p->begin());
+        for (AutoreleasePoolPage *q = p->parent; q; q = q->parent) {
+            mark += (uint32_t)(q->end() - q->begin());
+        }
         if (mark > p->hiwat  &&  mark > 256) {
             for( ; p; p = p->parent) {
                 p->unprotect();
@@ -1231,6 +1439,9 @@ objc_object::clearDeallocating_slow()
         weak_clear_no_lock(&table.weak_table, (id)this);
     }
     if (isa.has_sidetable_rc) {
+        // Drop any deferred overflow too so it can't leak into 
+        // a new object allocated at the same address.
+        sidetable_foldDeltas_nolock();
         table.refcnts.erase(this);
     }
     table.unlock();
@@ -1314,6 +1525,7 @@ objc_object::sidetable_moveExtraRC_nolock(size_t extra_rc,
     ASSERT(!isa.nonpointer);        // should already be changed to raw pointer
     SideTable& table = SideTables()[this];
 
+    sidetable_foldDeltas_nolock();
     size_t& refcntStorage = table.refcnts[this];
     size_t oldRefcnt = refcntStorage;
     // not deallocating - that was in the isa
@@ -1385,6 +1597,7 @@ objc_object::sidetable_subExtraRC_nolock(size_t delta_rc)
     ASSERT(isa.nonpointer);
     SideTable& table = SideTables()[this];
 
+    sidetable_foldDeltas_nolock();
     RefcountMap::iterator it = table.refcnts.find(this);
     if (it == table.refcnts.end()  ||  it->second == 0) {
         // Side table retain count is zero. Can't borrow.
@@ -1408,12 +1621,135 @@ objc_object::sidetable_getExtraRC_nolock()
 {
     ASSERT(isa.nonpointer);
     SideTable& table = SideTables()[this];
+    sidetable_foldDeltas_nolock();
     RefcountMap::iterator it = table.refcnts.find(this);
     if (it == table.refcnts.end()) return 0;
     else return it->second >> SIDE_TABLE_RC_SHIFT;
 }
 
 
+// Lock something that protects an overflow of the retain count 
+// out of the isa field. Returns this CPU's overflow buffer with a 
+// slot reserved for this object, or nil if the side table itself 
+// was locked instead.
+SideTableDeltas *
+objc_object::sidetable_lockForOverflow()
+{
+    if (!DisableSideTableDeltas) {
+        SideTableDeltas& deltas = CurrentSideTableDeltas();
+        deltas.lock();
+        if (deltas.reserve(this) < SideTableDeltas::Capacity) {
+            return &deltas;
+        }
+        deltas.unlock();
+    }
+
+    sidetable_lock();
+    return nil;
+}
+
+
+void 
+objc_object::sidetable_unlockForOverflow(SideTableDeltas *deltas)
+{
+    if (deltas) {
+        deltas->unlock();
+        return;
+    }
+
+    sidetable_unlock();
+
+    // The side table was used because this CPU's buffer was full.
+    // Flush the buffer in one batch, taking each side table lock once.
+    if (!DisableSideTableDeltas) {
+        SideTableDeltas& full = CurrentSideTableDeltas();
+        SideTable *flushed[SideTableDeltas::Capacity];
+        unsigned flushedCount = 0;
+        for (unsigned i = 0; i < SideTableDeltas::Capacity; i++) {
+            full.lock();
+            objc_object *obj = full.objects[i];
+            full.unlock();
+            if (!obj) continue;
+
+            SideTable& table = SideTables()[obj];
+            bool done = false;
+            for (unsigned j = 0; j < flushedCount; j++) {
+                if (flushed[j] == &table) done = true;
+            }
+            if (done) continue;
+            flushed[flushedCount++] = &table;
+
+            table.lock();
+            full.lock();
+            for (unsigned j = i; j < SideTableDeltas::Capacity; j++) {
+                objc_object *other = full.objects[j];
+                if (!other  ||  &SideTables()[other] != &table) continue;
+                size_t& refcntStorage = table.refcnts[other];
+                if (refcntStorage & SIDE_TABLE_RC_PINNED) {
+                    full.take(j);
+                    continue;
+                }
+                uintptr_t carry;
+                size_t newRefcnt = addc(refcntStorage, 
+                                        full.take(j) << SIDE_TABLE_RC_SHIFT, 
+                                        0, &carry);
+                refcntStorage = carry 
+                    ? SIDE_TABLE_RC_PINNED | (refcntStorage & SIDE_TABLE_FLAG_MASK)
+                    : newRefcnt;
+            }
+            full.unlock();
+            table.unlock();
+        }
+    }
+}
+
+
+// Add overflowed retain counts to this CPU's buffer 
+// instead of the side table.
+void 
+objc_object::sidetable_deferExtraRC_nolock(SideTableDeltas *deltas, 
+                                           size_t delta_rc)
+{
+    ASSERT(isa.nonpointer);
+    unsigned i = deltas->find(this);
+    ASSERT(i < SideTableDeltas::Capacity);  // reserved by lockForOverflow
+    deltas->deltas[i] += delta_rc;
+}
+
+
+// Move this object's overflowed retain counts from every CPU's 
+// buffer into the side table. The side table must be locked.
+void 
+objc_object::sidetable_foldDeltas_nolock()
+{
+    StripedMap<SideTableDeltas>& all = AllSideTableDeltas();
+    size_t delta_rc = 0;
+    for (unsigned i = 0; i < all.stripeCount(); i++) {
+        SideTableDeltas& deltas = all.stripeAtIndex(i);
+        deltas.lock();
+        unsigned slot = deltas.find(this);
+        if (slot < SideTableDeltas::Capacity) delta_rc += deltas.take(slot);
+        deltas.unlock();
+    }
+
+    if (delta_rc == 0) return;
+
+    SideTable& table = SideTables()[this];
+    size_t& refcntStorage = table.refcnts[this];
+    if (refcntStorage & SIDE_TABLE_RC_PINNED) return;
+
+    uintptr_t carry;
+    size_t newRefcnt = 
+        addc(refcntStorage, delta_rc << SIDE_TABLE_RC_SHIFT, 0, &carry);
+    if (carry) {
+        refcntStorage =
+            SIDE_TABLE_RC_PINNED | (refcntStorage & SIDE_TABLE_FLAG_MASK);
+    } else {
+        refcntStorage = newRefcnt;
+    }
+}
+
+
 // SUPPORT_NONPOINTER_ISA
 #endif
 
@@ -2027,6 +2363,7 @@ void arr_init(void)
 {
     AutoreleasePoolPage::init();
     SideTablesMap.init();
+    SideTableDeltasMap.init();
     _objc_associations_init();
 }
 
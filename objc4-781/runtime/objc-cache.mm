@@ -52,6 +52,16 @@
  * that could have had access to the garbage has finished or moved past the 
  * cache lookup stage, so it is safe to free the memory.
  *
+ * Requiring every thread to be outside objc_msgSend at the same instant 
+ * can stall collection indefinitely when many threads are sending messages. 
+ * Unless OBJC_DISABLE_CACHE_EPOCHS is set, each piece of garbage is instead 
+ * stamped with the current cache epoch, and every scan of the threads 
+ * starts a new epoch and records, per thread, the last epoch in which that 
+ * thread was seen outside the cache readers. A thread seen outside the 
+ * readers after some garbage was disconnected can no longer be using it, 
+ * so garbage is freed as soon as every live thread has passed its epoch, 
+ * even if the threads were never all quiescent at once.
+ *
  * All functions that modify cache data or structures must acquire the 
  * cacheUpdateLock to prevent interference from concurrent modifications.
  * The function that frees cache garbage must acquire the cacheUpdateLock 
@@ -97,6 +107,7 @@ enum {
 
 static void cache_collect_free(struct bucket_t *data, mask_t capacity);
 static int _collecting_in_critical(void);
+static uintptr_t _quiescent_epoch(void);
 static void _garbage_make_room(void);
 
 
@@ -835,6 +846,33 @@ void cache_init()
 #endif // HAVE_TASK_RESTARTABLE_RANGES
 }
 
+/***********************************************************************
+* _thread_in_critical.
+* Returns TRUE if the given thread is executing a cache-reading function, 
+* or if its state could not be determined.
+**********************************************************************/
+static bool _thread_in_critical(thread_act_t thread)
+{
+    // Find out where thread is executing
+    uintptr_t pc = _get_pc_for_thread(thread);
+
+    // Check for bad status, and if so, assume the worse (can't collect)
+    if (pc == PC_SENTINEL) return true;
+
+    // Check whether it is in the cache lookup code
+    for (int region = 0; objc_restartableRanges[region].location != 0; region++)
+    {
+        uint64_t loc = objc_restartableRanges[region].location;
+        if ((pc > loc) &&
+            (pc - loc < (uint64_t)objc_restartableRanges[region].length))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 static int _collecting_in_critical(void)
 {
 #if TARGET_OS_WIN32
@@ -875,37 +913,134 @@ static int _collecting_in_critical(void)
     result = FALSE;
     for (count = 0; count < number; count++)
     {
-        int region;
-        uintptr_t pc;
-
         // Don't bother checking ourselves
         if (threads[count] == mythread)
             continue;
 
-        // Find out where thread is executing
-        pc = _get_pc_for_thread (threads[count]);
-
-        // Check for bad status, and if so, assume the worse (can't collect)
-        if (pc == PC_SENTINEL)
-        {
+        if (_thread_in_critical(threads[count])) {
             result = TRUE;
-            goto done;
+            break;
         }
-        
-        // Check whether it is in the cache lookup code
-        for (region = 0; objc_restartableRanges[region].location != 0; region++)
-        {
-            uint64_t loc = objc_restartableRanges[region].location;
-            if ((pc > loc) &&
-                (pc - loc < (uint64_t)objc_restartableRanges[region].length))
-            {
-                result = TRUE;
-                goto done;
+    }
+
+    // Deallocate the port rights for the threads
+    for (count = 0; count < number; count++) {
+        mach_port_deallocate(mach_task_self (), threads[count]);
+    }
+
+    // Deallocate the thread list
+    vm_deallocate (mach_task_self (), (vm_address_t) threads, sizeof(threads[0]) * number);
+
+    // Return our finding
+    return result;
+}
+
+
+/***********************************************************************
+* _quiescent_epoch.
+* Starts a new cache epoch and returns the oldest epoch that some live 
+* thread might still be reading caches from. Garbage stamped with an 
+* epoch older than the result is no longer reachable by any cache reader.
+*
+* A thread is known to have passed an epoch once a scan that started 
+* after that epoch sees it outside the cache readers. Threads found in 
+* the cache readers keep the epoch they were last seen quiescent in. 
+* Threads not seen by the previous scan were created after it started, 
+* so they start out at the previous scan's epoch.
+* Cache locks: cacheUpdateLock must be held by the caller.
+**********************************************************************/
+
+// current cache epoch; garbage is stamped with this when it is freed
+static uintptr_t cache_epoch = 1;
+
+// epoch started by the most recent scan of the threads
+static uintptr_t cache_scan_epoch = 1;
+
+// last epoch in which each thread was seen outside the cache readers
+struct thread_epoch_t {
+    mach_port_t thread;
+    uintptr_t epoch;
+};
+static thread_epoch_t *thread_epochs = nil;
+static unsigned thread_epochs_count = 0;
+static unsigned thread_epochs_max = 0;
+
+static uintptr_t _quiescent_epoch(void)
+{
+#if CONFIG_USE_CACHE_LOCK
+    cacheUpdateLock.assertLocked();
+#else
+    runtimeLock.assertLocked();
+#endif
+
+    uintptr_t previousEpoch = cache_scan_epoch;
+    uintptr_t scanEpoch = cache_scan_epoch = ++cache_epoch;
+
+#if TARGET_OS_WIN32
+    return 0;
+#else
+#   if HAVE_TASK_RESTARTABLE_RANGES
+    // Synchronizing the restartable ranges moves every thread 
+    // out of the cache readers at once.
+    if (shouldUseRestartableRanges) {
+        if (!_collecting_in_critical()) return scanEpoch;
+    }
+#   endif
+
+    thread_act_port_array_t threads;
+    unsigned number;
+    unsigned count;
+    kern_return_t ret;
+
+    mach_port_t mythread = pthread_mach_thread_np(objc_thread_self());
+
+#if !DEBUG_TASK_THREADS
+    ret = task_threads(mach_task_self(), &threads, &number);
+#else
+    ret = objc_task_threads(mach_task_self(), &threads, &number);
+#endif
+
+    if (ret != KERN_SUCCESS) {
+        // See DEBUG_TASK_THREADS below to help debug this.
+        _objc_fatal("task_threads failed (result 0x%x)\n", ret);
+    }
+
+    // Rebuild the table with only the threads that are still alive.
+    thread_epoch_t *oldEpochs = thread_epochs;
+    unsigned oldCount = thread_epochs_count;
+    if (number > thread_epochs_max) {
+        thread_epochs_max = number * 2;
+    }
+    thread_epochs = (thread_epoch_t *)
+        malloc(thread_epochs_max * sizeof(thread_epoch_t));
+    thread_epochs_count = number;
+
+    uintptr_t result = scanEpoch;
+    unsigned hint = 0;
+    for (count = 0; count < number; count++) {
+        mach_port_t thread = threads[count];
+        uintptr_t epoch = previousEpoch;
+
+        // task_threads() usually returns threads in the same order, 
+        // so start looking where the last match was.
+        for (unsigned i = 0; i < oldCount; i++) {
+            unsigned j = (hint + i) % oldCount;
+            if (oldEpochs[j].thread == thread) {
+                epoch = oldEpochs[j].epoch;
+                hint = j + 1;
+                break;
             }
         }
+
+        if (thread == mythread  ||  !_thread_in_critical(thread)) {
+            epoch = scanEpoch;
+        }
+
+        thread_epochs[count] = thread_epoch_t{thread, epoch};
+        if (epoch < result) result = epoch;
     }
+    free(oldEpochs);
 
- done:
     // Deallocate the port rights for the threads
     for (count = 0; count < number; count++) {
         mach_port_deallocate(mach_task_self (), threads[count]);
@@ -914,8 +1049,8 @@ static int _collecting_in_critical(void)
     // Deallocate the thread list
     vm_deallocate (mach_task_self (), (vm_address_t) threads, sizeof(threads[0]) * number);
 
-    // Return our finding
     return result;
+#endif
 }
 
 
@@ -930,8 +1065,15 @@ static size_t garbage_byte_size = 0;
 // do not empty the garbage until garbage_byte_size gets at least this big
 static size_t garbage_threshold = 32*1024;
 
-// table of refs to free
-static bucket_t **garbage_refs = 0;
+// a dead cache and the cache epoch in which it was freed
+struct garbage_ref_t {
+    bucket_t *buckets;
+    mask_t capacity;
+    uintptr_t epoch;
+};
+
+// table of refs to free, oldest first
+static garbage_ref_t *garbage_refs = 0;
 
 // current number of refs in garbage_refs
 static size_t garbage_count = 0;
@@ -952,16 +1094,16 @@ static void _garbage_make_room(void)
     if (first)
     {
         first = 0;
-        garbage_refs = (bucket_t**)
-            malloc(INIT_GARBAGE_COUNT * sizeof(void *));
+        garbage_refs = (garbage_ref_t *)
+            malloc(INIT_GARBAGE_COUNT * sizeof(garbage_ref_t));
         garbage_max = INIT_GARBAGE_COUNT;
     }
 
     // Double the table if it is full
     else if (garbage_count == garbage_max)
     {
-        garbage_refs = (bucket_t**)
-            realloc(garbage_refs, garbage_max * 2 * sizeof(void *));
+        garbage_refs = (garbage_ref_t *)
+            realloc(garbage_refs, garbage_max * 2 * sizeof(garbage_ref_t));
         garbage_max *= 2;
     }
 }
@@ -986,7 +1128,7 @@ static void cache_collect_free(bucket_t *data, mask_t capacity)
 
     _garbage_make_room ();
     garbage_byte_size += cache_t::bytesForCapacity(capacity);
-    garbage_refs[garbage_count++] = data;
+    garbage_refs[garbage_count++] = garbage_ref_t{data, capacity, cache_epoch};
     cache_collect(false);
 }
 
@@ -1009,8 +1151,30 @@ void cache_collect(bool collectALot)
         return;
     }
 
+    // Number of refs at the front of the garbage that are deletable
+    size_t dead_count;
+
+    if (!DisableCacheEpochs) {
+        // Free whatever every thread has moved past, even if some 
+        // thread is in objc_msgSend right now.
+        do {
+            uintptr_t epoch = _quiescent_epoch();
+            for (dead_count = 0; dead_count < garbage_count; dead_count++) {
+                if (garbage_refs[dead_count].epoch >= epoch) break;
+            }
+        } while (collectALot  &&  dead_count < garbage_count);
+
+        if (dead_count == 0) {
+            if (PrintCaches  &&  garbage_count > 0) {
+                _objc_inform ("CACHES: not collecting; "
+                              "objc_msgSend in progress since epoch %lu",
+                              (unsigned long)garbage_refs[0].epoch);
+            }
+            return;
+        }
+    }
     // Synchronize collection with objc_msgSend and other cache readers
-    if (!collectALot) {
+    else if (!collectALot) {
         if (_collecting_in_critical ()) {
             // objc_msgSend (or other cache reader) is currently looking in
             // the cache and might still be using some garbage.
@@ -1020,32 +1184,41 @@ void cache_collect(bool collectALot)
             }
             return;
         }
+        dead_count = garbage_count;
     } 
     else {
         // No excuses.
         while (_collecting_in_critical()) 
             ;
+        dead_count = garbage_count;
     }
 
-    // No cache readers in progress - garbage is now deletable
+    // No cache readers in progress - these refs are now deletable
+
+    size_t dead_byte_size = 0;
+    for (size_t i = 0; i < dead_count; i++) {
+        dead_byte_size += cache_t::bytesForCapacity(garbage_refs[i].capacity);
+    }
 
     // Log our progress
     if (PrintCaches) {
         cache_collections++;
-        _objc_inform ("CACHES: COLLECTING %zu bytes (%zu allocations, %zu collections)", garbage_byte_size, cache_allocations, cache_collections);
+        _objc_inform ("CACHES: COLLECTING %zu bytes (%zu allocations, %zu collections)", dead_byte_size, cache_allocations, cache_collections);
     }
     
-    // Dispose all refs now in the garbage
-    // Erase each entry so debugging tools don't see stale pointers.
-    while (garbage_count--) {
-        auto dead = garbage_refs[garbage_count];
-        garbage_refs[garbage_count] = nil;
-        free(dead);
+    // Dispose all deletable refs now in the garbage
+    for (size_t i = 0; i < dead_count; i++) {
+        free(garbage_refs[i].buckets);
     }
-    
-    // Clear the garbage count and total size indicator
-    garbage_count = 0;
-    garbage_byte_size = 0;
+
+    // Keep the remaining refs and the total size indicator.
+    // Erase the vacated entries so debugging tools don't see stale pointers.
+    memmove(&garbage_refs[0], &garbage_refs[dead_count], 
+            (garbage_count - dead_count) * sizeof(garbage_ref_t));
+    bzero(&garbage_refs[garbage_count - dead_count], 
+          dead_count * sizeof(garbage_ref_t));
+    garbage_count -= dead_count;
+    garbage_byte_size -= dead_byte_size;
 
     if (PrintCaches) {
         size_t i;
@@ -43,3 +43,11 @@ OPTION( DisableTaggedPointers,    OBJC_DISABLE_TAGGED_POINTERS,    "disable tagg
 OPTION( DisableTaggedPointerObfuscation, OBJC_DISABLE_TAG_OBFUSCATION,    "disable obfuscation of tagged pointers")
 OPTION( DisableNonpointerIsa,     OBJC_DISABLE_NONPOINTER_ISA,     "disable non-pointer isa fields")
 OPTION( DisableInitializeForkSafety, OBJC_DISABLE_INITIALIZE_FORK_SAFETY, "disable safety checks for +initialize after fork")
+OPTION( DisableCacheEpochs,       OBJC_DISABLE_CACHE_EPOCHS,       "disable per-thread epoch tracking when freeing dead method caches")
+OPTION( DisableSideTableDeltas,   OBJC_DISABLE_SIDE_TABLE_DELTAS,  "disable per-CPU buffering of retain counts that overflow to the side table")
+OPTION( DisableThinSync,          OBJC_DISABLE_THIN_SYNC,          "disable thin locks for @synchronized on objects that are not contended")
+OPTION( DisableMethodIndex,       OBJC_DISABLE_METHOD_INDEX,       "disable merged method indexes for classes with many categories")
+OPTION( ParallelImageFixups,      OBJC_PARALLEL_IMAGE_FIXUPS,      "fix up selector and class references of large images on several threads")
+OPTION( DisableZoneMagazines,     OBJC_DISABLE_ZONE_MAGAZINES,     "disable per-CPU caches in the allocator for class_rw_t and class_rw_ext_t")
+OPTION( DisableAutoreleaseCoalescing, OBJC_DISABLE_AUTORELEASE_COALESCING, "disable coalescing of repeated autoreleases of the same object into one pool entry")
+OPTION( DisableAutoreleasePageGrowth, OBJC_DISABLE_AUTORELEASE_PAGE_GROWTH, "disable larger autorelease pool pages for deep pools")
@@ -289,6 +289,13 @@ OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_parent_offset OBJC_AVA
 OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_child_offset  OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 5.0);
 OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_depth_offset  OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 5.0);
 OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_hiwat_offset  OBJC_AVAILABLE(10.15, 13.0, 13.0, 6.0, 5.0);
+// Pages are no longer all the same size. The page's size is stored here.
+OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_size_offset   OBJC_AVAILABLE(10.16, 14.0, 14.0, 7.0, 6.0);
+// An entry may stand for several autoreleases of the same object.
+// The object is (entry & ptr_mask), and the number of autoreleases 
+// is 1 + ((entry & ~ptr_mask) >> count_shift).
+OBJC_EXTERN const uintptr_t objc_debug_autoreleasepoolpage_ptr_mask     OBJC_AVAILABLE(10.16, 14.0, 14.0, 7.0, 6.0);
+OBJC_EXTERN const uint32_t objc_debug_autoreleasepoolpage_count_shift   OBJC_AVAILABLE(10.16, 14.0, 14.0, 7.0, 6.0);
 
 __END_DECLS
 
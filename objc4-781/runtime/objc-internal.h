@@ -803,6 +803,24 @@ OBJC_EXPORT void
 _objc_autoreleasePoolPrint(void)
     OBJC_AVAILABLE(10.7, 5.0, 9.0, 1.0, 2.0);
 
+// Statistics for one of the runtime's internal zone allocators,
+// such as the one for class_rw_t. Counts are approximate while 
+// other threads use the zone.
+typedef struct objc_zone_stats {
+    const char * _Nonnull name;
+    size_t elementSize;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t cacheHits;     // allocations served from a per-CPU cache
+    size_t bytesResident;   // memory the zone has taken from malloc
+} objc_zone_stats;
+
+// Fills in statistics for up to count zones.
+// Returns the number of zones, which may be more than count.
+OBJC_EXPORT unsigned
+_objc_getZoneStats(objc_zone_stats * _Nullable stats, unsigned count)
+    OBJC_AVAILABLE(10.16, 14.0, 14.0, 7.0, 6.0);
+
 OBJC_EXPORT BOOL
 objc_should_deallocate(id _Nonnull object)
     OBJC_AVAILABLE(10.7, 5.0, 9.0, 1.0, 2.0);
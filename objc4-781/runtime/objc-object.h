@@ -497,6 +497,8 @@ objc_object::rootRetain(bool tryRetain, bool handleOverflow)
     if (isTaggedPointer()) return (id)this;
     // 默认不使用sideTable
     bool sideTableLocked = false;
+    // Per-CPU overflow buffer locked instead of the side table, if any.
+    SideTableDeltas *deltas = nil;
     // 是否需要将引用计数转到sidetable
     bool transcribeToSideTable = false;
 
@@ -521,7 +523,7 @@ objc_object::rootRetain(bool tryRetain, bool handleOverflow)
             // 如果不需要retain对象(引用计数+1) 且sideTable是锁上的
             if (!tryRetain && sideTableLocked)
                 // sidetable解锁
-                sidetable_unlock();
+                sidetable_unlockForOverflow(deltas);
             if (tryRetain)
                 // sidetable_tryRetain 尝试对引用计数器进行+1的操作 返回+1操作是否成功
                 return sidetable_tryRetain() ? (id)this : nil;
@@ -536,7 +538,7 @@ objc_object::rootRetain(bool tryRetain, bool handleOverflow)
             // 如果不需要去尝试 +1 并且 SideTables 表锁住了，就将其解锁
             // 这里的条件 应该永远都不会被满足
             if (!tryRetain && sideTableLocked)
-                sidetable_unlock();
+                sidetable_unlockForOverflow(deltas);
             // 如果对象正在被释放 执行retain是无效的
             return nil;
         }
@@ -557,7 +559,8 @@ objc_object::rootRetain(bool tryRetain, bool handleOverflow)
             }
             // 保留isa中extra_rc一半的值 将另一半转移到sidetable中
             // 如果不需要尝试 +1 并且 sidetable 表未加锁，就将其加锁
-            if (!tryRetain && !sideTableLocked) sidetable_lock();
+            // Prefer this CPU's overflow buffer over the side table lock.
+            if (!tryRetain && !sideTableLocked) deltas = sidetable_lockForOverflow();
             // sidetable加锁
             sideTableLocked = true;
             // 需要将引用计数转移到sidetable
@@ -575,10 +578,11 @@ objc_object::rootRetain(bool tryRetain, bool handleOverflow)
     // 如果需要转移引用计数到sidetable中
     if (slowpath(transcribeToSideTable)) {
         // 将溢出的引用计数加到 sidetable 中
-        sidetable_addExtraRC_nolock(RC_HALF);
+        if (deltas) sidetable_deferExtraRC_nolock(deltas, RC_HALF);
+        else sidetable_addExtraRC_nolock(RC_HALF);
     }
     // 如果不需要去尝试 +1 并且 SideTables 表锁住了，就将其解锁
-    if (slowpath(!tryRetain && sideTableLocked)) sidetable_unlock();
+    if (slowpath(!tryRetain && sideTableLocked)) sidetable_unlockForOverflow(deltas);
     // 返回当前对象 引用计数已完成+1操作
     return (id)this;
 }
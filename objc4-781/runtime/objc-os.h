@@ -737,6 +737,14 @@ class mutex_tt : nocopy_t {
             (&mLock, (os_unfair_lock_options_t)opts);
     }
 
+    bool tryLock() {
+        if (os_unfair_lock_trylock(&mLock)) {
+            lockdebug_mutex_lock(this);
+            return true;
+        }
+        return false;
+    }
+
     void unlock() {
         lockdebug_mutex_unlock(this);
 
@@ -696,7 +696,7 @@ static void defineLockOrder()
 #endif
     lockdebug_lock_precedes_lock(&objcMsgLogLock, &crashlog_lock);
     lockdebug_lock_precedes_lock(&AltHandlerDebugLock, &crashlog_lock);
-    lockdebug_lock_precedes_lock(&AssociationsManagerLock, &crashlog_lock);
+    AssociationsManagerLocks.precedeLock(&crashlog_lock);
     SideTableLocksPrecedeLock(&crashlog_lock);
     PropertyLocks.precedeLock(&crashlog_lock);
     StructLocks.precedeLock(&crashlog_lock);
@@ -720,20 +720,20 @@ static void defineLockOrder()
 #endif
     lockdebug_lock_precedes_lock(&loadMethodLock, &objcMsgLogLock);
     lockdebug_lock_precedes_lock(&loadMethodLock, &AltHandlerDebugLock);
-    lockdebug_lock_precedes_lock(&loadMethodLock, &AssociationsManagerLock);
+    AssociationsManagerLocks.succeedLock(&loadMethodLock);
     SideTableLocksSucceedLock(&loadMethodLock);
     PropertyLocks.succeedLock(&loadMethodLock);
     StructLocks.succeedLock(&loadMethodLock);
     CppObjectLocks.succeedLock(&loadMethodLock);
 
-    // PropertyLocks and CppObjectLocks and AssociationManagerLock 
+    // PropertyLocks and CppObjectLocks and AssociationsManagerLocks 
     // precede everything because they are held while objc_retain() 
     // or C++ copy are called.
     // (StructLocks do not precede everything because it calls memmove only.)
     auto PropertyAndCppObjectAndAssocLocksPrecedeLock = [&](const void *lock) {
         PropertyLocks.precedeLock(lock);
         CppObjectLocks.precedeLock(lock);
-        lockdebug_lock_precedes_lock(&AssociationsManagerLock, lock);
+        AssociationsManagerLocks.precedeLock(lock);
     };
 #if __OBJC2__
     PropertyAndCppObjectAndAssocLocksPrecedeLock(&runtimeLock);
@@ -754,10 +754,14 @@ static void defineLockOrder()
 
     SideTableLocksSucceedLocks(PropertyLocks);
     SideTableLocksSucceedLocks(CppObjectLocks);
-    SideTableLocksSucceedLock(&AssociationsManagerLock);
+    SideTableLocksSucceedLocks(AssociationsManagerLocks);
 
-    PropertyLocks.precedeLock(&AssociationsManagerLock);
-    CppObjectLocks.precedeLock(&AssociationsManagerLock);
+    int i = 0;
+    const void *assocLock;
+    while ((assocLock = AssociationsManagerLocks.getLock(i++))) {
+        PropertyLocks.precedeLock(assocLock);
+        CppObjectLocks.precedeLock(assocLock);
+    }
     
 #if __OBJC2__
     lockdebug_lock_precedes_lock(&classInitLock, &runtimeLock);
@@ -795,6 +799,7 @@ static void defineLockOrder()
     PropertyLocks.defineLockOrder();
     StructLocks.defineLockOrder();
     CppObjectLocks.defineLockOrder();
+    AssociationsManagerLocks.defineLockOrder();
 }
 // LOCKDEBUG
 #endif
@@ -811,7 +816,7 @@ void _objc_atfork_prepare()
     loadMethodLock.lock();
     PropertyLocks.lockAll();
     CppObjectLocks.lockAll();
-    AssociationsManagerLock.lock();
+    AssociationsManagerLocks.lockAll();
     SideTableLockAll();
     classInitLock.enter();
 #if __OBJC2__
@@ -843,7 +848,7 @@ void _objc_atfork_parent()
     CppObjectLocks.unlockAll();
     StructLocks.unlockAll();
     PropertyLocks.unlockAll();
-    AssociationsManagerLock.unlock();
+    AssociationsManagerLocks.unlockAll();
     AltHandlerDebugLock.unlock();
     objcMsgLogLock.unlock();
     crashlog_lock.unlock();
@@ -879,7 +884,7 @@ void _objc_atfork_child()
     CppObjectLocks.forceResetAll();
     StructLocks.forceResetAll();
     PropertyLocks.forceResetAll();
-    AssociationsManagerLock.forceReset();
+    AssociationsManagerLocks.forceResetAll();
     AltHandlerDebugLock.forceReset();
     objcMsgLogLock.forceReset();
     crashlog_lock.forceReset();
@@ -61,6 +61,7 @@ typedef struct objc_object *id;
 
 namespace {
     struct SideTable;
+    struct SideTableDeltas;
 };
 
 #include "isa.h"
@@ -170,6 +171,12 @@ private:
     bool sidetable_addExtraRC_nolock(size_t delta_rc);
     size_t sidetable_subExtraRC_nolock(size_t delta_rc);
     size_t sidetable_getExtraRC_nolock();
+
+    // Per-CPU side table overflow for nonpointer isa
+    SideTableDeltas *sidetable_lockForOverflow();
+    void sidetable_unlockForOverflow(SideTableDeltas *deltas);
+    void sidetable_deferExtraRC_nolock(SideTableDeltas *deltas, size_t delta_rc);
+    void sidetable_foldDeltas_nolock();
 #endif
 
     // Side-table-only retain count
@@ -486,6 +493,7 @@ extern bool didCallDyldNotifyRegister;
 /* selectors */
 extern void sel_init(size_t selrefCount);
 extern SEL sel_registerNameNoLock(const char *str, bool copy);
+extern SEL sel_lookUpNameForFixup(const char *str);
 
 extern SEL SEL_cxx_construct;
 extern SEL SEL_cxx_destruct;
@@ -792,11 +800,13 @@ inline void operator delete[](void* p, const std::nothrow_t&) throw() { free(p);
 
 
 class TimeLogger {
+    uint64_t mFirst;
     uint64_t mStart;
     bool mRecord;
  public:
     TimeLogger(bool record = true) 
-     : mStart(nanoseconds())
+     : mFirst(nanoseconds())
+     , mStart(mFirst)
      , mRecord(record) 
     { }
 
@@ -807,6 +817,31 @@ class TimeLogger {
             mStart = nanoseconds();
         }
     }
+
+    // Also report how many items the step handled and what each cost.
+    void log(const char *msg, size_t count, bool parallel = false) {
+        if (mRecord) {
+            uint64_t end = nanoseconds();
+            if (count) {
+                _objc_inform("%.2f ms: %s (%zu, %.1f ns each%s)", 
+                             (end - mStart) / 1000000.0, msg, count, 
+                             (double)(end - mStart) / count, 
+                             parallel ? ", parallel" : "");
+            } else {
+                _objc_inform("%.2f ms: %s (none)", 
+                             (end - mStart) / 1000000.0, msg);
+            }
+            mStart = nanoseconds();
+        }
+    }
+
+    // Report the time since this logger was created.
+    void logTotal(const char *msg) {
+        if (mRecord) {
+            _objc_inform("%.2f ms: %s", 
+                         (nanoseconds() - mFirst) / 1000000.0, msg);
+        }
+    }
 };
 
 enum { CacheLineSize = 64 };
@@ -838,6 +873,12 @@ class StripedMap {
     T& operator[] (const void *p) { 
         return array[indexForPointer(p)].value; 
     }
+    T& stripeAtIndex(unsigned int i) {
+        return array[i % StripeCount].value;
+    }
+    static unsigned int stripeCount() {
+        return StripeCount;
+    }
     const T& operator[] (const void *p) const { 
         return const_cast<StripedMap<T>>(this)[p]; 
     }
@@ -41,7 +41,7 @@ enum {
     OBJC_ASSOCIATION_GETTER_AUTORELEASE = (2 << 8)
 };
 
-spinlock_t AssociationsManagerLock;
+StripedMap<spinlock_t> AssociationsManagerLocks;
 
 namespace objc {
 
@@ -101,27 +101,146 @@ public:
 typedef DenseMap<const void *, ObjcAssociation> ObjectAssociationMap;
 typedef DenseMap<DisguisedPtr<objc_object>, ObjectAssociationMap> AssociationsHashMap;
 
-// class AssociationsManager manages a lock / hash table singleton pair.
-// Allocating an instance acquires the lock
+// A small cache of recently used associations that readers can search 
+// without taking any lock. Each entry is guarded by a sequence count 
+// that is odd while a writer (holding the shard's lock) updates it.
+//
+// Only associations whose getter neither retains nor autoreleases are 
+// cached: returning such a value races with a concurrent set exactly as 
+// a nonatomic property getter does. Atomic getters must retain the 
+// value before a concurrent set can release it, so they take the lock.
+class RecentAssociationsCache {
+    enum { Count = 16 };
+
+    struct Entry {
+        std::atomic<uint32_t> seq;
+        std::atomic<uintptr_t> object;  // disguised
+        std::atomic<uintptr_t> key;
+        std::atomic<uintptr_t> value;
+    };
+
+    Entry _entries[Count];
+
+    static unsigned indexFor(DisguisedPtr<objc_object> object, const void *key) {
+        uintptr_t k = (uintptr_t)(objc_object *)object ^ ((uintptr_t)key >> 3);
+        return ptr_hash(k) % Count;
+    }
+
+    static uintptr_t disguise(DisguisedPtr<objc_object> object) {
+        return -(uintptr_t)(objc_object *)object;
+    }
+
+    void write(Entry &e, uintptr_t object, uintptr_t key, uintptr_t value) {
+        uint32_t seq = e.seq.load(std::memory_order_relaxed);
+        e.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        e.object.store(object, std::memory_order_relaxed);
+        e.key.store(key, std::memory_order_relaxed);
+        e.value.store(value, std::memory_order_relaxed);
+        e.seq.store(seq + 2, std::memory_order_release);
+    }
+
+public:
+    static bool isCacheable(uintptr_t policy) {
+        return (policy & (OBJC_ASSOCIATION_GETTER_RETAIN | 
+                          OBJC_ASSOCIATION_GETTER_AUTORELEASE)) == 0;
+    }
+
+    // Lock-free. Returns true and sets value if (object, key) was found.
+    bool find(DisguisedPtr<objc_object> object, const void *key, id &value) {
+        Entry &e = _entries[indexFor(object, key)];
+        uint32_t seq = e.seq.load(std::memory_order_acquire);
+        if (seq & 1) return false;
+        uintptr_t o = e.object.load(std::memory_order_relaxed);
+        uintptr_t k = e.key.load(std::memory_order_relaxed);
+        uintptr_t v = e.value.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (e.seq.load(std::memory_order_relaxed) != seq) return false;
+        if (o != disguise(object)  ||  o == 0  ||  k != (uintptr_t)key) {
+            return false;
+        }
+        value = (id)v;
+        return true;
+    }
+
+    // The shard's lock must be held for all the remaining operations.
+
+    void insert(DisguisedPtr<objc_object> object, const void *key, 
+                const ObjcAssociation &association) {
+        Entry &e = _entries[indexFor(object, key)];
+        if (isCacheable(association.policy())) {
+            write(e, disguise(object), (uintptr_t)key, 
+                  (uintptr_t)association.value());
+        } else {
+            remove(object, key);
+        }
+    }
+
+    void remove(DisguisedPtr<objc_object> object, const void *key) {
+        Entry &e = _entries[indexFor(object, key)];
+        if (e.object.load(std::memory_order_relaxed) == disguise(object)  &&
+            e.key.load(std::memory_order_relaxed) == (uintptr_t)key)
+        {
+            write(e, 0, 0, 0);
+        }
+    }
+
+    void removeAll(DisguisedPtr<objc_object> object) {
+        for (unsigned i = 0; i < Count; i++) {
+            Entry &e = _entries[i];
+            if (e.object.load(std::memory_order_relaxed) == disguise(object)) {
+                write(e, 0, 0, 0);
+            }
+        }
+    }
+};
+
+// The associations of the objects that hash to one of 
+// AssociationsManagerLocks' stripes.
+struct AssociationsShard {
+    AssociationsHashMap map;
+    RecentAssociationsCache recent;
+};
+
+// class AssociationsManager manages the lock / hash table pair 
+// for one object's shard.
+// Allocating an instance acquires that shard's lock
 
 class AssociationsManager {
-    using Storage = ExplicitInitDenseMap<DisguisedPtr<objc_object>, ObjectAssociationMap>;
-    static Storage _mapStorage;
+    using Storage = ExplicitInit<StripedMap<AssociationsShard>>;
+    static Storage _shardStorage;
+
+    spinlock_t &_lock;
+    AssociationsShard &_shard;
 
 public:
-    AssociationsManager()   { AssociationsManagerLock.lock(); }
-    ~AssociationsManager()  { AssociationsManagerLock.unlock(); }
+    AssociationsManager(objc_object *object)
+        : _lock(AssociationsManagerLocks[object]), 
+          _shard(_shardStorage.get()[object])
+    {
+        _lock.lock();
+    }
+    ~AssociationsManager()  { _lock.unlock(); }
 
     AssociationsHashMap &get() {
-        return _mapStorage.get();
+        return _shard.map;
+    }
+
+    RecentAssociationsCache &recent() {
+        return _shard.recent;
+    }
+
+    // Does not take the lock.
+    static RecentAssociationsCache &recent(objc_object *object) {
+        return _shardStorage.get()[object].recent;
     }
 
     static void init() {
-        _mapStorage.init();
+        _shardStorage.init();
     }
 };
 
-AssociationsManager::Storage AssociationsManager::_mapStorage;
+AssociationsManager::Storage AssociationsManager::_shardStorage;
 
 } // namespace objc
 
@@ -138,8 +257,16 @@ _object_get_associative_reference(id object, const void *key)
 {
     ObjcAssociation association{};
 
+    // Nonatomic associations that were used recently need no lock.
+    id value;
+    if (AssociationsManager::recent((objc_object *)object)
+            .find((objc_object *)object, key, value))
+    {
+        return value;
+    }
+
     {
-        AssociationsManager manager;
+        AssociationsManager manager{(objc_object *)object};
         AssociationsHashMap &associations(manager.get());
         AssociationsHashMap::iterator i = associations.find((objc_object *)object);
         if (i != associations.end()) {
@@ -148,6 +275,7 @@ _object_get_associative_reference(id object, const void *key)
             if (j != refs.end()) {
                 association = j->second;
                 association.retainReturnedValue();
+                manager.recent().insert(i->first, key, association);
             }
         }
     }
@@ -173,7 +301,7 @@ _object_set_associative_reference(id object, const void *key, id value, uintptr_
     association.acquireValue();
 
     {
-        AssociationsManager manager;
+        AssociationsManager manager{(objc_object *)object};
         AssociationsHashMap &associations(manager.get());
 
         if (value) {
@@ -189,7 +317,9 @@ _object_set_associative_reference(id object, const void *key, id value, uintptr_
             if (!result.second) {
                 association.swap(result.first->second);
             }
+            manager.recent().insert(disguised, key, result.first->second);
         } else {
+            manager.recent().remove(disguised, key);
             auto refs_it = associations.find(disguised);
             if (refs_it != associations.end()) {
                 auto &refs = refs_it->second;
@@ -220,12 +350,13 @@ _object_remove_assocations(id object)
     ObjectAssociationMap refs{};
 
     {
-        AssociationsManager manager;
+        AssociationsManager manager{(objc_object *)object};
         AssociationsHashMap &associations(manager.get());
         AssociationsHashMap::iterator i = associations.find((objc_object *)object);
         if (i != associations.end()) {
             refs.swap(i->second);
             associations.erase(i);
+            manager.recent().removeAll((objc_object *)object);
         }
     }
 
@@ -1003,6 +1003,10 @@ class protocol_array_t :
     }
 };
 
+// Merged index of every method list of a class with many lists.
+// Built lazily by getMethodNoSuper_nolock.
+struct method_index_t;
+
 struct class_rw_ext_t {
     const class_ro_t *ro;
     method_array_t methods;
@@ -1010,6 +1014,7 @@ struct class_rw_ext_t {
     protocol_array_t protocols;
     char *demangledName;
     uint32_t version;
+    method_index_t *methodIndex;
 };
 
 struct class_rw_t {
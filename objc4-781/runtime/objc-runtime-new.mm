@@ -3359,6 +3359,199 @@ readProtocol(protocol_t *newproto, Class protocol_class,
     }
 }
 
+/***********************************************************************
+* Parallel image fixups
+* With OBJC_PARALLEL_IMAGE_FIXUPS, _read_images splits the selector refs 
+* and class refs of large images into chunks and fixes them up on several 
+* threads. Workers only read the selector and remapped class tables, 
+* which the calling thread keeps unchanged by holding runtimeLock and 
+* selLock. Selectors that are not registered yet are collected per chunk 
+* and registered afterwards on the calling thread in image and ref 
+* order, so the tables end up exactly as a serial fixup leaves them.
+* Locking: runtimeLock and selLock (for selectors) held by the caller
+**********************************************************************/
+#define IMAGE_FIXUP_CHUNK 4096
+#define IMAGE_FIXUP_PARALLEL_MIN (4 * IMAGE_FIXUP_CHUNK)
+#define IMAGE_FIXUP_MAX_THREADS 8
+
+struct image_fixup_chunk_t {
+    void *refs;
+    uint32_t count;
+    bool isBundle;
+    uint32_t missCount;
+    uint16_t *misses;   // selector fixups only
+};
+
+struct image_fixup_work_t {
+    image_fixup_chunk_t *chunks;
+    size_t chunkCount;
+    std::atomic<size_t> next;
+    void (*fn)(image_fixup_work_t *work, image_fixup_chunk_t *chunk);
+    const objc::DenseMap<Class, Class> *remapped;  // class fixups only
+};
+
+static void *
+imageFixupWorker(void *arg)
+{
+    auto work = (image_fixup_work_t *)arg;
+    size_t i;
+    while ((i = work->next.fetch_add(1, std::memory_order_relaxed)) 
+           < work->chunkCount)
+    {
+        work->fn(work, &work->chunks[i]);
+    }
+    return nil;
+}
+
+// Runs work->fn on every chunk, on extra threads if there is enough work.
+static bool
+runImageFixups(image_fixup_work_t *work, size_t refCount)
+{
+    unsigned threadCount = 0;
+    pthread_t threads[IMAGE_FIXUP_MAX_THREADS - 1];
+
+    if (refCount >= IMAGE_FIXUP_PARALLEL_MIN) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t wanted = MIN(work->chunkCount, (size_t)MAX(ncpu, 1L));
+        wanted = MIN(wanted, (size_t)IMAGE_FIXUP_MAX_THREADS);
+        while (threadCount + 1 < wanted  &&  
+               pthread_create(&threads[threadCount], nil, 
+                              imageFixupWorker, work) == 0)
+        {
+            threadCount++;
+        }
+    }
+
+    // This thread works too, so a failed pthread_create only costs time.
+    imageFixupWorker(work);
+    for (unsigned t = 0; t < threadCount; t++) {
+        pthread_join(threads[t], nil);
+    }
+    return threadCount > 0;
+}
+
+static void
+addImageFixupChunks(image_fixup_chunk_t *&chunks, size_t &chunkCount, 
+                    void *refs, size_t count, size_t refSize, bool isBundle)
+{
+    for (size_t start = 0; start < count; start += IMAGE_FIXUP_CHUNK) {
+        chunks = (image_fixup_chunk_t *)
+            realloc(chunks, (chunkCount + 1) * sizeof(*chunks));
+        auto& chunk = chunks[chunkCount++];
+        chunk.refs = (uint8_t *)refs + start * refSize;
+        chunk.count = (uint32_t)MIN(count - start, (size_t)IMAGE_FIXUP_CHUNK);
+        chunk.isBundle = isBundle;
+        chunk.missCount = 0;
+        chunk.misses = nil;
+    }
+}
+
+static void
+fixupSelectorRefsChunk(image_fixup_work_t *work __unused, 
+                       image_fixup_chunk_t *chunk)
+{
+    SEL *sels = (SEL *)chunk->refs;
+    for (uint32_t i = 0; i < chunk->count; i++) {
+        SEL sel = sel_lookUpNameForFixup(sel_cname(sels[i]));
+        if (!sel) {
+            chunk->misses[chunk->missCount++] = (uint16_t)i;
+        } else if (sels[i] != sel) {
+            sels[i] = sel;
+        }
+    }
+}
+
+// Returns the number of selector refs that were fixed up.
+static size_t
+fixupSelectorRefsInParallel(header_info **hList, uint32_t hCount, 
+                            bool *parallel)
+{
+    runtimeLock.assertLocked();
+    selLock.assertLocked();
+
+    image_fixup_work_t work{};
+    size_t refCount = 0;
+    for (uint32_t hIndex = 0; hIndex < hCount; hIndex++) {
+        header_info *hi = hList[hIndex];
+        if (hi->hasPreoptimizedSelectors()) continue;
+
+        size_t count;
+        SEL *sels = _getObjc2SelectorRefs(hi, &count);
+        addImageFixupChunks(work.chunks, work.chunkCount, 
+                            sels, count, sizeof(SEL), hi->isBundle());
+        refCount += count;
+    }
+
+    uint16_t *misses = (uint16_t *)
+        malloc(work.chunkCount * IMAGE_FIXUP_CHUNK * sizeof(uint16_t));
+    for (size_t c = 0; c < work.chunkCount; c++) {
+        work.chunks[c].misses = misses + c * IMAGE_FIXUP_CHUNK;
+    }
+
+    work.fn = fixupSelectorRefsChunk;
+    *parallel = runImageFixups(&work, refCount);
+
+    // Register new selectors in the order a serial fixup would have.
+    for (size_t c = 0; c < work.chunkCount; c++) {
+        auto& chunk = work.chunks[c];
+        SEL *sels = (SEL *)chunk.refs;
+        for (uint32_t m = 0; m < chunk.missCount; m++) {
+            uint16_t i = chunk.misses[m];
+            SEL sel = sel_registerNameNoLock(sel_cname(sels[i]), chunk.isBundle);
+            if (sels[i] != sel) {
+                sels[i] = sel;
+            }
+        }
+    }
+
+    free(misses);
+    free(work.chunks);
+    return refCount;
+}
+
+static void
+remapClassRefsChunk(image_fixup_work_t *work, image_fixup_chunk_t *chunk)
+{
+    Class *classrefs = (Class *)chunk->refs;
+    for (uint32_t i = 0; i < chunk->count; i++) {
+        auto it = work->remapped->find(classrefs[i]);
+        if (it != work->remapped->end()  &&  classrefs[i] != it->second) {
+            classrefs[i] = it->second;
+        }
+    }
+}
+
+// Returns the number of class refs and super refs that were remapped.
+static size_t
+remapClassRefsInParallel(header_info **hList, uint32_t hCount, 
+                         bool *parallel)
+{
+    runtimeLock.assertLocked();
+
+    image_fixup_work_t work{};
+    size_t refCount = 0;
+    for (uint32_t hIndex = 0; hIndex < hCount; hIndex++) {
+        header_info *hi = hList[hIndex];
+        size_t count;
+        Class *classrefs = _getObjc2ClassRefs(hi, &count);
+        addImageFixupChunks(work.chunks, work.chunkCount, 
+                            classrefs, count, sizeof(Class), false);
+        refCount += count;
+        classrefs = _getObjc2SuperRefs(hi, &count);
+        addImageFixupChunks(work.chunks, work.chunkCount, 
+                            classrefs, count, sizeof(Class), false);
+        refCount += count;
+    }
+
+    work.remapped = remappedClasses(NO);
+    work.fn = remapClassRefsChunk;
+    *parallel = runImageFixups(&work, refCount);
+
+    free(work.chunks);
+    return refCount;
+}
+
+
 /***********************************************************************
 * _read_images
 * Perform initial processing of the headers in the linked 
@@ -3464,29 +3657,39 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
 
     // Fix up @selector references
     static size_t UnfixedSelectors;
+    size_t phaseCount = 0;
+    bool phaseParallel = NO;
     {
         mutex_locker_t lock(selLock);
-        for (EACH_HEADER) {
-            if (hi->hasPreoptimizedSelectors()) continue;
-
-            bool isBundle = hi->isBundle();
-            SEL *sels = _getObjc2SelectorRefs(hi, &count);
-            UnfixedSelectors += count;
-            for (i = 0; i < count; i++) {
-                const char *name = sel_cname(sels[i]);
-                SEL sel = sel_registerNameNoLock(name, isBundle);
-                if (sels[i] != sel) {
-                    sels[i] = sel;
+        if (ParallelImageFixups) {
+            phaseCount = fixupSelectorRefsInParallel(hList, hCount, 
+                                                     &phaseParallel);
+        } else {
+            for (EACH_HEADER) {
+                if (hi->hasPreoptimizedSelectors()) continue;
+
+                bool isBundle = hi->isBundle();
+                SEL *sels = _getObjc2SelectorRefs(hi, &count);
+                phaseCount += count;
+                for (i = 0; i < count; i++) {
+                    const char *name = sel_cname(sels[i]);
+                    SEL sel = sel_registerNameNoLock(name, isBundle);
+                    if (sels[i] != sel) {
+                        sels[i] = sel;
+                    }
                 }
             }
         }
+        UnfixedSelectors += phaseCount;
     }
 
-    ts.log("IMAGE TIMES: fix up selector references");
+    ts.log("IMAGE TIMES: fix up selector references", 
+           phaseCount, phaseParallel);
 
     // Discover classes. Fix up unresolved future classes. Mark bundle classes.
     bool hasDyldRoots = dyld_shared_cache_some_image_overridden();
 
+    phaseCount = 0;
     for (EACH_HEADER) {
         if (! mustReadClasses(hi, hasDyldRoots)) {
             // Image is sufficiently optimized that we need not call readClass()
@@ -3498,6 +3701,7 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
         bool headerIsBundle = hi->isBundle();
         bool headerIsPreoptimized = hi->hasPreoptimizedClasses();
 
+        phaseCount += count;
         for (i = 0; i < count; i++) {
             Class cls = (Class)classlist[i];
             Class newCls = readClass(cls, headerIsBundle, headerIsPreoptimized);
@@ -3514,33 +3718,43 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
         }
     }
 
-    ts.log("IMAGE TIMES: discover classes");
+    ts.log("IMAGE TIMES: discover classes", phaseCount);
 
     // Fix up remapped classes
     // Class list and nonlazy class list remain unremapped.
     // Class refs and super refs are remapped for message dispatching.
     
-    if (!noClassesRemapped()) {
+    phaseCount = 0;
+    phaseParallel = NO;
+    if (noClassesRemapped()) {
+        // nothing to do
+    } else if (ParallelImageFixups) {
+        phaseCount = remapClassRefsInParallel(hList, hCount, &phaseParallel);
+    } else {
         for (EACH_HEADER) {
             Class *classrefs = _getObjc2ClassRefs(hi, &count);
+            phaseCount += count;
             for (i = 0; i < count; i++) {
                 remapClassRef(&classrefs[i]);
             }
             // fixme why doesn't test future1 catch the absence of this?
             classrefs = _getObjc2SuperRefs(hi, &count);
+            phaseCount += count;
             for (i = 0; i < count; i++) {
                 remapClassRef(&classrefs[i]);
             }
         }
     }
 
-    ts.log("IMAGE TIMES: remap classes");
+    ts.log("IMAGE TIMES: remap classes", phaseCount, phaseParallel);
 
 #if SUPPORT_FIXUP
     // Fix up old objc_msgSend_fixup call sites
+    phaseCount = 0;
     for (EACH_HEADER) {
         message_ref_t *refs = _getObjc2MessageRefs(hi, &count);
         if (count == 0) continue;
+        phaseCount += count;
 
         if (PrintVtables) {
             _objc_inform("VTABLES: repairing %zu unsupported vtable dispatch "
@@ -3551,12 +3765,13 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
         }
     }
 
-    ts.log("IMAGE TIMES: fix up objc_msgSend_fixup");
+    ts.log("IMAGE TIMES: fix up objc_msgSend_fixup", phaseCount);
 #endif
 
     bool cacheSupportsProtocolRoots = sharedCacheSupportsProtocolRoots();
 
     // Discover protocols. Fix up protocol refs.
+    phaseCount = 0;
     for (EACH_HEADER) {
         extern objc_class OBJC_CLASS_$_Protocol;
         Class cls = (Class)&OBJC_CLASS_$_Protocol;
@@ -3581,17 +3796,19 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
         bool isBundle = hi->isBundle();
 
         protocol_t * const *protolist = _getObjc2ProtocolList(hi, &count);
+        phaseCount += count;
         for (i = 0; i < count; i++) {
             readProtocol(protolist[i], cls, protocol_map, 
                          isPreoptimized, isBundle);
         }
     }
 
-    ts.log("IMAGE TIMES: discover protocols");
+    ts.log("IMAGE TIMES: discover protocols", phaseCount);
 
     // Fix up @protocol references
     // Preoptimized images may have the right 
     // answer already but we don't know for sure.
+    phaseCount = 0;
     for (EACH_HEADER) {
         // At launch time, we know preoptimized image refs are pointing at the
         // shared cache definition of a protocol.  We can skip the check on
@@ -3600,12 +3817,13 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
         if (launchTime && cacheSupportsProtocolRoots && hi->isPreoptimized())
             continue;
         protocol_t **protolist = _getObjc2ProtocolRefs(hi, &count);
+        phaseCount += count;
         for (i = 0; i < count; i++) {
             remapProtocolRef(&protolist[i]);
         }
     }
 
-    ts.log("IMAGE TIMES: fix up @protocol references");
+    ts.log("IMAGE TIMES: fix up @protocol references", phaseCount);
 
     // Discover categories. Only do this after the initial category
     // attachment has been done. For categories present at startup,
@@ -3626,9 +3844,11 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
     // +load handled by prepare_load_methods()
 
     // Realize non-lazy classes (for +load methods and static instances)
+    phaseCount = 0;
     for (EACH_HEADER) {
         classref_t const *classlist = 
             _getObjc2NonlazyClassList(hi, &count);
+        phaseCount += count;
         for (i = 0; i < count; i++) {
             Class cls = remapClass(classlist[i]);
             if (!cls) continue;
@@ -3649,7 +3869,7 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
         }
     }
 
-    ts.log("IMAGE TIMES: realize non-lazy classes");
+    ts.log("IMAGE TIMES: realize non-lazy classes", phaseCount);
 
     // Realize newly-resolved future classes, in case CF manipulates them
     if (resolvedFutureClasses) {
@@ -3664,12 +3884,13 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
         free(resolvedFutureClasses);
     }
 
-    ts.log("IMAGE TIMES: realize future classes");
+    ts.log("IMAGE TIMES: realize future classes", resolvedFutureClassCount);
 
     if (DebugNonFragileIvars) {
         realizeAllClasses();
     }
 
+    ts.logTotal("IMAGE TIMES: total");
 
     // Print preoptimization statistics
     if (PrintPreopt) {
@@ -5834,6 +6055,99 @@ method_lists_contains_any(method_list_t * const *mlists, method_list_t * const *
     return false;
 }
 
+/***********************************************************************
+ * method_index_t
+ * A hash table from SEL to method_t covering all of a class's method 
+ * lists, so that a method cache miss on a class with dozens of 
+ * categories costs one probe sequence instead of a search per list.
+ * Each selector maps to the method that a search of the lists in order 
+ * would have found first.
+ *
+ * Method lists are only ever added to a class, so an index is still 
+ * valid while the class's list count is the one it was built for.
+ * Methods replaced in place keep their method_t, so they stay valid too.
+ * Locking: runtimeLock must be held
+ **********************************************************************/
+#define METHOD_INDEX_MIN_LISTS 4
+
+struct method_index_t {
+    uint32_t listCount;
+    uint32_t mask;
+    struct entry_t {
+        SEL sel;
+        method_t *meth;
+    } entries[0];
+
+    static uint32_t hash(SEL sel, uint32_t mask) {
+        uintptr_t v = (uintptr_t)sel;
+        return (uint32_t)((v ^ (v >> 7) ^ (v >> 17)) & mask);
+    }
+
+    method_t *find(SEL sel) const {
+        uint32_t i = hash(sel, mask);
+        while (true) {
+            const entry_t &e = entries[i];
+            if (e.sel == sel) return e.meth;
+            if (!e.sel) return nil;
+            i = (i + 1) & mask;
+        }
+    }
+
+    // Does nothing if sel is already present, so that 
+    // the first method found in list order wins.
+    void insert(SEL sel, method_t *meth) {
+        uint32_t i = hash(sel, mask);
+        while (entries[i].sel) {
+            if (entries[i].sel == sel) return;
+            i = (i + 1) & mask;
+        }
+        entries[i].sel = sel;
+        entries[i].meth = meth;
+    }
+
+    static method_index_t *build(method_array_t &methods) {
+        uint32_t count = 0;
+        for (auto mlists = methods.beginLists(), end = methods.endLists();
+             mlists != end;
+             ++mlists)
+        {
+            count += (*mlists)->count;
+        }
+
+        // Keep the table at most half full.
+        uint32_t capacity = 4;
+        while (capacity < count * 2) capacity *= 2;
+
+        auto index = (method_index_t *)
+            calloc(sizeof(method_index_t) + capacity * sizeof(entry_t), 1);
+        index->listCount = methods.countLists();
+        index->mask = capacity - 1;
+
+        for (auto mlists = methods.beginLists(), end = methods.endLists();
+             mlists != end;
+             ++mlists)
+        {
+            for (auto& meth : **mlists) {
+                index->insert(meth.name, &meth);
+            }
+        }
+        return index;
+    }
+};
+
+static NEVER_INLINE method_t *
+getMethodFromIndex_nolock(class_rw_ext_t *rwe, SEL sel)
+{
+    runtimeLock.assertLocked();
+
+    method_index_t *index = rwe->methodIndex;
+    if (!index  ||  index->listCount != rwe->methods.countLists()) {
+        free(index);
+        index = rwe->methodIndex = method_index_t::build(rwe->methods);
+    }
+    return index->find(sel);
+}
+
 /***********************************************************************
  * getMethodNoSuper_nolock
  * fixme
@@ -5848,6 +6162,13 @@ getMethodNoSuper_nolock(Class cls, SEL sel)
     // fixme nil cls? 
     // fixme nil sel?
 
+    auto rwe = cls->data()->ext();
+    if (rwe  &&  rwe->methods.countLists() >= METHOD_INDEX_MIN_LISTS  &&  
+        !DisableMethodIndex)
+    {
+        return getMethodFromIndex_nolock(rwe, sel);
+    }
+
     auto const methods = cls->data()->methods();
     for (auto mlists = methods.beginLists(),
               end = methods.endLists();
@@ -7391,6 +7712,7 @@ static void free_class(Class cls)
             try_free(meth.types);
         }
         rwe->methods.tryFree();
+        free(rwe->methodIndex);
     }
     
     const ivar_list_t *ivars = ro->ivars;
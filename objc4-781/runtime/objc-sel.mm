@@ -28,7 +28,10 @@
 #include "DenseMapExtras.h"
 
 #if SUPPORT_PREOPT
+#include "objc-selopt-file.h"
+
 static const objc_selopt_t *builtins = NULL;
+static const objc_selopt_t *appSelectors = NULL;
 static bool useDyldSelectorLookup = false;
 #endif
 
@@ -37,6 +40,125 @@ static objc::ExplicitInitDenseSet<const char *> namedSelectors;
 static SEL search_builtins(const char *key);
 
 
+#if SUPPORT_PREOPT
+/***********************************************************************
+* appSelectorTableProblem
+* Returns why the mapped app selector table file cannot be used, or nil.
+* Checks enough that lookups cannot read outside the file.
+**********************************************************************/
+static const char *appSelectorTableProblem(const uint8_t *file, size_t size)
+{
+    auto header = (const objc_selopt_file_header_t *)file;
+    if (header->magic != OBJC_SELOPT_FILE_MAGIC) return "bad magic";
+    if (header->version != OBJC_SELOPT_FILE_VERSION  ||  
+        header->optVersion != objc_opt::VERSION) 
+    {
+        return "wrong version";
+    }
+    if (header->selectorCount == 0) return "no selectors";
+
+    uint64_t seloptEnd = (uint64_t)header->seloptOffset + header->seloptSize;
+    if (header->seloptOffset < sizeof(*header)  ||  
+        header->seloptOffset % 8 != 0  ||  
+        header->seloptSize < sizeof(objc_opt::objc_selopt_t)  ||  
+        seloptEnd > header->stringsOffset  ||  
+        (uint64_t)header->stringsOffset + header->stringsSize != size  ||  
+        header->stringsSize == 0  ||  file[size-1] != '\0')
+    {
+        return "bad layout";
+    }
+
+    auto selopt = (const objc_opt::objc_selopt_t *)(file + header->seloptOffset);
+    uint32_t capacity = selopt->capacity;
+    if (capacity == 0  ||  (capacity & (capacity - 1)) != 0  ||  
+        ((uint64_t)selopt->mask + 1) & selopt->mask  ||  
+        sizeof(objc_opt::objc_selopt_t) + (uint64_t)selopt->mask + 1 + 
+        (uint64_t)capacity * (sizeof(objc_opt::objc_stringhash_check_t) + 
+                              sizeof(objc_opt::objc_stringhash_offset_t))
+        != header->seloptSize)
+    {
+        return "bad table size";
+    }
+
+    // hash() is (uint32_t)(val >> shift) ^ scramble[...], and getIndex() 
+    // reads checkbytes()[hash] unchecked, so both parts must be < capacity.
+    if (selopt->shift <= 32  ||  selopt->shift >= 64  ||  
+        (1ULL << (64 - selopt->shift)) > capacity) 
+    {
+        return "bad hash";
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        if (selopt->scramble[i] >= capacity) return "bad hash";
+    }
+
+    const objc_opt::objc_stringhash_offset_t *offsets = selopt->offsets();
+    for (uint32_t i = 0; i < capacity; i++) {
+        if (offsets[i] == 0) continue;
+        int64_t pos = (int64_t)header->seloptOffset + offsets[i];
+        if (pos < header->stringsOffset  ||  pos >= (int64_t)size) {
+            return "bad string offset";
+        }
+    }
+
+    return nil;
+}
+
+
+/***********************************************************************
+* mapAppSelectorTable
+* Map the app selector table file named by OBJC_APP_SELECTOR_TABLE,
+* as built by the selopt tool. See objc-selopt-file.h.
+* Returns nil if there is no usable table.
+**********************************************************************/
+static const objc_selopt_t *mapAppSelectorTable(void)
+{
+    // Like every other OBJC_ variable, ignored when setuid or setgid.
+    if (issetugid()) return nil;
+    const char *path = getenv("OBJC_APP_SELECTOR_TABLE");
+    if (!path) return nil;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (PrintPreopt) {
+            _objc_inform("PREOPTIMIZATION: can't open app selector table "
+                         "%s (%s)", path, strerror(errno));
+        }
+        return nil;
+    }
+
+    struct stat st;
+    size_t size = 0;
+    void *file = MAP_FAILED;
+    if (fstat(fd, &st) == 0  &&  
+        st.st_size >= (off_t)sizeof(objc_selopt_file_header_t)  &&  
+        st.st_size <= (off_t)UINT32_MAX)
+    {
+        size = (size_t)st.st_size;
+        file = mmap(nil, size, PROT_READ, MAP_FILE | MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    const char *problem = file == MAP_FAILED ? "can't map file" 
+        : appSelectorTableProblem((const uint8_t *)file, size);
+    if (problem) {
+        if (PrintPreopt) {
+            _objc_inform("PREOPTIMIZATION: ignoring app selector table %s (%s)",
+                         path, problem);
+        }
+        if (file != MAP_FAILED) munmap(file, size);
+        return nil;
+    }
+
+    auto header = (const objc_selopt_file_header_t *)file;
+    if (PrintPreopt) {
+        _objc_inform("PREOPTIMIZATION: using app selector table %s "
+                     "(%u selectors)", path, header->selectorCount);
+    }
+    return (const objc_selopt_t *)((const uint8_t *)file + header->seloptOffset);
+}
+#endif
+
+
 /***********************************************************************
 * sel_init
 * Initialize selector tables and register selectors used internally.
@@ -65,6 +187,8 @@ void sel_init(size_t selrefCount)
                      occupied, capacity,
                      (unsigned)(occupied/(double)capacity*100));
     }
+
+    appSelectors = mapAppSelectorTable();
 	namedSelectors.init(useDyldSelectorLookup ? 0 : (unsigned)selrefCount);
 #else
 	namedSelectors.init((unsigned)selrefCount);
@@ -121,6 +245,13 @@ static SEL search_builtins(const char *name)
       if (SEL result = (SEL)_dyld_get_objc_selector(name))
           return result;
   }
+
+  // The app's own table comes after the shared cache's
+  // so that a selector never changes identity.
+  if (appSelectors) {
+      if (SEL result = (SEL)appSelectors->get(name))
+          return result;
+  }
 #endif
     return nil;
 }
@@ -156,6 +287,32 @@ SEL sel_registerNameNoLock(const char *name, bool copy) {
     return __sel_registerName(name, 0, copy);  // NO lock, maybe copy
 }
 
+// Returns the selector for name if it is already registered and can be 
+// found without calling into dyld, or nil.
+// Never registers anything and takes no locks, so it may be called from 
+// other threads while selLock's owner guarantees nobody registers 
+// selectors. Used by _read_images' parallel selector fixups.
+// A name found in namedSelectors is never one of dyld's selectors, 
+// so the answer is the same as sel_registerNameNoLock's.
+SEL sel_lookUpNameForFixup(const char *name) {
+#if SUPPORT_PREOPT
+    if (builtins) {
+        if (SEL result = (SEL)builtins->get(name)) return result;
+    }
+    if (appSelectors) {
+        // Only when dyld can't have it, so the answer is the same 
+        // as search_builtins'.
+        if (SEL result = (SEL)appSelectors->get(name)) {
+            if (!builtins  &&  !useDyldSelectorLookup) return result;
+            return nil;
+        }
+    }
+#endif
+    auto it = namedSelectors.get().find(name);
+    if (it == namedSelectors.get().end()) return nil;
+    return (SEL)*it;
+}
+
 
 // 2001/1/24
 // the majority of uses of this function (which used to return NULL if not found)
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2020 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * objc-selopt-file.h
+ * Layout of an app selector table file.
+ *
+ * The selopt tool (selopt.cpp) builds a precomputed perfect hash table
+ * of the selector names used by a set of app images, in the same format
+ * as the shared cache's objc_selopt_t. sel_init maps the file named by
+ * OBJC_APP_SELECTOR_TABLE read-only and searches it right after the
+ * shared cache's table, so those selectors are found without locking
+ * or inserting into the runtime's selector set.
+ *
+ * File layout:
+ *   objc_selopt_file_header_t
+ *   objc_selopt_t    (at seloptOffset, seloptSize bytes)
+ *   selector names   (at stringsOffset, stringsSize bytes, NUL-terminated)
+ * The table's string offsets are relative to the table itself,
+ * as in the shared cache.
+ *
+ * DO NOT INCLUDE ANY objc HEADERS HERE. The host tool uses this file.
+ */
+
+#ifndef _OBJC_SELOPT_FILE_H
+#define _OBJC_SELOPT_FILE_H
+
+#include <stdint.h>
+
+#define OBJC_SELOPT_FILE_MAGIC   0x6f6c6573   // 'selo'
+#define OBJC_SELOPT_FILE_VERSION 1
+
+struct objc_selopt_file_header_t {
+    uint32_t magic;         // OBJC_SELOPT_FILE_MAGIC
+    uint32_t version;       // OBJC_SELOPT_FILE_VERSION
+    uint32_t optVersion;    // objc_opt::VERSION the table was built with
+    uint32_t selectorCount;
+    uint32_t seloptOffset;
+    uint32_t seloptSize;
+    uint32_t stringsOffset;
+    uint32_t stringsSize;
+};
+
+#endif
@@ -28,6 +28,19 @@
 // Allocate a lock only when needed.  Since few locks are needed at any point
 // in time, keep them on a single list.
 //
+// Most objects are only ever locked by one thread at a time. Those never 
+// get a SyncData: the first thread to lock such an object claims a thin 
+// lock word for it with one compare-and-swap, and keeps the recursion 
+// count in its per-thread caches exactly as it would for a SyncData.
+// A thread that finds the object thin-locked by another thread inflates 
+// it instead: it counts itself in the word, which stops anybody from 
+// thin-locking anything that maps to that word, locks the SyncData 
+// mutex as before, and then waits for the thin owner to let go by 
+// blocking on a mutex the owner holds, so the owner runs at the 
+// waiter's priority just as it would with a SyncData.
+// Once the last inflated user exits the word is free for thin locking 
+// again, and unused SyncData beyond a small reserve are freed.
+//
 
 
 typedef struct alignas(CacheLineSize) SyncData {
@@ -68,8 +81,137 @@ struct SyncList {
 #define LIST_FOR_OBJ(obj) sDataLists[obj].data
 static StripedMap<SyncList> sDataLists;
 
+// Unused SyncData kept on each list for reuse. Any more are freed.
+#define SYNC_DATA_RESERVE 2
+
+
+// Thin lock words.
+// Each word is either zero, or holds the address of the object that is 
+// thin-locked in it plus THIN_SYNC_HELD, and/or the number of threads 
+// that went through a SyncData for any object that maps to this word.
+// A word with a nonzero inflated count never grants a new thin lock.
+// The thin owner also holds the word's owner mutex, taken before the 
+// word is claimed and released after it is cleared, for waiters to 
+// block on.
+// Tagged pointers, and every object on 32-bit platforms, always use 
+// a SyncData.
+
+#if __LP64__
+#   define SUPPORT_THIN_SYNC 1
+#else
+#   define SUPPORT_THIN_SYNC 0
+#endif
+
+#if SUPPORT_THIN_SYNC
+
+#define THIN_SYNC_HELD          0x0000000000000001ULL
+#define THIN_SYNC_OBJECT        0x0000fffffffffff0ULL
+#define THIN_SYNC_INFLATED_ONE  0x0001000000000000ULL
+#define THIN_SYNC_INFLATED      0xffff000000000000ULL
+
+#define THIN_SYNC_WORDS 1024
+
+struct ThinSyncWord {
+    std::atomic<uintptr_t> bits;
+    mutex_t owner;
+
+    constexpr ThinSyncWord() : bits(0), owner(fork_unsafe_lock) { }
+};
+static ThinSyncWord sThinLocks[THIN_SYNC_WORDS];
+
+static inline bool thinSyncAllowed(id object)
+{
+    return !object->isTaggedPointer()  &&  
+        ((uintptr_t)object & ~THIN_SYNC_OBJECT) == 0  &&  
+        !DisableThinSync;
+}
+
+static inline ThinSyncWord& thinSyncWord(id object)
+{
+    uintptr_t addr = (uintptr_t)object;
+    return sThinLocks[((addr >> 4) ^ (addr >> 14)) % THIN_SYNC_WORDS];
+}
+
+// Release a thin lock held by this thread.
+static void thinSyncRelease(id object)
+{
+    ThinSyncWord& thin = thinSyncWord(object);
+    std::atomic<uintptr_t>& word = thin.bits;
+    uintptr_t old = word.load(std::memory_order_relaxed);
+    do {
+        if ((old & ~THIN_SYNC_INFLATED) != ((uintptr_t)object | THIN_SYNC_HELD)) {
+            _objc_fatal("thin @synchronized lock is buggy");
+        }
+    } while (!word.compare_exchange_weak(old, old & THIN_SYNC_INFLATED,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed));
+    thin.owner.unlock();
+}
+
+// Drop this thread's inflated count after its last unlock of a SyncData.
+static void thinSyncDeflate(id object)
+{
+    thinSyncWord(object).bits.fetch_sub(THIN_SYNC_INFLATED_ONE, 
+                                   std::memory_order_release);
+}
+
+// Wait for a thin owner of object to unlock it. Called after locking 
+// object's SyncData mutex, at which point our inflated count prevents 
+// the object from being thin-locked again.
+static void thinSyncWait(id object)
+{
+    ThinSyncWord& thin = thinSyncWord(object);
+    uintptr_t held = (uintptr_t)object | THIN_SYNC_HELD;
+    while ((thin.bits.load(std::memory_order_acquire) & ~THIN_SYNC_INFLATED) == held) {
+        // The owner holds the owner mutex until after it clears the word.
+        thin.owner.lock();
+        thin.owner.unlock();
+    }
+}
+
+#else
 
-enum usage { ACQUIRE, RELEASE, CHECK };
+static inline bool thinSyncAllowed(id object __unused) { return false; }
+static inline void thinSyncRelease(id object __unused) { }
+static inline void thinSyncDeflate(id object __unused) { }
+static inline void thinSyncWait(id object __unused) { }
+
+#endif
+
+// Per-thread cache entries for thin locks store the object's address 
+// with the low bit set in place of a SyncData pointer.
+static inline bool isThinSync(SyncData *data)
+{
+    return (uintptr_t)data & 1;
+}
+
+static inline SyncData *thinSyncEntry(id object)
+{
+    return (SyncData *)((uintptr_t)object | 1);
+}
+
+static inline bool syncEntryMatches(SyncData *data, id object)
+{
+    if (isThinSync(data)) return data == thinSyncEntry(object);
+    return data->object == object;
+}
+
+// Unlink and free SyncData *pp if nobody uses it any more. 
+// Called with the list lock held.
+static bool reclaimSyncData(SyncData **pp)
+{
+    SyncData *p = *pp;
+    // A thread drops threadCount before unlocking the mutex, 
+    // so the mutex may still be on its way to being unlocked.
+    if (p->threadCount != 0  ||  !p->mutex.tryLock()) return false;
+    p->mutex.unlock();
+    *pp = p->nextData;
+    free(p);
+    return true;
+}
+
+
+enum usage { ACQUIRE, TRY_ACQUIRE, RELEASE, CHECK };
 
 static SyncCache *fetch_cache(bool create)
 {
@@ -120,18 +262,21 @@ static SyncData* id2data(id object, enum usage why)
     if (data) {
         fastCacheOccupied = YES;
 
-        if (data->object == object) {
+        if (syncEntryMatches(data, object)) {
             // Found a match in fast cache.
             uintptr_t lockCount;
 
             result = data;
             lockCount = (uintptr_t)tls_get_direct(SYNC_COUNT_DIRECT_KEY);
-            if (result->threadCount <= 0  ||  lockCount <= 0) {
+            if ((!isThinSync(result) && result->threadCount <= 0)  ||  
+                lockCount <= 0) 
+            {
                 _objc_fatal("id2data fastcache is buggy");
             }
 
             switch(why) {
-            case ACQUIRE: {
+            case ACQUIRE:
+            case TRY_ACQUIRE: {
                 lockCount++;
                 tls_set_direct(SYNC_COUNT_DIRECT_KEY, (void*)lockCount);
                 break;
@@ -142,8 +287,13 @@ static SyncData* id2data(id object, enum usage why)
                 if (lockCount == 0) {
                     // remove from fast cache
                     tls_set_direct(SYNC_DATA_DIRECT_KEY, NULL);
-                    // atomic because may collide with concurrent ACQUIRE
-                    OSAtomicDecrement32Barrier(&result->threadCount);
+                    if (isThinSync(result)) {
+                        thinSyncRelease(object);
+                    } else {
+                        // atomic because may collide with concurrent ACQUIRE
+                        OSAtomicDecrement32Barrier(&result->threadCount);
+                        if (thinSyncAllowed(object)) thinSyncDeflate(object);
+                    }
                 }
                 break;
             case CHECK:
@@ -162,16 +312,19 @@ static SyncData* id2data(id object, enum usage why)
         unsigned int i;
         for (i = 0; i < cache->used; i++) {
             SyncCacheItem *item = &cache->list[i];
-            if (item->data->object != object) continue;
+            if (!syncEntryMatches(item->data, object)) continue;
 
             // Found a match.
             result = item->data;
-            if (result->threadCount <= 0  ||  item->lockCount <= 0) {
+            if ((!isThinSync(result) && result->threadCount <= 0)  ||  
+                item->lockCount <= 0) 
+            {
                 _objc_fatal("id2data cache is buggy");
             }
                 
             switch(why) {
             case ACQUIRE:
+            case TRY_ACQUIRE:
                 item->lockCount++;
                 break;
             case RELEASE:
@@ -179,8 +332,13 @@ static SyncData* id2data(id object, enum usage why)
                 if (item->lockCount == 0) {
                     // remove from per-thread cache
                     cache->list[i] = cache->list[--cache->used];
-                    // atomic because may collide with concurrent ACQUIRE
-                    OSAtomicDecrement32Barrier(&result->threadCount);
+                    if (isThinSync(result)) {
+                        thinSyncRelease(object);
+                    } else {
+                        // atomic because may collide with concurrent ACQUIRE
+                        OSAtomicDecrement32Barrier(&result->threadCount);
+                        if (thinSyncAllowed(object)) thinSyncDeflate(object);
+                    }
                 }
                 break;
             case CHECK:
@@ -193,6 +351,45 @@ static SyncData* id2data(id object, enum usage why)
     }
 
     // Thread cache didn't find anything.
+#if SUPPORT_THIN_SYNC
+    // Thin-lock the object if nobody else is using its thin lock word.
+    // Otherwise count ourselves in the word and use a SyncData.
+    if ((why == ACQUIRE || why == TRY_ACQUIRE)  &&  thinSyncAllowed(object)) {
+        ThinSyncWord& thin = thinSyncWord(object);
+        std::atomic<uintptr_t>& word = thin.bits;
+        uintptr_t held = (uintptr_t)object | THIN_SYNC_HELD;
+        uintptr_t old = word.load(std::memory_order_relaxed);
+        while (true) {
+            // If the owner mutex is busy the last thin owner is still 
+            // on its way out. Use a SyncData rather than wait for it.
+            if (old == 0  &&  thin.owner.tryLock()) {
+                if (word.compare_exchange_strong(old, held,
+                                                 std::memory_order_acquire,
+                                                 std::memory_order_relaxed))
+                {
+                    result = thinSyncEntry(object);
+                    goto save_in_cache;
+                }
+                thin.owner.unlock();
+                continue;
+            }
+            if (why == TRY_ACQUIRE  &&  (old & ~THIN_SYNC_INFLATED) == held) {
+                // Thin-locked by another thread. Don't inflate.
+                return nil;
+            }
+            if ((old & THIN_SYNC_INFLATED) == THIN_SYNC_INFLATED) {
+                _objc_fatal("too many threads in @synchronized");
+            }
+            if (word.compare_exchange_weak(old, old + THIN_SYNC_INFLATED_ONE,
+                                           std::memory_order_relaxed,
+                                           std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+    }
+#endif
+
     // Walk in-use list looking for matching object
     // Spinlock prevents multiple threads from creating multiple 
     // locks for the same new object.
@@ -203,16 +400,26 @@ static SyncData* id2data(id object, enum usage why)
 
     {
         SyncData* p;
+        SyncData** pp;
         SyncData* firstUnused = NULL;
-        for (p = *listp; p != NULL; p = p->nextData) {
+        unsigned unusedCount = 0;
+        for (pp = listp; (p = *pp) != NULL; ) {
             if ( p->object == object ) {
                 result = p;
                 // atomic because may collide with concurrent RELEASE
                 OSAtomicIncrement32Barrier(&result->threadCount);
                 goto done;
             }
-            if ( (firstUnused == NULL) && (p->threadCount == 0) )
-                firstUnused = p;
+            if (p->threadCount == 0) {
+                if ( firstUnused == NULL ) {
+                    firstUnused = p;
+                } else if (++unusedCount >= SYNC_DATA_RESERVE  &&  
+                           reclaimSyncData(pp)) 
+                {
+                    continue;
+                }
+            }
+            pp = &p->nextData;
         }
     
         // no SyncData currently associated with object
@@ -241,32 +448,35 @@ static SyncData* id2data(id object, enum usage why)
     
  done:
     lockp->unlock();
-    if (result) {
-        // Only new ACQUIRE should get here.
-        // All RELEASE and CHECK and recursive ACQUIRE are 
-        // handled by the per-thread caches above.
-        if (why == RELEASE) {
-            // Probably some thread is incorrectly exiting 
-            // while the object is held by another thread.
-            return nil;
-        }
-        if (why != ACQUIRE) _objc_fatal("id2data is buggy");
-        if (result->object != object) _objc_fatal("id2data is buggy");
+    if (!result) return nil;
+
+    // Only new ACQUIRE should get here.
+    // All RELEASE and CHECK and recursive ACQUIRE are 
+    // handled by the per-thread caches above.
+    if (why == RELEASE) {
+        // Probably some thread is incorrectly exiting 
+        // while the object is held by another thread.
+        return nil;
+    }
+    if (why != ACQUIRE  &&  why != TRY_ACQUIRE) _objc_fatal("id2data is buggy");
+    if (result->object != object) _objc_fatal("id2data is buggy");
 
+#if SUPPORT_THIN_SYNC
+ save_in_cache:
+#endif
 #if SUPPORT_DIRECT_THREAD_KEYS
-        if (!fastCacheOccupied) {
-            // Save in fast thread cache
-            tls_set_direct(SYNC_DATA_DIRECT_KEY, result);
-            tls_set_direct(SYNC_COUNT_DIRECT_KEY, (void*)1);
-        } else 
+    if (!fastCacheOccupied) {
+        // Save in fast thread cache
+        tls_set_direct(SYNC_DATA_DIRECT_KEY, result);
+        tls_set_direct(SYNC_COUNT_DIRECT_KEY, (void*)1);
+    } else 
 #endif
-        {
-            // Save in thread cache
-            if (!cache) cache = fetch_cache(YES);
-            cache->list[cache->used].data = result;
-            cache->list[cache->used].lockCount = 1;
-            cache->used++;
-        }
+    {
+        // Save in thread cache
+        if (!cache) cache = fetch_cache(YES);
+        cache->list[cache->used].data = result;
+        cache->list[cache->used].lockCount = 1;
+        cache->used++;
     }
 
     return result;
@@ -288,7 +498,10 @@ int objc_sync_enter(id obj)
     if (obj) {
         SyncData* data = id2data(obj, ACQUIRE);
         ASSERT(data);
-        data->mutex.lock();
+        if (!isThinSync(data)) {
+            data->mutex.lock();
+            if (thinSyncAllowed(obj)) thinSyncWait(obj);
+        }
     } else {
         // @synchronized(nil) does nothing
         if (DebugNilSync) {
@@ -305,9 +518,17 @@ BOOL objc_sync_try_enter(id obj)
     BOOL result = YES;
 
     if (obj) {
-        SyncData* data = id2data(obj, ACQUIRE);
-        ASSERT(data);
-        result = data->mutex.tryLock();
+        SyncData* data = id2data(obj, TRY_ACQUIRE);
+        if (!data) {
+            // Thin-locked by another thread.
+            result = NO;
+        } else if (!isThinSync(data)) {
+            result = data->mutex.tryLock();
+            if (!result) {
+                // Give back what id2data acquired.
+                id2data(obj, RELEASE);
+            }
+        }
     } else {
         // @synchronized(nil) does nothing
         if (DebugNilSync) {
@@ -330,7 +551,7 @@ int objc_sync_exit(id obj)
         SyncData* data = id2data(obj, RELEASE); 
         if (!data) {
             result = OBJC_SYNC_NOT_OWNING_THREAD_ERROR;
-        } else {
+        } else if (!isThinSync(data)) {
             bool okay = data->mutex.tryUnlock();
             if (!okay) {
                 result = OBJC_SYNC_NOT_OWNING_THREAD_ERROR;
@@ -61,6 +61,21 @@ typedef DisguisedPtr<objc_object *> weak_referrer_t;
 #define PTR_MINUS_2 30
 #endif
 
+/*
+Both the weak table and the out-of-line referrer sets are open-addressed 
+hash tables probed a group of WEAK_GROUP_WIDTH slots at a time. Each slot 
+has a control byte stored after the slot array: WEAK_CTRL_EMPTY, 
+WEAK_CTRL_DELETED, or WEAK_CTRL_FULL plus 7 bits of the key's hash. 
+A lookup compares the control bytes of a whole group against the key's 
+tag at once (with SIMD where available), only looks at slots whose tags 
+match, and stops at the first group that contains an empty slot.
+Table sizes are powers of two and at least WEAK_GROUP_WIDTH.
+*/
+#define WEAK_GROUP_WIDTH 16
+#define WEAK_CTRL_EMPTY   0x00
+#define WEAK_CTRL_DELETED 0x01
+#define WEAK_CTRL_FULL    0x80
+
 /**
  * The internal structure stored in the weak references table. 
  * It maintains and stores
@@ -85,7 +100,7 @@ struct weak_entry_t {
             uintptr_t        out_of_line_ness : 2;
             uintptr_t        num_refs : PTR_MINUS_2;
             uintptr_t        mask;
-            uintptr_t        max_hash_displacement;
+            uintptr_t        num_deleted;
         };
         struct {
             // out_of_line_ness field is low bits of inline_referrers[1]
@@ -115,12 +130,13 @@ struct weak_entry_t {
 /**
  * The global weak references table. Stores object ids as keys,
  * and weak_entry_t structs as their values.
+ * The control bytes for weak_entries follow the last entry.
  */
 struct weak_table_t {
     weak_entry_t *weak_entries;
     size_t    num_entries;
     uintptr_t mask;
-    uintptr_t max_hash_displacement;
+    uintptr_t num_deleted;
 };
 
 /// Adds an (object, weak pointer) pair to the weak table.
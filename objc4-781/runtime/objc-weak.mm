@@ -30,6 +30,12 @@
 #include <sys/types.h>
 #include <libkern/OSAtomic.h>
 
+#if __SSE2__
+#   include <emmintrin.h>
+#elif __ARM_NEON
+#   include <arm_neon.h>
+#endif
+
 #define TABLE_SIZE(entry) (entry->mask ? entry->mask + 1 : 0)
 
 static void append_referrer(weak_entry_t *entry, objc_object **new_referrer);
@@ -66,9 +72,167 @@ static inline uintptr_t w_hash_pointer(objc_object **key) {
     return ptr_hash((uintptr_t)key);
 }
 
+
+/***********************************************************************
+* Group probing.
+* The low 7 bits of a hash are the tag stored in the control byte. 
+* The remaining bits choose the first group to probe. Groups are then 
+* visited in triangular order, which reaches every group because the 
+* group count is a power of two.
+**********************************************************************/
+
+static inline uint8_t weak_tag(uintptr_t hash) {
+    return WEAK_CTRL_FULL | (hash & 0x7f);
+}
+
+static inline uint8_t *weak_ctrl(void *slots, size_t slot_size, size_t count) {
+    return (uint8_t *)slots + slot_size * count;
+}
+
+// A set of matching slots within one group.
+struct weak_match_t {
+#if __ARM_NEON
+    // Four bits per slot; only the top bit of each nibble is kept.
+    uint64_t bits;
+    weak_match_t(uint64_t b) : bits(b & 0x8888888888888888ULL) { }
+    unsigned lowest() const { return __builtin_ctzll(bits) >> 2; }
+#else
+    // One bit per slot.
+    uint32_t bits;
+    weak_match_t(uint32_t b) : bits(b) { }
+    unsigned lowest() const { return __builtin_ctz(bits); }
+#endif
+    explicit operator bool() const { return bits != 0; }
+    void clearLowest() { bits &= bits - 1; }
+};
+
+// The control bytes of one group, loaded all at once.
+struct weak_group_t {
+#if __SSE2__
+    __m128i ctrl;
+    weak_group_t(const uint8_t *p) 
+        : ctrl(_mm_load_si128((const __m128i *)p)) { }
+    weak_match_t match(uint8_t tag) const {
+        return (uint32_t)_mm_movemask_epi8
+            (_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag)));
+    }
+    weak_match_t matchFull() const {
+        return (uint32_t)_mm_movemask_epi8(ctrl);
+    }
+    weak_match_t matchFree() const {
+        return (uint32_t)_mm_movemask_epi8(ctrl) ^ 0xffff;
+    }
+#elif __ARM_NEON
+    uint8x16_t ctrl;
+    weak_group_t(const uint8_t *p) : ctrl(vld1q_u8(p)) { }
+    static uint64_t nibbles(uint8x16_t eq) {
+        return vget_lane_u64(vreinterpret_u64_u8
+            (vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    }
+    weak_match_t match(uint8_t tag) const {
+        return nibbles(vceqq_u8(ctrl, vdupq_n_u8(tag)));
+    }
+    weak_match_t matchFull() const {
+        return nibbles(vtstq_u8(ctrl, vdupq_n_u8(WEAK_CTRL_FULL)));
+    }
+    weak_match_t matchFree() const {
+        return nibbles(vceqq_u8(vandq_u8(ctrl, vdupq_n_u8(WEAK_CTRL_FULL)), 
+                                vdupq_n_u8(0)));
+    }
+#else
+    const uint8_t *ctrl;
+    weak_group_t(const uint8_t *p) : ctrl(p) { }
+    weak_match_t match(uint8_t tag) const {
+        uint32_t bits = 0;
+        for (unsigned i = 0; i < WEAK_GROUP_WIDTH; i++) {
+            if (ctrl[i] == tag) bits |= 1U << i;
+        }
+        return bits;
+    }
+    weak_match_t matchFull() const {
+        uint32_t bits = 0;
+        for (unsigned i = 0; i < WEAK_GROUP_WIDTH; i++) {
+            if (ctrl[i] & WEAK_CTRL_FULL) bits |= 1U << i;
+        }
+        return bits;
+    }
+    weak_match_t matchFree() const {
+        return matchFull().bits ^ 0xffff;
+    }
+#endif
+};
+
+// The sequence of groups to visit for one hash.
+struct weak_probe_t {
+    size_t group;
+    size_t group_mask;
+    size_t step;
+
+    weak_probe_t(uintptr_t hash, size_t count) 
+        : group_mask(count / WEAK_GROUP_WIDTH - 1), step(0)
+    {
+        group = (hash >> 7) & group_mask;
+    }
+
+    size_t offset() const { return group * WEAK_GROUP_WIDTH; }
+
+    // Returns false once every group has been visited.
+    bool next() {
+        step++;
+        group = (group + step) & group_mask;
+        return step <= group_mask;
+    }
+};
+
+// Returns the first free slot in the probe sequence for hash.
+static size_t 
+weak_find_free(const uint8_t *ctrl, size_t count, uintptr_t hash, 
+               weak_entry_t *errorEntries)
+{
+    weak_probe_t probe(hash, count);
+    do {
+        weak_match_t free = weak_group_t(ctrl + probe.offset()).matchFree();
+        if (free) return probe.offset() + free.lowest();
+    } while (probe.next());
+    bad_weak_table(errorEntries);
+    return 0;
+}
+
+// Marks a slot unused. A slot can go back to empty if its group still 
+// has an empty slot: no probe sequence can have continued past that 
+// group, so nothing depends on this slot having been full.
+static bool 
+weak_erase_ctrl(uint8_t *ctrl, size_t index)
+{
+    size_t group = index & ~(size_t)(WEAK_GROUP_WIDTH - 1);
+    if (weak_group_t(ctrl + group).match(WEAK_CTRL_EMPTY)) {
+        ctrl[index] = WEAK_CTRL_EMPTY;
+        return false;
+    }
+    ctrl[index] = WEAK_CTRL_DELETED;
+    return true;
+}
+
+
+/***********************************************************************
+* Referrer sets.
+**********************************************************************/
+
+static inline uint8_t *referrers_ctrl(weak_entry_t *entry) {
+    return weak_ctrl(entry->referrers, sizeof(weak_referrer_t), 
+                     TABLE_SIZE(entry));
+}
+
+// The control bytes follow the slots. count is a multiple of 
+// WEAK_GROUP_WIDTH, which keeps them aligned for the group loads.
+static inline size_t referrers_bytes(size_t count) {
+    return count * sizeof(weak_referrer_t) + count;
+}
+
 /** 
- * Grow the entry's hash table of referrers. Rehashes each
- * of the referrers.
+ * Resize the entry's hash table of referrers. Rehashes each
+ * of the referrers. Grows the table only if deleted slots 
+ * are not enough to make room.
  * 
  * @param entry Weak pointer hash set for a particular object.
  */
@@ -79,26 +243,26 @@ static void grow_refs_and_insert(weak_entry_t *entry,
     ASSERT(entry->out_of_line());
 
     size_t old_size = TABLE_SIZE(entry);
-    size_t new_size = old_size ? old_size * 2 : 8;
+    size_t new_size = old_size;
+    if (entry->num_refs >= old_size / 2) new_size = old_size * 2;
 
-    size_t num_refs = entry->num_refs;
     weak_referrer_t *old_refs = entry->referrers;
+    uint8_t *old_ctrl = referrers_ctrl(entry);
+
+    entry->referrers = (weak_referrer_t *)calloc(1, referrers_bytes(new_size));
     entry->mask = new_size - 1;
-    
-    entry->referrers = (weak_referrer_t *)
-        calloc(TABLE_SIZE(entry), sizeof(weak_referrer_t));
     entry->num_refs = 0;
-    entry->max_hash_displacement = 0;
-    
-    for (size_t i = 0; i < old_size && num_refs > 0; i++) {
-        if (old_refs[i] != nil) {
-            append_referrer(entry, old_refs[i]);
-            num_refs--;
+    entry->num_deleted = 0;
+
+    for (size_t i = 0; i < old_size; i += WEAK_GROUP_WIDTH) {
+        weak_match_t full = weak_group_t(old_ctrl + i).matchFull();
+        for (; full; full.clearLowest()) {
+            append_referrer(entry, old_refs[i + full.lowest()]);
         }
     }
     // Insert
     append_referrer(entry, new_referrer);
-    if (old_refs) free(old_refs);
+    free(old_refs);
 }
 
 /** 
@@ -121,38 +285,34 @@ static void append_referrer(weak_entry_t *entry, objc_object **new_referrer)
         }
 
         // Couldn't insert inline. Allocate out of line.
-        weak_referrer_t *new_referrers = (weak_referrer_t *)
-            calloc(WEAK_INLINE_COUNT, sizeof(weak_referrer_t));
-        // This constructed table is invalid, but grow_refs_and_insert
-        // will fix it and rehash it.
+        weak_referrer_t old_referrers[WEAK_INLINE_COUNT];
+        memcpy(old_referrers, entry->inline_referrers, sizeof(old_referrers));
+
+        entry->referrers = (weak_referrer_t *)
+            calloc(1, referrers_bytes(WEAK_GROUP_WIDTH));
+        entry->num_refs = 0;
+        entry->out_of_line_ness = REFERRERS_OUT_OF_LINE;
+        entry->mask = WEAK_GROUP_WIDTH-1;
+        entry->num_deleted = 0;
+
         for (size_t i = 0; i < WEAK_INLINE_COUNT; i++) {
-            new_referrers[i] = entry->inline_referrers[i];
+            append_referrer(entry, old_referrers[i]);
         }
-        entry->referrers = new_referrers;
-        entry->num_refs = WEAK_INLINE_COUNT;
-        entry->out_of_line_ness = REFERRERS_OUT_OF_LINE;
-        entry->mask = WEAK_INLINE_COUNT-1;
-        entry->max_hash_displacement = 0;
     }
 
     ASSERT(entry->out_of_line());
 
-    if (entry->num_refs >= TABLE_SIZE(entry) * 3/4) {
+    if (entry->num_refs + entry->num_deleted >= TABLE_SIZE(entry) * 3/4) {
         return grow_refs_and_insert(entry, new_referrer);
     }
-    size_t begin = w_hash_pointer(new_referrer) & (entry->mask);
-    size_t index = begin;
-    size_t hash_displacement = 0;
-    while (entry->referrers[index] != nil) {
-        hash_displacement++;
-        index = (index+1) & entry->mask;
-        if (index == begin) bad_weak_table(entry);
-    }
-    if (hash_displacement > entry->max_hash_displacement) {
-        entry->max_hash_displacement = hash_displacement;
-    }
-    weak_referrer_t &ref = entry->referrers[index];
-    ref = new_referrer;
+
+    uintptr_t hash = w_hash_pointer(new_referrer);
+    uint8_t *ctrl = referrers_ctrl(entry);
+    size_t index = weak_find_free(ctrl, TABLE_SIZE(entry), hash, 
+                                  (weak_entry_t *)entry);
+    if (ctrl[index] == WEAK_CTRL_DELETED) entry->num_deleted--;
+    ctrl[index] = weak_tag(hash);
+    entry->referrers[index] = new_referrer;
     entry->num_refs++;
 }
 
@@ -160,8 +320,6 @@ static void append_referrer(weak_entry_t *entry, objc_object **new_referrer)
  * Remove old_referrer from set of referrers, if it's present.
  * Does not remove duplicates, because duplicates should not exist. 
  * 
- * @todo this is slow if old_referrer is not present. Is this ever the case? 
- *
  * @param entry The entry holding the referrers.
  * @param old_referrer The referrer to remove. 
  */
@@ -183,25 +341,46 @@ static void remove_referrer(weak_entry_t *entry, objc_object **old_referrer)
         return;
     }
 
-    size_t begin = w_hash_pointer(old_referrer) & (entry->mask);
-    size_t index = begin;
-    size_t hash_displacement = 0;
-    while (entry->referrers[index] != old_referrer) {
-        index = (index+1) & entry->mask;
-        if (index == begin) bad_weak_table(entry);
-        hash_displacement++;
-        if (hash_displacement > entry->max_hash_displacement) {
-            _objc_inform("Attempted to unregister unknown __weak variable "
-                         "at %p. This is probably incorrect use of "
-                         "objc_storeWeak() and objc_loadWeak(). "
-                         "Break on objc_weak_error to debug.\n", 
-                         old_referrer);
-            objc_weak_error();
-            return;
+    uintptr_t hash = w_hash_pointer(old_referrer);
+    uint8_t tag = weak_tag(hash);
+    uint8_t *ctrl = referrers_ctrl(entry);
+    weak_probe_t probe(hash, TABLE_SIZE(entry));
+    do {
+        weak_group_t group(ctrl + probe.offset());
+        for (weak_match_t m = group.match(tag); m; m.clearLowest()) {
+            size_t index = probe.offset() + m.lowest();
+            if (entry->referrers[index] == old_referrer) {
+                entry->referrers[index] = nil;
+                if (weak_erase_ctrl(ctrl, index)) entry->num_deleted++;
+                entry->num_refs--;
+                return;
+            }
         }
-    }
-    entry->referrers[index] = nil;
-    entry->num_refs--;
+        if (group.match(WEAK_CTRL_EMPTY)) break;
+    } while (probe.next());
+
+    _objc_inform("Attempted to unregister unknown __weak variable "
+                 "at %p. This is probably incorrect use of "
+                 "objc_storeWeak() and objc_loadWeak(). "
+                 "Break on objc_weak_error to debug.\n", 
+                 old_referrer);
+    objc_weak_error();
+}
+
+
+/***********************************************************************
+* Weak table.
+**********************************************************************/
+
+static inline uint8_t *entries_ctrl(weak_table_t *weak_table) {
+    return weak_ctrl(weak_table->weak_entries, sizeof(weak_entry_t), 
+                     TABLE_SIZE(weak_table));
+}
+
+// The control bytes follow the slots. count is a multiple of 
+// WEAK_GROUP_WIDTH, which keeps them aligned for the group loads.
+static inline size_t entries_bytes(size_t count) {
+    return count * sizeof(weak_entry_t) + count;
 }
 
 /** 
@@ -213,21 +392,15 @@ static void weak_entry_insert(weak_table_t *weak_table, weak_entry_t *new_entry)
     weak_entry_t *weak_entries = weak_table->weak_entries;
     ASSERT(weak_entries != nil);
 
-    size_t begin = hash_pointer(new_entry->referent) & (weak_table->mask);
-    size_t index = begin;
-    size_t hash_displacement = 0;
-    while (weak_entries[index].referent != nil) {
-        index = (index+1) & weak_table->mask;
-        if (index == begin) bad_weak_table(weak_entries);
-        hash_displacement++;
-    }
+    uintptr_t hash = hash_pointer(new_entry->referent);
+    uint8_t *ctrl = entries_ctrl(weak_table);
+    size_t index = weak_find_free(ctrl, TABLE_SIZE(weak_table), hash, 
+                                  weak_entries);
+    if (ctrl[index] == WEAK_CTRL_DELETED) weak_table->num_deleted--;
+    ctrl[index] = weak_tag(hash);
 
     weak_entries[index] = *new_entry;
     weak_table->num_entries++;
-
-    if (hash_displacement > weak_table->max_hash_displacement) {
-        weak_table->max_hash_displacement = hash_displacement;
-    }
 }
 
 
@@ -236,20 +409,20 @@ static void weak_resize(weak_table_t *weak_table, size_t new_size)
     size_t old_size = TABLE_SIZE(weak_table);
 
     weak_entry_t *old_entries = weak_table->weak_entries;
+    uint8_t *old_ctrl = old_entries ? entries_ctrl(weak_table) : nil;
     weak_entry_t *new_entries = (weak_entry_t *)
-        calloc(new_size, sizeof(weak_entry_t));
+        calloc(1, entries_bytes(new_size));
 
     weak_table->mask = new_size - 1;
     weak_table->weak_entries = new_entries;
-    weak_table->max_hash_displacement = 0;
+    weak_table->num_deleted = 0;
     weak_table->num_entries = 0;  // restored by weak_entry_insert below
     
     if (old_entries) {
-        weak_entry_t *entry;
-        weak_entry_t *end = old_entries + old_size;
-        for (entry = old_entries; entry < end; entry++) {
-            if (entry->referent) {
-                weak_entry_insert(weak_table, entry);
+        for (size_t i = 0; i < old_size; i += WEAK_GROUP_WIDTH) {
+            weak_match_t full = weak_group_t(old_ctrl + i).matchFull();
+            for (; full; full.clearLowest()) {
+                weak_entry_insert(weak_table, &old_entries[i + full.lowest()]);
             }
         }
         free(old_entries);
@@ -261,9 +434,15 @@ static void weak_grow_maybe(weak_table_t *weak_table)
 {
     size_t old_size = TABLE_SIZE(weak_table);
 
-    // Grow if at least 3/4 full.
-    if (weak_table->num_entries >= old_size * 3 / 4) {
-        weak_resize(weak_table, old_size ? old_size*2 : 64);
+    // Grow if at least 3/4 full. 
+    // Just rehash if most of that is deleted slots.
+    size_t used = weak_table->num_entries + weak_table->num_deleted;
+    if (used >= old_size * 3 / 4) {
+        if (old_size  &&  weak_table->num_entries < old_size / 2) {
+            weak_resize(weak_table, old_size);
+        } else {
+            weak_resize(weak_table, old_size ? old_size*2 : 64);
+        }
     }
 }
 
@@ -289,6 +468,10 @@ static void weak_entry_remove(weak_table_t *weak_table, weak_entry_t *entry)
     if (entry->out_of_line()) free(entry->referrers);
     bzero(entry, sizeof(*entry));
 
+    size_t index = entry - weak_table->weak_entries;
+    if (weak_erase_ctrl(entries_ctrl(weak_table), index)) {
+        weak_table->num_deleted++;
+    }
     weak_table->num_entries--;
 
     weak_compact_maybe(weak_table);
@@ -314,19 +497,23 @@ weak_entry_for_referent(weak_table_t *weak_table, objc_object *referent)
 
     if (!weak_entries) return nil;
 
-    size_t begin = hash_pointer(referent) & weak_table->mask;
-    size_t index = begin;
-    size_t hash_displacement = 0;
-    while (weak_table->weak_entries[index].referent != referent) {
-        index = (index+1) & weak_table->mask;
-        if (index == begin) bad_weak_table(weak_table->weak_entries);
-        hash_displacement++;
-        if (hash_displacement > weak_table->max_hash_displacement) {
-            return nil;
+    uintptr_t hash = hash_pointer(referent);
+    uint8_t tag = weak_tag(hash);
+    uint8_t *ctrl = entries_ctrl(weak_table);
+    weak_probe_t probe(hash, TABLE_SIZE(weak_table));
+    do {
+        weak_group_t group(ctrl + probe.offset());
+        for (weak_match_t m = group.match(tag); m; m.clearLowest()) {
+            size_t index = probe.offset() + m.lowest();
+            if (weak_entries[index].referent == referent) {
+                return &weak_entries[index];
+            }
         }
-    }
-    
-    return &weak_table->weak_entries[index];
+        if (group.match(WEAK_CTRL_EMPTY)) return nil;
+    } while (probe.next());
+
+    bad_weak_table(weak_entries);
+    return nil;
 }
 
 /** 
@@ -451,6 +638,23 @@ weak_is_registered_no_lock(weak_table_t *weak_table, id referent_id)
 #endif
 
 
+// Nil out one weak variable that should point to referent.
+static inline void 
+weak_clear_referrer(objc_object **referrer, objc_object *referent)
+{
+    if (*referrer == referent) {
+        *referrer = nil;
+    }
+    else if (*referrer) {
+        _objc_inform("__weak variable at %p holds %p instead of %p. "
+                     "This is probably incorrect use of "
+                     "objc_storeWeak() and objc_loadWeak(). "
+                     "Break on objc_weak_error to debug.\n", 
+                     referrer, (void*)*referrer, (void*)referent);
+        objc_weak_error();
+    }
+}
+
 /** 
  * Called by dealloc; nils out all weak pointers that point to the 
  * provided object so that they can no longer be used.
@@ -471,33 +675,32 @@ weak_clear_no_lock(weak_table_t *weak_table, id referent_id)
     }
 
     // zero out references
-    weak_referrer_t *referrers;
-    size_t count;
-    
     if (entry->out_of_line()) {
-        referrers = entry->referrers;
-        count = TABLE_SIZE(entry);
-    } 
-    else {
-        referrers = entry->inline_referrers;
-        count = WEAK_INLINE_COUNT;
-    }
-    
-    for (size_t i = 0; i < count; ++i) {
-        objc_object **referrer = referrers[i];
-        if (referrer) {
-            if (*referrer == referent) {
-                *referrer = nil;
+        // Gather a group's referrers first and then clear them together, 
+        // so the loads of the weak variables overlap instead of each 
+        // store waiting on the next probe.
+        weak_referrer_t *referrers = entry->referrers;
+        uint8_t *ctrl = referrers_ctrl(entry);
+        size_t count = TABLE_SIZE(entry);
+        for (size_t i = 0; i < count; i += WEAK_GROUP_WIDTH) {
+            objc_object **batch[WEAK_GROUP_WIDTH];
+            unsigned batched = 0;
+            weak_match_t full = weak_group_t(ctrl + i).matchFull();
+            for (; full; full.clearLowest()) {
+                objc_object **referrer = referrers[i + full.lowest()];
+                __builtin_prefetch(referrer, 1);
+                batch[batched++] = referrer;
             }
-            else if (*referrer) {
-                _objc_inform("__weak variable at %p holds %p instead of %p. "
-                             "This is probably incorrect use of "
-                             "objc_storeWeak() and objc_loadWeak(). "
-                             "Break on objc_weak_error to debug.\n", 
-                             referrer, (void*)*referrer, (void*)referent);
-                objc_weak_error();
+            for (unsigned b = 0; b < batched; b++) {
+                weak_clear_referrer(batch[b], referent);
             }
         }
+    } 
+    else {
+        for (size_t i = 0; i < WEAK_INLINE_COUNT; ++i) {
+            objc_object **referrer = entry->inline_referrers[i];
+            if (referrer) weak_clear_referrer(referrer, referent);
+        }
     }
     
     weak_entry_remove(weak_table, entry);
@@ -73,6 +73,10 @@ public:
     }
 };
 
+// Per-CPU magazines of free elements in front of a zone's free list.
+// Defined in objc-zalloc.mm.
+class ZoneCache;
+
 template<class T, bool useMalloc>
 class Zone {
 };
@@ -85,6 +89,7 @@ class Zone<T, false> {
     } __attribute__((packed));
 
     static AtomicQueue _freelist;
+    static ZoneCache _cache;
     static T *alloc_slow();
 
 public:
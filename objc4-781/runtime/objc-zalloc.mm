@@ -33,6 +33,8 @@
 #include "objc-private.h"
 #include "objc-zalloc.h"
 
+#include <os/tsd.h>
+
 namespace objc {
 
 void *AtomicQueue::pop()
@@ -73,9 +75,199 @@ T gcd(T a, T b)
     return b == 0 ? a : gcd(b, a % b);
 }
 
+/***********************************************************************
+* ZoneCache
+* Magazines of free elements cached per CPU in front of a zone.
+*
+* Every alloc and free through the plain free list is a CAS on the
+* same cache line, which bounces between CPUs when classes are 
+* realized on many threads. Instead each CPU slot holds a magazine of
+* up to MagazineSize free elements. A thread takes its CPU's magazine
+* with one atomic exchange on a line only that CPU normally touches,
+* allocates or frees privately, and puts it back. Elements move to 
+* and from the shared depot a whole magazine at a time.
+*
+* A thread that is preempted while holding a magazine leaves the slot
+* empty, and another thread on that CPU simply gets a different
+* magazine. If the slot was refilled by the time the magazine comes
+* back, one of the two goes to the depot. Nothing is ever locked, 
+* so fork() needs no special handling; a magazine held by a thread 
+* that does not exist in the child is leaked.
+*
+* Magazines are never freed, like the elements themselves, which is
+* what makes the AtomicQueue pops safe.
+**********************************************************************/
+
+class ZoneCache {
+    enum { MagazineSize = 32 };
+#if TARGET_OS_IPHONE && !TARGET_OS_SIMULATOR
+    enum { SlotCount = 8 };
+#else
+    enum { SlotCount = 64 };
+#endif
+
+    struct Magazine {
+        Magazine *next;         // depot link; must be first for AtomicQueue
+        Magazine *allNext;      // every magazine of this zone, for stats
+        uint64_t allocs;
+        uint64_t frees;
+        uint64_t cacheHits;
+        uint32_t count;
+        void *rounds[MagazineSize];
+    };
+
+    struct alignas(CacheLineSize) Slot {
+        std::atomic<Magazine *> magazine;
+    };
+
+    // Everything starts out zero, like Zone's free list, 
+    // so there is no static initializer.
+    // name and elementSize are filled in when the zone is first used.
+    const char *name;
+    size_t elementSize;
+
+    AtomicQueue loaded;         // magazines with at least one element
+    AtomicQueue empty;          // magazines with none
+    std::atomic<Magazine *> allMagazines;
+    std::atomic<size_t> bytesResident;
+    std::atomic<ZoneCache *> nextZone;
+    std::atomic<bool> registered;
+    Slot slots[SlotCount];
+
+    static std::atomic<ZoneCache *> allZones;
+
+    Slot& currentSlot() {
+        return slots[_os_cpu_number() % SlotCount];
+    }
+
+    void registerZone(const char *zoneName, size_t size) {
+        if (registered.exchange(true, std::memory_order_relaxed)) return;
+        name = zoneName;
+        elementSize = size;
+        ZoneCache *head = allZones.load(std::memory_order_relaxed);
+        do {
+            nextZone.store(head, std::memory_order_relaxed);
+        } while (!allZones.compare_exchange_weak(head, this, 
+                                                 std::memory_order_release, 
+                                                 std::memory_order_relaxed));
+    }
+
+    Magazine *newMagazine(const char *zoneName, size_t size) {
+        registerZone(zoneName, size);
+        Magazine *m = (Magazine *)::calloc(1, sizeof(Magazine));
+        bytesResident.fetch_add(sizeof(Magazine), std::memory_order_relaxed);
+        Magazine *head = allMagazines.load(std::memory_order_relaxed);
+        do {
+            m->allNext = head;
+        } while (!allMagazines.compare_exchange_weak(head, m, 
+                                                     std::memory_order_release,
+                                                     std::memory_order_relaxed));
+        return m;
+    }
+
+    // Returns the current CPU's magazine, or some empty one.
+    Magazine *take(Slot& slot, const char *zoneName, size_t size) {
+        Magazine *m = slot.magazine.exchange(nullptr, std::memory_order_acquire);
+        if (m) return m;
+        if (void *e = empty.pop()) return (Magazine *)e;
+        return newMagazine(zoneName, size);
+    }
+
+    // Returns a magazine to the slot it was taken from. 
+    // If the slot was refilled meanwhile the other one goes to the depot.
+    void putBack(Slot& slot, Magazine *m) {
+        Magazine *other = slot.magazine.exchange(m, std::memory_order_acq_rel);
+        if (other) {
+            if (other->count) loaded.push(other);
+            else empty.push(other);
+        }
+    }
+
+    // Fills an empty magazine with fresh zeroed elements.
+    // The batch is a multiple of the zone's slab size 
+    // so that packing is as dense as without magazines.
+    void refill(Magazine *m, size_t size, size_t slabCount) {
+        size_t batchCount = MagazineSize / slabCount * slabCount;
+        uint8_t *batch = (uint8_t *)::calloc(batchCount, size);
+        bytesResident.fetch_add(batchCount * size, std::memory_order_relaxed);
+        for (size_t i = batchCount; i > 0; i--) {
+            m->rounds[m->count++] = batch + (i - 1) * size;
+        }
+    }
+
+public:
+    // Returns an element whose first word may be stale 
+    // and whose remaining bytes are zero.
+    void *alloc(const char *zoneName, size_t size, size_t slabCount) {
+        Slot& slot = currentSlot();
+        Magazine *m = take(slot, zoneName, size);
+        if (m->count) {
+            m->cacheHits++;
+        } else if (void *e = loaded.pop()) {
+            empty.push(m);
+            m = (Magazine *)e;
+        } else {
+            refill(m, size, slabCount);
+        }
+        m->allocs++;
+        void *result = m->rounds[--m->count];
+        putBack(slot, m);
+        return result;
+    }
+
+    // e's bytes after the first word must already be zero.
+    void free(void *e, const char *zoneName, size_t size) {
+        Slot& slot = currentSlot();
+        Magazine *m = take(slot, zoneName, size);
+        if (m->count == MagazineSize) {
+            loaded.push(m);
+            if (void *spare = empty.pop()) m = (Magazine *)spare;
+            else m = newMagazine(zoneName, size);
+        }
+        m->frees++;
+        m->rounds[m->count++] = e;
+        putBack(slot, m);
+    }
+
+    // Counts are summed without stopping other threads, 
+    // so they are approximate while the zone is in use.
+    void getStats(objc_zone_stats *stats) {
+        stats->name = name;
+        stats->elementSize = elementSize;
+        stats->allocs = stats->frees = stats->cacheHits = 0;
+        for (Magazine *m = allMagazines.load(std::memory_order_acquire); 
+             m; m = m->allNext) 
+        {
+            stats->allocs += m->allocs;
+            stats->frees += m->frees;
+            stats->cacheHits += m->cacheHits;
+        }
+        stats->bytesResident = bytesResident.load(std::memory_order_relaxed);
+    }
+
+    static unsigned getAllStats(objc_zone_stats *stats, unsigned count) {
+        unsigned total = 0;
+        for (ZoneCache *z = allZones.load(std::memory_order_acquire); 
+             z; z = z->nextZone.load(std::memory_order_relaxed)) 
+        {
+            if (total < count) z->getStats(&stats[total]);
+            total++;
+        }
+        return total;
+    }
+};
+
+std::atomic<ZoneCache *> ZoneCache::allZones;
+
+template<class T>
+constexpr const char *ZoneName = "";
+
 template<class T>
 AtomicQueue Zone<T, false>::_freelist;
 
+template<class T>
+ZoneCache Zone<T, false>::_cache;
+
 template<class T>
 T *Zone<T, false>::alloc_slow()
 {
@@ -96,6 +288,13 @@ T *Zone<T, false>::alloc_slow()
 template<class T>
 T *Zone<T, false>::alloc()
 {
+    if (!DisableZoneMagazines) {
+        constexpr size_t n_elem = MALLOC_ALIGNMENT / gcd(sizeof(T), size_t{MALLOC_ALIGNMENT});
+        void *e = _cache.alloc(ZoneName<T>, sizeof(T), n_elem);
+        __builtin_bzero(e, sizeof(void *));
+        return reinterpret_cast<T *>(e);
+    }
+
     void *e = _freelist.pop();
     if (e) {
         __builtin_bzero(e, sizeof(void *));
@@ -110,12 +309,14 @@ void Zone<T, false>::free(T *ptr)
     if (ptr) {
         Element *e = reinterpret_cast<Element *>(ptr);
         __builtin_bzero(e->buf, sizeof(e->buf));
-        _freelist.push(e);
+        if (!DisableZoneMagazines) _cache.free(e, ZoneName<T>, sizeof(T));
+        else _freelist.push(e);
     }
 }
 
 #if __OBJC2__
 #define ZoneInstantiate(type) \
+	template<> constexpr const char *ZoneName<type> = #type; \
 	template class Zone<type, sizeof(type) % MALLOC_ALIGNMENT == 0>
 
 ZoneInstantiate(class_rw_t);
@@ -123,3 +324,17 @@ ZoneInstantiate(class_rw_ext_t);
 #endif
 
 }
+
+
+/***********************************************************************
+* _objc_getZoneStats
+* Statistics for the zones that use per-CPU magazines.
+* Zones that are backed by malloc directly, and zones that have 
+* not been used yet, are not listed.
+* Fills in at most count entries and returns the number of zones.
+**********************************************************************/
+unsigned
+_objc_getZoneStats(objc_zone_stats *stats, unsigned count)
+{
+    return objc::ZoneCache::getAllStats(stats, count);
+}
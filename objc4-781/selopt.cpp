@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2020 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * selopt
+ * Build an app selector table file for OBJC_APP_SELECTOR_TABLE.
+ *
+ * usage: selopt [-v] -o <output> <image>...
+ *
+ * Collects every selector name in the __objc_methname sections of
+ * the given Mach-O images (thin or fat, all architectures) and writes
+ * them with a precomputed perfect hash table in the shared cache's
+ * objc_selopt_t format. See runtime/objc-selopt-file.h for the layout.
+ *
+ * Build with something like:
+ *   clang++ -std=c++11 -Iruntime selopt.cpp -o selopt
+ * where objc-shared-cache.h is on the include path.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/errno.h>
+#include <os/overflow.h>
+#include <libkern/OSByteOrder.h>
+#include <mach-o/fat.h>
+#include <mach-o/loader.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#define SELOPT_WRITE
+#include <objc-shared-cache.h>
+#include "objc-selopt-file.h"
+
+using objc_opt::string_map;
+using objc_opt::objc_selopt_t;
+
+bool verbose = false;
+
+// All selector names, in the order first seen.
+std::vector<std::string> names;
+std::unordered_set<std::string> namesSeen;
+
+
+// Segment and section names are 16 bytes and may be un-terminated.
+bool segnameEquals(const char *lhs, const char *rhs)
+{
+    return 0 == strncmp(lhs, rhs, 16);
+}
+
+bool sectnameEquals(const char *lhs, const char *rhs)
+{
+    return segnameEquals(lhs, rhs);
+}
+
+
+void addNames(const char *start, uint64_t size)
+{
+    const char *end = start + size;
+    const char *s = start;
+    while (s < end) {
+        size_t len = strnlen(s, (size_t)(end - s));
+        if (len > 0  &&  s + len < end) {
+            std::string name(s, len);
+            if (namesSeen.insert(name).second) names.push_back(name);
+        }
+        s += len + 1;
+    }
+}
+
+
+template <typename mach_header_t, typename segment_command_t,
+          typename section_t, uint32_t LC_SEGMENT_T>
+bool parse_macho(uint8_t *buffer, size_t size)
+{
+    if (size < sizeof(mach_header_t)) {
+        printf("file is too small\n");
+        return false;
+    }
+
+    mach_header_t *mh = (mach_header_t *)buffer;
+    uint8_t *cmds = (uint8_t *)(mh + 1);
+    uint8_t *cmdsEnd = cmds + mh->sizeofcmds;
+    if (cmdsEnd > buffer + size) {
+        printf("file is badly formed\n");
+        return false;
+    }
+
+    for (uint32_t c = 0; c < mh->ncmds; c++) {
+        load_command *cmd = (load_command *)cmds;
+        if (cmds + sizeof(*cmd) > cmdsEnd  ||
+            cmd->cmdsize < sizeof(*cmd)  ||  cmds + cmd->cmdsize > cmdsEnd)
+        {
+            printf("file is badly formed\n");
+            return false;
+        }
+        cmds += cmd->cmdsize;
+        if (cmd->cmd != LC_SEGMENT_T) continue;
+
+        segment_command_t *seg = (segment_command_t *)cmd;
+        if (!segnameEquals(seg->segname, "__TEXT")) continue;
+
+        section_t *sect = (section_t *)(seg + 1);
+        if ((uint8_t *)(sect + seg->nsects) > cmds) {
+            printf("file is badly formed\n");
+            return false;
+        }
+        for (uint32_t i = 0; i < seg->nsects; i++) {
+            if (!sectnameEquals(sect[i].sectname, "__objc_methname")) continue;
+            if (sect[i].offset > size  ||  sect[i].size > size - sect[i].offset) {
+                printf("file is badly formed\n");
+                return false;
+            }
+            size_t before = names.size();
+            addNames((const char *)buffer + sect[i].offset, sect[i].size);
+            if (verbose) printf("%zu new selectors\n", names.size() - before);
+        }
+    }
+
+    return true;
+}
+
+
+bool parse_macho(uint8_t *buffer, size_t size)
+{
+    if (size < sizeof(uint32_t)) {
+        printf("file is too small\n");
+        return false;
+    }
+
+    uint32_t magic = *(uint32_t *)buffer;
+
+    switch (magic) {
+    case MH_MAGIC_64:
+        return parse_macho<mach_header_64, segment_command_64,
+                           section_64, LC_SEGMENT_64>(buffer, size);
+    case MH_MAGIC:
+        return parse_macho<mach_header, segment_command,
+                           section, LC_SEGMENT>(buffer, size);
+    default:
+        printf("file is not little-endian mach-o (magic %x)\n", magic);
+        return false;
+    }
+}
+
+
+bool parse_fat(uint8_t *buffer, size_t size)
+{
+    uint32_t magic;
+
+    if (size < sizeof(magic)) {
+        printf("file is too small\n");
+        return false;
+    }
+
+    magic = *(uint32_t *)buffer;
+    if (magic != FAT_MAGIC && magic != FAT_CIGAM) {
+        /* Not a fat file */
+        return parse_macho(buffer, size);
+    }
+
+    struct fat_header *fh;
+    uint32_t fat_nfat_arch;
+    struct fat_arch *archs;
+
+    if (size < sizeof(struct fat_header)) {
+        printf("file is too small\n");
+        return false;
+    }
+
+    fh = (struct fat_header *)buffer;
+    fat_nfat_arch = OSSwapBigToHostInt32(fh->nfat_arch);
+
+    size_t fat_arch_size;
+    // fat_nfat_arch * sizeof(struct fat_arch) + sizeof(struct fat_header)
+    if (os_mul_and_add_overflow(fat_nfat_arch, sizeof(struct fat_arch),
+                                sizeof(struct fat_header), &fat_arch_size))
+    {
+        printf("too many fat archs\n");
+        return false;
+    }
+    if (size < fat_arch_size) {
+        printf("file is too small\n");
+        return false;
+    }
+
+    archs = (struct fat_arch *)(buffer + sizeof(struct fat_header));
+
+    for (uint32_t i = 0; i < fat_nfat_arch; i++) {
+        uint32_t arch_offset = OSSwapBigToHostInt32(archs[i].offset);
+        uint32_t arch_size = OSSwapBigToHostInt32(archs[i].size);
+
+        /* Check that slice data is after all fat headers and archs */
+        /* and that the slice ends before the file does */
+        if (arch_offset < fat_arch_size  ||  arch_offset > size  ||
+            arch_size > size - arch_offset)
+        {
+            printf("file is badly formed\n");
+            return false;
+        }
+
+        if (verbose) printf("cputype %d\n",
+                            OSSwapBigToHostInt32(archs[i].cputype));
+        bool ok = parse_macho(buffer + arch_offset, arch_size);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+
+bool processFile(const char *filename)
+{
+    if (verbose) printf("file %s\n", filename);
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("open %s: %s\n", filename, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        printf("fstat %s: %s\n", filename, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    // Selector names are copied out, so the mapping can go away after.
+    void *buffer = mmap(NULL, (size_t)st.st_size, PROT_READ,
+                        MAP_FILE|MAP_PRIVATE, fd, 0);
+    if (buffer == MAP_FAILED) {
+        printf("mmap %s: %s\n", filename, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    bool result = parse_fat((uint8_t *)buffer, (size_t)st.st_size);
+    munmap(buffer, (size_t)st.st_size);
+    close(fd);
+    return result;
+}
+
+
+bool writeTable(const char *filename)
+{
+    if (names.empty()) {
+        printf("no selectors found\n");
+        return false;
+    }
+
+    std::string strings;
+    std::vector<size_t> nameOffsets;
+    for (const std::string& name : names) {
+        nameOffsets.push_back(strings.size());
+        strings.append(name);
+        strings.push_back('\0');
+    }
+
+    // The table's size depends only on the number of names. The first 
+    // write() fails for lack of space but fills in what size() needs.
+    std::vector<uint8_t> table(sizeof(objc_selopt_t));
+    objc_selopt_t *selopt = (objc_selopt_t *)table.data();
+    string_map sizing;
+    for (const std::string& name : names) {
+        sizing.insert(string_map::value_type(name.c_str(), 0));
+    }
+    const char *err = selopt->write(0, table.size(), sizing);
+    if (selopt->capacity == 0) {
+        printf("%s\n", err ? err : "perfect hash failed");
+        return false;
+    }
+    size_t tableSize = selopt->size();
+    table.assign(tableSize, 0);
+    selopt = (objc_selopt_t *)table.data();
+
+    // Table offsets are relative to the table. 
+    // Use file offsets for both the table and the names.
+    size_t stringsOffset = sizeof(objc_selopt_file_header_t) + tableSize;
+    string_map addresses;
+    for (size_t i = 0; i < names.size(); i++) {
+        addresses.insert(string_map::value_type(names[i].c_str(), 
+                                                stringsOffset + nameOffsets[i]));
+    }
+    err = selopt->write(sizeof(objc_selopt_file_header_t), 
+                                    tableSize, addresses);
+    if (err) {
+        printf("%s\n", err);
+        return false;
+    }
+
+    objc_selopt_file_header_t header;
+    bzero(&header, sizeof(header));
+    header.magic = OBJC_SELOPT_FILE_MAGIC;
+    header.version = OBJC_SELOPT_FILE_VERSION;
+    header.optVersion = objc_opt::VERSION;
+    header.selectorCount = (uint32_t)names.size();
+    header.seloptOffset = sizeof(header);
+    header.seloptSize = (uint32_t)tableSize;
+    header.stringsOffset = (uint32_t)(sizeof(header) + tableSize);
+    header.stringsSize = (uint32_t)strings.size();
+
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        printf("open %s: %s\n", filename, strerror(errno));
+        return false;
+    }
+    bool ok =
+        fwrite(&header, sizeof(header), 1, f) == 1  &&
+        fwrite(table.data(), tableSize, 1, f) == 1  &&
+        (strings.empty()  ||
+         fwrite(strings.data(), strings.size(), 1, f) == 1);
+    if (fclose(f) != 0) ok = false;
+    if (!ok) {
+        printf("write %s: %s\n", filename, strerror(errno));
+        unlink(filename);
+        return false;
+    }
+
+    if (verbose) {
+        printf("%u selectors, %u bytes of table, %u bytes of names\n",
+               header.selectorCount, header.seloptSize, header.stringsSize);
+    }
+    return true;
+}
+
+
+void usage(void)
+{
+    printf("usage: selopt [-v] -o <output> <image>...\n");
+    exit(1);
+}
+
+int main(int argc, const char *argv[]) {
+    const char *output = NULL;
+    int i;
+    for (i = 1; i < argc  &&  argv[i][0] == '-'; ++i) {
+        if (0 == strcmp(argv[i], "-v")) {
+            verbose = true;
+        } else if (0 == strcmp(argv[i], "-o")  &&  i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            usage();
+        }
+    }
+    if (!output  ||  i == argc) usage();
+
+    for ( ; i < argc; ++i) {
+        if (!processFile(argv[i])) return 1;
+    }
+
+    return writeTable(output) ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+/*
+TEST_CONFIG OS=macosx
+
+TEST_BUILD
+    $C{COMPILE} $DIR/appSelectorTable.m -o appSelectorTable.exe
+    $C{XCRUN} '$C{CXX}' -std=c++11 -I$DIR/../runtime $DIR/../selopt.cpp -o selopt
+    ./selopt -o appSelectorTable.selopt appSelectorTable.exe
+END
+
+TEST_ENV OBJC_APP_SELECTOR_TABLE=appSelectorTable.selopt OBJC_PRINT_PREOPTIMIZATION=YES
+TEST_RUN_OUTPUT
+(objc\[\d+\]: PREOPTIMIZATION: .*\n)*OK: appSelectorTable.m
+END
+*/
+
+// Selectors used by the app come from the table built by the selopt
+// tool instead of the runtime's selector set, and keep their identity.
+// Selector registration is timed with and without the table; 
+// the test re-runs itself without OBJC_APP_SELECTOR_TABLE for comparison.
+
+#include "test.h"
+#include "testroot.i"
+
+#include <objc/runtime.h>
+#include <dlfcn.h>
+#include <spawn.h>
+#include <mach/mach_time.h>
+
+#define LOOPS 1000
+
+#define SEL4(n) @selector(appSelectorTable##n##a), @selector(appSelectorTable##n##b), \
+                @selector(appSelectorTable##n##c), @selector(appSelectorTable##n##d)
+
+@interface AppSelectorTable : TestRoot @end
+@implementation AppSelectorTable
++(int)appSelectorTableMethod { return 1; }
+@end
+
+int main(int argc __unused, char **argv)
+{
+    bool withTable = getenv("OBJC_APP_SELECTOR_TABLE") != NULL;
+    const char *name = withTable ? "app table" : "no table";
+
+    SEL sels[] = {
+        SEL4(0), SEL4(1), SEL4(2), SEL4(3), SEL4(4), SEL4(5), SEL4(6), SEL4(7),
+        @selector(appSelectorTableMethod), @selector(alloc), @selector(init),
+    };
+    const size_t count = sizeof(sels)/sizeof(sels[0]);
+
+    for (size_t i = 0; i < count; i++) {
+        testassert(sels[i] == sel_registerName(sel_getName(sels[i])));
+        testassert(sels[i] == sel_getUid(sel_getName(sels[i])));
+        for (size_t j = 0; j < i; j++) testassert(sels[i] != sels[j]);
+    }
+
+    // Selectors only this app uses live in the mapped table, 
+    // not in any image, unless there is no table.
+    Dl_info info;
+    for (size_t i = 0; i < 32; i++) {
+        bool inImage = dladdr((const void *)sels[i], &info);
+        testassert(inImage == !withTable);
+    }
+
+    // Dynamically registered selectors are unaffected.
+    SEL dynamic = sel_registerName("appSelectorTableDynamic");
+    testassert(dynamic == sel_registerName("appSelectorTableDynamic"));
+    for (size_t i = 0; i < count; i++) testassert(dynamic != sels[i]);
+
+    testassert([AppSelectorTable appSelectorTableMethod] == 1);
+
+    uint64_t t0 = mach_absolute_time();
+    for (unsigned l = 0; l < LOOPS; l++) {
+        for (size_t i = 0; i < count; i++) {
+            sel_registerName(sel_getName(sels[i]));
+        }
+    }
+    uint64_t t1 = mach_absolute_time();
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    testprintf("%s: %.1f ns per sel_registerName\n", name, 
+               (double)(t1 - t0) * tb.numer / tb.denom / (LOOPS * count));
+
+    if (!withTable) exit(0);
+
+    // Re-run without the table for comparison.
+    unsetenv("OBJC_APP_SELECTOR_TABLE");
+    extern char **environ;
+    pid_t pid;
+    int result = posix_spawn(&pid, argv[0], NULL, NULL, argv, environ);
+    testassert(result == 0);
+    int status;
+    wait4(pid, &status, 0, NULL);
+    testassert(WIFEXITED(status)  &&  WEXITSTATUS(status) == 0);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,104 @@
+// TEST_CONFIG MEM=mrc
+
+// Throughput of objc_getAssociatedObject / objc_setAssociatedObject
+// from many threads, each working on its own objects, for read-mostly
+// and write-heavy mixes. Nonatomic associations are read from the
+// recent associations cache; atomic ones always take their shard's lock.
+// Also checks that every get returns the value last set.
+
+#include "test.h"
+#include "testroot.i"
+
+#include <objc/runtime.h>
+#include <pthread.h>
+#include <mach/mach_time.h>
+
+#define THREADS 8
+#define OBJECTS 64
+#define KEYS 4
+#define LOOPS 200000
+
+static char keys[KEYS];
+static id values[KEYS];
+
+struct work {
+    unsigned thread;
+    unsigned writePercent;
+    objc_AssociationPolicy policy;
+};
+
+static void *worker(void *arg)
+{
+    struct work *w = (struct work *)arg;
+    id objs[OBJECTS];
+    unsigned current[OBJECTS][KEYS];
+    for (unsigned i = 0; i < OBJECTS; i++) {
+        objs[i] = [TestRoot new];
+        for (unsigned k = 0; k < KEYS; k++) {
+            objc_setAssociatedObject(objs[i], &keys[k], values[k], w->policy);
+            current[i][k] = k;
+        }
+    }
+
+    unsigned n = w->thread;
+    for (unsigned l = 0; l < LOOPS; l++) {
+        n = n * 1103515245 + 12345;
+        unsigned i = (n >> 8) % OBJECTS;
+        unsigned k = (n >> 16) % KEYS;
+        if ((n >> 24) % 100 < w->writePercent) {
+            unsigned v = (current[i][k] + 1) % KEYS;
+            objc_setAssociatedObject(objs[i], &keys[k], values[v], w->policy);
+            current[i][k] = v;
+        } else @autoreleasepool {
+            id value = objc_getAssociatedObject(objs[i], &keys[k]);
+            testassert(value == values[current[i][k]]);
+        }
+    }
+
+    for (unsigned i = 0; i < OBJECTS; i++) {
+        [objs[i] release];
+    }
+    return NULL;
+}
+
+static void run(const char *name, objc_AssociationPolicy policy,
+                unsigned writePercent)
+{
+    pthread_t threads[THREADS];
+    struct work work[THREADS];
+
+    uint64_t start = mach_absolute_time();
+    for (unsigned t = 0; t < THREADS; t++) {
+        work[t] = (struct work){ t, writePercent, policy };
+        pthread_create(&threads[t], NULL, &worker, &work[t]);
+    }
+    for (unsigned t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    uint64_t elapsed = mach_absolute_time() - start;
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    double ns = (double)elapsed * tb.numer / tb.denom;
+    testprintf("%s, %u%% sets: %.1f ns/op\n", name, writePercent,
+               ns / ((double)THREADS * LOOPS));
+}
+
+int main()
+{
+    for (unsigned k = 0; k < KEYS; k++) {
+        values[k] = [TestRoot new];
+    }
+
+    run("nonatomic", OBJC_ASSOCIATION_RETAIN_NONATOMIC, 1);
+    run("nonatomic", OBJC_ASSOCIATION_RETAIN_NONATOMIC, 50);
+    run("assign", OBJC_ASSOCIATION_ASSIGN, 1);
+    run("atomic", OBJC_ASSOCIATION_RETAIN, 1);
+    run("atomic", OBJC_ASSOCIATION_RETAIN, 50);
+
+    for (unsigned k = 0; k < KEYS; k++) {
+        [values[k] release];
+    }
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,201 @@
+/*
+TEST_CONFIG MEM=mrc
+TEST_ENV OBJC_PRINT_POOL_HIGHWATER=YES
+TEST_RUN_OUTPUT
+(objc\[\d+\]: POOL HIGHWATER: .*\n)*OK: autoreleasePoolCoalescing.m
+END
+*/
+
+// Autorelease pool cost and memory for deep and wide patterns:
+//   wide:     one pool, many different objects
+//   repeated: one pool, the same object autoreleased many times
+//   deep:     many nested pools, a few objects each
+// Each pattern reports time per autorelease, pop time, the pool's
+// high water mark (the pages' hiwat field), and the bytes of pool
+// pages in use just before the pop.
+//
+// Repeated autoreleases must be coalesced into a few entries, decoded 
+// with objc_debug_autoreleasepoolpage_ptr_mask and _count_shift as a 
+// heap tool would, and deep pools must get larger pages.
+
+#include "test.h"
+#include "testroot.i"
+
+#include <objc/objc-internal.h>
+#include <objc/objc-gdb.h>
+#include <mach/mach_time.h>
+
+#define WIDE 100000
+#define DEEP 1000
+#define DEEP_OBJECTS 10
+
+static mach_timebase_info_data_t tb;
+static id objs[WIDE];
+
+static double ns(uint64_t t)
+{
+    return (double)t * tb.numer / tb.denom;
+}
+
+#define FIELD(page, type, field) \
+    (*(type *)((uintptr_t)(page) + objc_debug_autoreleasepoolpage_##field##_offset))
+
+// The thread's first pool page. It is never grown.
+static uintptr_t coldPage;
+
+// Bytes of pool pages in use, including empty pages kept for reuse.
+static size_t poolBytes(void)
+{
+    size_t bytes = 0;
+    for (uintptr_t page = coldPage; page; page = FIELD(page, uintptr_t, child)) {
+        bytes += FIELD(page, uint32_t, size);
+    }
+    return bytes;
+}
+
+// Pops propagate the high water mark from the hot page to the 
+// cold page. Start each pattern from zero.
+static void resetHiwat(void)
+{
+    for (uintptr_t page = coldPage; page; page = FIELD(page, uintptr_t, child)) {
+        FIELD(page, uint32_t, hiwat) = 0;
+    }
+}
+
+struct Times {
+    uint64_t start;
+    uint64_t pushed;
+    uint64_t popping;
+    uint64_t popped;
+    size_t bytes;
+};
+
+static void report(const char *pattern, unsigned count, struct Times t)
+{
+    testprintf("%-8s: %5.1f ns/autorelease, pop %7.1f us, "
+               "hiwat %6u entries, %7zu bytes of pages\n", 
+               pattern, ns(t.pushed - t.start) / count, 
+               ns(t.popped - t.popping) / 1000, 
+               FIELD(coldPage, uint32_t, hiwat), t.bytes);
+}
+
+static void wide(void)
+{
+    for (unsigned i = 0; i < WIDE; i++) objs[i] = [TestRoot new];
+    int dealloc = TestRootDealloc;
+    struct Times t;
+    resetHiwat();
+
+    void *pool = objc_autoreleasePoolPush();
+    t.start = mach_absolute_time();
+    for (unsigned i = 0; i < WIDE; i++) [objs[i] autorelease];
+    t.pushed = mach_absolute_time();
+    t.bytes = poolBytes();
+    t.popping = mach_absolute_time();
+    objc_autoreleasePoolPop(pool);
+    t.popped = mach_absolute_time();
+
+    testassert(TestRootDealloc == dealloc + WIDE);
+    report("wide", WIDE, t);
+}
+
+static void repeated(void)
+{
+    id obj = [TestRoot new];
+    for (unsigned i = 0; i < WIDE; i++) [obj retain];
+    int dealloc = TestRootDealloc;
+    struct Times t;
+    resetHiwat();
+
+    void *pool = objc_autoreleasePoolPush();
+    t.start = mach_absolute_time();
+    for (unsigned i = 0; i < WIDE; i++) [obj autorelease];
+    t.pushed = mach_absolute_time();
+    t.bytes = poolBytes();
+
+    // The pool was pushed on the cold page, and the entries for obj
+    // follow its boundary there.
+    uintptr_t *entry = (uintptr_t *)pool + 1;
+    uintptr_t *end = FIELD(coldPage, uintptr_t *, next);
+    size_t entries = 0, autoreleases = 0;
+    for (; entry < end; entry++) {
+        testassert((*entry & objc_debug_autoreleasepoolpage_ptr_mask) == (uintptr_t)obj);
+        entries++;
+        autoreleases += 1 + ((*entry & ~objc_debug_autoreleasepoolpage_ptr_mask) 
+                             >> objc_debug_autoreleasepoolpage_count_shift);
+    }
+#if __LP64__
+    testassert(autoreleases == WIDE);
+    testassert(entries <= WIDE / 65536 + 1);
+#endif
+
+    t.popping = mach_absolute_time();
+    objc_autoreleasePoolPop(pool);
+    t.popped = mach_absolute_time();
+
+    // Every autorelease must be released exactly once.
+    testassert(TestRootDealloc == dealloc);
+    testassert([obj retainCount] == 1);
+    [obj release];
+    testassert(TestRootDealloc == dealloc + 1);
+    report("repeated", WIDE, t);
+}
+
+static void deep(void)
+{
+    int dealloc = TestRootDealloc;
+    void *pools[DEEP];
+    struct Times t;
+    resetHiwat();
+
+    t.start = mach_absolute_time();
+    for (unsigned d = 0; d < DEEP; d++) {
+        pools[d] = objc_autoreleasePoolPush();
+        for (unsigned i = 0; i < DEEP_OBJECTS; i++) {
+            [[TestRoot new] autorelease];
+        }
+    }
+    t.pushed = mach_absolute_time();
+    t.bytes = poolBytes();
+
+    // Pages past the first few are larger, up to 16 times the base size.
+    uint32_t largest = 0;
+    for (uintptr_t page = coldPage; page; page = FIELD(page, uintptr_t, child)) {
+        uint32_t size = FIELD(page, uint32_t, size);
+        testassert(size >= PAGE_MIN_SIZE  &&  size <= 16 * PAGE_MIN_SIZE);
+        if (size > largest) largest = size;
+    }
+    testassert(largest > PAGE_MIN_SIZE);
+
+    t.popping = mach_absolute_time();
+    for (unsigned d = DEEP; d > 0; d--) {
+        objc_autoreleasePoolPop(pools[d-1]);
+    }
+    t.popped = mach_absolute_time();
+
+    testassert(TestRootDealloc == dealloc + DEEP * DEEP_OBJECTS);
+    report("deep", DEEP * DEEP_OBJECTS, t);
+}
+
+int main()
+{
+    mach_timebase_info(&tb);
+
+    // The first push only installs a placeholder.
+    // The second one allocates the first page.
+    void *top = objc_autoreleasePoolPush();
+    void *first = objc_autoreleasePoolPush();
+    coldPage = (uintptr_t)first & ~(uintptr_t)(PAGE_MIN_SIZE - 1);
+    testassert(FIELD(coldPage, uint32_t, size) == PAGE_MIN_SIZE);
+    testassert(!FIELD(coldPage, uintptr_t, parent));
+
+    for (int i = 0; i < 3; i++) {
+        wide();
+        repeated();
+        deep();
+    }
+    objc_autoreleasePoolPop(first);
+    objc_autoreleasePoolPop(top);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,136 @@
+// TEST_CONFIG MEM=mrc LANGUAGE=objective-c
+
+// This test checks that dead method caches are still freed while
+// other threads are constantly inside objc_msgSend.
+// Background threads message many cold classes whose caches keep
+// growing, while the main thread flushes their caches over and over.
+// With epoch-based reclamation the garbage must stay bounded even
+// though the threads are never all outside objc_msgSend at once.
+// The heap is sampled while flushing to report the peak garbage and the
+// reclamation latency, the longest time garbage stayed above the
+// collection threshold before it was freed.
+
+#include "test.h"
+#include "testroot.i"
+
+#include <pthread.h>
+#include <mach/mach_time.h>
+#include <objc/runtime.h>
+#include <objc/message.h>
+
+#define THREADS 8
+#define CLASSES 64
+#define METHODS 256
+#define FLUSHES 2000
+#define SAMPLE_EVERY 20
+
+// live caches, plus the runtime's 32KB garbage threshold and some slop
+#define LIVE_BYTES (CLASSES * METHODS * 2 * sizeof(void *) * 2)
+#define GARBAGE_THRESHOLD (32*1024)
+#define MAX_GARBAGE (LIVE_BYTES + 64*1024)
+
+static Class classes[CLASSES];
+static SEL sels[METHODS];
+static id objs[CLASSES];
+static volatile int done;
+static volatile uint64_t sends[THREADS];
+
+static uintptr_t selIMP(id self __unused, SEL _cmd) { return (uintptr_t)_cmd; }
+
+static void *sender(void *arg)
+{
+    uintptr_t t = (uintptr_t)arg;
+    uint64_t count = 0;
+    unsigned n = (unsigned)t;
+    while (!done) {
+        // Walk the classes in a different order on each thread so
+        // every cache keeps growing and being thrown away.
+        n = n * 1103515245 + 12345;
+        id obj = objs[(n >> 8) % CLASSES];
+        SEL sel = sels[(n >> 16) % METHODS];
+        uintptr_t result = ((uintptr_t (*)(id, SEL))objc_msgSend)(obj, sel);
+        testassert(result == (uintptr_t)sel);
+        count++;
+    }
+    sends[t] = count;
+    return NULL;
+}
+
+int main()
+{
+    char *name;
+    for (int i = 0; i < METHODS; i++) {
+        asprintf(&name, "epochSelector%d", i);
+        sels[i] = sel_registerName(name);
+        free(name);
+    }
+    for (int i = 0; i < CLASSES; i++) {
+        asprintf(&name, "EpochClass%d", i);
+        classes[i] = objc_allocateClassPair([TestRoot class], name, 0);
+        free(name);
+        for (int m = 0; m < METHODS; m++) {
+            class_addMethod(classes[i], sels[m], (IMP)selIMP, "L@:");
+        }
+        objc_registerClassPair(classes[i]);
+        objs[i] = [classes[i] new];
+    }
+
+    pthread_t threads[THREADS];
+    for (uintptr_t t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &sender, (void *)t);
+    }
+
+    // Let the caches warm up before measuring.
+    for (int i = 0; i < FLUSHES / 10; i++) {
+        _objc_flush_caches(classes[i % CLASSES]);
+    }
+
+    leak_mark();
+    size_t base = leak_inuse();
+    size_t peak = 0;
+    uint64_t overSince = 0;
+    uint64_t latency = 0;
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < FLUSHES; i++) {
+        _objc_flush_caches(classes[i % CLASSES]);
+        if (i % SAMPLE_EVERY != SAMPLE_EVERY - 1) continue;
+
+        // Anything above the memory in use after warm-up is garbage,
+        // or live caches that have grown since.
+        size_t inuse = leak_inuse();
+        size_t garbage = inuse > base ? inuse - base : 0;
+        if (garbage > peak) peak = garbage;
+        uint64_t now = mach_absolute_time();
+        if (garbage > LIVE_BYTES + GARBAGE_THRESHOLD) {
+            if (!overSince) overSince = now;
+            if (now - overSince > latency) latency = now - overSince;
+        } else {
+            overSince = 0;
+        }
+    }
+    uint64_t elapsed = mach_absolute_time() - start;
+
+    done = 1;
+    uint64_t total = 0;
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+        total += sends[t];
+    }
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    double ms = (double)elapsed * tb.numer / tb.denom / 1e6;
+    double latencyMs = (double)latency * tb.numer / tb.denom / 1e6;
+    testprintf("%d threads, %d flushes in %.1f ms, %llu sends\n",
+               THREADS, FLUSHES, ms, (unsigned long long)total);
+    testprintf("peak garbage %zu bytes, reclamation latency %.2f ms\n",
+               peak, latencyMs);
+
+    // Dead caches must have been freed along the way, not only at the end.
+    testassert(peak <= MAX_GARBAGE);
+    testassert(latencyMs < ms / 2);
+
+    leak_check(MAX_GARBAGE);
+
+    succeed(__FILE__);
+}
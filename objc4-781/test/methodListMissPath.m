@@ -0,0 +1,94 @@
+// TEST_CONFIG MEM=mrc
+
+// Cost of a method lookup that misses the method cache on classes with
+// 1 to 100 method lists, as if 1 to 100 categories were attached.
+// Every class_addMethod() call attaches a new method list, which is
+// what attaching a category does. class_getInstanceMethod() searches
+// the method lists on every call whether or not the cache has the IMP.
+//
+// Classes with enough lists get a merged method index. Methods replaced
+// or added after the index was built must still be found through it.
+
+#include "test.h"
+#include "testroot.i"
+
+#include <objc/runtime.h>
+#include <mach/mach_time.h>
+
+#define LOOPS 100000
+
+static uintptr_t selIMP(id self __unused, SEL _cmd) { return (uintptr_t)_cmd; }
+
+static void run(unsigned lists)
+{
+    char *className;
+    asprintf(&className, "MissPath%u", lists);
+    Class cls = objc_allocateClassPair([TestRoot class], className, 0);
+    free(className);
+    objc_registerClassPair(cls);
+
+    SEL *sels = (SEL *)calloc(lists, sizeof(SEL));
+    for (unsigned i = 0; i < lists; i++) {
+        char *selName;
+        asprintf(&selName, "missPath%u_%u", lists, i);
+        sels[i] = sel_registerName(selName);
+        free(selName);
+        testassert(class_addMethod(cls, sels[i], (IMP)selIMP, "L@:"));
+    }
+
+    // A method replaced in place after the index was built
+    // must be seen through the index.
+    testassert(class_getInstanceMethod(cls, sels[0]));
+    IMP override = imp_implementationWithBlock(^(id self __unused) { return 0; });
+    class_replaceMethod(cls, sels[0], override, "L@:");
+    testassert(method_getImplementation(class_getInstanceMethod(cls, sels[0])) == override);
+
+    // The oldest list is the most expensive to find without an index.
+    SEL oldest = sels[0];
+    SEL missing = @selector(missPathMissing);
+    uint64_t t0 = mach_absolute_time();
+    for (unsigned i = 0; i < LOOPS; i++) {
+        testassert(class_getInstanceMethod(cls, oldest));
+    }
+    uint64_t t1 = mach_absolute_time();
+    for (unsigned i = 0; i < LOOPS; i++) {
+        testassert(!class_getInstanceMethod(cls, missing));
+    }
+    uint64_t t2 = mach_absolute_time();
+
+    for (unsigned i = 1; i < lists; i++) {
+        Method m = class_getInstanceMethod(cls, sels[i]);
+        testassert(m  &&  method_getImplementation(m) == (IMP)selIMP);
+    }
+
+    // A list attached after the index was built must be found too,
+    // and a selector that was missing must stop missing.
+    char *addedName;
+    asprintf(&addedName, "missPath%u_added", lists);
+    SEL added = sel_registerName(addedName);
+    free(addedName);
+    testassert(!class_getInstanceMethod(cls, added));
+    testassert(class_addMethod(cls, added, (IMP)selIMP, "L@:"));
+    Method m = class_getInstanceMethod(cls, added);
+    testassert(m  &&  method_getImplementation(m) == (IMP)selIMP);
+    testassert(!class_addMethod(cls, sels[lists - 1], (IMP)selIMP, "L@:"));
+    testassert(!class_getInstanceMethod(cls, missing));
+    free(sels);
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    testprintf("%3u lists: found %6.1f ns, not found %6.1f ns\n",
+               lists,
+               (double)(t1 - t0) * tb.numer / tb.denom / LOOPS,
+               (double)(t2 - t1) * tb.numer / tb.denom / LOOPS);
+}
+
+int main()
+{
+    unsigned counts[] = { 1, 2, 4, 8, 16, 32, 64, 100 };
+    for (unsigned i = 0; i < sizeof(counts)/sizeof(counts[0]); i++) {
+        run(counts[i]);
+    }
+
+    succeed(__FILE__);
+}
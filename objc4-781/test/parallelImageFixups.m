@@ -0,0 +1,80 @@
+/*
+TEST_ENV OBJC_PARALLEL_IMAGE_FIXUPS=YES OBJC_PRINT_IMAGE_TIMES=YES
+TEST_RUN_OUTPUT
+(objc\[\d+\]: [\d.]+ ms: IMAGE TIMES: .*\n)*objc\[\d+\]: [\d.]+ ms: IMAGE TIMES: fix up selector references \(\d+, [\d.]+ ns each, parallel\)\n(objc\[\d+\]: [\d.]+ ms: IMAGE TIMES: .*\n)*OK: parallelImageFixups.m
+END
+*/
+
+// Selector refs and class refs must come out the same when
+// _read_images fixes them up in chunks, and the per-phase
+// IMAGE TIMES report must be printed.
+// This image has 32768 selector refs of its own, more than
+// IMAGE_FIXUP_PARALLEL_MIN, so its selectors are fixed up on 
+// several threads.
+
+#include "test.h"
+#include "testroot.i"
+
+#include <objc/runtime.h>
+
+@interface ParallelFixups : TestRoot @end
+@implementation ParallelFixups
++(int)parallelFixupsOne { return 1; }
++(int)parallelFixupsTwo { return 2; }
+@end
+
+@interface ParallelFixupsSub : ParallelFixups @end
+@implementation ParallelFixupsSub @end
+
+#define SEL4(n) @selector(parallelFixups##n##a), @selector(parallelFixups##n##b), \
+                @selector(parallelFixups##n##c), @selector(parallelFixups##n##d)
+
+// MANY_SELS(p) is 4^7 selectors named p followed by 7 digits 0-3.
+#define MANY1(p) @selector(p##0), @selector(p##1), @selector(p##2), @selector(p##3),
+#define MANY2(p) MANY1(p##0) MANY1(p##1) MANY1(p##2) MANY1(p##3)
+#define MANY3(p) MANY2(p##0) MANY2(p##1) MANY2(p##2) MANY2(p##3)
+#define MANY4(p) MANY3(p##0) MANY3(p##1) MANY3(p##2) MANY3(p##3)
+#define MANY5(p) MANY4(p##0) MANY4(p##1) MANY4(p##2) MANY4(p##3)
+#define MANY6(p) MANY5(p##0) MANY5(p##1) MANY5(p##2) MANY5(p##3)
+#define MANY_SELS(p) MANY6(p##0) MANY6(p##1) MANY6(p##2) MANY6(p##3)
+#define MANY_COUNT 16384
+
+static void checkManySels(const char *prefix, SEL *many)
+{
+    for (unsigned i = 0; i < MANY_COUNT; i++) {
+        char name[64];
+        int len = snprintf(name, sizeof(name), "%s", prefix);
+        for (int digit = 6; digit >= 0; digit--) {
+            name[len++] = '0' + ((i >> (2 * digit)) & 3);
+        }
+        name[len] = 0;
+        testassert(0 == strcmp(sel_getName(many[i]), name));
+        testassert(many[i] == sel_registerName(name));
+    }
+}
+
+int main()
+{
+    SEL sels[] = {
+        SEL4(0), SEL4(1), SEL4(2), SEL4(3), SEL4(4), SEL4(5), SEL4(6), SEL4(7),
+        @selector(parallelFixupsOne), @selector(parallelFixupsTwo),
+        @selector(alloc), @selector(init), @selector(class),
+    };
+    for (size_t i = 0; i < sizeof(sels)/sizeof(sels[0]); i++) {
+        testassert(sels[i] == sel_registerName(sel_getName(sels[i])));
+        for (size_t j = 0; j < i; j++) testassert(sels[i] != sels[j]);
+    }
+
+    SEL manyA[] = { MANY_SELS(parallelFixupsA) };
+    SEL manyB[] = { MANY_SELS(parallelFixupsB) };
+    checkManySels("parallelFixupsA", manyA);
+    checkManySels("parallelFixupsB", manyB);
+    testassert(manyA[MANY_COUNT - 1] != manyB[MANY_COUNT - 1]);
+
+    testassert([ParallelFixupsSub parallelFixupsOne] == 1);
+    testassert([ParallelFixupsSub parallelFixupsTwo] == 2);
+    testassert([ParallelFixupsSub superclass] == [ParallelFixups class]);
+    testassert(objc_getClass("ParallelFixupsSub") == [ParallelFixupsSub class]);
+
+    succeed(__FILE__);
+}
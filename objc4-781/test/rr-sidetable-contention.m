@@ -0,0 +1,127 @@
+// TEST_CFLAGS -framework Foundation
+// TEST_CONFIG MEM=mrc ARCH=x86_64
+
+// Contention microbenchmark for retain counts that overflow the
+// nonpointer isa into the side table. Every thread pushes its object's
+// retain count back and forth across the overflow boundary, first on one
+// shared hot object and then on one object per thread, with 1 to 64
+// threads. Retain counts must stay exact, and retainCount must include
+// deltas still buffered per CPU.
+//
+// The test runs once with per-CPU side table deltas and then re-runs
+// itself with OBJC_DISABLE_SIDE_TABLE_DELTAS=YES, which uses only the
+// striped side table locks, for comparison.
+
+// x86_64 only. arm64's side table limit is high enough that the
+// overflow path is rarely taken.
+
+#include "test.h"
+#import <Foundation/Foundation.h>
+#include <spawn.h>
+#include <mach/mach_time.h>
+
+#define LOOPS 512
+#define MAX_THREADS 64
+#if __x86_64__
+#   define RC_HALF  (1ULL<<7)
+#else
+#   error sorry
+#endif
+#define RC_DELTA (RC_HALF + 1)
+
+static int DeallocCount = 0;
+@interface Deallocator : NSObject @end
+@implementation Deallocator
+-(void)dealloc {
+    __sync_fetch_and_add(&DeallocCount, 1);
+    [super dealloc];
+}
+@end
+
+// These are global to avoid extra retains by the dispatch block objects.
+static Deallocator *objs[MAX_THREADS];
+static bool shared;
+static size_t threads;
+
+static void run(const char *name)
+{
+    dispatch_queue_t queue =
+        dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+
+    DeallocCount = 0;
+    for (size_t i = 0; i < threads; i++) {
+        objs[i] = shared && i > 0 ? objs[0] : [Deallocator new];
+    }
+    // Start every object just below the overflow boundary.
+    for (size_t i = 0; i < (shared ? 1 : threads); i++) {
+        for (size_t b = 0; b < RC_HALF * 2 - 2; b++) [objs[i] retain];
+    }
+    uintptr_t before = [objs[0] retainCount];
+
+    // Push every object across the overflow boundary and check the
+    // counts before anything else touches them. Some of the overflow
+    // may still be buffered in per-CPU deltas.
+    dispatch_apply(threads, queue, ^(size_t t) {
+        for (size_t b = 0; b < RC_DELTA; b++) [objs[t] retain];
+    });
+    testassert([objs[0] retainCount] == before + (shared ? threads : 1) * RC_DELTA);
+    dispatch_apply(threads, queue, ^(size_t t) {
+        for (size_t b = 0; b < RC_DELTA; b++) [objs[t] release];
+    });
+    testassert([objs[0] retainCount] == before);
+
+    uint64_t start = mach_absolute_time();
+    dispatch_apply(threads, queue, ^(size_t t) {
+        Deallocator *obj = objs[t];
+        for (size_t a = 0; a < LOOPS; a++) {
+            for (size_t b = 0; b < RC_DELTA; b++) {
+                [obj retain];
+            }
+            for (size_t b = 0; b < RC_DELTA; b++) {
+                [obj release];
+            }
+        }
+    });
+    uint64_t elapsed = mach_absolute_time() - start;
+
+    testassert([objs[0] retainCount] == before);
+    testassert(DeallocCount == 0);
+    for (size_t i = 0; i < (shared ? 1 : threads); i++) {
+        for (size_t b = 0; b < RC_HALF * 2 - 2; b++) [objs[i] release];
+        [objs[i] release];
+    }
+    testassert(DeallocCount == (shared ? 1 : threads));
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    double ns = (double)elapsed * tb.numer / tb.denom;
+    double ops = (double)threads * LOOPS * RC_DELTA * 2;
+    testprintf("%s, %2zu threads, %s: %.1f ns/op\n", name, threads,
+               shared ? "shared object" : "object per thread", ns / ops);
+}
+
+int main(int argc __unused, char **argv) {
+    bool disabled = getenv("OBJC_DISABLE_SIDE_TABLE_DELTAS") != NULL;
+    const char *name = disabled ? "side table lock" : "per-CPU deltas";
+
+    for (threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        shared = true;
+        run(name);
+        shared = false;
+        run(name);
+    }
+
+    if (disabled) exit(0);
+
+    // Re-run with the old scheme for comparison.
+    setenv("OBJC_DISABLE_SIDE_TABLE_DELTAS", "YES", 1);
+    extern char **environ;
+    pid_t pid;
+    int result = posix_spawn(&pid, argv[0], NULL, NULL, argv, environ);
+    testassert(result == 0);
+    int status;
+    wait4(pid, &status, 0, NULL);
+    testassert(WIFEXITED(status)  &&  WEXITSTATUS(status) == 0);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,165 @@
+// TEST_CONFIG MEM=mrc
+
+// objc_sync_enter / objc_sync_exit cost across contention levels:
+// one thread, threads on private objects, threads sharing a few
+// objects, and all threads on one object. Each shared object guards
+// a counter that must come out exact.
+//
+// It also checks that a thread that inflates an object's lock waits for
+// the thread holding the thin lock, and that SyncData made for
+// contended objects are freed again once nobody uses them.
+//
+// The test runs once with thin locks and then re-runs itself with
+// OBJC_DISABLE_THIN_SYNC=YES, which uses a SyncData for every lock,
+// for comparison.
+
+#include "test.h"
+#include "testroot.i"
+
+#include <objc/objc-sync.h>
+#include <objc/objc-internal.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <mach/mach_time.h>
+
+#define THREADS 8
+#define LOOPS 200000
+
+static id objs[THREADS];
+static unsigned counters[THREADS];
+static unsigned threadCount;
+static unsigned objectCount;
+
+static void *worker(void *arg)
+{
+    unsigned t = (unsigned)(uintptr_t)arg;
+    for (unsigned i = 0; i < LOOPS; i++) {
+        // objectCount == 0 means each thread has its own object.
+        unsigned o = objectCount ? (t + i) % objectCount : t;
+        testassert(objc_sync_enter(objs[o]) == OBJC_SYNC_SUCCESS);
+        if (i % 16 == 0) {
+            // Recursive entry.
+            testassert(objc_sync_enter(objs[o]) == OBJC_SYNC_SUCCESS);
+            testassert(objc_sync_exit(objs[o]) == OBJC_SYNC_SUCCESS);
+        }
+        counters[o]++;
+        testassert(objc_sync_exit(objs[o]) == OBJC_SYNC_SUCCESS);
+    }
+    return NULL;
+}
+
+static void *tryWorker(void *arg __unused)
+{
+    testassert(!objc_sync_try_enter(objs[0]));
+    testassert(objc_sync_exit(objs[0]) == OBJC_SYNC_NOT_OWNING_THREAD_ERROR);
+    return NULL;
+}
+
+static volatile bool handoffHeld;
+static volatile bool handoffAcquired;
+
+static void *handoffWorker(void *arg __unused)
+{
+    // objs[0] is thin-locked by the main thread, so this inflates it.
+    testassert(objc_sync_enter(objs[0]) == OBJC_SYNC_SUCCESS);
+    testassert(!handoffHeld);
+    handoffAcquired = true;
+    testassert(objc_sync_exit(objs[0]) == OBJC_SYNC_SUCCESS);
+    return NULL;
+}
+
+static const char *name;
+
+static void run(unsigned threads, unsigned objects)
+{
+    pthread_t pthreads[THREADS];
+    threadCount = threads;
+    objectCount = objects;
+    for (unsigned o = 0; o < THREADS; o++) counters[o] = 0;
+
+    uint64_t start = mach_absolute_time();
+    for (unsigned t = 0; t < threadCount; t++) {
+        pthread_create(&pthreads[t], NULL, &worker, (void *)(uintptr_t)t);
+    }
+    for (unsigned t = 0; t < threadCount; t++) {
+        pthread_join(pthreads[t], NULL);
+    }
+    uint64_t elapsed = mach_absolute_time() - start;
+
+    unsigned total = 0;
+    for (unsigned o = 0; o < THREADS; o++) total += counters[o];
+    testassert(total == threads * LOOPS);
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    double ns = (double)elapsed * tb.numer / tb.denom;
+    if (objects) {
+        testprintf("%s, %u threads on %u objects: %.1f ns/op\n",
+                   name, threads, objects, ns / ((double)threads * LOOPS));
+    } else {
+        testprintf("%s, %u threads on private objects: %.1f ns/op\n",
+                   name, threads, ns / ((double)threads * LOOPS));
+    }
+}
+
+int main(int argc __unused, char **argv)
+{
+    bool disabled = getenv("OBJC_DISABLE_THIN_SYNC") != NULL;
+    name = disabled ? "SyncData" : "thin locks";
+
+    for (unsigned o = 0; o < THREADS; o++) objs[o] = [TestRoot new];
+
+    run(1, 1);
+    run(THREADS, 0);
+    run(THREADS, THREADS / 2);
+    run(THREADS, 2);
+    run(THREADS, 1);
+
+    // Try-enter must fail while another thread holds the lock.
+    testassert(objc_sync_enter(objs[0]) == OBJC_SYNC_SUCCESS);
+    pthread_t th;
+    pthread_create(&th, NULL, &tryWorker, NULL);
+    pthread_join(th, NULL);
+    testassert(objc_sync_exit(objs[0]) == OBJC_SYNC_SUCCESS);
+
+    // A thread blocked behind a thin lock gets the lock once the
+    // thin owner exits, and not before.
+    testassert(objc_sync_enter(objs[0]) == OBJC_SYNC_SUCCESS);
+    handoffHeld = true;
+    pthread_create(&th, NULL, &handoffWorker, NULL);
+    usleep(100000);
+    testassert(!handoffAcquired);
+    handoffHeld = false;
+    testassert(objc_sync_exit(objs[0]) == OBJC_SYNC_SUCCESS);
+    pthread_join(th, NULL);
+    testassert(handoffAcquired);
+
+    // SyncData for objects that were contended once must not pile up.
+    for (unsigned o = 0; o < THREADS; o++) [objs[o] release];
+    for (unsigned o = 0; o < THREADS; o++) objs[o] = [TestRoot new];
+    run(THREADS, 1);
+    leak_mark();
+    for (unsigned round = 0; round < 10; round++) {
+        for (unsigned o = 0; o < THREADS; o++) [objs[o] release];
+        for (unsigned o = 0; o < THREADS; o++) objs[o] = [TestRoot new];
+        run(THREADS, THREADS / 2);
+    }
+    // Each of up to 64 lists may keep 2 unused SyncData of 64 bytes.
+    leak_check(64 * 2 * 64);
+
+    for (unsigned o = 0; o < THREADS; o++) [objs[o] release];
+
+    if (disabled) exit(0);
+
+    // Re-run with SyncData for every lock for comparison.
+    setenv("OBJC_DISABLE_THIN_SYNC", "YES", 1);
+    extern char **environ;
+    pid_t pid;
+    int result = posix_spawn(&pid, argv[0], NULL, NULL, argv, environ);
+    testassert(result == 0);
+    int status;
+    wait4(pid, &status, 0, NULL);
+    testassert(WIFEXITED(status)  &&  WEXITSTATUS(status) == 0);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,82 @@
+// TEST_CONFIG MEM=mrc
+
+// Throughput of weak reference register / unregister / clear.
+// Measured both for many weak variables pointing at one object
+// (one large referrer set) and for one weak variable per object
+// (many weak table entries), at 10^3 up to 10^6 weak references.
+// Define MAX_REFS as 10000000 to measure 10^7 as well.
+// Also checks that every weak variable ends up nil or unregistered.
+
+#include "test.h"
+#include "testroot.i"
+
+#include <objc/objc-internal.h>
+#include <mach/mach_time.h>
+
+#ifndef MAX_REFS
+#define MAX_REFS 1000000
+#endif
+
+static double nsPerOp(uint64_t elapsed, size_t count)
+{
+    static mach_timebase_info_data_t tb;
+    if (tb.denom == 0) mach_timebase_info(&tb);
+    return (double)elapsed * tb.numer / tb.denom / count;
+}
+
+static void oneReferent(size_t count)
+{
+    id *vars = (id *)calloc(count, sizeof(id));
+    id obj = [TestRoot new];
+
+    uint64_t t0 = mach_absolute_time();
+    for (size_t i = 0; i < count; i++) objc_initWeak(&vars[i], obj);
+    uint64_t t1 = mach_absolute_time();
+    for (size_t i = 0; i < count; i += 2) objc_destroyWeak(&vars[i]);
+    uint64_t t2 = mach_absolute_time();
+    [obj release];  // clears the remaining half
+    uint64_t t3 = mach_absolute_time();
+
+    for (size_t i = 1; i < count; i += 2) testassert(vars[i] == nil);
+
+    testprintf("one referent,   %8zu refs: register %5.1f ns, "
+               "unregister %5.1f ns, clear %5.1f ns\n", count,
+               nsPerOp(t1 - t0, count), nsPerOp(t2 - t1, count / 2),
+               nsPerOp(t3 - t2, count - count / 2));
+    free(vars);
+}
+
+static void manyReferents(size_t count)
+{
+    id *vars = (id *)calloc(count, sizeof(id));
+    id *objs = (id *)calloc(count, sizeof(id));
+    for (size_t i = 0; i < count; i++) objs[i] = [TestRoot new];
+
+    uint64_t t0 = mach_absolute_time();
+    for (size_t i = 0; i < count; i++) objc_initWeak(&vars[i], objs[i]);
+    uint64_t t1 = mach_absolute_time();
+    for (size_t i = 0; i < count; i += 2) objc_destroyWeak(&vars[i]);
+    uint64_t t2 = mach_absolute_time();
+    for (size_t i = 1; i < count; i += 2) [objs[i] release];
+    uint64_t t3 = mach_absolute_time();
+
+    for (size_t i = 0; i < count; i += 2) [objs[i] release];
+    for (size_t i = 1; i < count; i += 2) testassert(vars[i] == nil);
+
+    testprintf("many referents, %8zu refs: register %5.1f ns, "
+               "unregister %5.1f ns, dealloc+clear %5.1f ns\n", count,
+               nsPerOp(t1 - t0, count), nsPerOp(t2 - t1, count / 2),
+               nsPerOp(t3 - t2, count - count / 2));
+    free(objs);
+    free(vars);
+}
+
+int main()
+{
+    for (size_t count = 1000; count <= MAX_REFS; count *= 10) {
+        oneReferent(count);
+        manyReferents(count);
+    }
+
+    succeed(__FILE__);
+}
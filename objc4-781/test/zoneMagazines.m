@@ -0,0 +1,93 @@
+// TEST_CONFIG MEM=mrc
+
+// class_rw_t and class_rw_ext_t allocation from many threads at once.
+// Each thread creates classes, adds a method so that the class gets
+// a class_rw_ext_t, and disposes of them again. _objc_getZoneStats
+// must account for every allocation, and since every element is freed
+// soon after it was allocated, most allocations must come from the
+// per-CPU magazines.
+
+#include "test.h"
+#include "testroot.i"
+
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+#include <pthread.h>
+#include <mach/mach_time.h>
+
+#define THREADS 8
+#define LOOPS 500
+
+static uintptr_t selIMP(id self __unused, SEL _cmd) { return (uintptr_t)_cmd; }
+
+static void *worker(void *arg)
+{
+    unsigned t = (unsigned)(uintptr_t)arg;
+    SEL sel = sel_registerName("zoneMagazines");
+    for (unsigned i = 0; i < LOOPS; i++) {
+        char *name;
+        asprintf(&name, "ZoneMagazines_%u_%u", t, i);
+        Class cls = objc_allocateClassPair([TestRoot class], name, 0);
+        free(name);
+        testassert(cls);
+        objc_registerClassPair(cls);
+        testassert(class_addMethod(cls, sel, (IMP)selIMP, "L@:"));
+        testassert(class_getMethodImplementation(cls, sel) == (IMP)selIMP);
+        objc_disposeClassPair(cls);
+    }
+    return NULL;
+}
+
+static void getStats(const char *name, objc_zone_stats *outStats)
+{
+    bzero(outStats, sizeof(*outStats));
+    unsigned count = _objc_getZoneStats(NULL, 0);
+    objc_zone_stats *stats = (objc_zone_stats *)calloc(count, sizeof(*stats));
+    testassert(_objc_getZoneStats(stats, count) == count);
+    for (unsigned i = 0; i < count; i++) {
+        testprintf("%s: %zu bytes, %llu allocs, %llu frees, "
+                   "%llu cache hits, %zu bytes resident\n", 
+                   stats[i].name, stats[i].elementSize, 
+                   stats[i].allocs, stats[i].frees, 
+                   stats[i].cacheHits, stats[i].bytesResident);
+        testassert(stats[i].frees <= stats[i].allocs);
+        testassert(stats[i].cacheHits <= stats[i].allocs);
+        testassert(stats[i].bytesResident > 0);
+        if (0 == strcmp(stats[i].name, name)) *outStats = stats[i];
+    }
+    free(stats);
+}
+
+int main()
+{
+    objc_zone_stats before;
+    getStats("class_rw_ext_t", &before);
+
+    pthread_t threads[THREADS];
+    uint64_t start = mach_absolute_time();
+    for (unsigned t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &worker, (void *)(uintptr_t)t);
+    }
+    for (unsigned t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    uint64_t elapsed = mach_absolute_time() - start;
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+    testprintf("%.1f us per class\n", 
+               (double)elapsed * tb.numer / tb.denom / 1000 / (THREADS * LOOPS));
+
+    objc_zone_stats after;
+    getStats("class_rw_ext_t", &after);
+
+    // class_rw_ext_t is malloc'd directly on some architectures.
+    if (after.name) {
+        uint64_t allocs = after.allocs - before.allocs;
+        testassert(allocs >= THREADS * LOOPS);
+        testassert(after.frees - before.frees >= THREADS * LOOPS);
+        testassert(after.cacheHits - before.cacheHits >= allocs / 2);
+    }
+
+    succeed(__FILE__);
+}